@@ -25,6 +25,7 @@
 #include "BRBIP32Sequence.h"
 #include "BRCrypto.h"
 #include "BRBase58.h"
+#include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 
@@ -105,6 +106,94 @@ static void _CKDpub(BRECPoint *K, UInt256 *c, uint32_t i)
     }
 }
 
+// CKDpriv for each index in indexes from the same parent key, with the HMAC-SHA512 computations done together in one
+// batch, and point(kpar) only computed once for all the normal children
+static void _CKDprivList(UInt256 k[], UInt256 c[], UInt256 kpar, UInt256 cpar, const uint32_t indexes[], size_t count)
+{
+    uint8_t (*buf)[sizeof(BRECPoint) + sizeof(uint32_t)] = malloc(count*sizeof(*buf));
+    UInt512 *I = malloc(count*sizeof(*I));
+    void **mac = malloc(count*sizeof(*mac));
+    const void **data = malloc(count*sizeof(*data));
+    BRECPoint P;
+    int havePoint = 0;
+    
+    assert(buf != NULL);
+    assert(I != NULL);
+    assert(mac != NULL);
+    assert(data != NULL);
+    
+    for (size_t i = 0; i < count; i++) {
+        if (indexes[i] & BIP32_HARD) {
+            buf[i][0] = 0;
+            UInt256Set(&buf[i][1], kpar);
+        }
+        else {
+            if (! havePoint) BRSecp256k1PointGen(&P, &kpar), havePoint = 1;
+            *(BRECPoint *)buf[i] = P;
+        }
+        
+        UInt32SetBE(&buf[i][sizeof(BRECPoint)], indexes[i]);
+        mac[i] = &I[i];
+        data[i] = buf[i];
+    }
+    
+    BRHMACSHA512Batch(mac, &cpar, sizeof(cpar), data, sizeof(*buf), count); // I = HMAC-SHA512(c, k|P(k) || i)
+    
+    for (size_t i = 0; i < count; i++) {
+        k[i] = kpar;
+        BRSecp256k1ModAdd(&k[i], (UInt256 *)&I[i]); // k = IL + k (mod n)
+        c[i] = *(UInt256 *)&I[i].u8[sizeof(UInt256)]; // c = IR
+    }
+    
+    memset(buf, 0, count*sizeof(*buf));
+    memset(I, 0, count*sizeof(*I));
+    memset(&P, 0, sizeof(P));
+    kpar = cpar = UINT256_ZERO;
+    free(data);
+    free(mac);
+    free(I);
+    free(buf);
+}
+
+// CKDpub for each index in indexes from the same parent key, with the HMAC-SHA512 computations done together in one
+// batch, hardened indexes are skipped and left set to the parent key
+static void _CKDpubList(BRECPoint K[], UInt256 c[], BRECPoint Kpar, UInt256 cpar, const uint32_t indexes[],
+                        size_t count)
+{
+    uint8_t (*buf)[sizeof(BRECPoint) + sizeof(uint32_t)] = malloc(count*sizeof(*buf));
+    UInt512 *I = malloc(count*sizeof(*I));
+    void **mac = malloc(count*sizeof(*mac));
+    const void **data = malloc(count*sizeof(*data));
+    
+    assert(buf != NULL);
+    assert(I != NULL);
+    assert(mac != NULL);
+    assert(data != NULL);
+    
+    for (size_t i = 0; i < count; i++) {
+        *(BRECPoint *)buf[i] = Kpar;
+        UInt32SetBE(&buf[i][sizeof(BRECPoint)], indexes[i]);
+        mac[i] = &I[i];
+        data[i] = buf[i];
+    }
+    
+    BRHMACSHA512Batch(mac, &cpar, sizeof(cpar), data, sizeof(*buf), count); // I = HMAC-SHA512(c, P(K) || i)
+    
+    for (size_t i = 0; i < count; i++) {
+        K[i] = Kpar;
+        c[i] = cpar;
+        if ((indexes[i] & BIP32_HARD) == BIP32_HARD) continue; // can't derive private child key from public parent key
+        c[i] = *(UInt256 *)&I[i].u8[sizeof(UInt256)]; // c = IR
+        BRSecp256k1PointAdd(&K[i], (UInt256 *)&I[i]); // K = P(IL) + K
+    }
+    
+    memset(I, 0, count*sizeof(*I));
+    free(data);
+    free(mac);
+    free(I);
+    free(buf);
+}
+
 // returns the master public key for the default BIP32 wallet layout - derivation path N(m/0H)
 BRMasterPubKey BRBIP32MasterPubKey(const void *seed, size_t seedLen)
 {
@@ -155,6 +244,31 @@ size_t BRBIP32PubKey(uint8_t *pubKey, size_t pubKeyLen, BRMasterPubKey mpk, uint
     return (! pubKey || sizeof(BRECPoint) <= pubKeyLen) ? sizeof(BRECPoint) : 0;
 }
 
+// sets the public key for path N(m/0H/chain/index) to each element in keys
+void BRBIP32PubKeyList(BRKey keys[], size_t keysCount, BRMasterPubKey mpk, uint32_t chain, const uint32_t indexes[])
+{
+    UInt256 chainCode = mpk.chainCode;
+    BRECPoint pubKey = *(BRECPoint *)mpk.pubKey;
+    BRECPoint *K = (keysCount > 0) ? malloc(keysCount*sizeof(*K)) : NULL;
+    UInt256 *c = (keysCount > 0) ? malloc(keysCount*sizeof(*c)) : NULL;
+    
+    assert(memcmp(&mpk, &BR_MASTER_PUBKEY_NONE, sizeof(mpk)) != 0);
+    assert(keys != NULL || keysCount == 0);
+    assert(indexes != NULL || keysCount == 0);
+    
+    if (keys && keysCount > 0 && indexes) {
+        assert(K != NULL);
+        assert(c != NULL);
+        _CKDpub(&pubKey, &chainCode, chain); // path N(m/0H/chain)
+        _CKDpubList(K, c, pubKey, chainCode, indexes, keysCount); // index'th keys in chain
+        for (size_t i = 0; i < keysCount; i++) BRKeySetPubKey(&keys[i], K[i].p, sizeof(K[i]));
+        chainCode = UINT256_ZERO;
+    }
+    
+    if (c) free(c);
+    if (K) free(K);
+}
+
 // sets the private key for path m/0H/chain/index to key
 void BRBIP32PrivKey(BRKey *key, const void *seed, size_t seedLen, uint32_t chain, uint32_t index)
 {
@@ -168,13 +282,18 @@ void BRBIP32PrivKeyList(BRKey keys[], size_t keysCount, const void *seed, size_t
                         const uint32_t indexes[])
 {
     UInt512 I;
-    UInt256 secret, chainCode, s, c;
+    UInt256 secret, chainCode, *s, *c;
     
     assert(keys != NULL || keysCount == 0);
     assert(seed != NULL || seedLen == 0);
     assert(indexes != NULL || keysCount == 0);
     
     if (keys && keysCount > 0 && (seed || seedLen == 0) && indexes) {
+        s = malloc(keysCount*sizeof(*s));
+        c = malloc(keysCount*sizeof(*c));
+        assert(s != NULL);
+        assert(c != NULL);
+        
         BRHMAC(&I, BRSHA512, sizeof(UInt512), BIP32_SEED_KEY, strlen(BIP32_SEED_KEY), seed, seedLen);
         secret = *(UInt256 *)&I;
         chainCode = *(UInt256 *)&I.u8[sizeof(UInt256)];
@@ -182,15 +301,14 @@ void BRBIP32PrivKeyList(BRKey keys[], size_t keysCount, const void *seed, size_t
 
         _CKDpriv(&secret, &chainCode, 0 | BIP32_HARD); // path m/0H
         _CKDpriv(&secret, &chainCode, chain); // path m/0H/chain
-    
-        for (size_t i = 0; i < keysCount; i++) {
-            s = secret;
-            c = chainCode;
-            _CKDpriv(&s, &c, indexes[i]); // index'th key in chain
-            BRKeySetSecret(&keys[i], &s, 1);
-        }
+        _CKDprivList(s, c, secret, chainCode, indexes, keysCount); // index'th keys in chain
+        for (size_t i = 0; i < keysCount; i++) BRKeySetSecret(&keys[i], &s[i], 1);
         
-        secret = chainCode = c = s = UINT256_ZERO;
+        secret = chainCode = UINT256_ZERO;
+        memset(s, 0, keysCount*sizeof(*s));
+        memset(c, 0, keysCount*sizeof(*c));
+        free(c);
+        free(s);
     }
 }
 
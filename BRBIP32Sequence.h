@@ -58,6 +58,9 @@ BRMasterPubKey BRBIP32MasterPubKey(const void *seed, size_t seedLen);
 // returns number of bytes written, or pubKeyLen needed if pubKey is NULL
 size_t BRBIP32PubKey(uint8_t *pubKey, size_t pubKeyLen, BRMasterPubKey mpk, uint32_t chain, uint32_t index);
 
+// sets the public key for path N(m/0H/chain/index) to each element in keys
+void BRBIP32PubKeyList(BRKey keys[], size_t keysCount, BRMasterPubKey mpk, uint32_t chain, const uint32_t indexes[]);
+
 // sets the private key for path m/0H/chain/index to key
 void BRBIP32PrivKey(BRKey *key, const void *seed, size_t seedLen, uint32_t chain, uint32_t index);
 
@@ -30,6 +30,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
 
 #define BIP38_NOEC_PREFIX      0x0142
 #define BIP38_EC_PREFIX        0x0143
@@ -43,136 +45,27 @@
 #define BIP38_SCRYPT_EC_N      1024
 #define BIP38_SCRYPT_EC_R      1
 #define BIP38_SCRYPT_EC_P      1
+#define BIP38_SCRYPT_MEM_LIMIT (64*1024*1024) // scrypt scratch memory, enough for 4 threads at 128*r*n bytes each
 
 // BIP38 is a method for encrypting private keys with a passphrase
 // https://github.com/bitcoin/bips/blob/master/bip-0038.mediawiki
 
-static const uint8_t sbox[256] = {
-    0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
-    0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
-    0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
-    0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
-    0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
-    0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
-    0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
-    0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
-    0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
-    0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
-    0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
-    0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
-    0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
-    0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
-    0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
-    0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16
-};
-
-static const uint8_t sboxi[256] = {
-    0x52, 0x09, 0x6a, 0xd5, 0x30, 0x36, 0xa5, 0x38, 0xbf, 0x40, 0xa3, 0x9e, 0x81, 0xf3, 0xd7, 0xfb,
-    0x7c, 0xe3, 0x39, 0x82, 0x9b, 0x2f, 0xff, 0x87, 0x34, 0x8e, 0x43, 0x44, 0xc4, 0xde, 0xe9, 0xcb,
-    0x54, 0x7b, 0x94, 0x32, 0xa6, 0xc2, 0x23, 0x3d, 0xee, 0x4c, 0x95, 0x0b, 0x42, 0xfa, 0xc3, 0x4e,
-    0x08, 0x2e, 0xa1, 0x66, 0x28, 0xd9, 0x24, 0xb2, 0x76, 0x5b, 0xa2, 0x49, 0x6d, 0x8b, 0xd1, 0x25,
-    0x72, 0xf8, 0xf6, 0x64, 0x86, 0x68, 0x98, 0x16, 0xd4, 0xa4, 0x5c, 0xcc, 0x5d, 0x65, 0xb6, 0x92,
-    0x6c, 0x70, 0x48, 0x50, 0xfd, 0xed, 0xb9, 0xda, 0x5e, 0x15, 0x46, 0x57, 0xa7, 0x8d, 0x9d, 0x84,
-    0x90, 0xd8, 0xab, 0x00, 0x8c, 0xbc, 0xd3, 0x0a, 0xf7, 0xe4, 0x58, 0x05, 0xb8, 0xb3, 0x45, 0x06,
-    0xd0, 0x2c, 0x1e, 0x8f, 0xca, 0x3f, 0x0f, 0x02, 0xc1, 0xaf, 0xbd, 0x03, 0x01, 0x13, 0x8a, 0x6b,
-    0x3a, 0x91, 0x11, 0x41, 0x4f, 0x67, 0xdc, 0xea, 0x97, 0xf2, 0xcf, 0xce, 0xf0, 0xb4, 0xe6, 0x73,
-    0x96, 0xac, 0x74, 0x22, 0xe7, 0xad, 0x35, 0x85, 0xe2, 0xf9, 0x37, 0xe8, 0x1c, 0x75, 0xdf, 0x6e,
-    0x47, 0xf1, 0x1a, 0x71, 0x1d, 0x29, 0xc5, 0x89, 0x6f, 0xb7, 0x62, 0x0e, 0xaa, 0x18, 0xbe, 0x1b,
-    0xfc, 0x56, 0x3e, 0x4b, 0xc6, 0xd2, 0x79, 0x20, 0x9a, 0xdb, 0xc0, 0xfe, 0x78, 0xcd, 0x5a, 0xf4,
-    0x1f, 0xdd, 0xa8, 0x33, 0x88, 0x07, 0xc7, 0x31, 0xb1, 0x12, 0x10, 0x59, 0x27, 0x80, 0xec, 0x5f,
-    0x60, 0x51, 0x7f, 0xa9, 0x19, 0xb5, 0x4a, 0x0d, 0x2d, 0xe5, 0x7a, 0x9f, 0x93, 0xc9, 0x9c, 0xef,
-    0xa0, 0xe0, 0x3b, 0x4d, 0xae, 0x2a, 0xf5, 0xb0, 0xc8, 0xeb, 0xbb, 0x3c, 0x83, 0x53, 0x99, 0x61,
-    0x17, 0x2b, 0x04, 0x7e, 0xba, 0x77, 0xd6, 0x26, 0xe1, 0x69, 0x14, 0x63, 0x55, 0x21, 0x0c, 0x7d
-};
-
-#define xt(x) (((x) << 1) ^ ((((x) >> 7) & 1)*0x1b))
-
-static void _BRAES256ECBEncrypt(const void *key32, void *buf16)
-{
-    size_t i, j;
-    uint32_t _k[32/4], _x[16/4];
-    uint8_t *x = (uint8_t *)_x, *k = (uint8_t *)_k, r = 1, a, b, c, d, e;
-    
-    memcpy(_k, key32, sizeof(_k));
-    memcpy(_x, buf16, sizeof(_x));
-    
-    for (i = 0; i < 14; i++) {
-        for (j = 0; j < 4; j++) _x[j] ^= _k[j+(i & 1)*4]; // add round key
-        
-        for (j = 0; j < 16; j++) x[j] = sbox[x[j]]; // sub bytes
-        
-        // shift rows
-        a = x[1], x[1] = x[5], x[5] = x[9], x[9] = x[13], x[13] = a, a = x[10], x[10] = x[2], x[2] = a;
-        a = x[3], x[3] = x[15], x[15] = x[11], x[11] = x[7], x[7] = a, a = x[14], x[14] = x[6], x[6] = a;
-        
-        for (j = 0; i < 13 && j < 16; j += 4) { // mix columns
-            a = x[j], b = x[j+1], c = x[j+2], d = x[j+3], e = a ^ b ^ c ^ d;
-            x[j] ^= e ^ xt(a ^ b), x[j+1] ^= e ^ xt(b ^ c), x[j+2] ^= e ^ xt(c ^ d), x[j+3] ^= e ^ xt(d ^ a);
-        }
-        
-        if ((i % 2) != 0) { // expand key
-            k[0] ^= sbox[k[29]] ^ r, k[1] ^= sbox[k[30]], k[2] ^= sbox[k[31]], k[3] ^= sbox[k[28]], r = xt(r);
-            for (j = 4; j < 16; j += 4) k[j] ^= k[j-4], k[j+1] ^= k[j-3], k[j+2] ^= k[j-2], k[j+3] ^= k[j-1];
-            k[16] ^= sbox[k[12]], k[17] ^= sbox[k[13]], k[18] ^= sbox[k[14]], k[19] ^= sbox[k[15]];
-            for (j = 20; j < 32; j += 4) k[j] ^= k[j-4], k[j+1] ^= k[j-3], k[j+2] ^= k[j-2], k[j+3] ^= k[j-1];
-        }
-    }
-    
-    for (i = 0; i < 4; i++) _x[i] ^= _k[i]; // final add round key
-    memcpy(buf16, _x, sizeof(_x));
-}
-
-static void _BRAES256ECBDecrypt(const void *key32, void *buf16)
+// returns the number of threads to use for scrypt, one per cpu
+static unsigned _BRBIP38ThreadCount(void)
 {
-    size_t i, j;
-    uint32_t _k[32/4], _x[16/4];
-    uint8_t *x = (uint8_t *)_x, *k = (uint8_t *)_k, r = 1, a, b, c, d, e, f, g, h;
-    
-    memcpy(_k, key32, sizeof(_k));
-    memcpy(_x, buf16, sizeof(_x));
-    
-    for (i = 0; i < 7; i++) { // expand key
-        k[0] ^= sbox[k[29]] ^ r, k[1] ^= sbox[k[30]], k[2] ^= sbox[k[31]], k[3] ^= sbox[k[28]], r = xt(r);
-        for (j = 4; j < 16; j += 4) k[j] ^= k[j-4], k[j+1] ^= k[j-3], k[j+2] ^= k[j-2], k[j+3] ^= k[j-1];
-        k[16] ^= sbox[k[12]], k[17] ^= sbox[k[13]], k[18] ^= sbox[k[14]], k[19] ^= sbox[k[15]];
-        for (j = 20; j < 32; j += 4) k[j] ^= k[j-4], k[j+1] ^= k[j-3], k[j+2] ^= k[j-2], k[j+3] ^= k[j-1];
-    }
-    
-    for (i = 0; i < 14; i++) {
-        for (j = 0; j < 4; j++) _x[j] ^= _k[j+(i & 1)*4]; // add round key
-        
-        for (j = 0; i > 0 && j < 16; j += 4) { // unmix columns
-            a = x[j], b = x[j+1], c = x[j+2], d = x[j+3], e = a ^ b ^ c ^ d;
-            h = xt(e), f = e ^ xt(xt(h ^ a ^ c)), g = e ^ xt(xt(h ^ b ^ d));
-            x[j] ^= f ^ xt(a ^ b), x[j+1] ^= g ^ xt(b ^ c), x[j+2] ^= f ^ xt(c ^ d), x[j+3] ^= g ^ xt(d ^ a);
-        }
-        
-        // unshift rows
-        a = x[1], x[1] = x[13], x[13] = x[9], x[9] = x[5], x[5] = a, a = x[2], x[2] = x[10], x[10] = a;
-        a = x[3], x[3] = x[7], x[7] = x[11], x[11] = x[15], x[15] = a, a = x[6], x[6] = x[14], x[14] = a;
-        
-        for (j = 0; j < 16; j++) x[j] = sboxi[x[j]]; // unsub bytes
-        
-        if ((i % 2) == 0) { // unexpand key
-            for (j = 28; j > 16; j -= 4) k[j] ^= k[j-4], k[j+1] ^= k[j-3], k[j+2] ^= k[j-2], k[j+3] ^= k[j-1];
-            k[16] ^= sbox[k[12]], k[17] ^= sbox[k[13]], k[18] ^= sbox[k[14]], k[19] ^= sbox[k[15]];
-            for (j = 12; j > 0; j -= 4) k[j] ^= k[j-4], k[j+1] ^= k[j-3], k[j+2] ^= k[j-2], k[j+3] ^= k[j-1];
-            r = (r >> 1) ^ ((r & 1)*0x8d);
-            k[0] ^= sbox[k[29]] ^ r, k[1] ^= sbox[k[30]], k[2] ^= sbox[k[31]], k[3] ^= sbox[k[28]];
-        }
-    }
+    long cpuCount = sysconf(_SC_NPROCESSORS_ONLN);
     
-    for (i = 0; i < 4; i++) _x[i] ^= _k[i]; // final add round key
-    memcpy(buf16, _x, sizeof(_x));
+    return (cpuCount < 1) ? 1 : (cpuCount > BIP38_SCRYPT_P) ? BIP38_SCRYPT_P : (unsigned)cpuCount;
 }
 
-static UInt256 _BRBIP38DerivePassfactor(uint8_t flag, const uint8_t *entropy, const char *passphrase)
+static UInt256 _BRBIP38DerivePassfactor(uint8_t flag, const uint8_t *entropy, const char *passphrase,
+                                        unsigned threadCount, size_t memLimit)
 {
     size_t len = strlen(passphrase);
     UInt256 prefactor, passfactor;
     
-    BRScrypt(&prefactor, sizeof(prefactor), passphrase, len, entropy, (flag & BIP38_LOTSEQUENCE_FLAG) ? 4 : 8,
-             BIP38_SCRYPT_N, BIP38_SCRYPT_R, BIP38_SCRYPT_P);
+    BRScryptParallel(&prefactor, sizeof(prefactor), passphrase, len, entropy, (flag & BIP38_LOTSEQUENCE_FLAG) ? 4 : 8,
+                     BIP38_SCRYPT_N, BIP38_SCRYPT_R, BIP38_SCRYPT_P, threadCount, memLimit);
     
     if (flag & BIP38_LOTSEQUENCE_FLAG) { // passfactor = SHA256(SHA256(prefactor + entropy))
         uint8_t d[sizeof(prefactor) + sizeof(uint64_t)];
@@ -223,9 +116,8 @@ int BRBIP38KeyIsValid(const char *bip38Key)
     else return 0; // invalid prefix
 }
 
-// decrypts a BIP38 key using the given passphrase and returns false if passphrase is incorrect
-// passphrase must be unicode NFC normalized: http://www.unicode.org/reports/tr15/#Norm_Forms
-int BRKeySetBIP38Key(BRKey *key, const char *bip38Key, const char *passphrase)
+static int _BRKeySetBIP38Key(BRKey *key, const char *bip38Key, const char *passphrase, unsigned threadCount,
+                             size_t memLimit)
 {
     int r = 1;
     uint8_t data[39];
@@ -242,21 +134,23 @@ int BRKeySetBIP38Key(BRKey *key, const char *bip38Key, const char *passphrase)
     size_t pwLen = strlen(passphrase);
     UInt512 derived;
     UInt256 secret, derived1, derived2, hash;
+    BRAES256Ctx aes;
     BRAddress address = BR_ADDRESS_NONE;
 
     if (prefix == BIP38_NOEC_PREFIX) { // non EC multiplied key
         // data = prefix + flag + addresshash + encrypted1 + encrypted2
         UInt128 encrypted1 = UInt128Get(&data[7]), encrypted2 = UInt128Get(&data[23]);
 
-        BRScrypt(&derived, sizeof(derived), passphrase, pwLen, addresshash, sizeof(uint32_t),
-                 BIP38_SCRYPT_N, BIP38_SCRYPT_R, BIP38_SCRYPT_P);
+        BRScryptParallel(&derived, sizeof(derived), passphrase, pwLen, addresshash, sizeof(uint32_t),
+                         BIP38_SCRYPT_N, BIP38_SCRYPT_R, BIP38_SCRYPT_P, threadCount, memLimit);
         derived1 = *(UInt256 *)&derived, derived2 = *(UInt256 *)&derived.u64[4];
+        BRAES256Init(&aes, &derived2);
         
-        _BRAES256ECBDecrypt(&derived2, &encrypted1);
+        BRAES256ECBDecrypt(&aes, &encrypted1, sizeof(encrypted1));
         secret.u64[0] = encrypted1.u64[0] ^ derived1.u64[0];
         secret.u64[1] = encrypted1.u64[1] ^ derived1.u64[1];
         
-        _BRAES256ECBDecrypt(&derived2, &encrypted2);
+        BRAES256ECBDecrypt(&aes, &encrypted2, sizeof(encrypted2));
         secret.u64[2] = encrypted2.u64[0] ^ derived1.u64[2];
         secret.u64[3] = encrypted2.u64[1] ^ derived1.u64[3];
     }
@@ -264,22 +158,23 @@ int BRKeySetBIP38Key(BRKey *key, const char *bip38Key, const char *passphrase)
         // data = prefix + flag + addresshash + entropy + encrypted1[0...7] + encrypted2
         const uint8_t *entropy = &data[7];
         UInt128 encrypted1 = UINT128_ZERO, encrypted2 = UInt128Get(&data[23]);
-        UInt256 passfactor = _BRBIP38DerivePassfactor(flag, entropy, passphrase), factorb;
+        UInt256 passfactor = _BRBIP38DerivePassfactor(flag, entropy, passphrase, threadCount, memLimit), factorb;
         BRECPoint passpoint;
         uint64_t seedb[3];
         
         BRSecp256k1PointGen(&passpoint, &passfactor); // passpoint = G*passfactor
         derived = _BRBIP38DeriveKey(passpoint, addresshash, entropy);
         derived1 = *(UInt256 *)&derived, derived2 = *(UInt256 *)&derived.u64[4];
+        BRAES256Init(&aes, &derived2);
         memcpy(&encrypted1, &data[15], sizeof(uint64_t));
 
         // encrypted2 = (encrypted1[8...15] + seedb[16...23]) xor derived1[16...31]
-        _BRAES256ECBDecrypt(&derived2, &encrypted2);
+        BRAES256ECBDecrypt(&aes, &encrypted2, sizeof(encrypted2));
         encrypted1.u64[1] = encrypted2.u64[0] ^ derived1.u64[2];
         seedb[2] = encrypted2.u64[1] ^ derived1.u64[3];
 
         // encrypted1 = seedb[0...15] xor derived1[0...15]
-        _BRAES256ECBDecrypt(&derived2, &encrypted1);
+        BRAES256ECBDecrypt(&aes, &encrypted1, sizeof(encrypted1));
         seedb[0] = encrypted1.u64[0] ^ derived1.u64[0];
         seedb[1] = encrypted1.u64[1] ^ derived1.u64[1];
 
@@ -290,12 +185,98 @@ int BRKeySetBIP38Key(BRKey *key, const char *bip38Key, const char *passphrase)
     
     BRKeySetSecret(key, &secret, flag & BIP38_COMPRESSED_FLAG);
     secret = UINT256_ZERO;
+    memset(&aes, 0, sizeof(aes));
     BRKeyAddress(key, address.s, sizeof(address));
     BRSHA256_2(&hash, address.s, strlen(address.s));
     if (! address.s[0] || memcmp(&hash, addresshash, sizeof(uint32_t)) != 0) r = 0;
     return r;
 }
 
+// decrypts a BIP38 key using the given passphrase and returns false if passphrase is incorrect
+// passphrase must be unicode NFC normalized: http://www.unicode.org/reports/tr15/#Norm_Forms
+int BRKeySetBIP38Key(BRKey *key, const char *bip38Key, const char *passphrase)
+{
+    return _BRKeySetBIP38Key(key, bip38Key, passphrase, _BRBIP38ThreadCount(), BIP38_SCRYPT_MEM_LIMIT);
+}
+
+typedef struct {
+    BRKey *keys;
+    int *results;
+    const char **bip38Keys, **passphrases;
+    size_t count;
+    size_t next; // next key to be claimed by a thread
+    size_t validCount; // number of keys decrypted successfully
+    unsigned threadCount; // scrypt threads per key
+    size_t memLimit; // scrypt scratch memory per key
+    pthread_mutex_t lock;
+} BRBIP38Job;
+
+static void *_BRBIP38ThreadRoutine(void *arg)
+{
+    BRBIP38Job *job = arg;
+    size_t i;
+    int r = 0;
+    
+    pthread_mutex_lock(&job->lock);
+    
+    while (job->next < job->count) {
+        i = job->next++;
+        pthread_mutex_unlock(&job->lock);
+        r = _BRKeySetBIP38Key(&job->keys[i], job->bip38Keys[i], job->passphrases[i], job->threadCount, job->memLimit);
+        if (job->results) job->results[i] = r;
+        pthread_mutex_lock(&job->lock);
+        if (r) job->validCount++;
+    }
+    
+    pthread_mutex_unlock(&job->lock);
+    return NULL;
+}
+
+// decrypts count BIP38 keys, where bip38Keys[i] is decrypted with passphrases[i] and written to keys[i], and sets
+// results[i] to false if the passphrase is incorrect (results may be NULL)
+// the keys are decrypted on multiple threads, which is much faster than calling BRKeySetBIP38Key() for each key when
+// sweeping many paper wallets - returns the number of keys that were decrypted successfully
+size_t BRKeySetBIP38KeyList(BRKey keys[], int results[], size_t count, const char *bip38Keys[],
+                            const char *passphrases[])
+{
+    size_t vLen = 128*BIP38_SCRYPT_R*BIP38_SCRYPT_N, totalCount = _BRBIP38ThreadCount(), threadCount, i;
+    BRBIP38Job job;
+    
+    assert(keys != NULL || count == 0);
+    assert(bip38Keys != NULL || count == 0);
+    assert(passphrases != NULL || count == 0);
+    
+    // totalCount is the number of scrypt threads that fit in both the cpus and BIP38_SCRYPT_MEM_LIMIT, and is split
+    // between keys decrypted in parallel and scrypt threads within each key
+    if (totalCount > BIP38_SCRYPT_MEM_LIMIT/vLen) totalCount = BIP38_SCRYPT_MEM_LIMIT/vLen;
+    if (totalCount < 1) totalCount = 1;
+    threadCount = (totalCount < count) ? totalCount : count;
+    memset(&job, 0, sizeof(job));
+    job.keys = keys;
+    job.results = results;
+    job.bip38Keys = bip38Keys;
+    job.passphrases = passphrases;
+    job.count = count;
+    
+    if (threadCount > 0) { // keys are decrypted in parallel, with any remaining threads used for scrypt within each key
+        pthread_t threads[threadCount];
+        
+        job.threadCount = (unsigned)(totalCount/threadCount);
+        job.memLimit = job.threadCount*vLen;
+        pthread_mutex_init(&job.lock, NULL);
+        
+        for (i = 1; i < threadCount; i++) {
+            if (pthread_create(&threads[i], NULL, _BRBIP38ThreadRoutine, &job) != 0) break;
+        }
+        
+        _BRBIP38ThreadRoutine(&job);
+        while (i > 1) pthread_join(threads[--i], NULL);
+        pthread_mutex_destroy(&job.lock);
+    }
+    
+    return job.validCount;
+}
+
 // generates an "intermediate code" for an EC multiply mode key
 // salt should be 64bits of random data
 // passphrase must be unicode NFC normalized
@@ -337,6 +318,7 @@ size_t BRKeyBIP38Key(BRKey *key, char *bip38Key, size_t bip38KeyLen, const char
     UInt512 derived;
     UInt256 hash, derived1, derived2;
     UInt128 encrypted1, encrypted2;
+    BRAES256Ctx aes;
     
     if (! bip38Key) return 43*138/100 + 2; // 43bytes*log(256)/log(58), rounded up, plus NULL terminator
 
@@ -348,19 +330,21 @@ size_t BRKeyBIP38Key(BRKey *key, char *bip38Key, size_t bip38KeyLen, const char
     BRSHA256_2(&hash, address.s, strlen(address.s));
     salt = hash.u32[0];
 
-    BRScrypt(&derived, sizeof(derived), passphrase, strlen(passphrase), &salt, sizeof(salt),
-             BIP38_SCRYPT_N, BIP38_SCRYPT_R, BIP38_SCRYPT_P);
+    BRScryptParallel(&derived, sizeof(derived), passphrase, strlen(passphrase), &salt, sizeof(salt),
+                     BIP38_SCRYPT_N, BIP38_SCRYPT_R, BIP38_SCRYPT_P, _BRBIP38ThreadCount(), BIP38_SCRYPT_MEM_LIMIT);
     derived1 = *(UInt256 *)&derived, derived2 = *(UInt256 *)&derived.u64[4];
+    BRAES256Init(&aes, &derived2);
     
     // enctryped1 = AES256Encrypt(privkey[0...15] xor derived1[0...15], derived2)
     encrypted1.u64[0] = key->secret.u64[0] ^ derived1.u64[0];
     encrypted1.u64[1] = key->secret.u64[1] ^ derived1.u64[1];
-    _BRAES256ECBEncrypt(&derived2, &encrypted1);
+    BRAES256ECBEncrypt(&aes, &encrypted1, sizeof(encrypted1));
 
     // encrypted2 = AES256Encrypt(privkey[16...31] xor derived1[16...31], derived2)
     encrypted2.u64[0] = key->secret.u64[2] ^ derived1.u64[2];
     encrypted2.u64[1] = key->secret.u64[3] ^ derived1.u64[3];
-    _BRAES256ECBEncrypt(&derived2, &encrypted2);
+    BRAES256ECBEncrypt(&aes, &encrypted2, sizeof(encrypted2));
+    memset(&aes, 0, sizeof(aes));
     
     UInt16SetBE(&buf[off], prefix);
     off += sizeof(prefix);
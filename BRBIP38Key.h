@@ -40,6 +40,13 @@ int BRBIP38KeyIsValid(const char *bip38Key);
 // passphrase must be unicode NFC normalized: http://www.unicode.org/reports/tr15/#Norm_Forms
 int BRKeySetBIP38Key(BRKey *key, const char *bip38Key, const char *passphrase);
 
+// decrypts count BIP38 keys, where bip38Keys[i] is decrypted with passphrases[i] and written to keys[i], and sets
+// results[i] to false if the passphrase is incorrect (results may be NULL)
+// the keys are decrypted on multiple threads, which is much faster than calling BRKeySetBIP38Key() for each key when
+// sweeping many paper wallets - returns the number of keys that were decrypted successfully
+size_t BRKeySetBIP38KeyList(BRKey keys[], int results[], size_t count, const char *bip38Keys[],
+                            const char *passphrases[]);
+
 // generates an "intermediate code" for an EC multiply mode key
 // salt should be 64bits of random data
 // passphrase must be unicode NFC normalized
@@ -33,10 +33,20 @@
 
 #define BLOOM_MAX_HASH_FUNCS 50
 
-inline static uint32_t _BRBloomFilterHash(const BRBloomFilter *filter, const uint8_t *data, size_t dataLen,
-                                          uint32_t hashNum)
+#define BLOOM_HASH_LANES     8 // hash functions computed together when the result may be known after the first few
+#define BLOOM_BATCH_SIZE     64 // elements checked together by BRBloomFilterContainsDataList()
+
+// sets idx[i] to the filter bit for hash function first + i, for n <= BLOOM_MAX_HASH_FUNCS hash functions, computed
+// together in a single pass over data
+static void _BRBloomFilterHashes(const BRBloomFilter *filter, uint32_t idx[], uint32_t first, uint32_t n,
+                                 const uint8_t *data, size_t dataLen)
 {
-    return BRMurmur3_32(data, dataLen, hashNum*0xfba4c795 + filter->tweak) % (filter->length*8);
+    uint32_t i, seeds[BLOOM_MAX_HASH_FUNCS] = { 0 };
+    
+    assert(n <= BLOOM_MAX_HASH_FUNCS);
+    for (i = 0; i < n; i++) seeds[i] = (first + i)*0xfba4c795 + filter->tweak;
+    BRMurmur3_32Seeds(idx, data, dataLen, seeds, n);
+    for (i = 0; i < n; i++) idx[i] %= filter->length*8;
 }
 
 // returns a newly allocated bloom filter struct that must be freed by calling BRBloomFilterFree()
@@ -124,35 +134,122 @@ size_t BRBloomFilterSerialize(const BRBloomFilter *filter, uint8_t *buf, size_t
 // true if data is matched by filter
 int BRBloomFilterContainsData(const BRBloomFilter *filter, const uint8_t *data, size_t dataLen)
 {
-    uint32_t i, idx;
+    uint32_t i, j, n, idx[BLOOM_HASH_LANES];
     
     assert(filter != NULL);
     assert(data != NULL || dataLen == 0);
     
-    for (i = 0; data && i < filter->hashFuncs; i++) {
-        idx = _BRBloomFilterHash(filter, data, dataLen, i);
-        if (! (filter->filter[idx >> 3] & (1 << (7 & idx)))) return 0;
+    for (i = 0; data && i < filter->hashFuncs; i += n) { // most non-matching data fails on one of the first few bits
+        n = (filter->hashFuncs - i < BLOOM_HASH_LANES) ? filter->hashFuncs - i : BLOOM_HASH_LANES;
+        _BRBloomFilterHashes(filter, idx, i, n, data, dataLen);
+        
+        for (j = 0; j < n; j++) {
+            if (! (filter->filter[idx[j] >> 3] & (1 << (7 & idx[j])))) return 0;
+        }
     }
     
     return (data) ? 1 : 0;
 }
 
+// sets results[i] to true if data[i] is matched by filter, where data[i] is dataLen[i] bytes
+// consecutive elements of the same length are hashed together in simd lanes, one hash function at a time, so that most
+// non-matching elements are dropped after the first few hash functions
+// returns the number of matches
+size_t BRBloomFilterContainsDataList(const BRBloomFilter *filter, int results[], const uint8_t *data[],
+                                     const size_t dataLen[], size_t count)
+{
+    const void *elems[BLOOM_BATCH_SIZE];
+    uint32_t i, idx[BLOOM_BATCH_SIZE];
+    size_t j, k, l, n, m, live[BLOOM_BATCH_SIZE], matches = 0;
+    
+    assert(filter != NULL);
+    assert(results != NULL || count == 0);
+    assert(data != NULL || count == 0);
+    assert(dataLen != NULL || count == 0);
+    
+    for (j = 0; j < count; j += n) {
+        for (n = 1; j + n < count && n < BLOOM_BATCH_SIZE && dataLen[j + n] == dataLen[j]; n++);
+        
+        for (k = 0, m = 0; k < n; k++) { // live holds the indexes of elements that have matched every bit so far
+            results[j + k] = (data[j + k] != NULL);
+            if (results[j + k]) live[m++] = j + k;
+        }
+        
+        for (i = 0; m > 0 && i < filter->hashFuncs; i++) {
+            for (k = 0; k < m; k++) elems[k] = data[live[k]];
+            BRMurmur3_32Batch(idx, elems, dataLen[j], i*0xfba4c795 + filter->tweak, m);
+            
+            for (k = 0, l = 0; k < m; k++) {
+                idx[k] %= filter->length*8;
+                if (filter->filter[idx[k] >> 3] & (1 << (7 & idx[k]))) live[l++] = live[k];
+                else results[live[k]] = 0;
+            }
+            
+            m = l;
+        }
+        
+        matches += m;
+    }
+    
+    return matches;
+}
+
 // add data to filter
 void BRBloomFilterInsertData(BRBloomFilter *filter, const uint8_t *data, size_t dataLen)
 {
-    uint32_t i, idx;
+    uint32_t i, j, n, idx[BLOOM_MAX_HASH_FUNCS];
     
     assert(filter != NULL);
     assert(data != NULL || dataLen == 0);
     
-    for (i = 0; data && i < filter->hashFuncs; i++) {
-        idx = _BRBloomFilterHash(filter, data, dataLen, i);
-        filter->filter[idx >> 3] |= (1 << (7 & idx));
+    for (i = 0; data && i < filter->hashFuncs; i += n) {
+        n = (filter->hashFuncs - i < BLOOM_MAX_HASH_FUNCS) ? filter->hashFuncs - i : BLOOM_MAX_HASH_FUNCS;
+        _BRBloomFilterHashes(filter, idx, i, n, data, dataLen);
+        for (j = 0; j < n; j++) filter->filter[idx[j] >> 3] |= (1 << (7 & idx[j]));
     }
     
     if (data) filter->elemCount++;
 }
 
+// adds each data[i] that isn't already matched by filter, where data[i] is dataLen[i] bytes, in order, so that
+// duplicates are only counted once in elemCount - this hashes each element once, instead of once to check if it's
+// already matched and again to add it
+// returns the number of elements added
+size_t BRBloomFilterInsertDataList(BRBloomFilter *filter, const uint8_t *data[], const size_t dataLen[], size_t count)
+{
+    uint32_t j, idx[BLOOM_MAX_HASH_FUNCS];
+    size_t i, added = 0;
+    int match;
+    
+    assert(filter != NULL);
+    assert(data != NULL || count == 0);
+    assert(dataLen != NULL || count == 0);
+    
+    for (i = 0; i < count; i++) {
+        if (! data[i]) continue;
+        
+        if (filter->hashFuncs > BLOOM_MAX_HASH_FUNCS) { // parsed filters aren't limited to BLOOM_MAX_HASH_FUNCS
+            if (BRBloomFilterContainsData(filter, data[i], dataLen[i])) continue;
+            BRBloomFilterInsertData(filter, data[i], dataLen[i]);
+            added++;
+            continue;
+        }
+        
+        _BRBloomFilterHashes(filter, idx, 0, filter->hashFuncs, data[i], dataLen[i]);
+        
+        for (j = 0, match = 1; match && j < filter->hashFuncs; j++) {
+            if (! (filter->filter[idx[j] >> 3] & (1 << (7 & idx[j])))) match = 0;
+        }
+        
+        if (match) continue;
+        for (j = 0; j < filter->hashFuncs; j++) filter->filter[idx[j] >> 3] |= (1 << (7 & idx[j]));
+        filter->elemCount++;
+        added++;
+    }
+    
+    return added;
+}
+
 // frees memory allocated for filter
 void BRBloomFilterFree(BRBloomFilter *filter)
 {
@@ -68,9 +68,22 @@ size_t BRBloomFilterSerialize(const BRBloomFilter *filter, uint8_t *buf, size_t
 // true if data is matched by filter
 int BRBloomFilterContainsData(const BRBloomFilter *filter, const uint8_t *data, size_t dataLen);
 
+// sets results[i] to true if data[i] is matched by filter, where data[i] is dataLen[i] bytes
+// consecutive elements of the same length are hashed together in simd lanes, which is faster than calling
+// BRBloomFilterContainsData() for each element
+// returns the number of matches
+size_t BRBloomFilterContainsDataList(const BRBloomFilter *filter, int results[], const uint8_t *data[],
+                                     const size_t dataLen[], size_t count);
+
 // add data to filter
 void BRBloomFilterInsertData(BRBloomFilter *filter, const uint8_t *data, size_t dataLen);
 
+// adds each data[i] that isn't already matched by filter, where data[i] is dataLen[i] bytes, in order, so that
+// duplicates are only counted once in elemCount - this is faster than calling BRBloomFilterContainsData() and
+// BRBloomFilterInsertData() for each element, since each element is only hashed once
+// returns the number of elements added
+size_t BRBloomFilterInsertDataList(BRBloomFilter *filter, const uint8_t *data[], const size_t dataLen[], size_t count);
+
 // frees memory allocated for filter
 void BRBloomFilterFree(BRBloomFilter *filter);
 
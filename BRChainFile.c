@@ -0,0 +1,334 @@
+//
+//  BRChainFile.c
+//
+//  Created by Aaron Voisine on 10/17/26.
+//  Copyright (c) 2026 breadwallet LLC
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#include "BRChainFile.h"
+#include "BRCrypto.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define CHAIN_FILE_MAGIC  0x32484342 // "BCH2" read as little endian, so a file with another byte order is started over
+#define CHAIN_FILE_GROWTH 2016 // number of records the file grows by when it's full
+
+typedef struct {
+    uint32_t magic;
+    uint32_t recordSize; // sizeof(BRBlockHeader), so files written with a different struct layout are started over
+    uint32_t height; // height of the first record
+    uint32_t count; // number of committed records
+    uint32_t synced; // number of records known to be on persistent storage
+    uint32_t reserved; // keeps the records 8 byte aligned
+} BRChainFileMeta;
+
+struct BRChainFileStruct {
+    int fd;
+    char *path;
+    uint8_t *map;
+    size_t mapLen;
+    size_t capacity;
+};
+
+inline static BRChainFileMeta *_BRChainFileMeta(const BRChainFile *file)
+{
+    return (BRChainFileMeta *)file->map;
+}
+
+inline static BRBlockHeader *_BRChainFileRecords(const BRChainFile *file)
+{
+    return (BRBlockHeader *)(file->map + sizeof(BRChainFileMeta));
+}
+
+// returns the offset of record i in the file
+inline static size_t _BRChainFileOffset(size_t i)
+{
+    return sizeof(BRChainFileMeta) + i*sizeof(BRBlockHeader);
+}
+
+// maps capacity records of the file, growing the file first if needed, returns true on success, or false with errno set
+static int _BRChainFileMap(BRChainFile *file, size_t capacity)
+{
+    size_t len = _BRChainFileOffset(capacity);
+    struct stat st;
+    void *map;
+    
+    if (fstat(file->fd, &st) != 0) return 0;
+    if ((size_t)st.st_size < len && ftruncate(file->fd, (off_t)len) != 0) return 0;
+    map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, file->fd, 0);
+    if (map == MAP_FAILED) return 0;
+    if (file->map) munmap(file->map, file->mapLen);
+    file->map = map;
+    file->mapLen = len;
+    file->capacity = capacity;
+    return 1;
+}
+
+// writes the len mapped bytes at off to persistent storage, returns true on success, or false with errno set
+static int _BRChainFileSyncRange(BRChainFile *file, size_t off, size_t len)
+{
+    long pageSize = sysconf(_SC_PAGESIZE);
+    size_t start = (pageSize > 0) ? off - off % (size_t)pageSize : 0; // msync needs a page aligned address
+    
+    return (len == 0 || msync(file->map + start, off + len - start, MS_SYNC) == 0);
+}
+
+// returns true if the record's blockHash is the hash of its header fields, which it won't be if only some of the record
+// made it to persistent storage
+static int _BRChainFileRecordIsIntact(const BRBlockHeader *record)
+{
+    BRMerkleBlock block = BRBlockHeaderMerkleBlock(record);
+    uint8_t buf[80];
+    UInt256 md;
+    
+    if (BRMerkleBlockSerialize(&block, buf, sizeof(buf)) != sizeof(buf)) return 0;
+    BRSHA256_2(&md, buf, sizeof(buf));
+    return UInt256Eq(md, record->blockHash);
+}
+
+// opens the chain file at path, creating it if it doesn't exist, or starting it over if it isn't a valid chain file
+// returns NULL on failure, with errno set
+BRChainFile *BRChainFileOpen(const char *path)
+{
+    BRChainFile *file = calloc(1, sizeof(*file));
+    BRChainFileMeta *meta;
+    BRBlockHeader *r;
+    struct stat st;
+    size_t capacity = 0;
+    uint32_t i;
+    int err = 0;
+    
+    assert(file != NULL);
+    assert(path != NULL);
+    file->path = strdup(path);
+    file->fd = open(path, O_RDWR | O_CREAT, 0600);
+    if (! file->path) err = ENOMEM;
+    if (! err && (file->fd < 0 || fstat(file->fd, &st) != 0)) err = errno;
+    
+    if (! err) {
+        if ((size_t)st.st_size > sizeof(BRChainFileMeta)) {
+            capacity = ((size_t)st.st_size - sizeof(BRChainFileMeta))/sizeof(BRBlockHeader);
+        }
+        
+        if (! _BRChainFileMap(file, (capacity > 0) ? capacity : CHAIN_FILE_GROWTH)) err = errno;
+    }
+    
+    if (! err) {
+        meta = _BRChainFileMeta(file);
+        r = _BRChainFileRecords(file);
+        
+        if (meta->magic != CHAIN_FILE_MAGIC || meta->recordSize != sizeof(BRBlockHeader)) { // start over
+            memset(meta, 0, sizeof(*meta));
+            meta->magic = CHAIN_FILE_MAGIC;
+            meta->recordSize = sizeof(BRBlockHeader);
+        }
+        
+        if (meta->count > file->capacity) meta->count = (uint32_t)file->capacity;
+        if (meta->synced > meta->count) meta->synced = meta->count;
+        
+        // the kernel writes back mapped pages in any order, so if there was a crash, any of the records after the
+        // last sync, not just the last ones, may not have made it to persistent storage, and a record that straddles
+        // two pages may have only partly made it - keep them only up to the first one that isn't at the right height,
+        // doesn't link to the record before it, or doesn't hash to its blockHash
+        for (i = meta->synced; i < meta->count && r[i].height == meta->height + i &&
+             (i == 0 || UInt256Eq(r[i].prevBlock, r[i - 1].blockHash)) && _BRChainFileRecordIsIntact(&r[i]); i++);
+        meta->count = i;
+    }
+    
+    if (err) {
+        if (file->fd >= 0) close(file->fd);
+        if (file->path) free(file->path);
+        free(file);
+        file = NULL;
+        errno = err;
+    }
+    
+    return file;
+}
+// returns the number of headers in the file
+size_t BRChainFileCount(const BRChainFile *file)
+{
+    assert(file != NULL);
+    return _BRChainFileMeta(file)->count;
+}
+
+// returns the height of the first header in the file, only meaningful if the file isn't empty
+uint32_t BRChainFileFirstHeight(const BRChainFile *file)
+{
+    assert(file != NULL);
+    return _BRChainFileMeta(file)->height;
+}
+
+// returns the header at height, or NULL if there isn't one - the header points into the file, and is only valid until
+// the next call to BRChainFileAppend() or BRChainFileCompact()
+const BRBlockHeader *BRChainFileHeader(const BRChainFile *file, uint32_t height)
+{
+    const BRChainFileMeta *meta;
+    
+    assert(file != NULL);
+    meta = _BRChainFileMeta(file);
+    if (height < meta->height || height - meta->height >= meta->count) return NULL;
+    return &_BRChainFileRecords(file)[height - meta->height];
+}
+
+// appends header to the file, which must be at the height following the last header, or any height if the file is
+// empty, and whose blockHash must be the hash of its header fields, or it's dropped if the file is reopened before it's
+// synced - returns true on success, or false on failure, with errno set
+int BRChainFileAppend(BRChainFile *file, const BRBlockHeader *header)
+{
+    BRChainFileMeta *meta;
+    
+    assert(file != NULL);
+    assert(header != NULL);
+    meta = _BRChainFileMeta(file);
+    
+    if (meta->count > 0 && header->height != meta->height + meta->count) {
+        errno = EINVAL;
+        return 0;
+    }
+    
+    if (meta->count == file->capacity && ! _BRChainFileMap(file, file->capacity + CHAIN_FILE_GROWTH)) return 0;
+    meta = _BRChainFileMeta(file);
+    if (meta->count == 0) meta->height = header->height;
+    _BRChainFileRecords(file)[meta->count] = *header;
+    meta->count++; // the record is written before it's counted
+    return 1;
+}
+
+// removes all headers at height and above, such as when the main chain is reorganized - the new count is committed
+// before any of the removed records can be overwritten, so a crash never leaves removed headers in the file
+void BRChainFileTruncate(BRChainFile *file, uint32_t height)
+{
+    BRChainFileMeta *meta;
+    uint32_t count, oldCount;
+    
+    assert(file != NULL);
+    meta = _BRChainFileMeta(file);
+    
+    if (meta->count > 0 && height < meta->height + meta->count) {
+        count = (height > meta->height) ? height - meta->height : 0;
+        oldCount = meta->count;
+        meta->count = count;
+        if (meta->synced > count) meta->synced = count;
+        _BRChainFileSyncRange(file, 0, sizeof(*meta));
+        
+        // the removed records are then zeroed and synced, so that if a record appended later doesn't make it to
+        // persistent storage before a crash, the removed record at the same height can't take its place - only the
+        // meta data and the removed records are synced, the rest of the file is left for the next BRChainFileSync()
+        memset(&_BRChainFileRecords(file)[count], 0, (oldCount - count)*sizeof(BRBlockHeader));
+        _BRChainFileSyncRange(file, _BRChainFileOffset(count), (oldCount - count)*sizeof(BRBlockHeader));
+    }
+}
+
+// removes all headers below height, so the file doesn't keep growing from the height it was started at - the
+// remaining headers are written to a new file that replaces the old one, so a crash leaves either the old file or the
+// new one, and all of the remaining headers are on persistent storage once this returns
+// returns true on success, or false on failure, with errno set and the file unchanged
+int BRChainFileCompact(BRChainFile *file, uint32_t height)
+{
+    BRChainFileMeta *meta, m;
+    BRChainFile compact = { -1, NULL, NULL, 0, 0 };
+    size_t start, count, off = 0, len;
+    const uint8_t *buf;
+    ssize_t n = 0;
+    int err = 0;
+    
+    assert(file != NULL);
+    
+    char tmp[strlen(file->path) + 5];
+    
+    meta = _BRChainFileMeta(file);
+    if (meta->count == 0 || height <= meta->height) return 1;
+    start = (height - meta->height < meta->count) ? height - meta->height : meta->count;
+    count = meta->count - start;
+    m = *meta;
+    m.height = meta->height + (uint32_t)start;
+    m.count = m.synced = (uint32_t)count;
+    snprintf(tmp, sizeof(tmp), "%s.tmp", file->path);
+    compact.fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (compact.fd < 0) return 0;
+    
+    for (len = sizeof(m), buf = (const uint8_t *)&m; ! err && off < len; off += (size_t)n) {
+        n = write(compact.fd, buf + off, len - off);
+        if (n < 0 && errno != EINTR) err = errno;
+        if (n < 0) n = 0;
+    }
+    
+    buf = (const uint8_t *)&_BRChainFileRecords(file)[start];
+    
+    for (off = 0, len = count*sizeof(BRBlockHeader); ! err && off < len; off += (size_t)n) {
+        n = write(compact.fd, buf + off, len - off);
+        if (n < 0 && errno != EINTR) err = errno;
+        if (n < 0) n = 0;
+    }
+    
+    if (! err && ! _BRChainFileMap(&compact, (count/CHAIN_FILE_GROWTH + 1)*CHAIN_FILE_GROWTH)) err = errno;
+    if (! err && fsync(compact.fd) != 0) err = errno;
+    if (! err && rename(tmp, file->path) != 0) err = errno;
+    
+    if (err) {
+        if (compact.map) munmap(compact.map, compact.mapLen);
+        close(compact.fd);
+        unlink(tmp);
+        errno = err;
+        return 0;
+    }
+    
+    munmap(file->map, file->mapLen);
+    close(file->fd);
+    file->fd = compact.fd;
+    file->map = compact.map;
+    file->mapLen = compact.mapLen;
+    file->capacity = compact.capacity;
+    return 1;
+}
+
+// writes any changes to the file to persistent storage, returns true on success, or false on failure, with errno set
+int BRChainFileSync(BRChainFile *file)
+{
+    BRChainFileMeta *meta;
+    
+    assert(file != NULL);
+    meta = _BRChainFileMeta(file);
+    
+    // the records are synced before the synced count is, so it never covers a record that isn't on persistent storage
+    if (! _BRChainFileSyncRange(file, _BRChainFileOffset(meta->synced),
+                                (meta->count - meta->synced)*sizeof(BRBlockHeader))) return 0;
+    meta->synced = meta->count;
+    return _BRChainFileSyncRange(file, 0, sizeof(*meta));
+}
+
+// syncs and closes the file, and frees memory allocated for it
+void BRChainFileClose(BRChainFile *file)
+{
+    assert(file != NULL);
+    BRChainFileSync(file);
+    munmap(file->map, file->mapLen);
+    close(file->fd);
+    free(file->path);
+    free(file);
+}
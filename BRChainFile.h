@@ -0,0 +1,80 @@
+//
+//  BRChainFile.h
+//
+//  Created by Aaron Voisine on 10/17/26.
+//  Copyright (c) 2026 breadwallet LLC
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#ifndef BRChainFile_h
+#define BRChainFile_h
+
+#include "BRMerkleBlock.h"
+#include <stddef.h>
+#include <inttypes.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// an append-only file of block headers for a contiguous run of the main chain, with one fixed size record per height,
+// that's memory mapped so opening it only reads and hashes the headers appended since the last sync - the file grows by
+// one record per block until BRChainFileCompact() removes the headers that are no longer needed from the front
+typedef struct BRChainFileStruct BRChainFile;
+
+// opens the chain file at path, creating it if it doesn't exist, or starting it over if it isn't a valid chain file
+// returns NULL on failure, with errno set
+BRChainFile *BRChainFileOpen(const char *path);
+
+// returns the number of headers in the file
+size_t BRChainFileCount(const BRChainFile *file);
+
+// returns the height of the first header in the file, only meaningful if the file isn't empty
+uint32_t BRChainFileFirstHeight(const BRChainFile *file);
+
+// returns the header at height, or NULL if there isn't one - the header points into the file, and is only valid until
+// the next call to BRChainFileAppend() or BRChainFileCompact()
+const BRBlockHeader *BRChainFileHeader(const BRChainFile *file, uint32_t height);
+
+// appends header to the file, which must be at the height following the last header, or any height if the file is
+// empty, and whose blockHash must be the hash of its header fields, or it's dropped if the file is reopened before it's
+// synced - returns true on success, or false on failure, with errno set
+int BRChainFileAppend(BRChainFile *file, const BRBlockHeader *header);
+
+// removes all headers at height and above, such as when the main chain is reorganized - the new count is committed
+// before any of the removed records can be overwritten, so a crash never leaves removed headers in the file
+void BRChainFileTruncate(BRChainFile *file, uint32_t height);
+
+// removes all headers below height, so the file doesn't keep growing from the height it was started at - the
+// remaining headers are written to a new file that replaces the old one, so a crash leaves either the old file or the
+// new one, and all of the remaining headers are on persistent storage once this returns
+// returns true on success, or false on failure, with errno set and the file unchanged
+int BRChainFileCompact(BRChainFile *file, uint32_t height);
+
+// writes any changes to the file to persistent storage, returns true on success, or false on failure, with errno set
+int BRChainFileSync(BRChainFile *file);
+
+// syncs and closes the file, and frees memory allocated for it
+void BRChainFileClose(BRChainFile *file);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BRChainFile_h
@@ -26,6 +26,34 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <pthread.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#include <cpuid.h>
+#define SHA256_AVX2   1
+#define SHA256_SHANI  1
+#define AES256_AESNI  1
+#define CHACHA20_AVX2 1
+#endif
+
+#if defined(__ARM_FEATURE_CRYPTO) || defined(__ARM_FEATURE_SHA2)
+#include <arm_neon.h>
+#define SHA256_ARMV8 1
+#endif
+
+// forces inlining, so that a function body can be compiled more than once for different cpu features
+#if defined(__GNUC__)
+#define force_inline inline __attribute__((always_inline))
+#else
+#define force_inline inline
+#endif
+
+#if defined(__GNUC__) // gcc/clang vector extensions, these compile to sse2/avx2 instructions on x86 and neon on arm
+#define SIMD_LANES 8 // number of independent computations carried out together in simd lanes
+typedef uint32_t v8u32 __attribute__((vector_size(SIMD_LANES*sizeof(uint32_t))));
+typedef uint64_t v4u64 __attribute__((vector_size(SIMD_LANES*sizeof(uint32_t)))); // SIMD_LANES/2 64bit lanes
+#endif
 
 // endian swapping
 #if __BIG_ENDIAN__ || (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
@@ -110,19 +138,19 @@ void BRSHA1(void *md20, const void *data, size_t len)
 #define s2(x) (ror32((x), 7) ^ ror32((x), 18) ^ ((x) >> 3))
 #define s3(x) (ror32((x), 17) ^ ror32((x), 19) ^ ((x) >> 10))
 
-static void _BRSHA256Compress(uint32_t *r, uint32_t *x)
+static const uint32_t _sha256K[] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+force_inline static void _BRSHA256CompressBody(uint32_t *r, uint32_t *x)
 {
-    static const uint32_t k[] = {
-        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
-        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
-        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
-        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
-        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
-        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
-        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
-        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
-    };
-    
     int i;
     uint32_t a = r[0], b = r[1], c = r[2], d = r[3], e = r[4], f = r[5], g = r[6], h = r[7], t1, t2, w[64];
     
@@ -130,7 +158,7 @@ static void _BRSHA256Compress(uint32_t *r, uint32_t *x)
     for (; i < 64; i++) w[i] = s3(w[i - 2]) + w[i - 7] + s2(w[i - 15]) + w[i - 16];
     
     for (i = 0; i < 64; i++) {
-        t1 = h + s1(e) + ch(e, f, g) + k[i] + w[i];
+        t1 = h + s1(e) + ch(e, f, g) + _sha256K[i] + w[i];
         t2 = s0(a) + maj(a, b, c);
         h = g, g = f, f = e, e = d + t1, d = c, c = b, b = a, a = t1 + t2;
     }
@@ -140,6 +168,140 @@ static void _BRSHA256Compress(uint32_t *r, uint32_t *x)
     memset(w, 0, sizeof(w));
 }
 
+static void _BRSHA256CompressDefault(uint32_t *r, uint32_t *x)
+{
+    _BRSHA256CompressBody(r, x);
+}
+
+#if SHA256_AVX2
+// same as the default, but compiled to use avx2/bmi2 instructions such as rorx and andn
+__attribute__((target("avx2,bmi2")))
+static void _BRSHA256CompressAVX2(uint32_t *r, uint32_t *x)
+{
+    _BRSHA256CompressBody(r, x);
+}
+#endif
+
+#if SHA256_SHANI
+// x86 sha extensions: https://software.intel.com/en-us/articles/intel-sha-extensions
+__attribute__((target("sha,sse4.1")))
+static void _BRSHA256CompressSHANI(uint32_t *r, uint32_t *x)
+{
+    const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL); // big endian byte swap
+    __m128i m[4], msg, t, state0, state1, abef, cdgh;
+    
+    t = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&r[0]), 0xb1); // cdab
+    state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&r[4]), 0x1b); // efgh
+    state0 = abef = _mm_alignr_epi8(t, state1, 8); // abef
+    state1 = cdgh = _mm_blend_epi16(state1, t, 0xf0); // cdgh
+    
+    for (int i = 0; i < 16; i++) { // four rounds at a time
+        if (i < 4) m[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)&x[i*4]), mask);
+        msg = _mm_add_epi32(m[i % 4], _mm_loadu_si128((const __m128i *)&_sha256K[i*4]));
+        state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+        
+        if (i >= 3 && i < 15) { // message schedule for the next four rounds
+            t = _mm_add_epi32(m[(i + 1) % 4], _mm_alignr_epi8(m[i % 4], m[(i + 3) % 4], 4));
+            m[(i + 1) % 4] = _mm_sha256msg2_epu32(t, m[i % 4]);
+        }
+        
+        state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0e));
+        if (i >= 1 && i < 13) m[(i + 3) % 4] = _mm_sha256msg1_epu32(m[(i + 3) % 4], m[i % 4]);
+    }
+    
+    state0 = _mm_add_epi32(state0, abef);
+    state1 = _mm_add_epi32(state1, cdgh);
+    t = _mm_shuffle_epi32(state0, 0x1b); // feba
+    state1 = _mm_shuffle_epi32(state1, 0xb1); // dchg
+    _mm_storeu_si128((__m128i *)&r[0], _mm_blend_epi16(t, state1, 0xf0)); // dcba
+    _mm_storeu_si128((__m128i *)&r[4], _mm_alignr_epi8(state1, t, 8)); // hgfe
+}
+#endif
+
+#if SHA256_ARMV8
+// armv8 cryptography extensions
+static void _BRSHA256CompressARMv8(uint32_t *r, uint32_t *x)
+{
+    uint32x4_t m[4], msg, t, state0 = vld1q_u32(&r[0]), state1 = vld1q_u32(&r[4]), abcd = state0, efgh = state1;
+    
+    for (int i = 0; i < 4; i++) m[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8((const uint8_t *)&x[i*4])));
+    
+    for (int i = 0; i < 16; i++) { // four rounds at a time
+        msg = vaddq_u32(m[i % 4], vld1q_u32(&_sha256K[i*4]));
+        if (i < 12) m[i % 4] = vsha256su0q_u32(m[i % 4], m[(i + 1) % 4]); // message schedule for four rounds later
+        t = state0;
+        state0 = vsha256hq_u32(state0, state1, msg);
+        state1 = vsha256h2q_u32(state1, t, msg);
+        if (i < 12) m[i % 4] = vsha256su1q_u32(m[i % 4], m[(i + 2) % 4], m[(i + 3) % 4]);
+    }
+    
+    vst1q_u32(&r[0], vaddq_u32(state0, abcd));
+    vst1q_u32(&r[4], vaddq_u32(state1, efgh));
+}
+#endif
+
+static void _BRSHA256CompressSelect(uint32_t *r, uint32_t *x);
+
+// set to the fastest compression function for the enabled cpu features, the first call selects it
+static void (*volatile _BRSHA256Compress)(uint32_t *r, uint32_t *x) = _BRSHA256CompressSelect;
+
+static void _BRCryptoSelect(uint32_t features)
+{
+    _BRSHA256Compress = _BRSHA256CompressDefault;
+#if SHA256_AVX2
+    if (features & BR_CRYPTO_AVX2) _BRSHA256Compress = _BRSHA256CompressAVX2;
+#endif
+#if SHA256_SHANI
+    if (features & BR_CRYPTO_SHANI) _BRSHA256Compress = _BRSHA256CompressSHANI;
+#endif
+#if SHA256_ARMV8
+    if (features & BR_CRYPTO_ARMV8) _BRSHA256Compress = _BRSHA256CompressARMv8;
+#endif
+}
+
+static void _BRSHA256CompressSelect(uint32_t *r, uint32_t *x)
+{
+    _BRCryptoSelect(BRCryptoFeatures());
+    _BRSHA256Compress(r, x);
+}
+
+#define FEATURES_UNKNOWN 0x80000000
+
+static volatile uint32_t _features = FEATURES_UNKNOWN;
+
+static uint32_t _BRCryptoCPUFeatures(void)
+{
+    uint32_t features = 0;
+    
+#if SHA256_SHANI || SHA256_AVX2 || AES256_AESNI || CHACHA20_AVX2
+    unsigned a = 0, b = 0, c = 0, d = 0;
+    
+    __builtin_cpu_init();
+    if (__get_cpuid_max(0, NULL) >= 7) __cpuid_count(7, 0, a, b, c, d); // structured extended feature flags
+    if (__builtin_cpu_supports("sse4.1") && (b & (1 << 29))) features |= BR_CRYPTO_SHANI; // sha
+    if (__builtin_cpu_supports("avx2") && (b & (1 << 8))) features |= BR_CRYPTO_AVX2; // bmi2
+    if (__get_cpuid(1, &a, &b, &c, &d) && (c & (1 << 25))) features |= BR_CRYPTO_AESNI; // aes
+#endif
+#if SHA256_ARMV8
+    features |= BR_CRYPTO_ARMV8;
+#endif
+    return features;
+}
+
+// returns the hardware acceleration features currently in use
+uint32_t BRCryptoFeatures(void)
+{
+    if (_features == FEATURES_UNKNOWN) _features = _BRCryptoCPUFeatures();
+    return _features;
+}
+
+// limits hardware acceleration to the given features, where supported by the cpu (useful for testing and benchmarks)
+void BRCryptoSetFeatures(uint32_t features)
+{
+    _features = features & _BRCryptoCPUFeatures();
+    _BRCryptoSelect(_features);
+}
+
 void BRSHA224(void *md28, const void *data, size_t len) {
     size_t i;
     uint32_t x[16], buf[] = { 0xc1059ed8, 0x367cd507, 0x3070dd17, 0xf70e5939, 0xffc00b31, 0x68581511,
@@ -202,6 +364,344 @@ void BRSHA256_2(void *md32, const void *data, size_t len)
     BRSHA256(md32, t, sizeof(t));
 }
 
+#if defined(__GNUC__)
+
+// same as _BRSHA256Compress(), but operates on SIMD_LANES independent states at once, where r[i] holds word i of each
+// state, and x[i] holds word i of each message block, already converted to host byte order
+force_inline static void _BRSHA256CompressLanesBody(v8u32 *r, const v8u32 *x)
+{
+    int i;
+    v8u32 a = r[0], b = r[1], c = r[2], d = r[3], e = r[4], f = r[5], g = r[6], h = r[7], t1, t2, w[64];
+    
+    for (i = 0; i < 16; i++) w[i] = x[i];
+    for (; i < 64; i++) w[i] = s3(w[i - 2]) + w[i - 7] + s2(w[i - 15]) + w[i - 16];
+    
+    for (i = 0; i < 64; i++) {
+        t1 = h + s1(e) + ch(e, f, g) + _sha256K[i] + w[i];
+        t2 = s0(a) + maj(a, b, c);
+        h = g, g = f, f = e, e = d + t1, d = c, c = b, b = a, a = t1 + t2;
+    }
+    
+    r[0] += a, r[1] += b, r[2] += c, r[3] += d, r[4] += e, r[5] += f, r[6] += g, r[7] += h;
+}
+
+// sha256 of the 32 byte digests in r, which is replaced by the result
+force_inline static void _BRSHA256Lanes32Body(v8u32 *r)
+{
+    v8u32 x[16];
+    
+    for (int i = 0; i < 8; i++) x[i] = r[i], x[i + 8] = x[i] ^ x[i]; // zero the rest of the block
+    x[8] += 0x80000000; // padding
+    x[15] += 32*8; // length in bits
+    for (int i = 0; i < 8; i++) r[i] = r[i] ^ r[i];
+    r[0] += 0x6a09e667, r[1] += 0xbb67ae85, r[2] += 0x3c6ef372, r[3] += 0xa54ff53a;
+    r[4] += 0x510e527f, r[5] += 0x9b05688c, r[6] += 0x1f83d9ab, r[7] += 0x5be0cd19;
+    _BRSHA256CompressLanesBody(r, x);
+}
+
+// double-sha-256 of SIMD_LANES 64 byte blocks in x, with the result in r
+force_inline static void _BRSHA256_2_64LanesBody(v8u32 *r, const v8u32 *x)
+{
+    v8u32 pad[16];
+    
+    for (int i = 0; i < 8; i++) r[i] = x[0] ^ x[0];
+    r[0] += 0x6a09e667, r[1] += 0xbb67ae85, r[2] += 0x3c6ef372, r[3] += 0xa54ff53a;
+    r[4] += 0x510e527f, r[5] += 0x9b05688c, r[6] += 0x1f83d9ab, r[7] += 0x5be0cd19;
+    _BRSHA256CompressLanesBody(r, x);
+    for (int i = 0; i < 16; i++) pad[i] = x[0] ^ x[0];
+    pad[0] += 0x80000000; // padding
+    pad[15] += 64*8; // length in bits
+    _BRSHA256CompressLanesBody(r, pad);
+    _BRSHA256Lanes32Body(r);
+}
+
+static void _BRSHA256CompressLanesDefault(v8u32 *r, const v8u32 *x)
+{
+    _BRSHA256CompressLanesBody(r, x);
+}
+
+static void _BRSHA256Lanes32Default(v8u32 *r)
+{
+    _BRSHA256Lanes32Body(r);
+}
+
+static void _BRSHA256_2_64LanesDefault(v8u32 *r, const v8u32 *x)
+{
+    _BRSHA256_2_64LanesBody(r, x);
+}
+
+#if SHA256_AVX2
+__attribute__((target("avx2,bmi2")))
+static void _BRSHA256CompressLanesAVX2(v8u32 *r, const v8u32 *x)
+{
+    _BRSHA256CompressLanesBody(r, x);
+}
+
+__attribute__((target("avx2,bmi2")))
+static void _BRSHA256Lanes32AVX2(v8u32 *r)
+{
+    _BRSHA256Lanes32Body(r);
+}
+
+__attribute__((target("avx2,bmi2")))
+static void _BRSHA256_2_64LanesAVX2(v8u32 *r, const v8u32 *x)
+{
+    _BRSHA256_2_64LanesBody(r, x);
+}
+#endif
+
+// writes block n of the padded message data to block, returns the total number of blocks in the padded message
+static size_t _BRSHA256PaddedBlock(uint8_t *block, const uint8_t *data, size_t len, size_t n)
+{
+    size_t off = n*64, count = (off < len) ? ((len - off < 64) ? len - off : 64) : 0, blocks = (len + 8)/64 + 1;
+    
+    if (count > 0) memcpy(block, &data[off], count);
+    memset(&block[count], 0, 64 - count);
+    if (off <= len && len < off + 64) block[len - off] = 0x80; // append padding
+    
+    if (n + 1 == blocks) { // append length in bits
+        for (int i = 0; i < 8; i++) block[56 + i] = (uint8_t)(((uint64_t)len*8) >> (56 - 8*i));
+    }
+    
+    return blocks;
+}
+
+// true if hashing in simd lanes is faster than hashing one message at a time with the sha instructions in use
+static int _BRSHA256LanesFaster(void)
+{
+    uint32_t features = BRCryptoFeatures();
+    
+    // 8 avx2 lanes outrun sha-ni, but 8 lanes of portable code don't
+    return ((features & BR_CRYPTO_AVX2) || (features & (BR_CRYPTO_SHANI | BR_CRYPTO_ARMV8)) == 0);
+}
+
+// sha-256 of n <= SIMD_LANES messages, where data[l] is len[l] bytes, with the result in host byte order in lane l of r
+static void _BRSHA256Lanes(v8u32 *r, const void *data[], const size_t len[], size_t n)
+{
+    v8u32 t[8], x[16];
+    uint8_t block[64];
+    uint32_t w;
+    size_t b, j, l, blocks[SIMD_LANES], blockCount = 0;
+    
+    for (l = 0; l < SIMD_LANES; l++) {
+        assert(data[l < n ? l : 0] != NULL || len[l < n ? l : 0] == 0);
+        blocks[l] = (l < n) ? (len[l] + 8)/64 + 1 : 0;
+        if (blocks[l] > blockCount) blockCount = blocks[l];
+    }
+    
+    for (j = 0; j < 8; j++) r[j] = x[0] ^ x[0];
+    r[0] += 0x6a09e667, r[1] += 0xbb67ae85, r[2] += 0x3c6ef372, r[3] += 0xa54ff53a;
+    r[4] += 0x510e527f, r[5] += 0x9b05688c, r[6] += 0x1f83d9ab, r[7] += 0x5be0cd19;
+    
+    for (b = 0; b < blockCount; b++) {
+        for (l = 0; l < SIMD_LANES; l++) {
+            if (b < blocks[l]) _BRSHA256PaddedBlock(block, data[l], len[l], b);
+            else memset(block, 0, sizeof(block)); // lane is already done, result is discarded below
+            
+            for (j = 0; j < 16; j++) {
+                memcpy(&w, &block[j*4], sizeof(w));
+                x[j][l] = be32(w);
+            }
+        }
+        
+        memcpy(t, r, sizeof(t));
+#if SHA256_AVX2
+        if (BRCryptoFeatures() & BR_CRYPTO_AVX2) _BRSHA256CompressLanesAVX2(r, x);
+        else _BRSHA256CompressLanesDefault(r, x);
+#else
+        _BRSHA256CompressLanesDefault(r, x);
+#endif
+        
+        for (l = 0; l < SIMD_LANES; l++) { // keep the previous state for lanes that are already done
+            if (b < blocks[l]) continue;
+            for (j = 0; j < 8; j++) r[j][l] = t[j][l];
+        }
+    }
+}
+
+#endif // defined(__GNUC__)
+
+// double-sha-256 of count independent messages, where data[i] is len[i] bytes, and the result is written to md32[i]
+// this is faster than calling BRSHA256_2() for each message when there isn't hardware sha support, since the messages
+// are hashed together in simd lanes
+void BRSHA256_2Batch(void *md32[], const void *data[], const size_t len[], size_t count)
+{
+    size_t i = 0;
+    
+    assert(md32 != NULL || count == 0);
+    assert(data != NULL || count == 0);
+    assert(len != NULL || count == 0);
+    
+#if defined(__GNUC__)
+    if (_BRSHA256LanesFaster()) {
+        v8u32 r[8];
+        uint32_t w;
+        size_t j, l, n;
+        
+        for (; i + 1 < count; i += SIMD_LANES) { // a single message doesn't benefit from simd lanes
+            n = (count - i < SIMD_LANES) ? count - i : SIMD_LANES;
+            _BRSHA256Lanes(r, &data[i], &len[i], n);
+#if SHA256_AVX2
+            if (BRCryptoFeatures() & BR_CRYPTO_AVX2) _BRSHA256Lanes32AVX2(r);
+            else _BRSHA256Lanes32Default(r);
+#else
+            _BRSHA256Lanes32Default(r);
+#endif
+            
+            for (l = 0; l < n; l++) {
+                for (j = 0; j < 8; j++) {
+                    w = be32(r[j][l]);
+                    memcpy((uint8_t *)md32[i + l] + j*4, &w, sizeof(w));
+                }
+            }
+        }
+    }
+#endif
+    
+    for (; i < count; i++) BRSHA256_2(md32[i], data[i], len[i]);
+}
+
+// double-sha-256 of count contiguous 64 byte blocks in data64, with the 32 byte results written contiguously to md32
+// md32 may be the same as data64, which is convenient for hashing merkle tree nodes a level at a time
+void BRSHA256_2_64Batch(void *md32, const void *data64, size_t count)
+{
+    uint8_t *md = md32;
+    const uint8_t *data = data64;
+    size_t i = 0;
+    
+    assert(md32 != NULL || count == 0);
+    assert(data64 != NULL || count == 0);
+    
+#if defined(__GNUC__)
+    if (_BRSHA256LanesFaster()) {
+        v8u32 r[8], x[16];
+        uint32_t w;
+        size_t j, l, n;
+        
+        for (; i + 1 < count; i += SIMD_LANES) { // a single block doesn't benefit from simd lanes
+            n = (count - i < SIMD_LANES) ? count - i : SIMD_LANES;
+            
+            for (l = 0; l < SIMD_LANES; l++) { // all input is read before any output is written
+                for (j = 0; j < 16; j++) {
+                    memcpy(&w, &data[(i + (l < n ? l : 0))*64 + j*4], sizeof(w));
+                    x[j][l] = be32(w);
+                }
+            }
+            
+#if SHA256_AVX2
+            if (BRCryptoFeatures() & BR_CRYPTO_AVX2) _BRSHA256_2_64LanesAVX2(r, x);
+            else _BRSHA256_2_64LanesDefault(r, x);
+#else
+            _BRSHA256_2_64LanesDefault(r, x);
+#endif
+            
+            for (l = 0; l < n; l++) {
+                for (j = 0; j < 8; j++) {
+                    w = be32(r[j][l]);
+                    memcpy(&md[(i + l)*32 + j*4], &w, sizeof(w));
+                }
+            }
+        }
+    }
+#endif
+    
+    for (; i < count; i++) BRSHA256_2(&md[i*32], &data[i*64], 64);
+}
+
+void BRSHA256Init(BRSHA256Ctx *ctx)
+{
+    static const uint32_t h[] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c,
+                                  0x1f83d9ab, 0x5be0cd19 }; // initial buffer values
+    
+    assert(ctx != NULL);
+    memcpy(ctx->h, h, sizeof(h));
+    ctx->len = 0;
+}
+
+void BRSHA224Init(BRSHA256Ctx *ctx)
+{
+    static const uint32_t h[] = { 0xc1059ed8, 0x367cd507, 0x3070dd17, 0xf70e5939, 0xffc00b31, 0x68581511,
+                                  0x64f98fa7, 0xbefa4fa4 }; // initial buffer values
+    
+    assert(ctx != NULL);
+    memcpy(ctx->h, h, sizeof(h));
+    ctx->len = 0;
+}
+
+void BRSHA256Update(BRSHA256Ctx *ctx, const void *data, size_t len)
+{
+    size_t i = 0, off;
+    
+    assert(ctx != NULL);
+    assert(data != NULL || len == 0);
+    
+    off = ctx->len % 64;
+    ctx->len += len;
+    
+    if (off > 0 && len > 0) { // fill the partial block first
+        i = (len < 64 - off) ? len : 64 - off;
+        memcpy((uint8_t *)ctx->x + off, data, i);
+        if (off + i == 64) _BRSHA256Compress(ctx->h, ctx->x);
+    }
+    
+    for (; i + 64 <= len; i += 64) { // process data in 64 byte blocks
+        memcpy(ctx->x, (const uint8_t *)data + i, 64);
+        _BRSHA256Compress(ctx->h, ctx->x);
+    }
+    
+    if (i < len) memcpy(ctx->x, (const uint8_t *)data + i, len - i); // save the remainder for the next call
+}
+
+static void _BRSHA256Final(BRSHA256Ctx *ctx, void *md, size_t mdLen)
+{
+    size_t i = ctx->len % 64;
+    
+    memset((uint8_t *)ctx->x + i, 0, 64 - i); // clear remainder of x
+    ((uint8_t *)ctx->x)[i] = 0x80; // append padding
+    if (i >= 56) _BRSHA256Compress(ctx->h, ctx->x), memset(ctx->x, 0, 64); // length goes to next block
+    ctx->x[14] = be32((uint32_t)(ctx->len >> 29)), ctx->x[15] = be32((uint32_t)(ctx->len << 3)); // length in bits
+    _BRSHA256Compress(ctx->h, ctx->x); // finalize
+    for (i = 0; i < 8; i++) ctx->h[i] = be32(ctx->h[i]); // endian swap
+    memcpy(md, ctx->h, mdLen); // write to md
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+void BRSHA256Final(BRSHA256Ctx *ctx, void *md32)
+{
+    assert(ctx != NULL);
+    assert(md32 != NULL);
+    _BRSHA256Final(ctx, md32, 32);
+}
+
+void BRSHA224Final(BRSHA256Ctx *ctx, void *md28)
+{
+    assert(ctx != NULL);
+    assert(md28 != NULL);
+    _BRSHA256Final(ctx, md28, 28);
+}
+
+void BRSHA256Midstate(const BRSHA256Ctx *ctx, void *md32)
+{
+    uint32_t h[8];
+    
+    assert(ctx != NULL);
+    assert(md32 != NULL);
+    assert((ctx->len % 64) == 0);
+    for (size_t i = 0; i < 8; i++) h[i] = be32(ctx->h[i]);
+    memcpy(md32, h, sizeof(h));
+    memset(h, 0, sizeof(h));
+}
+
+void BRSHA256InitMidstate(BRSHA256Ctx *ctx, const void *md32, uint64_t len)
+{
+    assert(ctx != NULL);
+    assert(md32 != NULL);
+    assert((len % 64) == 0);
+    memcpy(ctx->h, md32, sizeof(ctx->h));
+    for (size_t i = 0; i < 8; i++) ctx->h[i] = be32(ctx->h[i]);
+    ctx->len = len;
+}
+
 // bitwise right rotation
 #define ror64(a, b) (((a) >> (b)) | ((a) << (64 - (b))))
 
@@ -211,27 +711,27 @@ void BRSHA256_2(void *md32, const void *data, size_t len)
 #define S2(x) (ror64((x), 1) ^ ror64((x), 8) ^ ((x) >> 7))
 #define S3(x) (ror64((x), 19) ^ ror64((x), 61) ^ ((x) >> 6))
 
+static const uint64_t _sha512K[] = {
+    0x428a2f98d728ae22, 0x7137449123ef65cd, 0xb5c0fbcfec4d3b2f, 0xe9b5dba58189dbbc, 0x3956c25bf348b538,
+    0x59f111f1b605d019, 0x923f82a4af194f9b, 0xab1c5ed5da6d8118, 0xd807aa98a3030242, 0x12835b0145706fbe,
+    0x243185be4ee4b28c, 0x550c7dc3d5ffb4e2, 0x72be5d74f27b896f, 0x80deb1fe3b1696b1, 0x9bdc06a725c71235,
+    0xc19bf174cf692694, 0xe49b69c19ef14ad2, 0xefbe4786384f25e3, 0x0fc19dc68b8cd5b5, 0x240ca1cc77ac9c65,
+    0x2de92c6f592b0275, 0x4a7484aa6ea6e483, 0x5cb0a9dcbd41fbd4, 0x76f988da831153b5, 0x983e5152ee66dfab,
+    0xa831c66d2db43210, 0xb00327c898fb213f, 0xbf597fc7beef0ee4, 0xc6e00bf33da88fc2, 0xd5a79147930aa725,
+    0x06ca6351e003826f, 0x142929670a0e6e70, 0x27b70a8546d22ffc, 0x2e1b21385c26c926, 0x4d2c6dfc5ac42aed,
+    0x53380d139d95b3df, 0x650a73548baf63de, 0x766a0abb3c77b2a8, 0x81c2c92e47edaee6, 0x92722c851482353b,
+    0xa2bfe8a14cf10364, 0xa81a664bbc423001, 0xc24b8b70d0f89791, 0xc76c51a30654be30, 0xd192e819d6ef5218,
+    0xd69906245565a910, 0xf40e35855771202a, 0x106aa07032bbd1b8, 0x19a4c116b8d2d0c8, 0x1e376c085141ab53,
+    0x2748774cdf8eeb99, 0x34b0bcb5e19b48a8, 0x391c0cb3c5c95a63, 0x4ed8aa4ae3418acb, 0x5b9cca4f7763e373,
+    0x682e6ff3d6b2b8a3, 0x748f82ee5defb2fc, 0x78a5636f43172f60, 0x84c87814a1f0ab72, 0x8cc702081a6439ec,
+    0x90befffa23631e28, 0xa4506cebde82bde9, 0xbef9a3f7b2c67915, 0xc67178f2e372532b, 0xca273eceea26619c,
+    0xd186b8c721c0c207, 0xeada7dd6cde0eb1e, 0xf57d4f7fee6ed178, 0x06f067aa72176fba, 0x0a637dc5a2c898a6,
+    0x113f9804bef90dae, 0x1b710b35131c471b, 0x28db77f523047d84, 0x32caab7b40c72493, 0x3c9ebe0a15c9bebc,
+    0x431d67c49c100d4c, 0x4cc5d4becb3e42b6, 0x597f299cfc657e2a, 0x5fcb6fab3ad6faec, 0x6c44198c4a475817
+};
+
 static void _BRSHA512Compress(uint64_t *r, uint64_t *x)
 {
-    static const uint64_t k[] = {
-        0x428a2f98d728ae22, 0x7137449123ef65cd, 0xb5c0fbcfec4d3b2f, 0xe9b5dba58189dbbc, 0x3956c25bf348b538,
-        0x59f111f1b605d019, 0x923f82a4af194f9b, 0xab1c5ed5da6d8118, 0xd807aa98a3030242, 0x12835b0145706fbe,
-        0x243185be4ee4b28c, 0x550c7dc3d5ffb4e2, 0x72be5d74f27b896f, 0x80deb1fe3b1696b1, 0x9bdc06a725c71235,
-        0xc19bf174cf692694, 0xe49b69c19ef14ad2, 0xefbe4786384f25e3, 0x0fc19dc68b8cd5b5, 0x240ca1cc77ac9c65,
-        0x2de92c6f592b0275, 0x4a7484aa6ea6e483, 0x5cb0a9dcbd41fbd4, 0x76f988da831153b5, 0x983e5152ee66dfab,
-        0xa831c66d2db43210, 0xb00327c898fb213f, 0xbf597fc7beef0ee4, 0xc6e00bf33da88fc2, 0xd5a79147930aa725,
-        0x06ca6351e003826f, 0x142929670a0e6e70, 0x27b70a8546d22ffc, 0x2e1b21385c26c926, 0x4d2c6dfc5ac42aed,
-        0x53380d139d95b3df, 0x650a73548baf63de, 0x766a0abb3c77b2a8, 0x81c2c92e47edaee6, 0x92722c851482353b,
-        0xa2bfe8a14cf10364, 0xa81a664bbc423001, 0xc24b8b70d0f89791, 0xc76c51a30654be30, 0xd192e819d6ef5218,
-        0xd69906245565a910, 0xf40e35855771202a, 0x106aa07032bbd1b8, 0x19a4c116b8d2d0c8, 0x1e376c085141ab53,
-        0x2748774cdf8eeb99, 0x34b0bcb5e19b48a8, 0x391c0cb3c5c95a63, 0x4ed8aa4ae3418acb, 0x5b9cca4f7763e373,
-        0x682e6ff3d6b2b8a3, 0x748f82ee5defb2fc, 0x78a5636f43172f60, 0x84c87814a1f0ab72, 0x8cc702081a6439ec,
-        0x90befffa23631e28, 0xa4506cebde82bde9, 0xbef9a3f7b2c67915, 0xc67178f2e372532b, 0xca273eceea26619c,
-        0xd186b8c721c0c207, 0xeada7dd6cde0eb1e, 0xf57d4f7fee6ed178, 0x06f067aa72176fba, 0x0a637dc5a2c898a6,
-        0x113f9804bef90dae, 0x1b710b35131c471b, 0x28db77f523047d84, 0x32caab7b40c72493, 0x3c9ebe0a15c9bebc,
-        0x431d67c49c100d4c, 0x4cc5d4becb3e42b6, 0x597f299cfc657e2a, 0x5fcb6fab3ad6faec, 0x6c44198c4a475817
-    };
-    
     int i;
     uint64_t a = r[0], b = r[1], c = r[2], d = r[3], e = r[4], f = r[5], g = r[6], h = r[7], t1, t2, w[80];
     
@@ -239,7 +739,7 @@ static void _BRSHA512Compress(uint64_t *r, uint64_t *x)
     for (; i < 80; i++) w[i] = S3(w[i - 2]) + w[i - 7] + S2(w[i - 15]) + w[i - 16];
     
     for (i = 0; i < 80; i++) {
-        t1 = h + S1(e) + ch(e, f, g) + k[i] + w[i];
+        t1 = h + S1(e) + ch(e, f, g) + _sha512K[i] + w[i];
         t2 = S0(a) + maj(a, b, c);
         h = g, g = f, f = e, e = d + t1, d = c, c = b, b = a, a = t1 + t2;
     }
@@ -301,101 +801,353 @@ void BRSHA512(void *md64, const void *data, size_t len)
     memset(buf, 0, sizeof(buf));
 }
 
-// basic ripemd functions
-#define f(x, y, z) ((x) ^ (y) ^ (z))
-#define g(x, y, z) (((x) & (y)) | (~(x) & (z)))
-#define h(x, y, z) (((x) | ~(y)) ^ (z))
-#define i(x, y, z) (((x) & (z)) | ((y) & ~(z)))
-#define j(x, y, z) ((x) ^ ((y) | ~(z)))
-
-// basic ripemd operation
-#define rmd(a, b, c, d, e, f, g, h, i, j) ((a) = rol32((f) + (b) + le32(c) + (d), (e)) + (g), (f) = (g), (g) = (h),\
-                                           (h) = rol32((i), 10), (i) = (j), (j) = (a))
-
-static void _BRRMDCompress(uint32_t *r, uint32_t *x)
+void BRSHA512Init(BRSHA512Ctx *ctx)
 {
-    // left line
-    static const int rl1[] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 }, // round 1, id
-                     rl2[] = { 7, 4, 13, 1, 10, 6, 15, 3, 12, 0, 9, 5, 2, 14, 11, 8 }, // round 2, rho
-                     rl3[] = { 3, 10, 14, 4, 9, 15, 8, 1, 2, 7, 0, 6, 13, 11, 5, 12 }, // round 3, rho^2
-                     rl4[] = { 1, 9, 11, 10, 0, 8, 12, 4, 13, 3, 7, 15, 14, 5, 6, 2 }, // round 4, rho^3
-                     rl5[] = { 4, 0, 5, 9, 7, 12, 2, 10, 14, 1, 3, 8, 11, 6, 15, 13 }; // round 5, rho^4
-    // right line
-    static const int rr1[] = { 5, 14, 7, 0, 9, 2, 11, 4, 13, 6, 15, 8, 1, 10, 3, 12 }, // round 1, pi
-                     rr2[] = { 6, 11, 3, 7, 0, 13, 5, 10, 14, 15, 8, 12, 4, 9, 1, 2 }, // round 2, rho pi
-                     rr3[] = { 15, 5, 1, 3, 7, 14, 6, 9, 11, 8, 12, 2, 10, 0, 4, 13 }, // round 3, rho^2 pi
-                     rr4[] = { 8, 6, 4, 1, 3, 11, 15, 0, 5, 12, 2, 13, 9, 7, 10, 14 }, // round 4, rho^3 pi
-                     rr5[] = { 12, 15, 10, 4, 1, 5, 8, 7, 6, 2, 13, 14, 0, 3, 9, 11 }; // round 5, rho^4 pi
-    // left line shifts
-    static const int sl1[] = { 11, 14, 15, 12, 5, 8, 7, 9, 11, 13, 14, 15, 6, 7, 9, 8 }, // round 1
-                     sl2[] = { 7, 6, 8, 13, 11, 9, 7, 15, 7, 12, 15, 9, 11, 7, 13, 12 }, // round 2
-                     sl3[] = { 11, 13, 6, 7, 14, 9, 13, 15, 14, 8, 13, 6, 5, 12, 7, 5 }, // round 3
-                     sl4[] = { 11, 12, 14, 15, 14, 15, 9, 8, 9, 14, 5, 6, 8, 6, 5, 12 }, // round 4
-                     sl5[] = { 9, 15, 5, 11, 6, 8, 13, 12, 5, 12, 13, 14, 11, 8, 5, 6 }; // round 5
-    // right line shifts
-    static const int sr1[] = { 8, 9, 9, 11, 13, 15, 15, 5, 7, 7, 8, 11, 14, 14, 12, 6 }, // round 1
-                     sr2[] = { 9, 13, 15, 7, 12, 8, 9, 11, 7, 7, 12, 7, 6, 15, 13, 11 }, // round 2
-                     sr3[] = { 9, 7, 15, 11, 8, 6, 6, 14, 12, 13, 5, 14, 13, 13, 7, 5 }, // round 3
-                     sr4[] = { 15, 5, 8, 11, 14, 14, 6, 14, 6, 9, 12, 9, 12, 5, 15, 8 }, // round 4
-                     sr5[] = { 8, 5, 12, 9, 12, 5, 14, 6, 8, 13, 6, 5, 15, 13, 11, 11 }; // round 5
-
-    int i;
-    uint32_t al = r[0], bl = r[1], cl = r[2], dl = r[3], el = r[4], ar = al, br = bl, cr = cl, dr = dl, er = el, t;
+    static const uint64_t h[] = { 0x6a09e667f3bcc908, 0xbb67ae8584caa73b, 0x3c6ef372fe94f82b, 0xa54ff53a5f1d36f1,
+                                  0x510e527fade682d1, 0x9b05688c2b3e6c1f, 0x1f83d9abfb41bd6b, 0x5be0cd19137e2179 };
     
-    for (i = 0; i < 16; i++) rmd(t, f(bl, cl, dl), x[rl1[i]], 0x00000000, sl1[i], al, el, dl, cl, bl); // round 1 left
-    for (i = 0; i < 16; i++) rmd(t, j(br, cr, dr), x[rr1[i]], 0x50a28be6, sr1[i], ar, er, dr, cr, br); // round 1 right
-    for (i = 0; i < 16; i++) rmd(t, g(bl, cl, dl), x[rl2[i]], 0x5a827999, sl2[i], al, el, dl, cl, bl); // round 2 left
-    for (i = 0; i < 16; i++) rmd(t, i(br, cr, dr), x[rr2[i]], 0x5c4dd124, sr2[i], ar, er, dr, cr, br); // round 2 right
-    for (i = 0; i < 16; i++) rmd(t, h(bl, cl, dl), x[rl3[i]], 0x6ed9eba1, sl3[i], al, el, dl, cl, bl); // round 3 left
-    for (i = 0; i < 16; i++) rmd(t, h(br, cr, dr), x[rr3[i]], 0x6d703ef3, sr3[i], ar, er, dr, cr, br); // round 3 right
-    for (i = 0; i < 16; i++) rmd(t, i(bl, cl, dl), x[rl4[i]], 0x8f1bbcdc, sl4[i], al, el, dl, cl, bl); // round 4 left
-    for (i = 0; i < 16; i++) rmd(t, g(br, cr, dr), x[rr4[i]], 0x7a6d76e9, sr4[i], ar, er, dr, cr, br); // round 4 right
-    for (i = 0; i < 16; i++) rmd(t, j(bl, cl, dl), x[rl5[i]], 0xa953fd4e, sl5[i], al, el, dl, cl, bl); // round 5 left
-    for (i = 0; i < 16; i++) rmd(t, f(br, cr, dr), x[rr5[i]], 0x00000000, sr5[i], ar, er, dr, cr, br); // round 5 right
+    assert(ctx != NULL);
+    memcpy(ctx->h, h, sizeof(h));
+    ctx->len = 0;
+}
+
+void BRSHA384Init(BRSHA512Ctx *ctx)
+{
+    static const uint64_t h[] = { 0xcbbb9d5dc1059ed8, 0x629a292a367cd507, 0x9159015a3070dd17, 0x152fecd8f70e5939,
+                                  0x67332667ffc00b31, 0x8eb44a8768581511, 0xdb0c2e0d64f98fa7, 0x47b5481dbefa4fa4 };
     
-    t = r[1] + cl + dr; // final result for r[0]
-    r[1] = r[2] + dl + er, r[2] = r[3] + el + ar, r[3] = r[4] + al + br, r[4] = r[0] + bl + cr, r[0] = t; // combine
-    al = bl = cl = dl = el = ar = br = cr = dr = er = t = 0;
+    assert(ctx != NULL);
+    memcpy(ctx->h, h, sizeof(h));
+    ctx->len = 0;
 }
 
-// ripemd-160: http://homes.esat.kuleuven.be/~bosselae/ripemd160.html
-void BRRMD160(void *md20, const void *data, size_t len)
+void BRSHA512Update(BRSHA512Ctx *ctx, const void *data, size_t len)
 {
-    size_t i;
-    uint32_t x[16], buf[] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 }; // initial buffer values
+    size_t i = 0, off;
     
-    assert(md20 != NULL);
+    assert(ctx != NULL);
     assert(data != NULL || len == 0);
-
-    for (i = 0; i <= len; i += 64) { // process data in 64 byte blocks
-        memcpy(x, (const uint8_t *)data + i, (i + 64 < len) ? 64 : len - i);
-        if (i + 64 > len) break;
-        _BRRMDCompress(buf, x);
+    
+    off = ctx->len % 128;
+    ctx->len += len;
+    
+    if (off > 0 && len > 0) { // fill the partial block first
+        i = (len < 128 - off) ? len : 128 - off;
+        memcpy((uint8_t *)ctx->x + off, data, i);
+        if (off + i == 128) _BRSHA512Compress(ctx->h, ctx->x);
     }
     
-    memset((uint8_t *)x + (len - i), 0, 64 - (len - i)); // clear remainder of x
-    ((uint8_t *)x)[len - i] = 0x80; // append padding
-    if (len - i >= 56) _BRRMDCompress(buf, x), memset(x, 0, 64); // length goes to next block
-    x[14] = le32((uint32_t)(len << 3)), x[15] = le32((uint32_t)(len >> 29)); // append length in bits
-    _BRRMDCompress(buf, x); // finalize
-    for (i = 0; i < 5; i++) buf[i] = le32(buf[i]); // endian swap
-    memcpy(md20, buf, 20); // write to md
-    memset(x, 0, sizeof(x));
-    memset(buf, 0, sizeof(buf));
+    for (; i + 128 <= len; i += 128) { // process data in 128 byte blocks
+        memcpy(ctx->x, (const uint8_t *)data + i, 128);
+        _BRSHA512Compress(ctx->h, ctx->x);
+    }
+    
+    if (i < len) memcpy(ctx->x, (const uint8_t *)data + i, len - i); // save the remainder for the next call
 }
 
-// bitcoin hash-160 = ripemd-160(sha-256(x))
-void BRHash160(void *md20, const void *data, size_t len)
+static void _BRSHA512Final(BRSHA512Ctx *ctx, void *md, size_t mdLen)
 {
-    uint8_t t[32];
-    
-    assert(md20 != NULL);
-    assert(data != NULL || len == 0);
+    size_t i = ctx->len % 128;
+    
+    memset((uint8_t *)ctx->x + i, 0, 128 - i); // clear remainder of x
+    ((uint8_t *)ctx->x)[i] = 0x80; // append padding
+    if (i >= 112) _BRSHA512Compress(ctx->h, ctx->x), memset(ctx->x, 0, 128); // length goes to next block
+    ctx->x[14] = be64(ctx->len >> 61), ctx->x[15] = be64(ctx->len << 3); // append length in bits
+    _BRSHA512Compress(ctx->h, ctx->x); // finalize
+    for (i = 0; i < 8; i++) ctx->h[i] = be64(ctx->h[i]); // endian swap
+    memcpy(md, ctx->h, mdLen); // write to md
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+void BRSHA512Final(BRSHA512Ctx *ctx, void *md64)
+{
+    assert(ctx != NULL);
+    assert(md64 != NULL);
+    _BRSHA512Final(ctx, md64, 64);
+}
+
+void BRSHA384Final(BRSHA512Ctx *ctx, void *md48)
+{
+    assert(ctx != NULL);
+    assert(md48 != NULL);
+    _BRSHA512Final(ctx, md48, 48);
+}
+
+void BRSHA512Midstate(const BRSHA512Ctx *ctx, void *md64)
+{
+    uint64_t h[8];
+    
+    assert(ctx != NULL);
+    assert(md64 != NULL);
+    assert((ctx->len % 128) == 0);
+    for (size_t i = 0; i < 8; i++) h[i] = be64(ctx->h[i]);
+    memcpy(md64, h, sizeof(h));
+    memset(h, 0, sizeof(h));
+}
+
+void BRSHA512InitMidstate(BRSHA512Ctx *ctx, const void *md64, uint64_t len)
+{
+    assert(ctx != NULL);
+    assert(md64 != NULL);
+    assert((len % 128) == 0);
+    memcpy(ctx->h, md64, sizeof(ctx->h));
+    for (size_t i = 0; i < 8; i++) ctx->h[i] = be64(ctx->h[i]);
+    ctx->len = len;
+}
+
+#if defined(__GNUC__)
+
+// same as _BRSHA512Compress(), but operates on SIMD_LANES/2 independent states at once, where r[i] holds word i of each
+// state, and x[i] holds word i of each message block, already converted to host byte order
+force_inline static void _BRSHA512CompressLanesBody(v4u64 *r, const v4u64 *x)
+{
+    int i;
+    v4u64 a = r[0], b = r[1], c = r[2], d = r[3], e = r[4], f = r[5], g = r[6], h = r[7], t1, t2, w[80];
+    
+    for (i = 0; i < 16; i++) w[i] = x[i];
+    for (; i < 80; i++) w[i] = S3(w[i - 2]) + w[i - 7] + S2(w[i - 15]) + w[i - 16];
+    
+    for (i = 0; i < 80; i++) {
+        t1 = h + S1(e) + ch(e, f, g) + _sha512K[i] + w[i];
+        t2 = S0(a) + maj(a, b, c);
+        h = g, g = f, f = e, e = d + t1, d = c, c = b, b = a, a = t1 + t2;
+    }
+    
+    r[0] += a, r[1] += b, r[2] += c, r[3] += d, r[4] += e, r[5] += f, r[6] += g, r[7] += h;
+}
+
+static void _BRSHA512CompressLanesDefault(v4u64 *r, const v4u64 *x)
+{
+    _BRSHA512CompressLanesBody(r, x);
+}
+
+#if SHA256_AVX2
+__attribute__((target("avx2,bmi2")))
+static void _BRSHA512CompressLanesAVX2(v4u64 *r, const v4u64 *x)
+{
+    _BRSHA512CompressLanesBody(r, x);
+}
+#endif
+
+static void _BRSHA512CompressLanes(v4u64 *r, const v4u64 *x)
+{
+#if SHA256_AVX2
+    if (BRCryptoFeatures() & BR_CRYPTO_AVX2) _BRSHA512CompressLanesAVX2(r, x);
+    else _BRSHA512CompressLanesDefault(r, x);
+#else
+    _BRSHA512CompressLanesDefault(r, x);
+#endif
+}
+
+#endif // defined(__GNUC__)
+
+// basic ripemd functions
+#define f(x, y, z) ((x) ^ (y) ^ (z))
+#define g(x, y, z) (((x) & (y)) | (~(x) & (z)))
+#define h(x, y, z) (((x) | ~(y)) ^ (z))
+#define i(x, y, z) (((x) & (z)) | ((y) & ~(z)))
+#define j(x, y, z) ((x) ^ ((y) | ~(z)))
+
+// basic ripemd operation
+#define rmd(a, b, c, d, e, f, g, h, i, j) ((a) = rol32((f) + (b) + le32(c) + (d), (e)) + (g), (f) = (g), (g) = (h),\
+                                           (h) = rol32((i), 10), (i) = (j), (j) = (a))
+
+// left line
+static const int rl1[] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 }, // round 1, id
+                 rl2[] = { 7, 4, 13, 1, 10, 6, 15, 3, 12, 0, 9, 5, 2, 14, 11, 8 }, // round 2, rho
+                 rl3[] = { 3, 10, 14, 4, 9, 15, 8, 1, 2, 7, 0, 6, 13, 11, 5, 12 }, // round 3, rho^2
+                 rl4[] = { 1, 9, 11, 10, 0, 8, 12, 4, 13, 3, 7, 15, 14, 5, 6, 2 }, // round 4, rho^3
+                 rl5[] = { 4, 0, 5, 9, 7, 12, 2, 10, 14, 1, 3, 8, 11, 6, 15, 13 }; // round 5, rho^4
+// right line
+static const int rr1[] = { 5, 14, 7, 0, 9, 2, 11, 4, 13, 6, 15, 8, 1, 10, 3, 12 }, // round 1, pi
+                 rr2[] = { 6, 11, 3, 7, 0, 13, 5, 10, 14, 15, 8, 12, 4, 9, 1, 2 }, // round 2, rho pi
+                 rr3[] = { 15, 5, 1, 3, 7, 14, 6, 9, 11, 8, 12, 2, 10, 0, 4, 13 }, // round 3, rho^2 pi
+                 rr4[] = { 8, 6, 4, 1, 3, 11, 15, 0, 5, 12, 2, 13, 9, 7, 10, 14 }, // round 4, rho^3 pi
+                 rr5[] = { 12, 15, 10, 4, 1, 5, 8, 7, 6, 2, 13, 14, 0, 3, 9, 11 }; // round 5, rho^4 pi
+// left line shifts
+static const int sl1[] = { 11, 14, 15, 12, 5, 8, 7, 9, 11, 13, 14, 15, 6, 7, 9, 8 }, // round 1
+                 sl2[] = { 7, 6, 8, 13, 11, 9, 7, 15, 7, 12, 15, 9, 11, 7, 13, 12 }, // round 2
+                 sl3[] = { 11, 13, 6, 7, 14, 9, 13, 15, 14, 8, 13, 6, 5, 12, 7, 5 }, // round 3
+                 sl4[] = { 11, 12, 14, 15, 14, 15, 9, 8, 9, 14, 5, 6, 8, 6, 5, 12 }, // round 4
+                 sl5[] = { 9, 15, 5, 11, 6, 8, 13, 12, 5, 12, 13, 14, 11, 8, 5, 6 }; // round 5
+// right line shifts
+static const int sr1[] = { 8, 9, 9, 11, 13, 15, 15, 5, 7, 7, 8, 11, 14, 14, 12, 6 }, // round 1
+                 sr2[] = { 9, 13, 15, 7, 12, 8, 9, 11, 7, 7, 12, 7, 6, 15, 13, 11 }, // round 2
+                 sr3[] = { 9, 7, 15, 11, 8, 6, 6, 14, 12, 13, 5, 14, 13, 13, 7, 5 }, // round 3
+                 sr4[] = { 15, 5, 8, 11, 14, 14, 6, 14, 6, 9, 12, 9, 12, 5, 15, 8 }, // round 4
+                 sr5[] = { 8, 5, 12, 9, 12, 5, 14, 6, 8, 13, 6, 5, 15, 13, 11, 11 }; // round 5
+
+static void _BRRMDCompress(uint32_t *r, uint32_t *x)
+{
+    int i;
+    uint32_t al = r[0], bl = r[1], cl = r[2], dl = r[3], el = r[4], ar = al, br = bl, cr = cl, dr = dl, er = el, t;
+    
+    for (i = 0; i < 16; i++) rmd(t, f(bl, cl, dl), x[rl1[i]], 0x00000000, sl1[i], al, el, dl, cl, bl); // round 1 left
+    for (i = 0; i < 16; i++) rmd(t, j(br, cr, dr), x[rr1[i]], 0x50a28be6, sr1[i], ar, er, dr, cr, br); // round 1 right
+    for (i = 0; i < 16; i++) rmd(t, g(bl, cl, dl), x[rl2[i]], 0x5a827999, sl2[i], al, el, dl, cl, bl); // round 2 left
+    for (i = 0; i < 16; i++) rmd(t, i(br, cr, dr), x[rr2[i]], 0x5c4dd124, sr2[i], ar, er, dr, cr, br); // round 2 right
+    for (i = 0; i < 16; i++) rmd(t, h(bl, cl, dl), x[rl3[i]], 0x6ed9eba1, sl3[i], al, el, dl, cl, bl); // round 3 left
+    for (i = 0; i < 16; i++) rmd(t, h(br, cr, dr), x[rr3[i]], 0x6d703ef3, sr3[i], ar, er, dr, cr, br); // round 3 right
+    for (i = 0; i < 16; i++) rmd(t, i(bl, cl, dl), x[rl4[i]], 0x8f1bbcdc, sl4[i], al, el, dl, cl, bl); // round 4 left
+    for (i = 0; i < 16; i++) rmd(t, g(br, cr, dr), x[rr4[i]], 0x7a6d76e9, sr4[i], ar, er, dr, cr, br); // round 4 right
+    for (i = 0; i < 16; i++) rmd(t, j(bl, cl, dl), x[rl5[i]], 0xa953fd4e, sl5[i], al, el, dl, cl, bl); // round 5 left
+    for (i = 0; i < 16; i++) rmd(t, f(br, cr, dr), x[rr5[i]], 0x00000000, sr5[i], ar, er, dr, cr, br); // round 5 right
+    
+    t = r[1] + cl + dr; // final result for r[0]
+    r[1] = r[2] + dl + er, r[2] = r[3] + el + ar, r[3] = r[4] + al + br, r[4] = r[0] + bl + cr, r[0] = t; // combine
+    al = bl = cl = dl = el = ar = br = cr = dr = er = t = 0;
+}
+
+#if defined(__GNUC__)
+
+// same as rmd(), but with message words that are already in host byte order
+#define rmdl(a, b, c, d, e, f, g, h, i, j) ((a) = rol32((f) + (b) + (c) + (d), (e)) + (g), (f) = (g), (g) = (h),\
+                                            (h) = rol32((i), 10), (i) = (j), (j) = (a))
+
+// same as _BRRMDCompress(), but operates on SIMD_LANES independent states at once, where r[i] holds word i of each
+// state, and x[i] holds word i of each message block, already converted to host byte order
+force_inline static void _BRRMDCompressLanesBody(v8u32 *r, const v8u32 *x)
+{
+    int i;
+    v8u32 al = r[0], bl = r[1], cl = r[2], dl = r[3], el = r[4], ar = al, br = bl, cr = cl, dr = dl, er = el, t;
+    
+    for (i = 0; i < 16; i++) rmdl(t, f(bl, cl, dl), x[rl1[i]], 0x00000000, sl1[i], al, el, dl, cl, bl);
+    for (i = 0; i < 16; i++) rmdl(t, j(br, cr, dr), x[rr1[i]], 0x50a28be6, sr1[i], ar, er, dr, cr, br);
+    for (i = 0; i < 16; i++) rmdl(t, g(bl, cl, dl), x[rl2[i]], 0x5a827999, sl2[i], al, el, dl, cl, bl);
+    for (i = 0; i < 16; i++) rmdl(t, i(br, cr, dr), x[rr2[i]], 0x5c4dd124, sr2[i], ar, er, dr, cr, br);
+    for (i = 0; i < 16; i++) rmdl(t, h(bl, cl, dl), x[rl3[i]], 0x6ed9eba1, sl3[i], al, el, dl, cl, bl);
+    for (i = 0; i < 16; i++) rmdl(t, h(br, cr, dr), x[rr3[i]], 0x6d703ef3, sr3[i], ar, er, dr, cr, br);
+    for (i = 0; i < 16; i++) rmdl(t, i(bl, cl, dl), x[rl4[i]], 0x8f1bbcdc, sl4[i], al, el, dl, cl, bl);
+    for (i = 0; i < 16; i++) rmdl(t, g(br, cr, dr), x[rr4[i]], 0x7a6d76e9, sr4[i], ar, er, dr, cr, br);
+    for (i = 0; i < 16; i++) rmdl(t, j(bl, cl, dl), x[rl5[i]], 0xa953fd4e, sl5[i], al, el, dl, cl, bl);
+    for (i = 0; i < 16; i++) rmdl(t, f(br, cr, dr), x[rr5[i]], 0x00000000, sr5[i], ar, er, dr, cr, br);
+    
+    t = r[1] + cl + dr;
+    r[1] = r[2] + dl + er, r[2] = r[3] + el + ar, r[3] = r[4] + al + br, r[4] = r[0] + bl + cr, r[0] = t;
+}
+
+static void _BRRMDCompressLanesDefault(v8u32 *r, const v8u32 *x)
+{
+    _BRRMDCompressLanesBody(r, x);
+}
+
+#if SHA256_AVX2
+__attribute__((target("avx2,bmi2")))
+static void _BRRMDCompressLanesAVX2(v8u32 *r, const v8u32 *x)
+{
+    _BRRMDCompressLanesBody(r, x);
+}
+#endif
+
+static void _BRRMDCompressLanes(v8u32 *r, const v8u32 *x)
+{
+#if SHA256_AVX2
+    if (BRCryptoFeatures() & BR_CRYPTO_AVX2) _BRRMDCompressLanesAVX2(r, x);
+    else _BRRMDCompressLanesDefault(r, x);
+#else
+    _BRRMDCompressLanesDefault(r, x);
+#endif
+}
+
+#endif // defined(__GNUC__)
+
+// ripemd-160: http://homes.esat.kuleuven.be/~bosselae/ripemd160.html
+void BRRMD160(void *md20, const void *data, size_t len)
+{
+    size_t i;
+    uint32_t x[16], buf[] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 }; // initial buffer values
+    
+    assert(md20 != NULL);
+    assert(data != NULL || len == 0);
+
+    for (i = 0; i <= len; i += 64) { // process data in 64 byte blocks
+        memcpy(x, (const uint8_t *)data + i, (i + 64 < len) ? 64 : len - i);
+        if (i + 64 > len) break;
+        _BRRMDCompress(buf, x);
+    }
+    
+    memset((uint8_t *)x + (len - i), 0, 64 - (len - i)); // clear remainder of x
+    ((uint8_t *)x)[len - i] = 0x80; // append padding
+    if (len - i >= 56) _BRRMDCompress(buf, x), memset(x, 0, 64); // length goes to next block
+    x[14] = le32((uint32_t)(len << 3)), x[15] = le32((uint32_t)(len >> 29)); // append length in bits
+    _BRRMDCompress(buf, x); // finalize
+    for (i = 0; i < 5; i++) buf[i] = le32(buf[i]); // endian swap
+    memcpy(md20, buf, 20); // write to md
+    memset(x, 0, sizeof(x));
+    memset(buf, 0, sizeof(buf));
+}
+
+// bitcoin hash-160 = ripemd-160(sha-256(x))
+void BRHash160(void *md20, const void *data, size_t len)
+{
+    uint8_t t[32];
+    
+    assert(md20 != NULL);
+    assert(data != NULL || len == 0);
     
     BRSHA256(t, data, len);
     BRRMD160(md20, t, sizeof(t));
 }
 
+// hash-160 of count independent messages, where data[i] is len[i] bytes, and the result is written to md20[i]
+// this is much faster than calling BRHash160() for each message, e.g. when generating many addresses from public keys,
+// since the ripemd-160 hashes, and the sha-256 hashes when there isn't hardware sha support, are computed in simd lanes
+void BRHash160Batch(void *md20[], const void *data[], const size_t len[], size_t count)
+{
+    size_t i = 0;
+    
+    assert(md20 != NULL || count == 0);
+    assert(data != NULL || count == 0);
+    assert(len != NULL || count == 0);
+    
+#if defined(__GNUC__)
+    v8u32 r[8], x[16];
+    uint8_t t[32];
+    uint32_t w;
+    size_t j, l, n;
+    
+    for (; i + 1 < count; i += SIMD_LANES) { // a single message doesn't benefit from simd lanes
+        n = (count - i < SIMD_LANES) ? count - i : SIMD_LANES;
+        
+        if (_BRSHA256LanesFaster()) _BRSHA256Lanes(r, &data[i], &len[i], n);
+        else { // hash each message with the sha instructions, and only use simd lanes for ripemd-160
+            memset(r, 0, sizeof(r));
+            
+            for (l = 0; l < n; l++) {
+                BRSHA256(t, data[i + l], len[i + l]);
+                
+                for (j = 0; j < 8; j++) {
+                    memcpy(&w, &t[j*4], sizeof(w));
+                    r[j][l] = be32(w);
+                }
+            }
+        }
+        
+        for (j = 0; j < 8; j++) { // the ripemd-160 message words are the byte swapped sha-256 state words
+            x[j] = (r[j] << 24) | ((r[j] << 8) & 0xff0000) | ((r[j] >> 8) & 0xff00) | (r[j] >> 24);
+            x[j + 8] = x[j] ^ x[j];
+        }
+        
+        x[8] += 0x80; // padding
+        x[14] += 32*8; // length in bits
+        for (j = 0; j < 5; j++) r[j] = r[j] ^ r[j];
+        r[0] += 0x67452301, r[1] += 0xefcdab89, r[2] += 0x98badcfe, r[3] += 0x10325476, r[4] += 0xc3d2e1f0;
+        _BRRMDCompressLanes(r, x);
+        
+        for (l = 0; l < n; l++) {
+            for (j = 0; j < 5; j++) {
+                w = le32(r[j][l]);
+                memcpy((uint8_t *)md20[i + l] + j*4, &w, sizeof(w));
+            }
+        }
+    }
+    
+    memset(t, 0, sizeof(t));
+#endif
+    
+    for (; i < count; i++) BRHash160(md20[i], data[i], len[i]);
+}
+
 // basic md5 functions
 #define F(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
 #define G(x, y, z) ((y) ^ ((z) & ((x) ^ (y))))
@@ -493,36 +1245,389 @@ uint32_t BRMurmur3_32(const void *data, size_t len, uint32_t seed)
     return h;
 }
 
+#if defined(__GNUC__)
+// same as BRMurmur3_32Seeds(), but hashes SIMD_LANES seeds at a time, and count must be a multiple of SIMD_LANES
+// the data blocks don't depend on the seed, so they're only mixed once for all lanes
+force_inline static void _BRMurmur3_32LanesBody(uint32_t *md, const void *data, size_t len, const uint32_t *seeds,
+                                                size_t count)
+{
+    v8u32 h;
+    uint32_t k = 0;
+    size_t i, j, blocks = len/4;
+    
+    for (j = 0; j < count; j += SIMD_LANES) {
+        memcpy(&h, &seeds[j], sizeof(h));
+        
+        for (i = 0; i < blocks; i++) {
+            memcpy(&k, (const uint8_t *)data + i*4, sizeof(k));
+            k = le32(k)*C1;
+            k = rol32(k, 15)*C2;
+            h ^= k;
+            h = rol32(h, 13)*5 + 0xe6546b64;
+        }
+        
+        k = 0;
+        
+        switch (len & 3) {
+            case 3: k ^= ((const uint8_t *)data)[i*4 + 2] << 16; // fall through
+            case 2: k ^= ((const uint8_t *)data)[i*4 + 1] << 8; // fall through
+            case 1: k ^= ((const uint8_t *)data)[i*4], k *= C1, h ^= rol32(k, 15)*C2;
+        }
+        
+        h ^= (uint32_t)len;
+        fmix32(h);
+        memcpy(&md[j], &h, sizeof(h));
+    }
+}
+
+static void _BRMurmur3_32LanesDefault(uint32_t *md, const void *data, size_t len, const uint32_t *seeds, size_t count)
+{
+    _BRMurmur3_32LanesBody(md, data, len, seeds, count);
+}
+
+#if SHA256_AVX2
+__attribute__((target("avx2,bmi2")))
+static void _BRMurmur3_32LanesAVX2(uint32_t *md, const void *data, size_t len, const uint32_t *seeds, size_t count)
+{
+    _BRMurmur3_32LanesBody(md, data, len, seeds, count);
+}
+#endif
+#endif
+
+// murmurHash3 (x86_32) of data with each of count seeds, where the result for seeds[i] is written to md[i]
+void BRMurmur3_32Seeds(uint32_t md[], const void *data, size_t len, const uint32_t seeds[], size_t count)
+{
+    size_t i = 0;
+    
+    assert(md != NULL || count == 0);
+    assert(data != NULL || len == 0);
+    assert(seeds != NULL || count == 0);
+    
+#if defined(__GNUC__)
+    void (*lanes)(uint32_t *, const void *, size_t, const uint32_t *, size_t) = _BRMurmur3_32LanesDefault;
+    uint32_t s[SIMD_LANES], h[SIMD_LANES];
+    
+#if SHA256_AVX2
+    if (BRCryptoFeatures() & BR_CRYPTO_AVX2) lanes = _BRMurmur3_32LanesAVX2;
+#endif
+    i = count - count % SIMD_LANES;
+    lanes(md, data, len, seeds, i);
+    
+    if (i < count) { // remaining seeds in a partial set of lanes
+        memset(s, 0, sizeof(s));
+        memcpy(s, &seeds[i], (count - i)*sizeof(*s));
+        lanes(h, data, len, s, SIMD_LANES);
+        memcpy(&md[i], h, (count - i)*sizeof(*h));
+    }
+#else
+    for (; i < count; i++) md[i] = BRMurmur3_32(data, len, seeds[i]);
+#endif
+}
+
+#if defined(__GNUC__)
+// same as BRMurmur3_32Batch(), but hashes SIMD_LANES elements at a time, and count must be a multiple of SIMD_LANES
+force_inline static void _BRMurmur3_32BatchLanesBody(uint32_t *md, const void **data, size_t len, uint32_t seed,
+                                                     size_t count)
+{
+    v8u32 h, k;
+    uint32_t w;
+    const uint8_t *d;
+    size_t i, j, l, blocks = len/4;
+    
+    for (j = 0; j < count; j += SIMD_LANES) {
+        for (l = 0; l < SIMD_LANES; l++) h[l] = seed;
+        
+        for (i = 0; i < blocks; i++) {
+            for (l = 0; l < SIMD_LANES; l++) memcpy(&w, (const uint8_t *)data[j + l] + i*4, sizeof(w)), k[l] = le32(w);
+            k *= C1;
+            k = rol32(k, 15)*C2;
+            h ^= k;
+            h = rol32(h, 13)*5 + 0xe6546b64;
+        }
+        
+        if (len & 3) {
+            for (l = 0; l < SIMD_LANES; l++) {
+                d = (const uint8_t *)data[j + l] + i*4, w = 0;
+                
+                switch (len & 3) {
+                    case 3: w ^= d[2] << 16; // fall through
+                    case 2: w ^= d[1] << 8; // fall through
+                    case 1: w ^= d[0];
+                }
+                
+                k[l] = w;
+            }
+            
+            k *= C1;
+            h ^= rol32(k, 15)*C2;
+        }
+        
+        h ^= (uint32_t)len;
+        fmix32(h);
+        memcpy(&md[j], &h, sizeof(h));
+    }
+}
+
+static void _BRMurmur3_32BatchLanesDefault(uint32_t *md, const void **data, size_t len, uint32_t seed, size_t count)
+{
+    _BRMurmur3_32BatchLanesBody(md, data, len, seed, count);
+}
+
+#if SHA256_AVX2
+__attribute__((target("avx2,bmi2")))
+static void _BRMurmur3_32BatchLanesAVX2(uint32_t *md, const void **data, size_t len, uint32_t seed, size_t count)
+{
+    _BRMurmur3_32BatchLanesBody(md, data, len, seed, count);
+}
+#endif
+#endif
+
+// murmurHash3 (x86_32) of count elements of len bytes each with the same seed, where the result for data[i] is written
+// to md[i]
+void BRMurmur3_32Batch(uint32_t md[], const void *data[], size_t len, uint32_t seed, size_t count)
+{
+    size_t i = 0;
+    
+    assert(md != NULL || count == 0);
+    assert(data != NULL || count == 0);
+    
+#if defined(__GNUC__)
+    void (*lanes)(uint32_t *, const void **, size_t, uint32_t, size_t) = _BRMurmur3_32BatchLanesDefault;
+    const void *d[SIMD_LANES];
+    uint32_t h[SIMD_LANES];
+    size_t j;
+    
+#if SHA256_AVX2
+    if (BRCryptoFeatures() & BR_CRYPTO_AVX2) lanes = _BRMurmur3_32BatchLanesAVX2;
+#endif
+    i = count - count % SIMD_LANES;
+    lanes(md, data, len, seed, i);
+    
+    if (i < count) { // remaining elements in a partial set of lanes, with the unused lanes hashing data[i] again
+        for (j = 0; j < SIMD_LANES; j++) d[j] = data[(i + j < count) ? i + j : i];
+        lanes(h, d, len, seed, SIMD_LANES);
+        memcpy(&md[i], h, (count - i)*sizeof(*h));
+    }
+#else
+    for (; i < count; i++) md[i] = BRMurmur3_32(data[i], len, seed);
+#endif
+}
+
 // HMAC(key, data) = hash((key xor opad) || hash((key xor ipad) || data))
 // opad = 0x5c5c5c...5c5c
 // ipad = 0x363636...3636
 void BRHMAC(void *mac, void (*hash)(void *, const void *, size_t), size_t hashLen, const void *key, size_t keyLen,
             const void *data, size_t dataLen)
 {
-    size_t i, blockLen = (hashLen > 32) ? 128 : 64;
-    uint8_t k[hashLen];
-    uint64_t kipad[(blockLen + dataLen)/sizeof(uint64_t) + 1], kopad[(blockLen + hashLen)/sizeof(uint64_t) + 1];
-    
     assert(mac != NULL);
     assert(hash != NULL);
     assert(hashLen > 0 && (hashLen % 4) == 0);
     assert(key != NULL || keyLen == 0);
     assert(data != NULL || dataLen == 0);
     
-    if (keyLen > blockLen) hash(k, key, keyLen), key = k, keyLen = sizeof(k);
-    memset(kipad, 0, blockLen);
-    memcpy(kipad, key, keyLen);
-    for (i = 0; i < blockLen/sizeof(uint64_t); i++) kipad[i] ^= 0x3636363636363636;
-    memset(kopad, 0, blockLen);
-    memcpy(kopad, key, keyLen);
-    for (i = 0; i < blockLen/sizeof(uint64_t); i++) kopad[i] ^= 0x5c5c5c5c5c5c5c5c;
-    memcpy(&kipad[blockLen/sizeof(uint64_t)], data, dataLen);
-    hash(&kopad[blockLen/sizeof(uint64_t)], kipad, blockLen + dataLen);
-    hash(mac, kopad, blockLen + hashLen);
+    if (hash == BRSHA224 || hash == BRSHA256 || hash == BRSHA384 || hash == BRSHA512) {
+        BRHMACCtx ctx;
+        
+        BRHMACInit(&ctx, hash, hashLen, key, keyLen);
+        BRHMACUpdate(&ctx, data, dataLen);
+        BRHMACFinal(&ctx, mac);
+    }
+    else { // hash functions with no incremental interface need the key block and data together in one buffer
+        size_t i, blockLen = (hashLen > 32) ? 128 : 64;
+        uint8_t k[64];
+        uint64_t *kipad = malloc(blockLen + dataLen), kopad[(128 + 64)/sizeof(uint64_t)];
+        
+        assert(hashLen <= sizeof(k));
+        assert(kipad != NULL);
+        if (keyLen > blockLen) hash(k, key, keyLen), key = k, keyLen = hashLen;
+        memset(kipad, 0, blockLen);
+        memcpy(kipad, key, keyLen);
+        for (i = 0; i < blockLen/sizeof(uint64_t); i++) kipad[i] ^= 0x3636363636363636;
+        memset(kopad, 0, blockLen);
+        memcpy(kopad, key, keyLen);
+        for (i = 0; i < blockLen/sizeof(uint64_t); i++) kopad[i] ^= 0x5c5c5c5c5c5c5c5c;
+        memcpy(&kipad[blockLen/sizeof(uint64_t)], data, dataLen);
+        hash(&kopad[blockLen/sizeof(uint64_t)], kipad, blockLen + dataLen);
+        hash(mac, kopad, blockLen + hashLen);
+        
+        memset(k, 0, sizeof(k));
+        memset(kipad, 0, blockLen);
+        memset(kopad, 0, sizeof(kopad));
+        free(kipad);
+    }
+}
+
+static void _BRHMACHashInit(void (*hash)(void *, const void *, size_t), void *hashCtx)
+{
+    if (hash == BRSHA224) BRSHA224Init(hashCtx);
+    else if (hash == BRSHA256) BRSHA256Init(hashCtx);
+    else if (hash == BRSHA384) BRSHA384Init(hashCtx);
+    else BRSHA512Init(hashCtx);
+}
+
+static void _BRHMACHashUpdate(void (*hash)(void *, const void *, size_t), void *hashCtx, const void *data, size_t len)
+{
+    if (hash == BRSHA224 || hash == BRSHA256) BRSHA256Update(hashCtx, data, len);
+    else BRSHA512Update(hashCtx, data, len);
+}
+
+static void _BRHMACHashFinal(void (*hash)(void *, const void *, size_t), void *hashCtx, void *md)
+{
+    if (hash == BRSHA224) BRSHA224Final(hashCtx, md);
+    else if (hash == BRSHA256) BRSHA256Final(hashCtx, md);
+    else if (hash == BRSHA384) BRSHA384Final(hashCtx, md);
+    else BRSHA512Final(hashCtx, md);
+}
+
+void BRHMACInit(BRHMACCtx *ctx, void (*hash)(void *, const void *, size_t), size_t hashLen, const void *key,
+                size_t keyLen)
+{
+    size_t i, blockLen = (hashLen > 32) ? 128 : 64;
+    uint64_t k[128/sizeof(uint64_t)];
+    
+    assert(ctx != NULL);
+    assert(hash == BRSHA224 || hash == BRSHA256 || hash == BRSHA384 || hash == BRSHA512);
+    assert(hashLen > 0 && (hashLen % 4) == 0);
+    assert(key != NULL || keyLen == 0);
     
+    ctx->hash = hash;
+    ctx->hashLen = hashLen;
+    memset(k, 0, sizeof(k));
+    if (keyLen > blockLen) hash(k, key, keyLen);
+    else if (keyLen > 0) memcpy(k, key, keyLen);
+    for (i = 0; i < blockLen/sizeof(uint64_t); i++) k[i] ^= 0x3636363636363636;
+    _BRHMACHashInit(hash, &ctx->inner);
+    _BRHMACHashUpdate(hash, &ctx->inner, k, blockLen); // hash(key xor ipad || ...
+    for (i = 0; i < blockLen/sizeof(uint64_t); i++) k[i] ^= 0x3636363636363636 ^ 0x5c5c5c5c5c5c5c5c;
+    _BRHMACHashInit(hash, &ctx->outer);
+    _BRHMACHashUpdate(hash, &ctx->outer, k, blockLen); // hash(key xor opad || ...
     memset(k, 0, sizeof(k));
-    memset(kipad, 0, blockLen);
-    memset(kopad, 0, blockLen);
+}
+
+void BRHMACUpdate(BRHMACCtx *ctx, const void *data, size_t dataLen)
+{
+    assert(ctx != NULL);
+    assert(data != NULL || dataLen == 0);
+    _BRHMACHashUpdate(ctx->hash, &ctx->inner, data, dataLen);
+}
+
+void BRHMACFinal(BRHMACCtx *ctx, void *mac)
+{
+    uint8_t md[64];
+    
+    assert(ctx != NULL);
+    assert(mac != NULL);
+    _BRHMACHashFinal(ctx->hash, &ctx->inner, md);
+    _BRHMACHashUpdate(ctx->hash, &ctx->outer, md, ctx->hashLen);
+    _BRHMACHashFinal(ctx->hash, &ctx->outer, mac);
+    memset(md, 0, sizeof(md));
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+// hmac-sha512 of count messages with the same key, where data[i] is dataLen bytes, and the mac is written to mac64[i]
+// the key is only hashed once, and the messages are hashed together in simd lanes, which is much faster than calling
+// BRHMAC() for each message, e.g. when deriving many bip32 child keys from the same parent
+void BRHMACSHA512Batch(void *mac64[], const void *key, size_t keyLen, const void *data[], size_t dataLen,
+                       size_t count)
+{
+    BRHMACCtx ctx, ctx2;
+    size_t i = 0;
+    
+    assert(mac64 != NULL || count == 0);
+    assert(key != NULL || keyLen == 0);
+    assert(data != NULL || count == 0);
+    
+    BRHMACInit(&ctx, BRSHA512, 512/8, key, keyLen); // midstates after the ipad and opad key blocks
+    
+#if defined(__GNUC__)
+    v4u64 r[8], x[16];
+    uint64_t w, bits = (128 + dataLen)*8; // the message follows a 128 byte key block
+    uint8_t block[128];
+    size_t b, j, l, n, off, blockCount = (dataLen + 16)/128 + 1;
+    
+    for (; i + 1 < count; i += SIMD_LANES/2) { // a single message doesn't benefit from simd lanes
+        n = (count - i < SIMD_LANES/2) ? count - i : SIMD_LANES/2;
+        for (j = 0; j < 8; j++) r[j] = x[0] ^ x[0], r[j] += ctx.inner.sha512.h[j];
+        
+        for (b = 0, off = 0; b < blockCount; b++, off += 128) { // inner hash: hash((key xor ipad) || data)
+            for (l = 0; l < SIMD_LANES/2; l++) {
+                const uint8_t *d = data[i + (l < n ? l : 0)];
+                size_t len = (off < dataLen) ? ((dataLen - off < 128) ? dataLen - off : 128) : 0;
+                
+                if (len > 0) memcpy(block, &d[off], len);
+                memset(&block[len], 0, 128 - len);
+                if (off <= dataLen && dataLen < off + 128) block[dataLen - off] = 0x80; // append padding
+                
+                for (j = 0; j < 16; j++) {
+                    memcpy(&w, &block[j*8], sizeof(w));
+                    x[j][l] = be64(w);
+                }
+                
+                if (b + 1 == blockCount) x[15][l] = bits; // append length in bits
+            }
+            
+            _BRSHA512CompressLanes(r, x);
+        }
+        
+        // outer hash: hash((key xor opad) || inner hash)
+        for (j = 0; j < 8; j++) x[j] = r[j], x[j + 8] = x[j] ^ x[j];
+        x[8] += 0x8000000000000000; // padding
+        x[15] += (128 + 64)*8; // length in bits
+        for (j = 0; j < 8; j++) r[j] = x[8] ^ x[8], r[j] += ctx.outer.sha512.h[j];
+        _BRSHA512CompressLanes(r, x);
+        
+        for (l = 0; l < n; l++) {
+            for (j = 0; j < 8; j++) {
+                w = be64(r[j][l]);
+                memcpy((uint8_t *)mac64[i + l] + j*8, &w, sizeof(w));
+            }
+        }
+    }
+    
+    memset(block, 0, sizeof(block));
+    memset(r, 0, sizeof(r));
+    memset(x, 0, sizeof(x));
+#endif
+    
+    for (; i < count; i++) {
+        ctx2 = ctx;
+        BRHMACUpdate(&ctx2, data[i], dataLen);
+        BRHMACFinal(&ctx2, mac64[i]);
+    }
+    
+    memset(&ctx, 0, sizeof(ctx));
+}
+
+// K = HMAC(K, V || b || seed || nonce || ps)
+static void _BRHMACDRBGUpdateK(void *K, const void *V, uint8_t b, void (*hash)(void *, const void *, size_t),
+                               size_t hashLen, const void *seed, size_t seedLen, const void *nonce, size_t nonceLen,
+                               const void *ps, size_t psLen)
+{
+    if (hash == BRSHA224 || hash == BRSHA256 || hash == BRSHA384 || hash == BRSHA512) {
+        BRHMACCtx ctx;
+        
+        BRHMACInit(&ctx, hash, hashLen, K, hashLen);
+        BRHMACUpdate(&ctx, V, hashLen);
+        BRHMACUpdate(&ctx, &b, 1);
+        BRHMACUpdate(&ctx, seed, seedLen);
+        BRHMACUpdate(&ctx, nonce, nonceLen);
+        BRHMACUpdate(&ctx, ps, psLen);
+        BRHMACFinal(&ctx, K);
+    }
+    else {
+        size_t off = 0, bufLen = hashLen + 1 + seedLen + nonceLen + psLen;
+        uint8_t *buf = malloc(bufLen);
+        
+        assert(buf != NULL);
+        memcpy(&buf[off], V, hashLen), off += hashLen;
+        buf[off++] = b;
+        if (seedLen > 0) memcpy(&buf[off], seed, seedLen), off += seedLen;
+        if (nonceLen > 0) memcpy(&buf[off], nonce, nonceLen), off += nonceLen;
+        if (psLen > 0) memcpy(&buf[off], ps, psLen), off += psLen;
+        BRHMAC(K, hash, hashLen, K, hashLen, buf, bufLen);
+        memset(buf, 0, bufLen);
+        free(buf);
+    }
 }
 
 // hmac-drbg with no prediction resistance or additional input
@@ -531,8 +1636,7 @@ void BRHMAC(void *mac, void (*hash)(void *, const void *, size_t), size_t hashLe
 void BRHMACDRBG(void *out, size_t outLen, void *K, void *V, void (*hash)(void *, const void *, size_t), size_t hashLen,
                 const void *seed, size_t seedLen, const void *nonce, size_t nonceLen, const void *ps, size_t psLen)
 {
-    size_t i, bufLen = hashLen + 1 + seedLen + nonceLen + psLen;
-    uint8_t buf[bufLen];
+    size_t i;
     
     assert(out != NULL || outLen == 0);
     assert(K != NULL);
@@ -547,30 +1651,91 @@ void BRHMACDRBG(void *out, size_t outLen, void *K, void *V, void (*hash)(void *,
         for (i = 0; i < hashLen; i++) ((uint8_t *)K)[i] = 0x00, ((uint8_t *)V)[i] = 0x01;
     }
     
-    memcpy(buf, V, hashLen);
-    buf[hashLen] = 0x00;
-    memcpy(&buf[hashLen + 1], seed, seedLen);
-    memcpy(&buf[hashLen + 1 + seedLen], nonce, nonceLen);
-    memcpy(&buf[hashLen + 1 + seedLen + nonceLen], ps, psLen);
-    BRHMAC(K, hash, hashLen, K, hashLen, buf, bufLen); // K = HMAC(K, V || 0x00 || entropy || nonce || ps)
+    // K = HMAC(K, V || 0x00 || entropy || nonce || ps)
+    _BRHMACDRBGUpdateK(K, V, 0x00, hash, hashLen, seed, seedLen, nonce, nonceLen, ps, psLen);
     BRHMAC(V, hash, hashLen, K, hashLen, V, hashLen);  // V = HMAC(K, V)
     
     if (seed || nonce || ps) {
-        memcpy(buf, V, hashLen);
-        buf[hashLen] = 0x01;
-        BRHMAC(K, hash, hashLen, K, hashLen, buf, bufLen); // K = HMAC(K, V || 0x01 || entropy || nonce || ps)
+        // K = HMAC(K, V || 0x01 || entropy || nonce || ps)
+        _BRHMACDRBGUpdateK(K, V, 0x01, hash, hashLen, seed, seedLen, nonce, nonceLen, ps, psLen);
         BRHMAC(V, hash, hashLen, K, hashLen, V, hashLen);  // V = HMAC(K, V)
     }
     
-    memset(buf, 0, bufLen);
-    
     for (i = 0; i*hashLen < outLen; i++) {
         BRHMAC(V, hash, hashLen, K, hashLen, V, hashLen); // V = HMAC(K, V)
         memcpy((uint8_t *)out + i*hashLen, V, (i*hashLen + hashLen <= outLen) ? hashLen : outLen % hashLen);
     }
 }
 
-static void _BRPoly1305Compress(uint32_t h[5], const void *key32, const void *data, size_t len, int final)
+#if defined(__SIZEOF_INT128__)
+// h is the poly1305 accumulator in three 44bit limbs, h[0] + h[1]*2^44 + h[2]*2^88, so that each block takes 9 64bit
+// multiplies, and if final is true, the 16 byte mac is written to the start of h
+static void _BRPoly1305Compress(uint64_t h[5], const void *key32, const void *data, size_t len, int final)
+{
+    uint64_t x[2], c, t0, t1, g0, g1, g2, r0, r1, r2, s1, s2;
+    unsigned __int128 d0, d1, d2;
+
+    // r &= 0xffffffc0ffffffc0ffffffc0fffffff
+    memcpy(x, key32, 16);
+    t0 = le64(x[0]), t1 = le64(x[1]);
+    r0 = t0 & 0xffc0fffffff, r1 = ((t0 >> 44) | (t1 << 20)) & 0xfffffc0ffff, r2 = (t1 >> 24) & 0x00ffffffc0f;
+    s1 = r1*(5 << 2), s2 = r2*(5 << 2); // 2^132 = 5*2^2 mod 2^130 - 5
+    
+    for (size_t i = 0; i < len; i += 16) { // process data in 16 byte blocks
+        if (i + 16 > len) {
+            memcpy(x, (const uint8_t *)data + i, len - i);
+            memset((uint8_t *)x + (len - i), 0, 16 - (len - i)); // clear remainder of x
+            ((uint8_t *)x)[len - i] = 1; // append padding
+        }
+        else memcpy(x, (const uint8_t *)data + i, 16);
+        
+        // h += x
+        t0 = le64(x[0]), t1 = le64(x[1]);
+        h[0] += t0 & 0xfffffffffff, h[1] += ((t0 >> 44) | (t1 << 20)) & 0xfffffffffff;
+        h[2] += ((t1 >> 24) & 0x3ffffffffff) | ((i + 16 <= len) ? ((uint64_t)1 << 40) : 0);
+        
+        // h *= r
+        d0 = (unsigned __int128)h[0]*r0 + (unsigned __int128)h[1]*s2 + (unsigned __int128)h[2]*s1;
+        d1 = (unsigned __int128)h[0]*r1 + (unsigned __int128)h[1]*r0 + (unsigned __int128)h[2]*s2;
+        d2 = (unsigned __int128)h[0]*r2 + (unsigned __int128)h[1]*r1 + (unsigned __int128)h[2]*r0;
+        
+        // (partial) h %= p
+        c = (uint64_t)(d0 >> 44), h[0] = (uint64_t)d0 & 0xfffffffffff, d1 += c;
+        c = (uint64_t)(d1 >> 44), h[1] = (uint64_t)d1 & 0xfffffffffff, d2 += c;
+        c = (uint64_t)(d2 >> 42), h[2] = (uint64_t)d2 & 0x3ffffffffff;
+        h[0] += c*5, h[1] += h[0] >> 44, h[0] &= 0xfffffffffff;
+    }
+    
+    if (final) {
+        // fully carry h
+        c = h[1] >> 44, h[1] &= 0xfffffffffff, h[2] += c, c = h[2] >> 42, h[2] &= 0x3ffffffffff, h[0] += c*5;
+        c = h[0] >> 44, h[0] &= 0xfffffffffff, h[1] += c, c = h[1] >> 44, h[1] &= 0xfffffffffff, h[2] += c;
+        c = h[2] >> 42, h[2] &= 0x3ffffffffff, h[0] += c*5, c = h[0] >> 44, h[0] &= 0xfffffffffff, h[1] += c;
+        
+        // compute h + -p
+        g0 = h[0] + 5, c = g0 >> 44, g0 &= 0xfffffffffff, g1 = h[1] + c, c = g1 >> 44, g1 &= 0xfffffffffff;
+        g2 = h[2] + c - ((uint64_t)1 << 42);
+        
+        // select h if h < p, or h + -p if h >= p
+        c = (g2 >> 63) - 1, h[0] = (h[0] & ~c) | (g0 & c), h[1] = (h[1] & ~c) | (g1 & c);
+        h[2] = (h[2] & ~c) | (g2 & c);
+        
+        // mac = (h + pad) % (2^128)
+        memcpy(x, (const uint8_t *)key32 + 16, 16);
+        t0 = le64(x[0]), t1 = le64(x[1]);
+        h[0] += t0 & 0xfffffffffff, c = h[0] >> 44, h[0] &= 0xfffffffffff;
+        h[1] += (((t0 >> 44) | (t1 << 20)) & 0xfffffffffff) + c, c = h[1] >> 44, h[1] &= 0xfffffffffff;
+        h[2] += (t1 >> 24) + c;
+        h[0] = le64(h[0] | (h[1] << 44)), h[1] = le64((h[1] >> 20) | (h[2] << 24));
+    }
+    
+    d0 = d1 = d2 = 0;
+    x[0] = x[1] = c = t0 = t1 = g0 = g1 = g2 = r0 = r1 = r2 = s1 = s2 = 0;
+}
+#else
+// h is the poly1305 accumulator in five 26bit limbs, for cpus without 64bit multiplies, and if final is true, the 16
+// byte mac is written to the start of h
+static void _BRPoly1305Compress(uint64_t h[5], const void *key32, const void *data, size_t len, int final)
 {
     uint32_t x[4], b, t0, t1, t2, t3, t4, r0, r1, r2, r3, r4;
     uint64_t d0, d1, d2, d3, d4;
@@ -629,18 +1794,20 @@ static void _BRPoly1305Compress(uint32_t h[5], const void *key32, const void *da
         memcpy(x, (const uint8_t *)key32 + 16, 16);
         d0 = (uint64_t)h[0] + le32(x[0]), d1 = (uint64_t)h[1] + le32(x[1]) + (d0 >> 32);
         d2 = (uint64_t)h[2] + le32(x[2]) + (d1 >> 32), d3 = (uint64_t)h[3] + le32(x[3]) + (d2 >> 32);
-        h[0] = le32((uint32_t)d0), h[1] = le32((uint32_t)d1), h[2] = le32((uint32_t)d2), h[3] = le32((uint32_t)d3);
+        h[0] = le64((d0 & 0xffffffff) | (d1 << 32)), h[1] = le64((d2 & 0xffffffff) | (d3 << 32));
     }
     
     d0 = d1 = d2 = d3 = d4 = 0;
     x[0] = x[1] = x[2] = x[3] = b = t0 = t1 = t2 = t3 = t4 = r0 = r1 = r2 = r3 = r4 = 0;
 }
 
+#endif
+
 // poly1305 authenticator: https://tools.ietf.org/html/rfc7539
 // NOTE: must use constant time mem comparison when verifying mac to defend against timing attacks
 void BRPoly1305(void *mac16, const void *key32, const void *data, size_t len)
 {
-    uint32_t h[5] = { 0, 0, 0, 0, 0 };
+    uint64_t h[5] = { 0, 0, 0, 0, 0 };
     
     assert(mac16 != NULL);
     assert(data != NULL || len == 0);
@@ -655,6 +1822,75 @@ void BRPoly1305(void *mac16, const void *key32, const void *data, size_t len)
 #define qr(a, b, c, d) ((a) += (b), (d) = rol32((d) ^ (a), 16), (c) += (d), (b) = rol32((b) ^ (c), 12),\
                         (a) += (b), (d) = rol32((d) ^ (a), 8), (c) += (d), (b) = rol32((b) ^ (c), 7))
 
+#if defined(__GNUC__)
+// computes SIMD_LANES consecutive chacha20 blocks, starting from state s, where x[i] holds word i of each block
+force_inline static void _BRChacha20LanesBody(v8u32 *x, const uint32_t *s)
+{
+    v8u32 y[16];
+    size_t i;
+    
+    for (i = 0; i < 16; i++) x[i] = (x[0] ^ x[0]) + s[i];
+    x[12] += (v8u32) { 0, 1, 2, 3, 4, 5, 6, 7 };
+    x[13] -= (v8u32)(x[12] < s[12]); // carry block counter
+    memcpy(y, x, sizeof(y));
+    
+    for (i = 0; i < 10; i++) {
+        qr(y[0], y[4], y[8], y[12]), qr(y[1], y[5], y[9], y[13]), qr(y[2], y[6], y[10], y[14]);
+        qr(y[3], y[7], y[11], y[15]), qr(y[0], y[5], y[10], y[15]), qr(y[1], y[6], y[11], y[12]);
+        qr(y[2], y[7], y[8], y[13]), qr(y[3], y[4], y[9], y[14]);
+    }
+    
+    for (i = 0; i < 16; i++) x[i] += y[i];
+    memset(y, 0, sizeof(y));
+}
+
+static void _BRChacha20LanesDefault(v8u32 *x, const uint32_t *s)
+{
+    _BRChacha20LanesBody(x, s);
+}
+
+#if CHACHA20_AVX2
+__attribute__((target("avx2,bmi2")))
+static void _BRChacha20LanesAVX2(v8u32 *x, const uint32_t *s)
+{
+    _BRChacha20LanesBody(x, s);
+}
+#endif
+
+// xors len <= 64*SIMD_LANES bytes of data with the keystream for SIMD_LANES blocks starting from state s
+static void _BRChacha20Lanes(uint8_t *out, const uint8_t *data, size_t len, const uint32_t *s)
+{
+    v8u32 x[16];
+    uint32_t b[16*SIMD_LANES];
+    uint64_t w, k;
+    size_t i, l;
+    
+    assert(len <= sizeof(b));
+#if CHACHA20_AVX2
+    if (BRCryptoFeatures() & BR_CRYPTO_AVX2) _BRChacha20LanesAVX2(x, s);
+    else _BRChacha20LanesDefault(x, s);
+#else
+    _BRChacha20LanesDefault(x, s);
+#endif
+    
+    for (l = 0; l < SIMD_LANES; l++) {
+        for (i = 0; i < 16; i++) b[l*16 + i] = le32(x[i][l]);
+    }
+    
+    for (i = 0; i + 8 <= len; i += 8) {
+        memcpy(&w, &data[i], sizeof(w));
+        memcpy(&k, (uint8_t *)b + i, sizeof(k));
+        w ^= k;
+        memcpy(&out[i], &w, sizeof(w));
+    }
+    
+    for (; i < len; i++) out[i] = data[i] ^ ((uint8_t *)b)[i];
+    w = k = 0;
+    memset(x, 0, sizeof(x));
+    memset(b, 0, sizeof(b));
+}
+#endif
+
 // chacha20 stream cypher: https://cr.yp.to/chacha.html
 void BRChacha20(void *out, const void *key32, const void *iv8, const void *data, size_t len, uint64_t counter)
 {
@@ -673,8 +1909,19 @@ void BRChacha20(void *out, const void *key32, const void *iv8, const void *data,
     s[13] = le32(counter >> 32);
     memcpy(&s[14], iv8, 8);
     for (i = 0; i < 16; i++) s[i] = le32(s[i]);
+    i = 0;
+    
+#if defined(__GNUC__)
+    // process data SIMD_LANES blocks at a time, leaving the scalar code for a single remaining block
+    for (; len - i > 64; i += j) {
+        j = (len - i < 64*SIMD_LANES) ? len - i : 64*SIMD_LANES;
+        _BRChacha20Lanes((uint8_t *)out + i, (const uint8_t *)data + i, j, s);
+        s[12] += SIMD_LANES;
+        if (s[12] < SIMD_LANES) s[13]++;
+    }
+#endif
 
-    for (i = 0; i < len; i++) {
+    for (; i < len; i++) {
         if (i % 64 == 0) {
             x0 = s[0], x1 = s[1], x2 = s[2], x3 = s[3], x4 = s[4], x5 = s[5], x6 = s[6], x7 = s[7];
             x8 = s[8], x9 = s[9], x10 = s[10], x11 = s[11], x12 = s[12], x13 = s[13], x14 = s[14], x15 = s[15];
@@ -706,8 +1953,7 @@ size_t BRChacha20Poly1305AEADEncrypt(void *out, size_t outLen, const void *key32
                                      const void *data, size_t dataLen, const void *ad, size_t adLen)
 {
     const void *iv = (const uint8_t *)nonce12 + 4;
-    uint64_t counter = 0, macKey[4] = { 0, 0, 0, 0 }, pad[2] = { 0, 0 };
-    uint32_t h[5] = { 0, 0, 0, 0, 0 };
+    uint64_t counter = 0, macKey[4] = { 0, 0, 0, 0 }, pad[2] = { 0, 0 }, h[5] = { 0, 0, 0, 0, 0 };
 
     if (! out) return dataLen + 16;
     if (outLen < dataLen + 16 || dataLen/64 >= UINT32_MAX) return 0;
@@ -740,8 +1986,7 @@ size_t BRChacha20Poly1305AEADDecrypt(void *out, size_t outLen, const void *key32
                                      const void *data, size_t dataLen, const void *ad, size_t adLen)
 {
     const void *iv = (const uint8_t *)nonce12 + 4;
-    uint64_t counter = 0, macKey[4] = { 0, 0, 0, 0 }, pad[2] = { 0, 0 };
-    uint32_t h[5] = { 0, 0, 0, 0, 0 }, mac[4];
+    uint64_t counter = 0, macKey[4] = { 0, 0, 0, 0 }, pad[2] = { 0, 0 }, h[5] = { 0, 0, 0, 0, 0 }, mac[2];
     
     if (! out) return (dataLen < 16) ? 0 : dataLen - 16;
     if (dataLen < 16 || (dataLen - 16)/64 >= UINT32_MAX || outLen + 16 < dataLen) return 0;
@@ -765,13 +2010,310 @@ size_t BRChacha20Poly1305AEADDecrypt(void *out, size_t outLen, const void *key32
     pad[1] = le64(outLen);
     _BRPoly1305Compress(h, macKey, pad, 16, 1);
     memcpy(mac, (const uint8_t *)data + outLen, 16);
-    if ((mac[0] ^ h[0]) | (mac[1] ^ h[1]) | (mac[2] ^ h[2]) | (mac[3] ^ h[3]) != 0) outLen = 0; // constant time compare
+    if (((mac[0] ^ h[0]) | (mac[1] ^ h[1])) != 0) outLen = 0; // constant time compare
     BRChacha20(out, key32, iv, data, outLen, le64(counter) + 1);
     counter = macKey[0] = macKey[1] = macKey[2] = macKey[3] = pad[0] = pad[1] = 0;
-    mac[0] = mac[1] = mac[2] = mac[3] = h[0] = h[1] = h[2] = h[3] = h[4] = 0;
+    mac[0] = mac[1] = h[0] = h[1] = h[2] = h[3] = h[4] = 0;
     return outLen;
 }
 
+// aes s-box as a boolean circuit over bit planes, where bit j of q[i] is bit i of byte j, so up to 16 bytes are
+// substituted at once without any table lookups that could leak key or data bits through cache timing
+// circuit from Boyar and Peralta: https://eprint.iacr.org/2011/332
+static void _BRAESSBoxPlanes(uint16_t q[8])
+{
+    uint16_t x0 = q[7], x1 = q[6], x2 = q[5], x3 = q[4], x4 = q[3], x5 = q[2], x6 = q[1], x7 = q[0],
+             y1, y2, y3, y4, y5, y6, y7, y8, y9, y10, y11, y12, y13, y14, y15, y16, y17, y18, y19, y20, y21,
+             z0, z1, z2, z3, z4, z5, z6, z7, z8, z9, z10, z11, z12, z13, z14, z15, z16, z17, t[68];
+    
+    // top linear transform
+    y14 = x3 ^ x5, y13 = x0 ^ x6, y9 = x0 ^ x3, y8 = x0 ^ x5, t[0] = x1 ^ x2, y1 = t[0] ^ x7, y4 = y1 ^ x3;
+    y12 = y13 ^ y14, y2 = y1 ^ x0, y5 = y1 ^ x6, y3 = y5 ^ y8, t[1] = x4 ^ y12, y15 = t[1] ^ x5, y20 = t[1] ^ x1;
+    y6 = y15 ^ x7, y10 = y15 ^ t[0], y11 = y20 ^ y9, y7 = x7 ^ y11, y17 = y10 ^ y11, y19 = y10 ^ y8;
+    y16 = t[0] ^ y11, y21 = y13 ^ y16, y18 = x0 ^ y16;
+    
+    // nonlinear section, inversion in GF(2^8)
+    t[2] = y12 & y15, t[3] = y3 & y6, t[4] = t[3] ^ t[2], t[5] = y4 & x7, t[6] = t[5] ^ t[2], t[7] = y13 & y16;
+    t[8] = y5 & y1, t[9] = t[8] ^ t[7], t[10] = y2 & y7, t[11] = t[10] ^ t[7], t[12] = y9 & y11, t[13] = y14 & y17;
+    t[14] = t[13] ^ t[12], t[15] = y8 & y10, t[16] = t[15] ^ t[12], t[17] = t[4] ^ t[14], t[18] = t[6] ^ t[16];
+    t[19] = t[9] ^ t[14], t[20] = t[11] ^ t[16], t[21] = t[17] ^ y20, t[22] = t[18] ^ y19, t[23] = t[19] ^ y21;
+    t[24] = t[20] ^ y18, t[25] = t[21] ^ t[22], t[26] = t[21] & t[23], t[27] = t[24] ^ t[26], t[28] = t[25] & t[27];
+    t[29] = t[28] ^ t[22], t[30] = t[23] ^ t[24], t[31] = t[22] ^ t[26], t[32] = t[31] & t[30], t[33] = t[32] ^ t[24];
+    t[34] = t[23] ^ t[33], t[35] = t[27] ^ t[33], t[36] = t[24] & t[35], t[37] = t[36] ^ t[34], t[38] = t[27] ^ t[36];
+    t[39] = t[29] & t[38], t[40] = t[25] ^ t[39], t[41] = t[40] ^ t[37], t[42] = t[29] ^ t[33], t[43] = t[29] ^ t[40];
+    t[44] = t[33] ^ t[37], t[45] = t[42] ^ t[41];
+    z0 = t[44] & y15, z1 = t[37] & y6, z2 = t[33] & x7, z3 = t[43] & y16, z4 = t[40] & y1, z5 = t[29] & y7;
+    z6 = t[42] & y11, z7 = t[45] & y17, z8 = t[41] & y10, z9 = t[44] & y12, z10 = t[37] & y3, z11 = t[33] & y4;
+    z12 = t[43] & y13, z13 = t[40] & y5, z14 = t[29] & y2, z15 = t[42] & y9, z16 = t[45] & y14, z17 = t[41] & y8;
+    
+    // bottom linear transform
+    t[46] = z15 ^ z16, t[47] = z10 ^ z11, t[48] = z5 ^ z13, t[49] = z9 ^ z10, t[50] = z2 ^ z12, t[51] = z2 ^ z5;
+    t[52] = z7 ^ z8, t[53] = z0 ^ z3, t[54] = z6 ^ z7, t[55] = z16 ^ z17, t[56] = z12 ^ t[48], t[57] = t[50] ^ t[53];
+    t[58] = z4 ^ t[46], t[59] = z3 ^ t[54], t[60] = t[46] ^ t[57], t[61] = z14 ^ t[57], t[62] = t[52] ^ t[58];
+    t[63] = t[49] ^ t[58], t[64] = z4 ^ t[59], t[65] = t[61] ^ t[62], t[66] = z1 ^ t[63], t[67] = t[64] ^ t[65];
+    q[7] = t[59] ^ t[63], q[1] = ~(t[56] ^ t[62]), q[0] = ~(t[48] ^ t[60]), q[4] = t[53] ^ t[66];
+    q[3] = t[51] ^ t[66], q[2] = t[47] ^ t[65], q[6] = ~(t[64] ^ q[4]), q[5] = ~(t[55] ^ t[67]);
+    memset(t, 0, sizeof(t));
+}
+
+// transposes the 8x8 bit matrix x, where row i is byte i, and column j is bit j of each byte
+static uint64_t _BRAESTranspose8(uint64_t x)
+{
+    uint64_t t;
+    
+    t = (x ^ (x >> 7)) & 0x00aa00aa00aa00aa, x ^= t ^ (t << 7);
+    t = (x ^ (x >> 14)) & 0x0000cccc0000cccc, x ^= t ^ (t << 14);
+    t = (x ^ (x >> 28)) & 0x00000000f0f0f0f0, x ^= t ^ (t << 28);
+    return x;
+}
+
+// substitutes len <= 16 bytes of x using the aes s-box, or the inverse s-box if inverse is true
+static void _BRAESSubBytes(uint8_t *x, size_t len, int inverse)
+{
+    uint64_t lo = 0, hi = 0;
+    uint16_t q[8], t[8];
+    size_t i, j;
+    
+    for (j = 0; j < len; j++) { // transpose bytes into bit planes
+        if (j < 8) lo |= (uint64_t)x[j] << j*8;
+        else hi |= (uint64_t)x[j] << (j - 8)*8;
+    }
+    
+    lo = _BRAESTranspose8(lo), hi = _BRAESTranspose8(hi);
+    for (i = 0; i < 8; i++) q[i] = (uint16_t)(((lo >> i*8) & 0xff) | ((hi >> i*8) & 0xff) << 8);
+    
+    // the inverse s-box is the s-box with the inverse of its affine transform applied before and after
+    for (j = 0; inverse && j < 2; j++) {
+        if (j == 1) _BRAESSBoxPlanes(q);
+        for (i = 0; i < 8; i++) t[i] = q[(i + 7) % 8] ^ q[(i + 5) % 8] ^ q[(i + 2) % 8];
+        for (i = 0; i < 8; i++) q[i] = (i == 0 || i == 2) ? ~t[i] : t[i]; // constant 0x05
+    }
+    
+    if (! inverse) _BRAESSBoxPlanes(q);
+    
+    for (i = 0, lo = hi = 0; i < 8; i++) lo |= (uint64_t)(q[i] & 0xff) << i*8, hi |= (uint64_t)(q[i] >> 8) << i*8;
+    lo = _BRAESTranspose8(lo), hi = _BRAESTranspose8(hi);
+    for (j = 0; j < len; j++) x[j] = (uint8_t)((j < 8) ? lo >> j*8 : hi >> (j - 8)*8); // transpose back into bytes
+    lo = hi = 0;
+    memset(q, 0, sizeof(q));
+    memset(t, 0, sizeof(t));
+}
+
+#define xt(x) ((uint8_t)(((x) << 1) ^ ((((x) >> 7) & 1)*0x1b))) // multiply by x in GF(2^8)
+
+// aes mix columns on the 16 byte state x, or the inverse if inverse is true
+static void _BRAESMixColumns(uint8_t *x, int inverse)
+{
+    uint8_t a, b, c, d, e, f, g, h;
+    
+    for (size_t j = 0; j < 16; j += 4) {
+        a = x[j], b = x[j+1], c = x[j+2], d = x[j+3], e = a ^ b ^ c ^ d;
+        h = xt(e), f = (inverse) ? e ^ xt(xt(h ^ a ^ c)) : e, g = (inverse) ? e ^ xt(xt(h ^ b ^ d)) : e;
+        x[j] ^= f ^ xt(a ^ b), x[j+1] ^= g ^ xt(b ^ c), x[j+2] ^= f ^ xt(c ^ d), x[j+3] ^= g ^ xt(d ^ a);
+    }
+}
+
+static void _BRAES256ECBEncryptDefault(const uint8_t *k, uint8_t *buf, size_t len)
+{
+    uint8_t *x, a;
+    
+    for (size_t off = 0; off < len; off += 16) {
+        x = &buf[off];
+        
+        for (size_t i = 0; i < 15; i++) {
+            if (i > 0) {
+                _BRAESSubBytes(x, 16, 0);
+                
+                // shift rows
+                a = x[1], x[1] = x[5], x[5] = x[9], x[9] = x[13], x[13] = a, a = x[10], x[10] = x[2], x[2] = a;
+                a = x[3], x[3] = x[15], x[15] = x[11], x[11] = x[7], x[7] = a, a = x[14], x[14] = x[6], x[6] = a;
+                
+                if (i < 14) _BRAESMixColumns(x, 0);
+            }
+            
+            for (size_t j = 0; j < 16; j++) x[j] ^= k[i*16 + j]; // add round key
+        }
+    }
+}
+
+// k holds the round keys for the equivalent inverse cypher, in decryption order
+static void _BRAES256ECBDecryptDefault(const uint8_t *k, uint8_t *buf, size_t len)
+{
+    uint8_t *x, a;
+    
+    for (size_t off = 0; off < len; off += 16) {
+        x = &buf[off];
+        
+        for (size_t i = 0; i < 15; i++) {
+            if (i > 0) {
+                _BRAESSubBytes(x, 16, 1);
+                
+                // unshift rows
+                a = x[1], x[1] = x[13], x[13] = x[9], x[9] = x[5], x[5] = a, a = x[2], x[2] = x[10], x[10] = a;
+                a = x[3], x[3] = x[7], x[7] = x[11], x[11] = x[15], x[15] = a, a = x[6], x[6] = x[14], x[14] = a;
+                
+                if (i < 14) _BRAESMixColumns(x, 1);
+            }
+            
+            for (size_t j = 0; j < 16; j++) x[j] ^= k[i*16 + j]; // add round key
+        }
+    }
+}
+
+#if AES256_AESNI
+// x86 aes-ni instructions
+__attribute__((target("aes,sse2")))
+static void _BRAES256ECBEncryptAESNI(const uint8_t *k, uint8_t *buf, size_t len)
+{
+    __m128i rk[15], x;
+    
+    for (int i = 0; i < 15; i++) rk[i] = _mm_loadu_si128((const __m128i *)&k[i*16]);
+    
+    for (size_t off = 0; off < len; off += 16) {
+        x = _mm_xor_si128(_mm_loadu_si128((const __m128i *)&buf[off]), rk[0]);
+        for (int i = 1; i < 14; i++) x = _mm_aesenc_si128(x, rk[i]);
+        _mm_storeu_si128((__m128i *)&buf[off], _mm_aesenclast_si128(x, rk[14]));
+    }
+    
+    memset(rk, 0, sizeof(rk));
+}
+
+__attribute__((target("aes,sse2")))
+static void _BRAES256ECBDecryptAESNI(const uint8_t *k, uint8_t *buf, size_t len)
+{
+    __m128i rk[15], x;
+    
+    for (int i = 0; i < 15; i++) rk[i] = _mm_loadu_si128((const __m128i *)&k[i*16]);
+    
+    for (size_t off = 0; off < len; off += 16) {
+        x = _mm_xor_si128(_mm_loadu_si128((const __m128i *)&buf[off]), rk[0]);
+        for (int i = 1; i < 14; i++) x = _mm_aesdec_si128(x, rk[i]);
+        _mm_storeu_si128((__m128i *)&buf[off], _mm_aesdeclast_si128(x, rk[14]));
+    }
+    
+    memset(rk, 0, sizeof(rk));
+}
+#endif
+
+// expands key32 into the aes-256 round keys for encryption and decryption
+void BRAES256Init(BRAES256Ctx *ctx, const void *key32)
+{
+    uint8_t *k = ctx->ek, t[4], a, r = 1;
+    
+    assert(ctx != NULL);
+    assert(key32 != NULL);
+    memcpy(k, key32, 32);
+    
+    for (size_t i = 32; i < sizeof(ctx->ek); i += 4) {
+        memcpy(t, &k[i - 4], sizeof(t));
+        
+        if (i % 32 == 0) { // rotate, substitute, and add round constant
+            a = t[0], t[0] = t[1], t[1] = t[2], t[2] = t[3], t[3] = a;
+            _BRAESSubBytes(t, sizeof(t), 0);
+            t[0] ^= r, r = xt(r);
+        }
+        else if (i % 32 == 16) _BRAESSubBytes(t, sizeof(t), 0);
+        
+        for (size_t j = 0; j < 4; j++) k[i + j] = k[i - 32 + j] ^ t[j];
+    }
+    
+    // equivalent inverse cypher round keys are in reverse order, with inverse mix columns applied to all but the first
+    // and last round keys
+    for (size_t i = 0; i < 15; i++) {
+        memcpy(&ctx->dk[i*16], &k[(14 - i)*16], 16);
+        if (i > 0 && i < 14) _BRAESMixColumns(&ctx->dk[i*16], 1);
+    }
+    
+    memset(t, 0, sizeof(t));
+}
+
+// encrypts len bytes of buf in place with aes-256 in ecb mode, len must be a multiple of 16
+void BRAES256ECBEncrypt(const BRAES256Ctx *ctx, void *buf, size_t len)
+{
+    assert(ctx != NULL);
+    assert(buf != NULL || len == 0);
+    assert((len % 16) == 0);
+    
+#if AES256_AESNI
+    if (BRCryptoFeatures() & BR_CRYPTO_AESNI) _BRAES256ECBEncryptAESNI(ctx->ek, buf, len);
+    else _BRAES256ECBEncryptDefault(ctx->ek, buf, len);
+#else
+    _BRAES256ECBEncryptDefault(ctx->ek, buf, len);
+#endif
+}
+
+// decrypts len bytes of buf in place with aes-256 in ecb mode, len must be a multiple of 16
+void BRAES256ECBDecrypt(const BRAES256Ctx *ctx, void *buf, size_t len)
+{
+    assert(ctx != NULL);
+    assert(buf != NULL || len == 0);
+    assert((len % 16) == 0);
+    
+#if AES256_AESNI
+    if (BRCryptoFeatures() & BR_CRYPTO_AESNI) _BRAES256ECBDecryptAESNI(ctx->dk, buf, len);
+    else _BRAES256ECBDecryptDefault(ctx->dk, buf, len);
+#else
+    _BRAES256ECBDecryptDefault(ctx->dk, buf, len);
+#endif
+}
+
+// pbkdf2 rounds 2 through rounds for hmac-sha-256 or hmac-sha-224, starting from U1 and T1, using the inner and outer
+// hmac midstates ih and oh, so each round takes two compressions instead of four
+static void _BRPBKDF2SHA256Rounds(void *T, const void *U1, const uint32_t ih[8], const uint32_t oh[8], size_t hashLen,
+                                  unsigned rounds)
+{
+    uint32_t x[16], h[8], t[8];
+    size_t i, n = hashLen/sizeof(uint32_t);
+    
+    memset(x, 0, sizeof(x));
+    memcpy(x, U1, hashLen);
+    memcpy(t, T, hashLen);
+    x[n] = be32(0x80000000); // padding
+    x[15] = be32((uint32_t)(64 + hashLen)*8); // length in bits of the key block plus U, for both inner and outer hash
+    
+    for (unsigned r = 1; r < rounds; r++) {
+        memcpy(h, ih, sizeof(h));
+        _BRSHA256Compress(h, x); // inner hash
+        for (i = 0; i < n; i++) x[i] = be32(h[i]);
+        memcpy(h, oh, sizeof(h));
+        _BRSHA256Compress(h, x); // outer hash
+        for (i = 0; i < n; i++) x[i] = be32(h[i]), t[i] ^= x[i]; // Urounds = hmac_hash(pw, Urounds-1), Ti ^= Urounds
+    }
+    
+    memcpy(T, t, hashLen);
+    memset(x, 0, sizeof(x));
+    memset(h, 0, sizeof(h));
+    memset(t, 0, sizeof(t));
+}
+
+// same as _BRPBKDF2SHA256Rounds() for hmac-sha-512 or hmac-sha-384
+static void _BRPBKDF2SHA512Rounds(void *T, const void *U1, const uint64_t ih[8], const uint64_t oh[8], size_t hashLen,
+                                  unsigned rounds)
+{
+    uint64_t x[16], h[8], t[8];
+    size_t i, n = hashLen/sizeof(uint64_t);
+    
+    memset(x, 0, sizeof(x));
+    memcpy(x, U1, hashLen);
+    memcpy(t, T, hashLen);
+    x[n] = be64(0x8000000000000000); // padding
+    x[15] = be64((uint64_t)(128 + hashLen)*8); // length in bits of the key block plus U, for both inner and outer hash
+    
+    for (unsigned r = 1; r < rounds; r++) {
+        memcpy(h, ih, sizeof(h));
+        _BRSHA512Compress(h, x); // inner hash
+        for (i = 0; i < n; i++) x[i] = be64(h[i]);
+        memcpy(h, oh, sizeof(h));
+        _BRSHA512Compress(h, x); // outer hash
+        for (i = 0; i < n; i++) x[i] = be64(h[i]), t[i] ^= x[i]; // Urounds = hmac_hash(pw, Urounds-1), Ti ^= Urounds
+    }
+    
+    memcpy(T, t, hashLen);
+    memset(x, 0, sizeof(x));
+    memset(h, 0, sizeof(h));
+    memset(t, 0, sizeof(t));
+}
+
 // dk = T1 || T2 || ... || Tdklen/hlen
 // Ti = U1 xor U2 xor ... xor Urounds
 // U1 = hmac_hash(pw, salt || be32(i))
@@ -781,34 +2323,58 @@ size_t BRChacha20Poly1305AEADDecrypt(void *out, size_t outLen, const void *key32
 void BRPBKDF2(void *dk, size_t dkLen, void (*hash)(void *, const void *, size_t), size_t hashLen,
               const void *pw, size_t pwLen, const void *salt, size_t saltLen, unsigned rounds)
 {
-    uint8_t s[saltLen + sizeof(uint32_t)];
-    uint32_t i, j, U[hashLen/sizeof(uint32_t)], T[hashLen/sizeof(uint32_t)];
+    int sha256 = (hash == BRSHA224 || hash == BRSHA256), sha512 = (hash == BRSHA384 || hash == BRSHA512);
+    BRHMACCtx ctx, ctx2;
+    uint8_t *s = NULL;
+    uint32_t i, j, U[64/sizeof(uint32_t)], T[64/sizeof(uint32_t)];
     
     assert(dk != NULL || dkLen == 0);
     assert(hash != NULL);
-    assert(hashLen > 0 && (hashLen % 4) == 0);
+    assert(hashLen > 0 && (hashLen % 4) == 0 && hashLen <= sizeof(U));
     assert(pw != NULL || pwLen == 0);
     assert(salt != NULL || saltLen == 0);
     assert(rounds > 0);
     
-    memcpy(s, salt, saltLen);
+    if (sha256 || sha512) { // the key blocks are only hashed once, and their midstates are reused for every round
+        BRHMACInit(&ctx, hash, hashLen, pw, pwLen);
+    }
+    else {
+        s = malloc(saltLen + sizeof(uint32_t));
+        assert(s != NULL);
+        if (saltLen > 0) memcpy(s, salt, saltLen);
+    }
     
     for (i = 0; i < (dkLen + hashLen - 1)/hashLen; i++) {
         j = be32(i + 1);
-        memcpy(s + saltLen, &j, sizeof(j));
-        BRHMAC(U, hash, hashLen, pw, pwLen, s, sizeof(s)); // U1 = hmac_hash(pw, salt || be32(i))
-        memcpy(T, U, sizeof(U));
         
-        for (unsigned r = 1; r < rounds; r++) {
-            BRHMAC(U, hash, hashLen, pw, pwLen, U, sizeof(U)); // Urounds = hmac_hash(pw, Urounds-1)
-            for (j = 0; j < hashLen/sizeof(uint32_t); j++) T[j] ^= U[j]; // Ti = U1 ^ U2 ^ ... ^ Urounds
+        if (sha256 || sha512) { // U1 = hmac_hash(pw, salt || be32(i))
+            ctx2 = ctx;
+            BRHMACUpdate(&ctx2, salt, saltLen);
+            BRHMACUpdate(&ctx2, &j, sizeof(j));
+            BRHMACFinal(&ctx2, U);
+        }
+        else {
+            memcpy(s + saltLen, &j, sizeof(j));
+            BRHMAC(U, hash, hashLen, pw, pwLen, s, saltLen + sizeof(j));
+        }
+        
+        memcpy(T, U, hashLen);
+        
+        if (sha256) _BRPBKDF2SHA256Rounds(T, U, ctx.inner.sha256.h, ctx.outer.sha256.h, hashLen, rounds);
+        else if (sha512) _BRPBKDF2SHA512Rounds(T, U, ctx.inner.sha512.h, ctx.outer.sha512.h, hashLen, rounds);
+        else {
+            for (unsigned r = 1; r < rounds; r++) {
+                BRHMAC(U, hash, hashLen, pw, pwLen, U, hashLen); // Urounds = hmac_hash(pw, Urounds-1)
+                for (j = 0; j < hashLen/sizeof(uint32_t); j++) T[j] ^= U[j]; // Ti = U1 ^ U2 ^ ... ^ Urounds
+            }
         }
         
         // dk = T1 || T2 || ... || Tdklen/hlen
         memcpy((uint8_t *)dk + i*hashLen, T, (i*hashLen + hashLen <= dkLen) ? hashLen : dkLen % hashLen);
     }
     
-    memset(s, 0, sizeof(s));
+    if (s) memset(s, 0, saltLen + sizeof(uint32_t)), free(s);
+    if (sha256 || sha512) memset(&ctx, 0, sizeof(ctx));
     memset(U, 0, sizeof(U));
     memset(T, 0, sizeof(T));
 }
@@ -851,14 +2417,85 @@ static void _blockmix_salsa8(uint64_t *dest, const uint64_t *src, uint64_t *b, u
     }
 }
 
+#define SCRYPT_ALIGN 32 // alignment of the scratch memory, large enough for any simd registers used with it
+
+struct BRScryptCtxStruct {
+    uint8_t *buf;
+    void *v; // buf rounded up to SCRYPT_ALIGN
+    size_t vLen;
+};
+
+// returns scratch memory of at least len bytes, reusing ctx memory from previous calls when it's large enough
+static void *_BRScryptCtxV(BRScryptCtx *ctx, size_t len)
+{
+    if (len > ctx->vLen) {
+        if (ctx->buf) memset(ctx->v, 0, ctx->vLen), free(ctx->buf);
+        ctx->buf = malloc(len + SCRYPT_ALIGN);
+        assert(ctx->buf != NULL);
+        ctx->v = ctx->buf + SCRYPT_ALIGN - (uintptr_t)ctx->buf % SCRYPT_ALIGN;
+        ctx->vLen = len;
+    }
+    
+    return ctx->v;
+}
+
+// wipes and frees ctx scratch memory
+static void _BRScryptCtxClear(BRScryptCtx *ctx)
+{
+    if (ctx->buf) memset(ctx->v, 0, ctx->vLen), free(ctx->buf);
+    ctx->buf = NULL;
+    ctx->v = NULL;
+    ctx->vLen = 0;
+}
+
+// runs the scrypt ROMix function over the 128*r byte block b, v must hold 128*r*n bytes
+static void _BRScryptROMix(uint32_t *b, unsigned n, unsigned r, uint64_t *v)
+{
+    uint64_t x[16*r], y[16*r], z[8], m;
+    
+    for (unsigned j = 0; j < 32*r; j++) ((uint32_t *)x)[j] = le32(b[j]);
+    
+    for (unsigned j = 0; j < n; j += 2) {
+        memcpy(&v[j*(16*r)], x, 128*r);
+        _blockmix_salsa8(y, x, z, r);
+        memcpy(&v[(j + 1)*(16*r)], y, 128*r);
+        _blockmix_salsa8(x, y, z, r);
+    }
+    
+    for (unsigned j = 0; j < n; j += 2) {
+        m = le64(x[(2*r - 1)*8]) & (n - 1);
+        for (unsigned k = 0; k < 16*r; k++) x[k] ^= v[m*(16*r) + k];
+        _blockmix_salsa8(y, x, z, r);
+        m = le64(y[(2*r - 1)*8]) & (n - 1);
+        for (unsigned k = 0; k < 16*r; k++) y[k] ^= v[m*(16*r) + k];
+        _blockmix_salsa8(x, y, z, r);
+    }
+    
+    for (unsigned j = 0; j < 32*r; j++) b[j] = le32(((uint32_t *)x)[j]);
+    memset(x, 0, sizeof(x));
+    memset(y, 0, sizeof(y));
+    memset(z, 0, sizeof(z));
+    memset(&m, 0, sizeof(m));
+}
+
+// v must hold 128*r*n bytes
+static void _BRScrypt(void *dk, size_t dkLen, const void *pw, size_t pwLen, const void *salt, size_t saltLen,
+                      unsigned n, unsigned r, unsigned p, uint64_t *v)
+{
+    uint32_t b[32*r*p];
+    
+    BRPBKDF2(b, sizeof(b), BRSHA256, 256/8, pw, pwLen, salt, saltLen, 1);
+    for (unsigned i = 0; i < p; i++) _BRScryptROMix(&b[i*32*r], n, r, v);
+    BRPBKDF2(dk, dkLen, BRSHA256, 256/8, pw, pwLen, b, sizeof(b), 1);
+    memset(b, 0, sizeof(b));
+}
+
 // scrypt key derivation: http://www.tarsnap.com/scrypt.html
 void BRScrypt(void *dk, size_t dkLen, const void *pw, size_t pwLen, const void *salt, size_t saltLen,
               unsigned n, unsigned r, unsigned p)
 {
-    uint64_t x[16*r], y[16*r], z[8], *v = malloc(128*r*n), m;
-    uint32_t b[32*r*p];
+    BRScryptCtx ctx = { NULL, NULL, 0 };
     
-    assert(v != NULL);
     assert(dk != NULL || dkLen == 0);
     assert(pw != NULL || pwLen == 0);
     assert(salt != NULL || saltLen == 0);
@@ -866,36 +2503,269 @@ void BRScrypt(void *dk, size_t dkLen, const void *pw, size_t pwLen, const void *
     assert(r > 0);
     assert(p > 0);
     
-    BRPBKDF2(b, sizeof(b), BRSHA256, 256/8, pw, pwLen, salt, saltLen, 1);
+    _BRScrypt(dk, dkLen, pw, pwLen, salt, saltLen, n, r, p, _BRScryptCtxV(&ctx, 128*r*n));
+    _BRScryptCtxClear(&ctx);
+}
+
+typedef struct {
+    uint32_t *b; // p blocks of 128*r bytes, each mixed independently
+    unsigned n, r, p;
+    unsigned next; // next block to be claimed by a thread
+    pthread_mutex_t lock;
+} BRScryptJob;
+
+static void *_BRScryptThreadRoutine(void *arg)
+{
+    BRScryptJob *job = arg;
+    BRScryptCtx ctx = { NULL, NULL, 0 };
+    unsigned i;
+    
+    for (;;) {
+        pthread_mutex_lock(&job->lock);
+        i = (job->next < job->p) ? job->next++ : job->p;
+        pthread_mutex_unlock(&job->lock);
+        if (i >= job->p) break;
+        _BRScryptROMix(&job->b[i*32*job->r], job->n, job->r, _BRScryptCtxV(&ctx, 128*job->r*job->n));
+    }
+    
+    _BRScryptCtxClear(&ctx);
+    return NULL;
+}
+
+// same as BRScrypt(), but mixes the p independent blocks on up to threadCount threads, including the calling thread
+// each thread uses 128*r*n bytes of scratch memory, and no more threads are used than fit within memLimit bytes
+void BRScryptParallel(void *dk, size_t dkLen, const void *pw, size_t pwLen, const void *salt, size_t saltLen,
+                      unsigned n, unsigned r, unsigned p, unsigned threadCount, size_t memLimit)
+{
+    size_t count = (threadCount < p) ? threadCount : p, vLen = 128*(size_t)r*n, i;
+    
+    assert(dk != NULL || dkLen == 0);
+    assert(pw != NULL || pwLen == 0);
+    assert(salt != NULL || saltLen == 0);
+    assert(n > 0);
+    assert(r > 0);
+    assert(p > 0);
+    
+    if (count > memLimit/vLen) count = memLimit/vLen;
+    
+    if (count < 2) {
+        BRScrypt(dk, dkLen, pw, pwLen, salt, saltLen, n, r, p);
+    }
+    else {
+        uint32_t b[32*r*p];
+        BRScryptJob job = { .b = b, .n = n, .r = r, .p = p, .next = 0 };
+        pthread_t threads[count];
+        
+        BRPBKDF2(b, sizeof(b), BRSHA256, 256/8, pw, pwLen, salt, saltLen, 1);
+        pthread_mutex_init(&job.lock, NULL);
+        
+        for (i = 1; i < count; i++) {
+            if (pthread_create(&threads[i], NULL, _BRScryptThreadRoutine, &job) != 0) break;
+        }
+        
+        _BRScryptThreadRoutine(&job); // any blocks not claimed by the other threads are mixed on the calling thread
+        while (i > 1) pthread_join(threads[--i], NULL);
+        pthread_mutex_destroy(&job.lock);
+        BRPBKDF2(dk, dkLen, BRSHA256, 256/8, pw, pwLen, b, sizeof(b), 1);
+        memset(b, 0, sizeof(b));
+    }
+}
+
+// returns a newly allocated scrypt context that must be freed by calling BRScryptCtxFree()
+BRScryptCtx *BRScryptCtxNew(void)
+{
+    BRScryptCtx *ctx = calloc(1, sizeof(*ctx));
+    
+    assert(ctx != NULL);
+    return ctx;
+}
+
+// same as BRScrypt(), but reuses the scratch memory in ctx instead of allocating and wiping it for each call
+// NOTE: scratch memory isn't wiped until BRScryptCtxFree() is called, so this should not be used with secret inputs
+void BRScryptCtxDerive(BRScryptCtx *ctx, void *dk, size_t dkLen, const void *pw, size_t pwLen, const void *salt,
+                       size_t saltLen, unsigned n, unsigned r, unsigned p)
+{
+    assert(ctx != NULL);
+    assert(dk != NULL || dkLen == 0);
+    assert(pw != NULL || pwLen == 0);
+    assert(salt != NULL || saltLen == 0);
+    assert(n > 0);
+    assert(r > 0);
+    assert(p > 0);
+    
+    _BRScrypt(dk, dkLen, pw, pwLen, salt, saltLen, n, r, p, _BRScryptCtxV(ctx, 128*r*n));
+}
+
+#if defined(__GNUC__)
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SCRYPT_AVX2 1 // on x86, a second copy of the scrypt lanes is compiled for avx2 and selected at runtime
+#endif
+
+// same as _salsa20_8(), but operates on SIMD_LANES independent blocks at once, where b[i] holds word i of each block
+force_inline static void _salsa20_8_lanes(v8u32 b[16])
+{
+    v8u32 x0 = b[0], x1 = b[1], x2 = b[2],  x3 = b[3],  x4 = b[4],  x5 = b[5],  x6 = b[6],  x7 = b[7],
+          x8 = b[8], x9 = b[9], xa = b[10], xb = b[11], xc = b[12], xd = b[13], xe = b[14], xf = b[15];
+    
+    for (unsigned i = 0; i < 8; i += 2) {
+        // operate on columns
+        x4 ^= rol32(x0 + xc, 7), x8 ^= rol32(x4 + x0, 9), xc ^= rol32(x8 + x4, 13), x0 ^= rol32(xc + x8, 18);
+        x9 ^= rol32(x5 + x1, 7), xd ^= rol32(x9 + x5, 9), x1 ^= rol32(xd + x9, 13), x5 ^= rol32(x1 + xd, 18);
+        xe ^= rol32(xa + x6, 7), x2 ^= rol32(xe + xa, 9), x6 ^= rol32(x2 + xe, 13), xa ^= rol32(x6 + x2, 18);
+        x3 ^= rol32(xf + xb, 7), x7 ^= rol32(x3 + xf, 9), xb ^= rol32(x7 + x3, 13), xf ^= rol32(xb + x7, 18);
+        
+        // operate on rows
+        x1 ^= rol32(x0 + x3, 7), x2 ^= rol32(x1 + x0, 9), x3 ^= rol32(x2 + x1, 13), x0 ^= rol32(x3 + x2, 18);
+        x6 ^= rol32(x5 + x4, 7), x7 ^= rol32(x6 + x5, 9), x4 ^= rol32(x7 + x6, 13), x5 ^= rol32(x4 + x7, 18);
+        xb ^= rol32(xa + x9, 7), x8 ^= rol32(xb + xa, 9), x9 ^= rol32(x8 + xb, 13), xa ^= rol32(x9 + x8, 18);
+        xc ^= rol32(xf + xe, 7), xd ^= rol32(xc + xf, 9), xe ^= rol32(xd + xc, 13), xf ^= rol32(xe + xd, 18);
+    }
+    
+    b[0] += x0, b[1] += x1, b[2] += x2,  b[3] += x3,  b[4] += x4,  b[5] += x5,  b[6] += x6,  b[7] += x7;
+    b[8] += x8, b[9] += x9, b[10] += xa, b[11] += xb, b[12] += xc, b[13] += xd, b[14] += xe, b[15] += xf;
+}
+
+force_inline static void _blockmix_salsa8_lanes(v8u32 *dest, const v8u32 *src, v8u32 *b, unsigned r)
+{
+    memcpy(b, &src[(2*r - 1)*16], 16*sizeof(*b));
+    
+    for (unsigned i = 0; i < 2*r; i += 2) {
+        for (unsigned j = 0; j < 16; j++) b[j] ^= src[i*16 + j];
+        _salsa20_8_lanes(b);
+        memcpy(&dest[i*8], b, 16*sizeof(*b));
+        for (unsigned j = 0; j < 16; j++) b[j] ^= src[i*16 + 16 + j];
+        _salsa20_8_lanes(b);
+        memcpy(&dest[i*8 + r*16], b, 16*sizeof(*b));
+    }
+}
+
+// runs the scrypt ROMix function over x, which holds SIMD_LANES interleaved 128*r byte blocks, v must hold n*32*r
+force_inline static void _BRScryptROMixLanes(v8u32 *x, v8u32 *v, unsigned n, unsigned r)
+{
+    v8u32 y[32*r], z[16];
+    uint32_t m;
+    
+    for (unsigned j = 0; j < n; j += 2) {
+        memcpy(&v[j*(32*r)], x, 32*r*sizeof(*x));
+        _blockmix_salsa8_lanes(y, x, z, r);
+        memcpy(&v[(j + 1)*(32*r)], y, 32*r*sizeof(*y));
+        _blockmix_salsa8_lanes(x, y, z, r);
+    }
     
-    for (int i = 0; i < p; i++) {
-        for (unsigned j = 0; j < 32*r; j++) ((uint32_t *)x)[j] = le32(b[i*32*r + j]);
+    for (unsigned j = 0; j < n; j += 2) {
+        for (unsigned l = 0; l < SIMD_LANES; l++) { // each lane reads from a different position in v
+            m = x[(2*r - 1)*16][l] & (n - 1);
+            for (unsigned k = 0; k < 32*r; k++) x[k][l] ^= v[m*(32*r) + k][l];
+        }
         
-        for (unsigned j = 0; j < n; j += 2) {
-            memcpy(&v[j*(16*r)], x, 128*r);
-            _blockmix_salsa8(y, x, z, r);
-            memcpy(&v[(j + 1)*(16*r)], y, 128*r);
-            _blockmix_salsa8(x, y, z, r);
+        _blockmix_salsa8_lanes(y, x, z, r);
+        
+        for (unsigned l = 0; l < SIMD_LANES; l++) {
+            m = y[(2*r - 1)*16][l] & (n - 1);
+            for (unsigned k = 0; k < 32*r; k++) y[k][l] ^= v[m*(32*r) + k][l];
         }
         
-        for (unsigned j = 0; j < n; j += 2) {
-            m = le64(x[(2*r - 1)*8]) & (n - 1);
-            for (unsigned k = 0; k < 16*r; k++) x[k] ^= v[m*(16*r) + k];
-            _blockmix_salsa8(y, x, z, r);
-            m = le64(y[(2*r - 1)*8]) & (n - 1);
-            for (unsigned k = 0; k < 16*r; k++) y[k] ^= v[m*(16*r) + k];
-            _blockmix_salsa8(x, y, z, r);
+        _blockmix_salsa8_lanes(x, y, z, r);
+    }
+}
+
+static void _BRScryptROMixLanesDefault(v8u32 *x, v8u32 *v, unsigned n, unsigned r)
+{
+    _BRScryptROMixLanes(x, v, n, r);
+}
+
+#if SCRYPT_AVX2
+__attribute__((target("avx2")))
+static void _BRScryptROMixLanesAVX2(v8u32 *x, v8u32 *v, unsigned n, unsigned r)
+{
+    _BRScryptROMixLanes(x, v, n, r);
+}
+#endif
+
+// computes scrypt for SIMD_LANES or fewer (count) pw/salt pairs together, v must hold SIMD_LANES*128*r*n bytes
+static void _BRScryptLanes(void *dk[], size_t dkLen, const void *pw[], size_t pwLen, const void *salt[],
+                           size_t saltLen, size_t count, unsigned n, unsigned r, unsigned p, v8u32 *v)
+{
+    v8u32 x[32*r];
+    uint32_t b[SIMD_LANES][32*r*p];
+    size_t l;
+    
+    for (l = 0; l < count; l++) BRPBKDF2(b[l], sizeof(b[l]), BRSHA256, 256/8, pw[l], pwLen, salt[l], saltLen, 1);
+    for (; l < SIMD_LANES; l++) memcpy(b[l], b[0], sizeof(b[l])); // unused lanes just repeat the first lane
+    
+    for (unsigned i = 0; i < p; i++) {
+        for (unsigned j = 0; j < 32*r; j++) {
+            for (l = 0; l < SIMD_LANES; l++) x[j][l] = le32(b[l][i*32*r + j]);
         }
         
-        for (unsigned j = 0; j < 32*r; j++) b[i*32*r + j] = le32(((uint32_t *)x)[j]);
+#if SCRYPT_AVX2
+        if (BRCryptoFeatures() & BR_CRYPTO_AVX2) _BRScryptROMixLanesAVX2(x, v, n, r);
+        else _BRScryptROMixLanesDefault(x, v, n, r);
+#else
+        _BRScryptROMixLanesDefault(x, v, n, r);
+#endif
+        
+        for (unsigned j = 0; j < 32*r; j++) {
+            for (l = 0; l < SIMD_LANES; l++) b[l][i*32*r + j] = le32(x[j][l]);
+        }
     }
     
-    BRPBKDF2(dk, dkLen, BRSHA256, 256/8, pw, pwLen, b, sizeof(b), 1);
+    for (l = 0; l < count; l++) BRPBKDF2(dk[l], dkLen, BRSHA256, 256/8, pw[l], pwLen, b[l], sizeof(b[l]), 1);
     memset(b, 0, sizeof(b));
     memset(x, 0, sizeof(x));
-    memset(y, 0, sizeof(y));
-    memset(z, 0, sizeof(z));
-    memset(v, 0, 128*r*n);
-    free(v);
-    memset(&m, 0, sizeof(m));
+}
+
+#endif // defined(__GNUC__)
+
+// same as BRScryptBatch(), but reuses the scratch memory in ctx instead of allocating and wiping it for each call
+// NOTE: scratch memory isn't wiped until BRScryptCtxFree() is called, so this should not be used with secret inputs
+void BRScryptCtxDeriveBatch(BRScryptCtx *ctx, void *dk[], size_t dkLen, const void *pw[], size_t pwLen,
+                            const void *salt[], size_t saltLen, size_t count, unsigned n, unsigned r, unsigned p)
+{
+    size_t i = 0;
+    
+    assert(ctx != NULL);
+    assert(dk != NULL || count == 0);
+    assert(pw != NULL || count == 0);
+    assert(salt != NULL || count == 0);
+    assert(n > 0);
+    assert(r > 0);
+    assert(p > 0);
+    
+#if defined(__GNUC__)
+    if (count > 1) { // a single pair doesn't benefit from simd lanes
+        v8u32 *v = _BRScryptCtxV(ctx, SIMD_LANES*128*r*n);
+        
+        for (i = 0; i + 1 < count; i += SIMD_LANES) {
+            _BRScryptLanes(&dk[i], dkLen, &pw[i], pwLen, &salt[i], saltLen,
+                           (count - i < SIMD_LANES) ? count - i : SIMD_LANES, n, r, p, v);
+        }
+    }
+#endif
+    
+    for (; i < count; i++) {
+        _BRScrypt(dk[i], dkLen, pw[i], pwLen, salt[i], saltLen, n, r, p, _BRScryptCtxV(ctx, 128*r*n));
+    }
+}
+
+// computes scrypt for count independent pw/salt pairs, storing the result for pw[i] and salt[i] in dk[i]
+// each pw[i] is pwLen bytes and each salt[i] is saltLen bytes - this is much faster than calling BRScrypt() for each
+// pair when hashing many small inputs, such as block headers, since the pairs are computed together in simd lanes
+void BRScryptBatch(void *dk[], size_t dkLen, const void *pw[], size_t pwLen, const void *salt[], size_t saltLen,
+                   size_t count, unsigned n, unsigned r, unsigned p)
+{
+    BRScryptCtx ctx = { NULL, NULL, 0 };
+    
+    BRScryptCtxDeriveBatch(&ctx, dk, dkLen, pw, pwLen, salt, saltLen, count, n, r, p);
+    _BRScryptCtxClear(&ctx);
+}
+
+// wipes and frees memory allocated for ctx
+void BRScryptCtxFree(BRScryptCtx *ctx)
+{
+    assert(ctx != NULL);
+    
+    _BRScryptCtxClear(ctx);
+    free(ctx);
 }
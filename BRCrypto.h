@@ -32,6 +32,18 @@
 extern "C" {
 #endif
 
+// hardware acceleration features, used automatically when supported by the cpu
+#define BR_CRYPTO_SHANI 0x01 // x86 sha extensions
+#define BR_CRYPTO_AVX2  0x02 // x86 avx2 and bmi2 instructions
+#define BR_CRYPTO_ARMV8 0x04 // armv8 cryptography extensions
+#define BR_CRYPTO_AESNI 0x08 // x86 aes instructions
+
+// returns the hardware acceleration features currently in use
+uint32_t BRCryptoFeatures(void);
+
+// limits hardware acceleration to the given features, where supported by the cpu (useful for testing and benchmarks)
+void BRCryptoSetFeatures(uint32_t features);
+
 // sha-1 - not recommended for cryptographic use
 void BRSHA1(void *md20, const void *data, size_t len);
 
@@ -42,25 +54,107 @@ void BRSHA224(void *md28, const void *data, size_t len);
 // double-sha-256 = sha-256(sha-256(x))
 void BRSHA256_2(void *md32, const void *data, size_t len);
 
+// double-sha-256 of count independent messages, where data[i] is len[i] bytes, and the result is written to md32[i]
+// this is faster than calling BRSHA256_2() for each message when there isn't hardware sha support, since the messages
+// are hashed together in simd lanes
+void BRSHA256_2Batch(void *md32[], const void *data[], const size_t len[], size_t count);
+
+// double-sha-256 of count contiguous 64 byte blocks in data64, with the 32 byte results written contiguously to md32
+// md32 may be the same as data64, which is convenient for hashing merkle tree nodes a level at a time
+void BRSHA256_2_64Batch(void *md32, const void *data64, size_t count);
+
 void BRSHA384(void *md48, const void *data, size_t len);
 
 void BRSHA512(void *md64, const void *data, size_t len);
 
+// incremental sha-256 and sha-224, for hashing data that isn't contiguous in memory without copying it
+typedef struct {
+    uint32_t h[8]; // intermediate hash state
+    uint32_t x[16]; // partial block
+    uint64_t len; // total bytes hashed so far
+} BRSHA256Ctx;
+
+void BRSHA256Init(BRSHA256Ctx *ctx);
+void BRSHA224Init(BRSHA256Ctx *ctx);
+void BRSHA256Update(BRSHA256Ctx *ctx, const void *data, size_t len);
+
+// writes the final hash to md and wipes ctx
+void BRSHA256Final(BRSHA256Ctx *ctx, void *md32);
+void BRSHA224Final(BRSHA256Ctx *ctx, void *md28);
+
+// midstate export: after hashing a multiple of 64 bytes, writes the intermediate hash state to md32, so that hashing
+// can later resume from the same point by calling BRSHA256InitMidstate() with the same md32 and len
+void BRSHA256Midstate(const BRSHA256Ctx *ctx, void *md32);
+void BRSHA256InitMidstate(BRSHA256Ctx *ctx, const void *md32, uint64_t len);
+
+// incremental sha-512 and sha-384
+typedef struct {
+    uint64_t h[8]; // intermediate hash state
+    uint64_t x[16]; // partial block
+    uint64_t len; // total bytes hashed so far
+} BRSHA512Ctx;
+
+void BRSHA512Init(BRSHA512Ctx *ctx);
+void BRSHA384Init(BRSHA512Ctx *ctx);
+void BRSHA512Update(BRSHA512Ctx *ctx, const void *data, size_t len);
+
+// writes the final hash to md and wipes ctx
+void BRSHA512Final(BRSHA512Ctx *ctx, void *md64);
+void BRSHA384Final(BRSHA512Ctx *ctx, void *md48);
+
+// midstate export: after hashing a multiple of 128 bytes, writes the intermediate hash state to md64, so that hashing
+// can later resume from the same point by calling BRSHA512InitMidstate() with the same md64 and len
+void BRSHA512Midstate(const BRSHA512Ctx *ctx, void *md64);
+void BRSHA512InitMidstate(BRSHA512Ctx *ctx, const void *md64, uint64_t len);
+
 // ripemd-160: http://homes.esat.kuleuven.be/~bosselae/ripemd160.html
 void BRRMD160(void *md20, const void *data, size_t len);
 
 // bitcoin hash-160 = ripemd-160(sha-256(x))
 void BRHash160(void *md20, const void *data, size_t len);
 
+// hash-160 of count independent messages, where data[i] is len[i] bytes, and the result is written to md20[i]
+// the messages are hashed together in simd lanes, which is much faster than calling BRHash160() for each message
+void BRHash160Batch(void *md20[], const void *data[], const size_t len[], size_t count);
+
 // md5 - for non-cryptographic use only
 void BRMD5(void *md16, const void *data, size_t len);
 
 // murmurHash3 (x86_32): https://code.google.com/p/smhasher/ - for non cryptographic use only
 uint32_t BRMurmur3_32(const void *data, size_t len, uint32_t seed);
 
+// murmurHash3 (x86_32) of the same data with each of count seeds, where the result for seeds[i] is written to md[i]
+// the seeds are hashed together in simd lanes, which is much faster than calling BRMurmur3_32() for each seed
+void BRMurmur3_32Seeds(uint32_t md[], const void *data, size_t len, const uint32_t seeds[], size_t count);
+
+// murmurHash3 (x86_32) of count elements of len bytes each with the same seed, where the result for data[i] is written
+// to md[i] - the elements are hashed together in simd lanes, which is faster than calling BRMurmur3_32() for each one
+void BRMurmur3_32Batch(uint32_t md[], const void *data[], size_t len, uint32_t seed, size_t count);
+
 void BRHMAC(void *mac, void (*hash)(void *, const void *, size_t), size_t hashLen, const void *key, size_t keyLen,
             const void *data, size_t dataLen);
 
+// incremental hmac, hash must be BRSHA224, BRSHA256, BRSHA384 or BRSHA512
+// a copy of ctx made after BRHMACInit() can be reused to mac more data with the same key, without rehashing the key
+typedef struct {
+    void (*hash)(void *, const void *, size_t);
+    size_t hashLen;
+    union { BRSHA256Ctx sha256; BRSHA512Ctx sha512; } inner, outer;
+} BRHMACCtx;
+
+void BRHMACInit(BRHMACCtx *ctx, void (*hash)(void *, const void *, size_t), size_t hashLen, const void *key,
+                size_t keyLen);
+void BRHMACUpdate(BRHMACCtx *ctx, const void *data, size_t dataLen);
+
+// writes the final mac and wipes ctx
+void BRHMACFinal(BRHMACCtx *ctx, void *mac);
+
+// hmac-sha512 of count messages with the same key, where data[i] is dataLen bytes, and the mac is written to mac64[i]
+// the key is only hashed once, and the messages are hashed together in simd lanes, which is much faster than calling
+// BRHMAC() for each message, e.g. when deriving many bip32 child keys from the same parent
+void BRHMACSHA512Batch(void *mac64[], const void *key, size_t keyLen, const void *data[], size_t dataLen,
+                       size_t count);
+
 // hmac-drbg with no prediction resistance or additional input
 // K and V must point to buffers of size hashLen, and ps (personalization string) may be NULL
 // to generate additional drbg output, use K and V from the previous call, and set seed, nonce and ps to NULL
@@ -81,6 +175,20 @@ size_t BRChacha20Poly1305AEADEncrypt(void *out, size_t outLen, const void *key32
 size_t BRChacha20Poly1305AEADDecrypt(void *out, size_t outLen, const void *key32, const void *nonce12,
                                      const void *data, size_t dataLen, const void *ad, size_t adLen);
     
+// aes-256 block cypher with the key schedule expanded once, for encrypting or decrypting many blocks with one key
+// ctx holds the expanded key, and should be wiped with memset() when it's no longer needed
+typedef struct {
+    uint8_t ek[240]; // encryption round keys
+    uint8_t dk[240]; // decryption round keys
+} BRAES256Ctx;
+
+void BRAES256Init(BRAES256Ctx *ctx, const void *key32);
+
+// encrypts or decrypts len bytes of buf in place in ecb mode, len must be a multiple of 16
+// NOTE: ecb mode encrypts identical blocks to identical output, and is only suitable for single blocks of random data
+void BRAES256ECBEncrypt(const BRAES256Ctx *ctx, void *buf, size_t len);
+void BRAES256ECBDecrypt(const BRAES256Ctx *ctx, void *buf, size_t len);
+
 void BRPBKDF2(void *dk, size_t dkLen, void (*hash)(void *, const void *, size_t), size_t hashLen,
               const void *pw, size_t pwLen, const void *salt, size_t saltLen, unsigned rounds);
 
@@ -88,6 +196,34 @@ void BRPBKDF2(void *dk, size_t dkLen, void (*hash)(void *, const void *, size_t)
 void BRScrypt(void *dk, size_t dkLen, const void *pw, size_t pwLen, const void *salt, size_t saltLen,
               unsigned n, unsigned r, unsigned p);
 
+// same as BRScrypt(), but mixes the p independent blocks on up to threadCount threads, including the calling thread
+// each thread uses 128*r*n bytes of scratch memory, and no more threads are used than fit within memLimit bytes
+void BRScryptParallel(void *dk, size_t dkLen, const void *pw, size_t pwLen, const void *salt, size_t saltLen,
+                      unsigned n, unsigned r, unsigned p, unsigned threadCount, size_t memLimit);
+
+// computes scrypt for count independent pw/salt pairs, storing the result for pw[i] and salt[i] in dk[i]
+// each pw[i] is pwLen bytes and each salt[i] is saltLen bytes - this is much faster than calling BRScrypt() for each
+// pair when hashing many small inputs, such as block headers, since the pairs are computed together in simd lanes
+void BRScryptBatch(void *dk[], size_t dkLen, const void *pw[], size_t pwLen, const void *salt[], size_t saltLen,
+                   size_t count, unsigned n, unsigned r, unsigned p);
+
+// reusable scrypt scratch memory, for hashing many inputs without allocating and wiping 128*r*n bytes for each one
+typedef struct BRScryptCtxStruct BRScryptCtx;
+
+// returns a newly allocated scrypt context that must be freed by calling BRScryptCtxFree()
+BRScryptCtx *BRScryptCtxNew(void);
+
+// same as BRScrypt() and BRScryptBatch(), but reuses the scratch memory in ctx instead of allocating and wiping it for
+// each call
+// NOTE: scratch memory isn't wiped until BRScryptCtxFree() is called, so these should not be used with secret inputs
+void BRScryptCtxDerive(BRScryptCtx *ctx, void *dk, size_t dkLen, const void *pw, size_t pwLen, const void *salt,
+                       size_t saltLen, unsigned n, unsigned r, unsigned p);
+void BRScryptCtxDeriveBatch(BRScryptCtx *ctx, void *dk[], size_t dkLen, const void *pw[], size_t pwLen,
+                            const void *salt[], size_t saltLen, size_t count, unsigned n, unsigned r, unsigned p);
+
+// wipes and frees memory allocated for ctx
+void BRScryptCtxFree(BRScryptCtx *ctx);
+
 #ifdef __cplusplus
 }
 #endif
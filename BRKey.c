@@ -301,6 +301,45 @@ size_t BRKeyAddress(BRKey *key, char *addr, size_t addrLen)
     return addrLen;
 }
 
+// writes the pay-to-pubkey-hash bitcoin address for each of count keys to addrs[i], which must hold addrLen bytes
+// an empty string is written for any key that has no valid address
+void BRKeyAddressList(BRKey keys[], size_t count, char *addrs[], size_t addrLen)
+{
+    UInt160 hashes[64];
+    const void *pubKeys[64];
+    void *mds[64];
+    size_t i, j, n, lens[64];
+    uint8_t data[21];
+    
+    assert(keys != NULL || count == 0);
+    assert(addrs != NULL || count == 0);
+    data[0] = BITCOIN_PUBKEY_ADDRESS;
+#if BITCOIN_TESTNET
+    data[0] = BITCOIN_PUBKEY_ADDRESS_TEST;
+#endif
+    
+    for (i = 0; i < count; i += n) { // hash the pubkeys 64 at a time
+        n = (count - i < 64) ? count - i : 64;
+        
+        for (j = 0; j < n; j++) {
+            hashes[j] = UINT160_ZERO;
+            lens[j] = BRKeyPubKey(&keys[i + j], NULL, 0);
+            pubKeys[j] = keys[i + j].pubKey;
+            mds[j] = &hashes[j];
+        }
+        
+        BRHash160Batch(mds, pubKeys, lens, n);
+        
+        for (j = 0; j < n; j++) {
+            UInt160Set(&data[1], hashes[j]);
+            
+            if (UInt160IsZero(hashes[j]) || BRBase58CheckEncode(addrs[i + j], addrLen, data, sizeof(data)) == 0) {
+                if (addrLen > 0) addrs[i + j][0] = '\0';
+            }
+        }
+    }
+}
+
 // signs md with key and writes signature to sig
 // returns the number of bytes written, or sigLen needed if sig is NULL
 // returns 0 on failure
@@ -91,6 +91,11 @@ UInt160 BRKeyHash160(BRKey *key);
 // returns the number of bytes written, or addrLen needed if addr is NULL
 size_t BRKeyAddress(BRKey *key, char *addr, size_t addrLen);
 
+// writes the pay-to-pubkey-hash bitcoin address for each of count keys to addrs[i], which must hold addrLen bytes
+// the pubkey hashes are computed together, which is much faster than calling BRKeyAddress() for each key
+// an empty string is written for any key that has no valid address
+void BRKeyAddressList(BRKey keys[], size_t count, char *addrs[], size_t addrLen);
+
 // signs md with key and writes signature to sig
 // returns the number of bytes written, or sigLen needed if sig is NULL
 // returns 0 on failure
@@ -31,18 +31,11 @@
 #include <limits.h>
 #include <string.h>
 #include <assert.h>
+#include <pthread.h>
 
 #define MAX_PROOF_OF_WORK 0x1e0fffff    // highest value for difficulty target (higher values are less difficult)
 #define TARGET_TIMESPAN   302400        // = 3.5*24*60*60; the targeted timespan between difficulty target adjustments
 
-inline static int _ceil_log2(int x)
-{
-    int r = (x & (x - 1)) ? 1 : 0;
-    
-    while ((x >>= 1) != 0) r++;
-    return r;
-}
-
 // from https://en.bitcoin.it/wiki/Protocol_specification#Merkle_Trees
 // Merkle trees are binary trees of hashes. Merkle trees in bitcoin use a double SHA-256, the SHA-256 hash of the
 // SHA-256 hash of something. If, when forming a row in the tree (other than the root of the tree), it would have an odd
@@ -84,52 +77,244 @@ BRMerkleBlock *BRMerkleBlockNew(void)
     return block;
 }
 
-// buf must contain either a serialized merkleblock or header
-// returns a merkle block struct that must be freed by calling BRMerkleBlockFree()
-BRMerkleBlock *BRMerkleBlockParse(const uint8_t *buf, size_t bufLen)
+// sets the header fields, blockHash and height of header from block
+void BRBlockHeaderSet(BRBlockHeader *header, const BRMerkleBlock *block)
 {
-    BRMerkleBlock *block = (buf && 80 <= bufLen) ? BRMerkleBlockNew() : NULL;
-    size_t off = 0, len = 0;
+    assert(header != NULL);
+    assert(block != NULL);
     
-    assert(buf != NULL || bufLen == 0);
+    header->blockHash = block->blockHash;
+    header->version = block->version;
+    header->prevBlock = block->prevBlock;
+    header->merkleRoot = block->merkleRoot;
+    header->timestamp = block->timestamp;
+    header->target = block->target;
+    header->nonce = block->nonce;
+    header->height = block->height;
+}
+
+// returns a merkle block with just the header fields, blockHash and height of header, with no tx hashes, that doesn't
+// need to be freed
+BRMerkleBlock BRBlockHeaderMerkleBlock(const BRBlockHeader *header)
+{
+    BRMerkleBlock block;
+    
+    assert(header != NULL);
+    memset(&block, 0, sizeof(block));
+    block.blockHash = header->blockHash;
+    block.version = header->version;
+    block.prevBlock = header->prevBlock;
+    block.merkleRoot = header->merkleRoot;
+    block.timestamp = header->timestamp;
+    block.target = header->target;
+    block.nonce = header->nonce;
+    block.height = header->height;
+    return block;
+}
+
+static pthread_key_t _scryptCtxKey;
+static pthread_once_t _scryptCtxOnce = PTHREAD_ONCE_INIT;
+
+static void _BRScryptCtxDestroy(void *ctx)
+{
+    BRScryptCtxFree(ctx);
+}
+
+static void _BRScryptCtxKeyCreate(void)
+{
+    pthread_key_create(&_scryptCtxKey, _BRScryptCtxDestroy);
+}
+
+// returns scrypt scratch memory for proof-of-work hashing, cached per thread so it's only allocated once per thread
+static BRScryptCtx *_BRMerkleBlockScryptCtx(void)
+{
+    BRScryptCtx *ctx;
     
-    if (block) {
-        block->version = UInt32GetLE(&buf[off]);
-        off += sizeof(uint32_t);
-        block->prevBlock = UInt256Get(&buf[off]);
-        off += sizeof(UInt256);
-        block->merkleRoot = UInt256Get(&buf[off]);
-        off += sizeof(UInt256);
-        block->timestamp = UInt32GetLE(&buf[off]);
-        off += sizeof(uint32_t);
-        block->target = UInt32GetLE(&buf[off]);
-        off += sizeof(uint32_t);
-        block->nonce = UInt32GetLE(&buf[off]);
+    pthread_once(&_scryptCtxOnce, _BRScryptCtxKeyCreate);
+    ctx = pthread_getspecific(_scryptCtxKey);
+    
+    if (! ctx) {
+        ctx = BRScryptCtxNew();
+        pthread_setspecific(_scryptCtxKey, ctx);
+    }
+    
+    return ctx;
+}
+
+// parses everything but the block hash and proof-of-work hash, which are left for the caller to compute, into block
+// without copying - hashes and flags point into buf, so the tx hashes aren't necessarily aligned, and must be read with
+// UInt256Get() - returns true if buf contains at least a block header
+static int _BRMerkleBlockParseView(BRMerkleBlock *block, const uint8_t *buf, size_t bufLen)
+{
+    size_t off = 0, len = 0, count;
+    
+    assert(block != NULL);
+    assert(buf != NULL || bufLen == 0);
+    memset(block, 0, sizeof(*block));
+    block->height = BLOCK_UNKNOWN_HEIGHT;
+    if (! buf || bufLen < 80) return 0;
+    
+    block->version = UInt32GetLE(&buf[off]);
+    off += sizeof(uint32_t);
+    block->prevBlock = UInt256Get(&buf[off]);
+    off += sizeof(UInt256);
+    block->merkleRoot = UInt256Get(&buf[off]);
+    off += sizeof(UInt256);
+    block->timestamp = UInt32GetLE(&buf[off]);
+    off += sizeof(uint32_t);
+    block->target = UInt32GetLE(&buf[off]);
+    off += sizeof(uint32_t);
+    block->nonce = UInt32GetLE(&buf[off]);
+    off += sizeof(uint32_t);
+    
+    if (off + sizeof(uint32_t) <= bufLen) {
+        block->totalTx = UInt32GetLE(&buf[off]);
         off += sizeof(uint32_t);
+        count = (size_t)BRVarInt(&buf[off], (off <= bufLen ? bufLen - off : 0), &len);
+        off += len;
         
-        if (off + sizeof(uint32_t) <= bufLen) {
-            block->totalTx = UInt32GetLE(&buf[off]);
-            off += sizeof(uint32_t);
-            block->hashesCount = (size_t)BRVarInt(&buf[off], (off <= bufLen ? bufLen - off : 0), &len);
-            off += len;
-            len = block->hashesCount*sizeof(UInt256);
-            block->hashes = (off + len <= bufLen) ? malloc(len) : NULL;
-            if (block->hashes) memcpy(block->hashes, &buf[off], len);
+        if (off <= bufLen && count <= (bufLen - off)/sizeof(UInt256)) { // a truncated tree is left empty
+            block->hashes = (count > 0) ? (UInt256 *)&buf[off] : NULL;
+            block->hashesCount = count;
+            off += count*sizeof(UInt256);
+            count = (size_t)BRVarInt(&buf[off], (off <= bufLen ? bufLen - off : 0), &len);
             off += len;
-            block->flagsLen = (size_t)BRVarInt(&buf[off], (off <= bufLen ? bufLen - off : 0), &len);
-            off += len;
-            len = block->flagsLen;
-            block->flags = (off + len <= bufLen) ? malloc(len) : NULL;
-            if (block->flags) memcpy(block->flags, &buf[off], len);
+            
+            if (off <= bufLen && count <= bufLen - off) {
+                block->flags = (count > 0) ? (uint8_t *)&buf[off] : NULL;
+                block->flagsLen = count;
+            }
         }
-        
-        BRSHA256_2(&block->blockHash, buf, 80);
-        BRScrypt(&block->powHash, sizeof(block->powHash), buf, 80, buf, 80, 1024, 1, 1);
     }
     
+    return 1;
+}
+
+// parses everything but the block hash and proof-of-work hash, which are left for the caller to compute
+static BRMerkleBlock *_BRMerkleBlockParse(const uint8_t *buf, size_t bufLen)
+{
+    BRMerkleBlock view;
+    
+    return (_BRMerkleBlockParseView(&view, buf, bufLen)) ? BRMerkleBlockCopy(&view) : NULL;
+}
+
+// buf must contain either a serialized merkleblock or header
+// the proof-of-work hash isn't computed until it's needed, see BRMerkleBlockSetPowHashes()
+// returns a merkle block struct that must be freed by calling BRMerkleBlockFree()
+BRMerkleBlock *BRMerkleBlockParse(const uint8_t *buf, size_t bufLen)
+{
+    BRMerkleBlock *block = _BRMerkleBlockParse(buf, bufLen);
+    
+    if (block) BRSHA256_2(&block->blockHash, buf, 80);
     return block;
 }
 
+// parses a serialized merkleblock or header into block without any allocations - block->hashes and block->flags point
+// into buf, so block is only usable for as long as buf is, and must not be passed to BRMerkleBlockFree()
+// use BRMerkleBlockCopy() to get a block that outlives buf
+// returns true if buf was parsed successfully
+int BRMerkleBlockView(BRMerkleBlock *block, const uint8_t *buf, size_t bufLen)
+{
+    int r = _BRMerkleBlockParseView(block, buf, bufLen);
+    
+    if (r) BRSHA256_2(&block->blockHash, buf, 80);
+    return r;
+}
+
+// returns a newly allocated copy of block, with its own copy of the tx hashes and flags, that must be freed by calling
+// BRMerkleBlockFree()
+BRMerkleBlock *BRMerkleBlockCopy(const BRMerkleBlock *block)
+{
+    BRMerkleBlock *cpy = BRMerkleBlockNew();
+    
+    assert(block != NULL);
+    assert(block->hashes != NULL || block->hashesCount == 0);
+    assert(block->flags != NULL || block->flagsLen == 0);
+    *cpy = *block;
+    cpy->hashes = (block->hashesCount > 0) ? malloc(block->hashesCount*sizeof(UInt256)) : NULL;
+    cpy->flags = (block->flagsLen > 0) ? malloc(block->flagsLen) : NULL;
+    assert(cpy->hashes != NULL || block->hashesCount == 0);
+    assert(cpy->flags != NULL || block->flagsLen == 0);
+    if (cpy->hashes) memcpy(cpy->hashes, block->hashes, block->hashesCount*sizeof(UInt256));
+    if (cpy->flags) memcpy(cpy->flags, block->flags, block->flagsLen);
+    return cpy;
+}
+
+// buf must contain count serialized headers of 81 bytes each, as found in a "headers" message
+// the block hashes for all the headers are computed together, which is much faster than parsing them one by one
+// populates blocks with merkle block structs that must each be freed by calling BRMerkleBlockFree()
+void BRMerkleBlockParseHeaders(BRMerkleBlock *blocks[], const uint8_t *buf, size_t count)
+{
+    void **blockHashes = (count > 0) ? malloc(count*sizeof(*blockHashes)) : NULL;
+    const void **headers = (count > 0) ? malloc(count*sizeof(*headers)) : NULL;
+    size_t *lens = (count > 0) ? malloc(count*sizeof(*lens)) : NULL;
+    
+    assert(blocks != NULL || count == 0);
+    assert(buf != NULL || count == 0);
+    assert(blockHashes != NULL || count == 0);
+    assert(headers != NULL || count == 0);
+    assert(lens != NULL || count == 0);
+    
+    for (size_t i = 0; i < count; i++) {
+        blocks[i] = _BRMerkleBlockParse(&buf[81*i], 81);
+        blockHashes[i] = &blocks[i]->blockHash;
+        headers[i] = &buf[81*i];
+        lens[i] = 80;
+    }
+    
+    BRSHA256_2Batch(blockHashes, headers, lens, count);
+    if (lens) free(lens);
+    if (headers) free(headers);
+    if (blockHashes) free(blockHashes);
+}
+
+// writes the 80 byte block header to buf
+static void _BRMerkleBlockSerializeHeader(const BRMerkleBlock *block, uint8_t *buf)
+{
+    size_t off = 0;
+    
+    UInt32SetLE(&buf[off], block->version);
+    off += sizeof(uint32_t);
+    UInt256Set(&buf[off], block->prevBlock);
+    off += sizeof(UInt256);
+    UInt256Set(&buf[off], block->merkleRoot);
+    off += sizeof(UInt256);
+    UInt32SetLE(&buf[off], block->timestamp);
+    off += sizeof(uint32_t);
+    UInt32SetLE(&buf[off], block->target);
+    off += sizeof(uint32_t);
+    UInt32SetLE(&buf[off], block->nonce);
+}
+
+// computes the proof-of-work hash for each block that doesn't already have one, so that it's only computed for blocks
+// that are kept - the hashes are computed together, which is much faster than computing them one by one
+void BRMerkleBlockSetPowHashes(BRMerkleBlock *blocks[], size_t count)
+{
+    uint8_t *buf = (count > 0) ? malloc(count*80) : NULL;
+    void **powHashes = (count > 0) ? malloc(count*sizeof(*powHashes)) : NULL;
+    const void **headers = (count > 0) ? malloc(count*sizeof(*headers)) : NULL;
+    size_t n = 0;
+    
+    assert(blocks != NULL || count == 0);
+    assert(buf != NULL || count == 0);
+    assert(powHashes != NULL || count == 0);
+    assert(headers != NULL || count == 0);
+    
+    for (size_t i = 0; i < count; i++) {
+        if (! UInt256IsZero(blocks[i]->powHash)) continue;
+        _BRMerkleBlockSerializeHeader(blocks[i], &buf[n*80]);
+        powHashes[n] = &blocks[i]->powHash;
+        headers[n] = &buf[n*80];
+        n++;
+    }
+    
+    BRScryptCtxDeriveBatch(_BRMerkleBlockScryptCtx(), powHashes, sizeof(UInt256), headers, 80, headers, 80, n,
+                           1024, 1, 1);
+    if (headers) free(headers);
+    if (powHashes) free(powHashes);
+    if (buf) free(buf);
+}
+
 // returns number of bytes written to buf, or total bufLen needed if buf is NULL (block->height is not serialized)
 size_t BRMerkleBlockSerialize(const BRMerkleBlock *block, uint8_t *buf, size_t bufLen)
 {
@@ -143,18 +328,8 @@ size_t BRMerkleBlockSerialize(const BRMerkleBlock *block, uint8_t *buf, size_t b
     }
     
     if (buf && len <= bufLen) {
-        UInt32SetLE(&buf[off], block->version);
-        off += sizeof(uint32_t);
-        UInt256Set(&buf[off], block->prevBlock);
-        off += sizeof(UInt256);
-        UInt256Set(&buf[off], block->merkleRoot);
-        off += sizeof(UInt256);
-        UInt32SetLE(&buf[off], block->timestamp);
-        off += sizeof(uint32_t);
-        UInt32SetLE(&buf[off], block->target);
-        off += sizeof(uint32_t);
-        UInt32SetLE(&buf[off], block->nonce);
-        off += sizeof(uint32_t);
+        _BRMerkleBlockSerializeHeader(block, buf);
+        off += 80;
     
         if (block->totalTx > 0) {
             UInt32SetLE(&buf[off], block->totalTx);
@@ -171,41 +346,107 @@ size_t BRMerkleBlockSerialize(const BRMerkleBlock *block, uint8_t *buf, size_t b
     return (! buf || len <= bufLen) ? len : 0;
 }
 
-static size_t _BRMerkleBlockTxHashesR(const BRMerkleBlock *block, UInt256 *txHashes, size_t hashesCount, size_t *idx,
-                                      size_t *hashIdx, size_t *flagIdx, int depth)
+// walks the partial merkle tree in depth-first order, consuming flags and hashes the same way they were encoded, using
+// a fixed size stack instead of recursion since the tree is never more than 32 levels deep - writes up to hashesCount
+// matched tx hashes to txHashes, and if root isn't NULL, sets it to the merkle root, found by hashing the nodes that
+// were walked a level at a time from the bottom up, so all the nodes of a level are hashed together in simd lanes
+// returns number of matched tx hashes found
+// NOTE: this merkle tree design has a security vulnerability (CVE-2012-2459), which can be defended against by
+// considering the merkle root invalid if there are duplicate hashes in any rows with an even number of elements
+static size_t _BRMerkleBlockWalk(const BRMerkleBlock *block, UInt256 *txHashes, size_t hashesCount, UInt256 *root)
 {
+    // both branches of every internal node are walked, and the leaves are either hashes, or up to 33 missing nodes once
+    // the walk runs out of flags or hashes, so there are at most 2*(block->hashesCount + 33) nodes
+    struct { UInt256 md; uint8_t depth, internal; } _nodes[128], *nodes = _nodes; // visited nodes, depth-first order
+    UInt256 _pairs[128], *pairs = _pairs; // left and right branch hashes of the internal nodes of one level
+    uint32_t _order[128], *order = _order, start[34], end[33]; // node indexes sorted by depth, left to right
+    uint8_t right[33]; // true when the left branch of the node at depth d is done, and the right branch is next
+    size_t max = (root) ? 2*block->hashesCount + 67 : 0, nodesCount = 0, count = 0, hashIdx = 0, flagIdx = 0, i, j, n;
+    int depth = 0, maxDepth = 0, internal, r = 1;
+    UInt256 md;
     uint8_t flag;
     
-    if (*flagIdx/8 < block->flagsLen && *hashIdx < block->hashesCount) {
-        flag = (block->flags[*flagIdx/8] & (1 << (*flagIdx % 8)));
-        (*flagIdx)++;
+    if (max > sizeof(_nodes)/sizeof(*_nodes)) {
+        nodes = malloc(max*sizeof(*nodes));
+        pairs = malloc(max*sizeof(*pairs));
+        order = malloc(max*sizeof(*order));
+        assert(nodes != NULL && pairs != NULL && order != NULL);
+    }
+    
+    while (maxDepth < 32 && ((uint64_t)1 << maxDepth) < block->totalTx) maxDepth++; // ceil(log2(totalTx))
     
-        if (! flag || depth == _ceil_log2(block->totalTx)) {
-            if (flag && *idx < hashesCount) {
-                if (txHashes) txHashes[*idx] = block->hashes[*hashIdx]; // leaf
-                (*idx)++;
+    for (;;) {
+        md = UINT256_ZERO; // node is missing if we run out of flags or hashes
+        internal = 0;
+        
+        if (flagIdx/8 < block->flagsLen && hashIdx < block->hashesCount) {
+            flag = (block->flags[flagIdx/8] & (1 << (flagIdx % 8)));
+            flagIdx++;
+            
+            if (flag && depth != maxDepth) internal = 1; // internal node, its hash is found once its branches are
+            else md = UInt256Get(&block->hashes[hashIdx++]); // leaf, hashes aren't necessarily aligned in a block view
+            
+            if (flag && ! internal && count < hashesCount) {
+                if (txHashes) txHashes[count] = md;
+                count++;
             }
+        }
         
-            (*hashIdx)++;
+        if (root) {
+            assert(nodesCount < max);
+            nodes[nodesCount].md = md, nodes[nodesCount].depth = (uint8_t)depth;
+            nodes[nodesCount++].internal = (uint8_t)internal;
         }
-        else {
-            _BRMerkleBlockTxHashesR(block, txHashes, hashesCount, idx, hashIdx, flagIdx, depth + 1); // left branch
-            _BRMerkleBlockTxHashesR(block, txHashes, hashesCount, idx, hashIdx, flagIdx, depth + 1); // right branch
+        
+        if (internal) { // walk the left branch next
+            right[depth++] = 0;
+            continue;
         }
+        
+        while (depth > 0 && right[depth - 1]) depth--; // both branches are done, move up a level
+        if (depth == 0) break;
+        right[depth - 1] = 1; // left branch is done, walk the right branch next
     }
-
-    return *idx;
+    
+    if (root) {
+        memset(start, 0, sizeof(start)); // sort the nodes by depth, depth-first order is left to right on each level
+        for (i = 0; i < nodesCount; i++) start[nodes[i].depth + 1]++;
+        for (i = 1; i < sizeof(start)/sizeof(*start); i++) start[i] += start[i - 1];
+        memcpy(end, start, sizeof(end));
+        for (i = 0; i < nodesCount; i++) order[end[nodes[i].depth]++] = (uint32_t)i;
+        
+        for (depth = maxDepth - 1; depth >= 0; depth--) { // the children of a level are the nodes of the level below it
+            for (i = start[depth], j = start[depth + 1], n = 0; i < end[depth]; i++) {
+                if (! nodes[order[i]].internal) continue;
+                assert(j + 1 < end[depth + 1]);
+                pairs[2*n] = nodes[order[j++]].md;
+                pairs[2*n + 1] = nodes[order[j++]].md;
+                if (UInt256IsZero(pairs[2*n]) || UInt256Eq(pairs[2*n], pairs[2*n + 1])) r = 0; // CVE-2012-2459
+                if (UInt256IsZero(pairs[2*n + 1])) pairs[2*n + 1] = pairs[2*n]; // missing right branch, dup left
+                n++;
+            }
+            
+            BRSHA256_2_64Batch(pairs, pairs, n); // the hash of each pair is written over the first n hashes
+            
+            for (i = start[depth], n = 0; i < end[depth]; i++) {
+                if (nodes[order[i]].internal) nodes[order[i]].md = pairs[n++];
+            }
+        }
+        
+        *root = (r) ? nodes[0].md : UINT256_ZERO;
+    }
+    
+    if (nodes != _nodes) free(nodes), free(pairs), free(order);
+    return count;
 }
 
 // populates txHashes with the matched tx hashes in the block
 // returns number of hashes written, or the total hashesCount needed if txHashes is NULL
 size_t BRMerkleBlockTxHashes(const BRMerkleBlock *block, UInt256 *txHashes, size_t hashesCount)
 {
-    size_t idx = 0, hashIdx = 0, flagIdx = 0;
-
     assert(block != NULL);
     
-    return _BRMerkleBlockTxHashesR(block, txHashes, (txHashes) ? hashesCount : SIZE_MAX, &idx, &hashIdx, &flagIdx, 0);
+    return _BRMerkleBlockWalk(block, txHashes, (txHashes) ? hashesCount : SIZE_MAX, NULL);
 }
 
 // sets the hashes and flags fields for a block created with BRMerkleBlockNew()
@@ -222,51 +463,50 @@ void BRMerkleBlockSetTxHashes(BRMerkleBlock *block, const UInt256 hashes[], size
     if (block->flags) free(block->flags);
     block->flags = (flagsLen > 0) ? malloc(flagsLen) : NULL;
     if (block->flags) memcpy(block->flags, flags, flagsLen);
+    block->hashesCount = (block->hashes) ? hashesCount : 0;
+    block->flagsLen = (block->flags) ? flagsLen : 0;
 }
 
-// recursively walks the merkle tree to calculate the merkle root
-// NOTE: this merkle tree design has a security vulnerability (CVE-2012-2459), which can be defended against by
-// considering the merkle root invalid if there are duplicate hashes in any rows with an even number of elements
-static UInt256 _BRMerkleBlockRootR(const BRMerkleBlock *block, size_t *hashIdx, size_t *flagIdx, int depth)
+// true if powHash meets the block's difficulty target
+static int _BRMerkleBlockPoWIsValid(const BRMerkleBlock *block, UInt256 powHash)
 {
-    uint8_t flag;
-    UInt256 hashes[2], md = UINT256_ZERO;
-
-    if (*flagIdx/8 < block->flagsLen && *hashIdx < block->hashesCount) {
-        flag = (block->flags[*flagIdx/8] & (1 << (*flagIdx % 8)));
-        (*flagIdx)++;
-
-        if (flag && depth != _ceil_log2(block->totalTx)) {
-            hashes[0] = _BRMerkleBlockRootR(block, hashIdx, flagIdx, depth + 1); // left branch
-            hashes[1] = _BRMerkleBlockRootR(block, hashIdx, flagIdx, depth + 1); // right branch
-
-            if (! UInt256IsZero(hashes[0]) && ! UInt256Eq(hashes[0], hashes[1])) {
-                if (UInt256IsZero(hashes[1])) hashes[1] = hashes[0]; // if right branch is missing, dup left branch
-                BRSHA256_2(&md, hashes, sizeof(hashes));
-            }
-            else *hashIdx = SIZE_MAX; // defend against (CVE-2012-2459)
+    // target is in "compact" format, where the most significant byte is the size of resulting value in bytes, the next
+    // bit is the sign, and the remaining 23bits is the value after having been right shifted by (size - 3)*8 bits
+    const uint32_t size = block->target >> 24, target = block->target & 0x00ffffff;
+    UInt256 t = UINT256_ZERO;
+    int r = 1;
+    
+    if (size > (MAX_PROOF_OF_WORK >> 24)) return 0; // target is out of range
+    if (size > 3) UInt32SetLE(&t.u8[size - 3], target);
+    else UInt32SetLE(t.u8, target >> (3 - size)*8);
+    
+    for (int i = sizeof(t) - 1; r && i >= 0; i--) { // check proof-of-work
+        if (powHash.u8[i] < t.u8[i]) break;
+        if (powHash.u8[i] > t.u8[i]) {
+            HUGOLOG("invalid pow [%d]: %x - %x", i, powHash.u8[i], t.u8[i]);
+            r = 0;
         }
-        else md = block->hashes[(*hashIdx)++]; // leaf
     }
     
-    return md;
+    return r;
 }
 
-// true if merkle tree and timestamp are valid, and proof-of-work matches the stated difficulty target
-// NOTE: this only checks if the block difficulty matches the difficulty target in the header, it does not check if the
-// target is correct for the block's height in the chain - use BRMerkleBlockVerifyDifficulty() for that
-int BRMerkleBlockIsValid(const BRMerkleBlock *block, uint32_t currentTime)
+// same as BRMerkleBlockIsValidExceptPoW(), but also writes the matched tx hashes in the block to txHashes, which must
+// have room for block->hashesCount hashes, and sets txCount to the number written - the merkle root and the matched
+// tx hashes are found in a single walk of the partial merkle tree
+int BRMerkleBlockValidateTxHashes(const BRMerkleBlock *block, uint32_t currentTime, UInt256 *txHashes, size_t *txCount)
 {
     assert(block != NULL);
+    assert(txHashes != NULL || txCount == NULL);
     
-    // target is in "compact" format, where the most significant byte is the size of resulting value in bytes, the next
-    // bit is the sign, and the remaining 23bits is the value after having been right shifted by (size - 3)*8 bits
     static const uint32_t maxsize = MAX_PROOF_OF_WORK >> 24, maxtarget = MAX_PROOF_OF_WORK & 0x00ffffff;
     const uint32_t size = block->target >> 24, target = block->target & 0x00ffffff;
-    size_t hashIdx = 0, flagIdx = 0;
-    UInt256 merkleRoot = _BRMerkleBlockRootR(block, &hashIdx, &flagIdx, 0), t = UINT256_ZERO;
+    UInt256 merkleRoot = UINT256_ZERO;
+    size_t count = _BRMerkleBlockWalk(block, txHashes, (txHashes) ? block->hashesCount : 0, &merkleRoot);
     int r = 1;
     
+    if (txCount) *txCount = count;
+    
     // check if merkle root is correct
     if (block->totalTx > 0 && ! UInt256Eq(merkleRoot, block->merkleRoot)) {
         HUGOLOG("invalid merkleRoot: %s - %s", u256_hex_encode(merkleRoot), u256_hex_encode(block->merkleRoot));
@@ -285,18 +525,43 @@ int BRMerkleBlockIsValid(const BRMerkleBlock *block, uint32_t currentTime)
         r = 0;
     }
     
-    if (size > 3) UInt32SetLE(&t.u8[size - 3], target);
-    else UInt32SetLE(t.u8, target >> (3 - size)*8);
+    return r;
+}
+
+// true if merkle tree and timestamp are valid, and the difficulty target is in range, without checking proof-of-work
+// proof-of-work can then be checked with BRMerkleBlockVerifyPoW() only for blocks that are kept
+int BRMerkleBlockIsValidExceptPoW(const BRMerkleBlock *block, uint32_t currentTime)
+{
+    return BRMerkleBlockValidateTxHashes(block, currentTime, NULL, NULL);
+}
+
+// computes the proof-of-work hash if the block doesn't already have one, and returns true if it matches the stated
+// difficulty target
+int BRMerkleBlockVerifyPoW(BRMerkleBlock *block)
+{
+    assert(block != NULL);
+    BRMerkleBlockSetPowHashes(&block, 1);
+    return _BRMerkleBlockPoWIsValid(block, block->powHash);
+}
+
+// true if merkle tree and timestamp are valid, and proof-of-work matches the stated difficulty target
+// NOTE: this only checks if the block difficulty matches the difficulty target in the header, it does not check if the
+// target is correct for the block's height in the chain - use BRMerkleBlockVerifyDifficulty() for that
+int BRMerkleBlockIsValid(const BRMerkleBlock *block, uint32_t currentTime)
+{
+    uint8_t buf[80];
+    UInt256 powHash;
     
-    for (int i = sizeof(t) - 1; r && i >= 0; i--) { // check proof-of-work
-        if (block->powHash.u8[i] < t.u8[i]) break;
-        if (block->powHash.u8[i] > t.u8[i]) {
-            HUGOLOG("invalid pow [%d]: %x - %x", i, block->powHash.u8[i], t.u8[i]);
-            r = 0;
-        }
+    assert(block != NULL);
+    if (! BRMerkleBlockIsValidExceptPoW(block, currentTime)) return 0;
+    powHash = block->powHash;
+    
+    if (UInt256IsZero(powHash)) { // proof-of-work hash hasn't been computed yet
+        _BRMerkleBlockSerializeHeader(block, buf);
+        BRScryptCtxDerive(_BRMerkleBlockScryptCtx(), &powHash, sizeof(powHash), buf, 80, buf, 80, 1024, 1, 1);
     }
     
-    return r;
+    return _BRMerkleBlockPoWIsValid(block, powHash);
 }
 
 // true if the given tx hash is known to be included in the block
@@ -308,7 +573,7 @@ int BRMerkleBlockContainsTxHash(const BRMerkleBlock *block, UInt256 txHash)
     assert(! UInt256IsZero(txHash));
     
     for (size_t i = 0; ! r && i < block->hashesCount; i++) {
-        if (UInt256Eq(block->hashes[i], txHash)) r = 1;
+        if (UInt256Eq(UInt256Get(&block->hashes[i]), txHash)) r = 1;
     }
     
     return r;
@@ -326,6 +591,19 @@ int BRMerkleBlockContainsTxHash(const BRMerkleBlock *block, UInt256 txHash)
 // the previous difficulty, the change is limited to either 4x or 1/4. There is also a minimum difficulty value
 // intuitively named MAX_PROOF_OF_WORK... since larger values are less difficult.
 int BRMerkleBlockVerifyDifficulty(const BRMerkleBlock *block, const BRMerkleBlock *previous, uint32_t transitionTime)
+{
+    BRBlockHeader header;
+    
+    assert(block != NULL);
+    assert(previous != NULL);
+    
+    BRBlockHeaderSet(&header, previous);
+    return BRMerkleBlockVerifyDifficultyHeader(block, &header, transitionTime);
+}
+
+// same as BRMerkleBlockVerifyDifficulty(), but previous is a chain entry header
+int BRMerkleBlockVerifyDifficultyHeader(const BRMerkleBlock *block, const BRBlockHeader *previous,
+                                        uint32_t transitionTime)
 {
     int r = 1;
     
@@ -67,18 +67,62 @@ typedef struct {
 #define BR_MERKLE_BLOCK_NONE\
     ((BRMerkleBlock) { UINT256_ZERO, 0, UINT256_ZERO, UINT256_ZERO, 0, 0, 0, 0, NULL, 0, NULL, 0, 0 })
 
+// compact chain entry for blocks that are only kept for their header, such as in a chain index - just the 80 byte
+// header fields and height, with the block hash cached (no powHash is kept, since it's verified before adding a block)
+// blockHash is the first field, the same as BRMerkleBlock, so a block header can be looked up using a block, and vice
+// versa, in a BRSet using BRMerkleBlockHash() and BRMerkleBlockEq()
+typedef struct {
+    UInt256 blockHash;
+    uint32_t version;
+    UInt256 prevBlock;
+    UInt256 merkleRoot;
+    uint32_t timestamp; // time interval since unix epoch
+    uint32_t target;
+    uint32_t nonce;
+    uint32_t height;
+} BRBlockHeader;
+
 // returns a newly allocated merkle block struct that must be freed by calling BRMerkleBlockFree()
 BRMerkleBlock *BRMerkleBlockNew(void);
 
+// sets the header fields, blockHash and height of header from block
+void BRBlockHeaderSet(BRBlockHeader *header, const BRMerkleBlock *block);
+
+// returns a merkle block with just the header fields, blockHash and height of header, with no tx hashes, that doesn't
+// need to be freed
+BRMerkleBlock BRBlockHeaderMerkleBlock(const BRBlockHeader *header);
+
 // buf must contain either a serialized merkleblock or header
+// the proof-of-work hash isn't computed until it's needed, see BRMerkleBlockSetPowHashes()
 // returns a merkle block struct that must be freed by calling BRMerkleBlockFree()
 BRMerkleBlock *BRMerkleBlockParse(const uint8_t *buf, size_t bufLen);
 
+// parses a serialized merkleblock or header into block without any allocations - block->hashes and block->flags point
+// into buf, so block is only usable for as long as buf is, and must not be passed to BRMerkleBlockFree()
+// use BRMerkleBlockCopy() to get a block that outlives buf
+// returns true if buf was parsed successfully
+int BRMerkleBlockView(BRMerkleBlock *block, const uint8_t *buf, size_t bufLen);
+
+// returns a newly allocated copy of block, with its own copy of the tx hashes and flags, that must be freed by calling
+// BRMerkleBlockFree()
+BRMerkleBlock *BRMerkleBlockCopy(const BRMerkleBlock *block);
+
+// buf must contain count serialized headers of 81 bytes each, as found in a "headers" message
+// the block hashes for all the headers are computed together, which is much faster than parsing them one by one
+// populates blocks with merkle block structs that must each be freed by calling BRMerkleBlockFree()
+void BRMerkleBlockParseHeaders(BRMerkleBlock *blocks[], const uint8_t *buf, size_t count);
+
+// computes the proof-of-work hash for each block that doesn't already have one (powHash is UINT256_ZERO), so that the
+// expensive scrypt hash is only computed for blocks that are kept - the hashes are computed together, which is much
+// faster than computing them one by one
+void BRMerkleBlockSetPowHashes(BRMerkleBlock *blocks[], size_t count);
+
 // returns number of bytes written to buf, or total bufLen needed if buf is NULL (block->height is not serialized)
 size_t BRMerkleBlockSerialize(const BRMerkleBlock *block, uint8_t *buf, size_t bufLen);
 
 // populates txHashes with the matched tx hashes in the block
 // returns number of tx hashes written, or the total hashesCount needed if txHashes is NULL
+// the number of matched tx hashes is never more than block->hashesCount, so txHashes can be sized for that up front
 size_t BRMerkleBlockTxHashes(const BRMerkleBlock *block, UInt256 *txHashes, size_t hashesCount);
 
 // sets the hashes and flags fields for a block created with BRMerkleBlockNew()
@@ -88,8 +132,21 @@ void BRMerkleBlockSetTxHashes(BRMerkleBlock *block, const UInt256 hashes[], size
 // true if merkle tree and timestamp are valid, and proof-of-work matches the stated difficulty target
 // NOTE: this only checks if the block difficulty matches the difficulty target in the header, it does not check if the
 // target is correct for the block's height in the chain - use BRMerkleBlockVerifyDifficulty() for that
+// if the proof-of-work hash hasn't been computed yet, it's computed without being stored in block
 int BRMerkleBlockIsValid(const BRMerkleBlock *block, uint32_t currentTime);
 
+// same as BRMerkleBlockIsValid(), but without checking proof-of-work, only that the difficulty target is in range
+int BRMerkleBlockIsValidExceptPoW(const BRMerkleBlock *block, uint32_t currentTime);
+
+// same as BRMerkleBlockIsValidExceptPoW(), but also writes the matched tx hashes in the block to txHashes, which must
+// have room for block->hashesCount hashes, and sets txCount to the number written - the merkle root and the matched
+// tx hashes are found in a single walk of the partial merkle tree
+int BRMerkleBlockValidateTxHashes(const BRMerkleBlock *block, uint32_t currentTime, UInt256 *txHashes, size_t *txCount);
+
+// computes the proof-of-work hash if the block doesn't already have one, and returns true if it matches the stated
+// difficulty target
+int BRMerkleBlockVerifyPoW(BRMerkleBlock *block);
+
 // true if the given tx hash is known to be included in the block
 int BRMerkleBlockContainsTxHash(const BRMerkleBlock *block, UInt256 txHash);
 
@@ -98,6 +155,10 @@ int BRMerkleBlockContainsTxHash(const BRMerkleBlock *block, UInt256 txHash);
 // transitionTime may be 0 if block->height is not a multiple of BLOCK_DIFFICULTY_INTERVAL
 int BRMerkleBlockVerifyDifficulty(const BRMerkleBlock *block, const BRMerkleBlock *previous, uint32_t transitionTime);
 
+// same as BRMerkleBlockVerifyDifficulty(), but previous is a chain entry header
+int BRMerkleBlockVerifyDifficultyHeader(const BRMerkleBlock *block, const BRBlockHeader *previous,
+                                        uint32_t transitionTime);
+
 // returns a hash value for block suitable for use in a hashtable
 inline static size_t BRMerkleBlockHash(const void *block)
 {
@@ -38,11 +38,22 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <netdb.h>
+#include <poll.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/time.h>
 #include <netinet/in.h>	
 #include <arpa/inet.h>
 
+#if defined(__linux__) // linux based systems have epoll, timerfd and eventfd for the single threaded peer reactor
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#define PEER_REACTOR 1
+#else
+#define PEER_REACTOR 0
+#endif
+
 #if BITCOIN_TESTNET
 #define MAGIC_NUMBER 0xf1c8d2fd
 #else
@@ -57,6 +68,15 @@
 #define LOCAL_HOST         ((UInt128) { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff, 0x7f, 0x00, 0x00, 0x01 })
 #define CONNECT_TIMEOUT    3.0
 #define MESSAGE_TIMEOUT    10.0
+#define HEADERS_CHUNK      64 // number of headers a worker thread hashes at a time
+#define MAX_HEADERS_THREADS 8 // maximum number of worker threads used to hash headers
+#define REACTOR_EVENTS     64 // maximum number of socket events the reactor thread handles per wakeup
+#define RECV_BUFFER_SIZE   0x10000 // initial size of a peer's receive buffer, it grows to fit larger messages
+#define SEND_BUFFER_SIZE   0x4000 // initial size of a peer's send queue, it grows to fit whatever the socket won't take
+#define MAX_SEND_QUEUE     0x400000 // peers this far behind reading what we send are disconnected, over twice the
+                                    // size of the largest message we send, a getdata with MAX_GETDATA_HASHES items
+#define MSG_TYPES_MAX      PEER_STATS_TYPES // maximum number of message types in the handler table, each has stats
+#define MSG_INDEX_SIZE     128 // slots in the message type hash index, a power of 2 that's at least 2*MSG_TYPES_MAX
 
 // the standard blockchain download protocol works as follows (for SPV mode):
 // - local peer sends getblocks
@@ -93,6 +113,45 @@ typedef enum {
     inv_filtered_block = 3
 } inv_type;
 
+// message types are interned to these when a message is received, and used to index the message handler table
+typedef enum {
+    msg_unknown = 0,
+    msg_version,
+    msg_verack,
+    msg_addr,
+    msg_inv,
+    msg_tx,
+    msg_headers,
+    msg_getaddr,
+    msg_getdata,
+    msg_notfound,
+    msg_ping,
+    msg_pong,
+    msg_merkleblock,
+    msg_reject,
+    msg_feefilter,
+    msg_getblocks, // types from here on are only sent, they're in the handler table for their stats
+    msg_getheaders,
+    msg_block,
+    msg_mempool,
+    msg_filterload,
+    msg_filteradd,
+    msg_filterclear,
+    msg_alert,
+    msg_builtin_count // types registered with BRPeerSetMessageHandler() are numbered from here
+} msg_type;
+
+typedef struct {
+    uint8_t *headers; // copy of the serialized headers from a "headers" message
+    BRMerkleBlock **blocks;
+    size_t count;
+    size_t nextChunk; // next chunk of headers to be claimed by a worker thread
+    size_t doneCount; // number of chunks that have been hashed and validated
+    size_t invalid; // index of the first invalid header, or count if all headers are valid
+    uint32_t now;
+    uint32_t keepTime; // headers newer than a week before this are discarded by the peer manager, so skip their pow
+} BRHeadersJob;
+
 typedef struct {
     BRPeer peer; // superstruct on top of BRPeer
     char host[INET6_ADDRSTRLEN];
@@ -118,6 +177,7 @@ typedef struct {
     void (*hasTx)(void *info, UInt256 txHash);
     void (*rejectedTx)(void *info, UInt256 txHash, uint8_t code);
     void (*relayedBlock)(void *info, BRMerkleBlock *block);
+    void (*relayedHeaders)(void *info, BRMerkleBlock *blocks[], size_t blocksCount);
     void (*notfound)(void *info, const UInt256 txHashes[], size_t txCount, const UInt256 blockHashes[],
                      size_t blockCount);
     void (*setFeePerKb)(void *info, uint64_t feePerKb);
@@ -128,9 +188,46 @@ typedef struct {
     void (**pongCallback)(void *info, int success);
     void *mempoolInfo;
     void (*mempoolCallback)(void *info, int success);
+    BRHeadersJob **headersJobs; // headers waiting to be relayed, in the order they were received
     pthread_t thread;
+    int reactor; // true if the peer is serviced by the shared reactor thread instead of its own thread
+    int reactorConnecting; // true while the reactor thread waits for the socket connection to complete
+    int reactorError; // errno.h code the reactor thread will disconnect the peer with, or 0
+    int reactorParked; // true while the next received message waits for queued headers, so the socket isn't read
+    int reactorDone; // true once the reactor thread is only waiting for queued headers to disconnect the peer
+    uint8_t *recvBuf; // bytes recvStart to recvEnd have been received, but not yet accepted as a complete message
+    size_t recvStart, recvEnd, recvCapacity;
+    uint8_t *sendBuf; // bytes sendStart to sendEnd are queued messages the socket hasn't taken yet
+    size_t sendStart, sendEnd, sendCapacity;
+    pthread_mutex_t sendLock; // held while the send queue is added to or sent from, or while stats are updated
+    uint32_t reactorEvents; // the epoll events the reactor thread is waiting on for the peer's socket
+    double msgTimeout;
+    BRPeerStats stats; // per type counters, the totals are filled in by BRPeerGetStats()
+    double idleStart; // when the last data received from the peer was done being handled, or 0 if not connected,
+                      // only changed with the send lock held, along with stats
+    double sendBlockedStart; // when the socket stopped taking everything queued to send, or 0 if nothing is queued
 } BRPeerContext;
 
+// worker threads shared by all peers, so that hashing headers doesn't hold up reading from the peer's socket
+static pthread_mutex_t _headersLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _headersQueued = PTHREAD_COND_INITIALIZER, _headersDone = PTHREAD_COND_INITIALIZER;
+static BRHeadersJob **_headersQueue = NULL; // jobs with chunks that haven't been claimed by a worker thread yet
+static pthread_t _headersThreads[MAX_HEADERS_THREADS];
+static size_t _headersThreadCount = 0;
+static int _headersStarted = 0, _headersStopping = 0;
+
+// reactor thread shared by all peers connected while the reactor is enabled, see BRPeerSetReactorEnabled()
+static int _reactorEnabled = 0;
+#if PEER_REACTOR
+static pthread_mutex_t _reactorLock = PTHREAD_MUTEX_INITIALIZER;
+static BRPeerContext **_reactorPeers = NULL; // peers serviced by the reactor thread
+static pthread_t _reactorThread;
+static int _reactorFd = -1, _reactorTimerFd = -1, _reactorWakeFd = -1, _reactorStopping = 0;
+#endif
+
+static void _BRPeerReactorWake(void);
+static void _BRPeerFlush(BRPeer *peer);
+
 void BRPeerSendVersionMessage(BRPeer *peer);
 void BRPeerSendVerackMessage(BRPeer *peer);
 void BRPeerSendAddr(BRPeer *peer);
@@ -442,6 +539,127 @@ static int _BRPeerAcceptTxMessage(BRPeer *peer, const uint8_t *msg, size_t msgLe
     return r;
 }
 
+// computes proof-of-work for the headers that will be kept, and validates all count headers starting at blocks[i]
+// returns the index of the first invalid header, or i + count if they're all valid
+static size_t _BRPeerValidateHeaders(BRHeadersJob *job, size_t i, size_t count)
+{
+    size_t j, k;
+    
+    for (k = i; k < i + count && job->blocks[k]->timestamp + 7*24*60*60 <= job->keepTime; k++);
+    BRMerkleBlockSetPowHashes(&job->blocks[i], k - i);
+    
+    for (j = i; j < i + count; j++) {
+        if (! BRMerkleBlockIsValidExceptPoW(job->blocks[j], job->now)) break;
+        if (j < k && ! BRMerkleBlockVerifyPoW(job->blocks[j])) break;
+    }
+    
+    return j;
+}
+
+static void *_headersThreadRoutine(void *arg)
+{
+    BRHeadersJob *job;
+    size_t i, j, n;
+    
+    (void)arg; // worker threads all share _headersQueue
+    pthread_mutex_lock(&_headersLock);
+    
+    for (;;) {
+        while (array_count(_headersQueue) == 0 && ! _headersStopping) {
+            pthread_cond_wait(&_headersQueued, &_headersLock);
+        }
+        
+        if (array_count(_headersQueue) == 0) break; // stopping, see BRPeerStopThreads()
+        job = _headersQueue[0];
+        i = (job->nextChunk++)*HEADERS_CHUNK;
+        if (job->nextChunk*HEADERS_CHUNK >= job->count) array_rm(_headersQueue, 0);
+        pthread_mutex_unlock(&_headersLock);
+        
+        n = (job->count - i < HEADERS_CHUNK) ? job->count - i : HEADERS_CHUNK;
+        BRMerkleBlockParseHeaders(&job->blocks[i], &job->headers[81*i], n);
+        j = _BRPeerValidateHeaders(job, i, n);
+        
+        pthread_mutex_lock(&_headersLock);
+        if (j < i + n && j < job->invalid) job->invalid = j;
+        
+        if (++job->doneCount*HEADERS_CHUNK >= job->count) {
+            pthread_cond_broadcast(&_headersDone);
+            _BRPeerReactorWake(); // the reactor thread relays finished headers when it wakes
+        }
+    }
+    
+    pthread_mutex_unlock(&_headersLock);
+    return NULL; // joined by BRPeerStopThreads()
+}
+
+// starts the worker threads, if they aren't already running, and returns the number of them
+static size_t _BRPeerHeadersThreadsStart(void)
+{
+    long cpuCount = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t count = (cpuCount < 1) ? 1 : (cpuCount > MAX_HEADERS_THREADS) ? MAX_HEADERS_THREADS : (size_t)cpuCount;
+    
+    pthread_mutex_lock(&_headersLock);
+    
+    if (! _headersStarted) {
+        if (! _headersQueue) array_new(_headersQueue, 10);
+        
+        for (size_t i = 0; i < count; i++) {
+            if (pthread_create(&_headersThreads[_headersThreadCount], NULL, _headersThreadRoutine, NULL) == 0) {
+                _headersThreadCount++;
+            }
+        }
+        
+        _headersStarted = 1;
+    }
+    
+    count = _headersThreadCount;
+    pthread_mutex_unlock(&_headersLock);
+    return count;
+}
+
+// relays headers hashed by the worker threads, in the order they were received
+// if wait is true, waits for all queued headers to finish, otherwise stops at the first unfinished headers message
+// if discard is true, the headers are freed instead of relayed
+// returns false if any of the headers were invalid
+static int _BRPeerRelayHeaders(BRPeer *peer, int wait, int discard)
+{
+    BRPeerContext *ctx = (BRPeerContext *)peer;
+    BRHeadersJob *job;
+    size_t i, count;
+    int done, r = 1;
+    
+    while (array_count(ctx->headersJobs) > 0) {
+        job = ctx->headersJobs[0];
+        pthread_mutex_lock(&_headersLock);
+        while (wait && job->doneCount*HEADERS_CHUNK < job->count) pthread_cond_wait(&_headersDone, &_headersLock);
+        done = (job->doneCount*HEADERS_CHUNK >= job->count);
+        pthread_mutex_unlock(&_headersLock);
+        if (! done) break;
+        array_rm(ctx->headersJobs, 0);
+        count = (r && ! discard) ? job->invalid : 0; // nothing after an invalid header is relayed
+        
+        if (count < job->count && r && ! discard) {
+            peer_log(peer, "invalid block header: %s", u256_hex_encode(job->blocks[count]->blockHash));
+        }
+        
+        if (count > 0 && ctx->relayedHeaders) {
+            ctx->relayedHeaders(ctx->info, job->blocks, count);
+        }
+        else if (ctx->relayedBlock) {
+            for (i = 0; i < count; i++) ctx->relayedBlock(ctx->info, job->blocks[i]);
+        }
+        else for (i = 0; i < count; i++) BRMerkleBlockFree(job->blocks[i]);
+        
+        for (i = count; i < job->count; i++) BRMerkleBlockFree(job->blocks[i]);
+        if (job->invalid < job->count) r = 0;
+        free(job->headers);
+        free(job->blocks);
+        free(job);
+    }
+    
+    return r;
+}
+
 static int _BRPeerAcceptHeadersMessage(BRPeer *peer, const uint8_t *msg, size_t msgLen)
 {
     BRPeerContext *ctx = (BRPeerContext *)peer;
@@ -481,18 +699,30 @@ static int _BRPeerAcceptHeadersMessage(BRPeer *peer, const uint8_t *msg, size_t
             }
             else BRPeerSendGetheaders(peer, locators, 2, UINT256_ZERO);
 
-            for (size_t i = 0; r && i < count; i++) {
-                BRMerkleBlock *block = BRMerkleBlockParse(&msg[off + 81*i], 81);
-                
-                if (! BRMerkleBlockIsValid(block, (uint32_t)now)) {
-                    peer_log(peer, "invalid block header: %s", u256_hex_encode(block->blockHash));
-                    BRMerkleBlockFree(block);
-                    r = 0;
-                }
-                else if (ctx->relayedBlock) {
-                    ctx->relayedBlock(ctx->info, block);
-                }
-                else BRMerkleBlockFree(block);
+            BRHeadersJob *job = calloc(1, sizeof(*job));
+            
+            assert(job != NULL);
+            job->headers = malloc(81*count); // msg is reused for the next message, so the headers must be copied
+            job->blocks = malloc(count*sizeof(*job->blocks)); // count can be too large for the stack
+            assert(job->headers != NULL);
+            assert(job->blocks != NULL);
+            memcpy(job->headers, &msg[off], 81*count);
+            job->count = job->invalid = count;
+            job->now = (uint32_t)now;
+            job->keepTime = ctx->earliestKeyTime + BLOCK_MAX_TIME_DRIFT;
+            array_add(ctx->headersJobs, job);
+            
+            if (_BRPeerHeadersThreadsStart() > 0) { // hash and validate headers on worker threads, relay them once done
+                pthread_mutex_lock(&_headersLock);
+                array_add(_headersQueue, job);
+                pthread_cond_broadcast(&_headersQueued);
+                pthread_mutex_unlock(&_headersLock);
+            }
+            else { // no worker threads could be started, so hash and validate headers right here
+                BRMerkleBlockParseHeaders(job->blocks, job->headers, count);
+                job->invalid = _BRPeerValidateHeaders(job, 0, count);
+                job->nextChunk = job->doneCount = (count + HEADERS_CHUNK - 1)/HEADERS_CHUNK;
+                r = _BRPeerRelayHeaders(peer, 1, 0);
             }
         }
         else {
@@ -687,49 +917,46 @@ static int _BRPeerAcceptMerkleblockMessage(BRPeer *peer, const uint8_t *msg, siz
     // a merkleblock message, the remote node is expected to send tx messages for the tx referenced in the block. When a
     // non-tx message is received we should have all the tx in the merkleblock.
     BRPeerContext *ctx = (BRPeerContext *)peer;
-    BRMerkleBlock *block = BRMerkleBlockParse(msg, msgLen);
-    int r = 1;
+    BRMerkleBlock view, *block = NULL;
+    int r = BRMerkleBlockView(&view, msg, msgLen); // view points into msg, so nothing is allocated unless it's kept
+    size_t count = (r) ? view.hashesCount : 0; // upper bound on the number of matched tx hashes
+    UInt256 _hashes[0x1000/sizeof(UInt256)],
+            *hashes = (count <= sizeof(_hashes)/sizeof(*_hashes)) ? _hashes : malloc(count*sizeof(*hashes));
+    
+    assert(hashes != NULL);
   
-    if (! block) {
+    if (! r) {
         peer_log(peer, "malformed merkleblock message with length: %zu", msgLen);
-        r = 0;
     }
-    else if (! BRMerkleBlockIsValid(block, (uint32_t)time(NULL))) {
-        peer_log(peer, "invalid merkleblock: %s", u256_hex_encode(block->blockHash));
-        BRMerkleBlockFree(block);
-        block = NULL;
+    else if (! BRMerkleBlockValidateTxHashes(&view, (uint32_t)time(NULL), hashes, &count)) { // pow is checked if kept
+        peer_log(peer, "invalid merkleblock: %s", u256_hex_encode(view.blockHash));
         r = 0;
     }
     else if (! ctx->sentFilter && ! ctx->sentGetdata) {
         peer_log(peer, "got merkleblock message before loading a filter");
-        BRMerkleBlockFree(block);
-        block = NULL;
         r = 0;
     }
     else {
-        size_t count = BRMerkleBlockTxHashes(block, NULL, 0);
-        UInt256 _hashes[(sizeof(UInt256)*count <= 0x1000) ? count : 0],
-                *hashes = (sizeof(UInt256)*count <= 0x1000) ? _hashes : malloc(count*sizeof(*hashes));
-        
-        assert(hashes != NULL);
-        count = BRMerkleBlockTxHashes(block, hashes, count);
-
         for (size_t i = count; i > 0; i--) { // reverse order for more efficient removal as tx arrive
             if (BRSetContains(ctx->knownTxHashSet, &hashes[i - 1])) continue;
             array_add(ctx->currentBlockTxHashes, hashes[i - 1]);
         }
-
-        if (hashes != _hashes) free(hashes);
+        
+        // the partial merkle tree is only needed for the matched tx hashes, so don't copy it if there aren't any, see
+        // relayedBlock in BRPeerSetCallbacks()
+        if (count == 0) view.hashes = NULL, view.hashesCount = 0, view.flags = NULL, view.flagsLen = 0;
+        
+        // the block only needs its own copy if it outlives msg, waiting for tx messages or passed to relayedBlock
+        if (array_count(ctx->currentBlockTxHashes) > 0 || ctx->relayedBlock) block = BRMerkleBlockCopy(&view);
     }
 
+    if (hashes != _hashes) free(hashes);
+
     if (block) {
         if (array_count(ctx->currentBlockTxHashes) > 0) { // wait til we get all tx messages before processing the block
             ctx->currentBlock = block;
         }
-        else if (ctx->relayedBlock) {
-            ctx->relayedBlock(ctx->info, block);
-        }
-        else BRMerkleBlockFree(block);
+        else ctx->relayedBlock(ctx->info, block);
     }
 
     return r;
@@ -805,40 +1032,324 @@ static int _BRPeerAcceptFeeFilterMessage(BRPeer *peer, const uint8_t *msg, size_
     return r;
 }
 
-static int _BRPeerAcceptMessage(BRPeer *peer, const uint8_t *msg, size_t msgLen, const char *type)
+// message handler table, indexed by msg_type - built in types have an accept function, unless they're only sent, and
+// types registered with BRPeerSetMessageHandler() have a handler and its info pointer
+static struct {
+    char type[12]; // NULL padded, the same as the header type field
+    int (*accept)(BRPeer *peer, const uint8_t *msg, size_t msgLen);
+    void *info;
+    int (*handler)(void *info, BRPeer *peer, const uint8_t *msg, size_t msgLen);
+} _msgHandlers[MSG_TYPES_MAX] = {
+    [msg_version] = { MSG_VERSION, _BRPeerAcceptVersionMessage, NULL, NULL },
+    [msg_verack] = { MSG_VERACK, _BRPeerAcceptVerackMessage, NULL, NULL },
+    [msg_addr] = { MSG_ADDR, _BRPeerAcceptAddrMessage, NULL, NULL },
+    [msg_inv] = { MSG_INV, _BRPeerAcceptInvMessage, NULL, NULL },
+    [msg_tx] = { MSG_TX, _BRPeerAcceptTxMessage, NULL, NULL },
+    [msg_headers] = { MSG_HEADERS, _BRPeerAcceptHeadersMessage, NULL, NULL },
+    [msg_getaddr] = { MSG_GETADDR, _BRPeerAcceptGetaddrMessage, NULL, NULL },
+    [msg_getdata] = { MSG_GETDATA, _BRPeerAcceptGetdataMessage, NULL, NULL },
+    [msg_notfound] = { MSG_NOTFOUND, _BRPeerAcceptNotfoundMessage, NULL, NULL },
+    [msg_ping] = { MSG_PING, _BRPeerAcceptPingMessage, NULL, NULL },
+    [msg_pong] = { MSG_PONG, _BRPeerAcceptPongMessage, NULL, NULL },
+    [msg_merkleblock] = { MSG_MERKLEBLOCK, _BRPeerAcceptMerkleblockMessage, NULL, NULL },
+    [msg_reject] = { MSG_REJECT, _BRPeerAcceptRejectMessage, NULL, NULL },
+    [msg_feefilter] = { MSG_FEEFILTER, _BRPeerAcceptFeeFilterMessage, NULL, NULL },
+    [msg_getblocks] = { MSG_GETBLOCKS, NULL, NULL, NULL },
+    [msg_getheaders] = { MSG_GETHEADERS, NULL, NULL, NULL },
+    [msg_block] = { MSG_BLOCK, NULL, NULL, NULL },
+    [msg_mempool] = { MSG_MEMPOOL, NULL, NULL, NULL },
+    [msg_filterload] = { MSG_FILTERLOAD, NULL, NULL, NULL },
+    [msg_filteradd] = { MSG_FILTERADD, NULL, NULL, NULL },
+    [msg_filterclear] = { MSG_FILTERCLEAR, NULL, NULL, NULL },
+    [msg_alert] = { MSG_ALERT, NULL, NULL, NULL }
+};
+
+// open addressed hash index of the message handler table, each slot is a msg_type, or msg_unknown if the slot is empty
+static uint8_t _msgIndex[MSG_INDEX_SIZE];
+static size_t _msgTypesCount = msg_builtin_count;
+static pthread_rwlock_t _msgLock = PTHREAD_RWLOCK_INITIALIZER; // held for reading while the table is looked up
+static pthread_once_t _msgOnce = PTHREAD_ONCE_INIT;
+
+// returns the first hash index slot to probe for a NULL padded 12 byte message type
+inline static size_t _BRPeerMessageSlot(const char *type)
+{
+    uint32_t h = 0x811C9dc5; // FNV_OFFSET
+    
+    for (size_t i = 0; i < 12; i++) h = (h ^ (uint8_t)type[i])*0x01000193; // (h xor type[i])*FNV_PRIME
+    return h & (MSG_INDEX_SIZE - 1);
+}
+
+// returns the hash index slot that holds the given NULL padded 12 byte message type, or the empty slot it belongs in
+static size_t _BRPeerMessageFind(const char *type)
+{
+    size_t i = _BRPeerMessageSlot(type);
+    
+    while (_msgIndex[i] != msg_unknown && memcmp(_msgHandlers[_msgIndex[i]].type, type, 12) != 0) {
+        i = (i + 1) & (MSG_INDEX_SIZE - 1);
+    }
+    
+    return i;
+}
+
+static void _msgIndexBuild(void)
+{
+    for (int t = msg_unknown + 1; t < msg_builtin_count; t++) _msgIndex[_BRPeerMessageFind(_msgHandlers[t].type)] = t;
+}
+
+// interns a message type string, such as the type field of a message header, returns msg_unknown if no handler for
+// the type has been added to the message handler table
+static msg_type _BRPeerMessageType(const char *type)
+{
+    size_t len = strnlen(type, 12);
+    msg_type r;
+    char t[12];
+    
+    pthread_once(&_msgOnce, _msgIndexBuild);
+    memcpy(t, type, len); // NULL pads the type the same way the table does, ignoring anything after a NULL
+    memset(&t[len], 0, sizeof(t) - len);
+    pthread_rwlock_rdlock(&_msgLock);
+    r = _msgIndex[_BRPeerMessageFind(t)];
+    pthread_rwlock_unlock(&_msgLock);
+    return r;
+}
+
+// returns the PEER_STATS_BUCKETS histogram bucket for a msgLen byte payload
+inline static size_t _BRPeerSizeBucket(size_t msgLen)
+{
+    size_t i = 0;
+    
+    while (i + 1 < PEER_STATS_BUCKETS && msgLen >= ((size_t)16 << 2*i)) i++;
+    return i;
+}
+
+// name is only used for logging, it's the type string the message was received with
+static int _BRPeerAcceptMessage(BRPeer *peer, const uint8_t *msg, size_t msgLen, msg_type type, const char *name)
 {
     BRPeerContext *ctx = (BRPeerContext *)peer;
+    int (*handler)(void *info, BRPeer *peer, const uint8_t *msg, size_t msgLen);
+    void *info;
     int r = 1;
     
-    if (ctx->currentBlock && strncmp(MSG_TX, type, 12) != 0) { // if we receive a non-tx message, merkleblock is done
+    if (ctx->currentBlock && type != msg_tx) { // if we receive a non-tx message, merkleblock is done
         peer_log(peer, "incomplete merkleblock %s, expected %zu more tx, got %s",
-                 u256_hex_encode(ctx->currentBlock->blockHash), array_count(ctx->currentBlockTxHashes), type);
+                 u256_hex_encode(ctx->currentBlock->blockHash), array_count(ctx->currentBlockTxHashes), name);
         array_clear(ctx->currentBlockTxHashes);
         ctx->currentBlock = NULL;
         r = 0;
     }
-    else if (strncmp(MSG_VERSION, type, 12) == 0) r = _BRPeerAcceptVersionMessage(peer, msg, msgLen);
-    else if (strncmp(MSG_VERACK, type, 12) == 0) r = _BRPeerAcceptVerackMessage(peer, msg, msgLen);
-    else if (strncmp(MSG_ADDR, type, 12) == 0) r = _BRPeerAcceptAddrMessage(peer, msg, msgLen);
-    else if (strncmp(MSG_INV, type, 12) == 0) r = _BRPeerAcceptInvMessage(peer, msg, msgLen);
-    else if (strncmp(MSG_TX, type, 12) == 0) r = _BRPeerAcceptTxMessage(peer, msg, msgLen);
-    else if (strncmp(MSG_HEADERS, type, 12) == 0) r = _BRPeerAcceptHeadersMessage(peer, msg, msgLen);
-    else if (strncmp(MSG_GETADDR, type, 12) == 0) r = _BRPeerAcceptGetaddrMessage(peer, msg, msgLen);
-    else if (strncmp(MSG_GETDATA, type, 12) == 0) r = _BRPeerAcceptGetdataMessage(peer, msg, msgLen);
-    else if (strncmp(MSG_NOTFOUND, type, 12) == 0) r = _BRPeerAcceptNotfoundMessage(peer, msg, msgLen);
-    else if (strncmp(MSG_PING, type, 12) == 0) r = _BRPeerAcceptPingMessage(peer, msg, msgLen);
-    else if (strncmp(MSG_PONG, type, 12) == 0) r = _BRPeerAcceptPongMessage(peer, msg, msgLen);
-    else if (strncmp(MSG_MERKLEBLOCK, type, 12) == 0) r = _BRPeerAcceptMerkleblockMessage(peer, msg, msgLen);
-    else if (strncmp(MSG_REJECT, type, 12) == 0) r = _BRPeerAcceptRejectMessage(peer, msg, msgLen);
-    else if (strncmp(MSG_FEEFILTER, type, 12) == 0) r = _BRPeerAcceptFeeFilterMessage(peer, msg, msgLen);
-    else peer_log(peer, "dropping %s, length %zu, not implemented", type, msgLen);
+    else if (type != msg_unknown && _msgHandlers[type].accept) r = _msgHandlers[type].accept(peer, msg, msgLen);
+    else {
+        pthread_rwlock_rdlock(&_msgLock); // the handler and its info are set together, see BRPeerSetMessageHandler()
+        handler = (type != msg_unknown) ? _msgHandlers[type].handler : NULL;
+        info = _msgHandlers[type].info;
+        pthread_rwlock_unlock(&_msgLock);
+        if (handler) r = handler(info, peer, msg, msgLen);
+        else peer_log(peer, "dropping %s, length %zu, not implemented", name, msgLen);
+    }
 
     return r;
 }
 
+// checks a message header that starts with the magic number, returns an errno.h code if it's malformed, otherwise 0
+static int _BRPeerCheckHeader(BRPeer *peer, const uint8_t *header)
+{
+    const char *type = (const char *)(&header[4]);
+    uint32_t msgLen = UInt32GetLE(&header[16]);
+    int error = 0;
+    
+    if (header[15] != 0) { // verify header type field is NULL terminated
+        peer_log(peer, "malformed message header: type not NULL terminated");
+        error = EPROTO;
+    }
+    else if (msgLen > MAX_MSG_LENGTH) { // check message length
+        peer_log(peer, "error reading %s, message length %"PRIu32" is too long", type, msgLen);
+        error = EPROTO;
+    }
+    
+    return error;
+}
+
+// verifies the checksum of a complete message, and accepts it once any queued headers it may depend on are relayed
+// returns an errno.h code if the peer should be disconnected, otherwise 0
+static int _BRPeerAcceptPayload(BRPeer *peer, const uint8_t *header, const uint8_t *payload)
+{
+    const char *name = (const char *)(&header[4]);
+    msg_type type = _BRPeerMessageType(name);
+    uint32_t msgLen = UInt32GetLE(&header[16]);
+    uint32_t checksum = UInt32GetLE(&header[20]);
+    BRPeerContext *ctx = (BRPeerContext *)peer;
+    BRPeerMessageStats *stats = &ctx->stats.types[type];
+    struct timeval tv;
+    double start;
+    UInt256 hash;
+    int error = 0;
+    
+    gettimeofday(&tv, NULL);
+    start = tv.tv_sec + (double)tv.tv_usec/1000000;
+    pthread_mutex_lock(&ctx->sendLock); // BRPeerGetStats() copies the stats with the send lock held
+    stats->received++;
+    stats->bytesReceived += HEADER_LENGTH + msgLen;
+    stats->receivedSizes[_BRPeerSizeBucket(msgLen)]++;
+    pthread_mutex_unlock(&ctx->sendLock);
+    BRSHA256_2(&hash, payload, msgLen);
+    
+    if (UInt32GetLE(&hash) != checksum) { // verify checksum
+        peer_log(peer, "error reading %s, invalid checksum %x, expected %x, payload length:%"PRIu32", SHA256_2:%s",
+                 name, UInt32GetLE(&hash), checksum, msgLen, u256_hex_encode(hash));
+        error = EPROTO;
+    }
+    else if (type != msg_headers && ! _BRPeerRelayHeaders(peer, ! ctx->reactor, 0)) {
+        error = EPROTO; // other messages may depend on queued headers, so those go first, see _BRPeerAcceptFrames()
+    }
+    else if (! _BRPeerAcceptMessage(peer, payload, msgLen, type, name)) error = EPROTO;
+    
+    gettimeofday(&tv, NULL);
+    pthread_mutex_lock(&ctx->sendLock);
+    stats->handlerTime += tv.tv_sec + (double)tv.tv_usec/1000000 - start;
+    pthread_mutex_unlock(&ctx->sendLock);
+    return error;
+}
+
+// sets addr to the peer's socket address, and returns its length
+static socklen_t _BRPeerSocketAddress(const BRPeer *peer, struct sockaddr_storage *addr)
+{
+    socklen_t addrLen;
+    
+    memset(addr, 0, sizeof(*addr));
+    
+    if (_BRPeerIsIPv4(peer)) {
+        ((struct sockaddr_in *)addr)->sin_family = AF_INET;
+        ((struct sockaddr_in *)addr)->sin_addr = *(struct in_addr *)&peer->address.u32[3];
+        ((struct sockaddr_in *)addr)->sin_port = htons(peer->port);
+        addrLen = sizeof(struct sockaddr_in);
+    }
+    else {
+        ((struct sockaddr_in6 *)addr)->sin6_family = AF_INET6;
+        ((struct sockaddr_in6 *)addr)->sin6_addr = *(struct in6_addr *)&peer->address;
+        ((struct sockaddr_in6 *)addr)->sin6_port = htons(peer->port);
+        addrLen = sizeof(struct sockaddr_in6);
+    }
+    
+    return addrLen;
+}
+
+// returns the offset of the first magic number in buf, or of a partial magic number at the end of buf, or len if there
+// is neither - memchr() is vectorized, so this skips over garbage much faster than checking one byte at a time
+static size_t _BRPeerFindMagic(const uint8_t *buf, size_t len)
+{
+    const uint8_t *p = buf, *end = buf + len;
+    uint8_t magic[sizeof(uint32_t)];
+    
+    UInt32SetLE(magic, MAGIC_NUMBER);
+    
+    while (p < end && (p = memchr(p, magic[0], end - p)) != NULL) {
+        if (memcmp(p, magic, ((size_t)(end - p) < sizeof(magic)) ? (size_t)(end - p) : sizeof(magic)) == 0) break;
+        p++;
+    }
+    
+    return (p) ? (size_t)(p - buf) : len;
+}
+
+// accepts every complete message in the peer's receive buffer, returns an errno.h code if the peer should be
+// disconnected, otherwise 0 - the reactor thread never waits for the worker threads, so for peers it services, a
+// message that has to wait for queued headers is parked, and accepted by _BRPeerReactorCheck() once they're relayed
+static int _BRPeerAcceptFrames(BRPeer *peer)
+{
+    BRPeerContext *ctx = (BRPeerContext *)peer;
+    int parked = ctx->reactorParked, error = 0;
+    size_t frameLen, len;
+    
+    ctx->reactorParked = 0;
+    
+    while (! error && ctx->socket >= 0) {
+        len = ctx->recvEnd - ctx->recvStart;
+        ctx->recvStart += _BRPeerFindMagic(&ctx->recvBuf[ctx->recvStart], len); // skip anything before the magic number
+        len = ctx->recvEnd - ctx->recvStart;
+        if (len < HEADER_LENGTH) break;
+        error = _BRPeerCheckHeader(peer, &ctx->recvBuf[ctx->recvStart]);
+        frameLen = HEADER_LENGTH + UInt32GetLE(&ctx->recvBuf[ctx->recvStart + 16]);
+        if (error || len < frameLen) break;
+        
+        if (ctx->reactor && array_count(ctx->headersJobs) > 0 &&
+            _BRPeerMessageType((const char *)&ctx->recvBuf[ctx->recvStart + 4]) != msg_headers) {
+            if (! _BRPeerRelayHeaders(peer, 0, 0)) error = EPROTO;
+            ctx->reactorParked = (array_count(ctx->headersJobs) > 0);
+            if (error || ctx->reactorParked) break;
+        }
+        
+        ctx->recvStart += frameLen;
+        error = _BRPeerAcceptPayload(peer, &ctx->recvBuf[ctx->recvStart - frameLen],
+                                     &ctx->recvBuf[ctx->recvStart - frameLen + HEADER_LENGTH]);
+    }
+    
+    if (ctx->recvStart == ctx->recvEnd) ctx->recvStart = ctx->recvEnd = 0;
+    
+    if (ctx->reactorParked != parked && ctx->socket >= 0) { // stop, or resume, reading the socket
+        pthread_mutex_lock(&ctx->sendLock);
+        _BRPeerFlush(peer);
+        pthread_mutex_unlock(&ctx->sendLock);
+    }
+    
+    return error;
+}
+
+// reads as much as is available into the peer's receive buffer with a single read, and accepts every message that's
+// complete, so that small messages don't take separate reads for their header and payload
+// flags are passed to recv(), returns an errno.h code if the peer should be disconnected, otherwise 0
+static int _BRPeerReceive(BRPeer *peer, int flags, double time)
+{
+    BRPeerContext *ctx = (BRPeerContext *)peer;
+    size_t frameLen = 0, len = ctx->recvEnd - ctx->recvStart;
+    int socket = ctx->socket, error = 0;
+    struct timeval tv;
+    ssize_t n;
+    
+    if (len >= HEADER_LENGTH) frameLen = HEADER_LENGTH + UInt32GetLE(&ctx->recvBuf[ctx->recvStart + 16]);
+    
+    // move a partial message to the start of the buffer once it won't fit in the rest of the buffer
+    if (ctx->recvStart > 0 && (ctx->recvEnd == ctx->recvCapacity || ctx->recvStart + frameLen > ctx->recvCapacity)) {
+        memmove(ctx->recvBuf, &ctx->recvBuf[ctx->recvStart], len);
+        ctx->recvStart = 0;
+        ctx->recvEnd = len;
+    }
+    
+    if (! ctx->recvBuf || frameLen > ctx->recvCapacity) {
+        ctx->recvCapacity = (frameLen > RECV_BUFFER_SIZE) ? frameLen : RECV_BUFFER_SIZE;
+        ctx->recvBuf = realloc(ctx->recvBuf, ctx->recvCapacity);
+        assert(ctx->recvBuf != NULL);
+    }
+    
+    n = (socket >= 0) ? recv(socket, &ctx->recvBuf[ctx->recvEnd], ctx->recvCapacity - ctx->recvEnd, flags) : -1;
+    if (n == 0) error = ECONNRESET;
+    if (n < 0 && socket >= 0 && errno != EWOULDBLOCK && errno != EAGAIN && errno != EINTR) error = errno;
+    if (error) peer_log(peer, "%s", strerror(error));
+    if (n > 0) ctx->recvEnd += n;
+    
+    if (n > 0 && ctx->idleStart > 0) { // time spent waiting for the peer to send something
+        gettimeofday(&tv, NULL);
+        pthread_mutex_lock(&ctx->sendLock);
+        ctx->stats.idleTime += tv.tv_sec + (double)tv.tv_usec/1000000 - ctx->idleStart;
+        pthread_mutex_unlock(&ctx->sendLock);
+    }
+    
+    if (n > 0 && ! error) error = _BRPeerAcceptFrames(peer);
+    
+    if (n > 0 && ctx->socket >= 0) {
+        gettimeofday(&tv, NULL);
+        pthread_mutex_lock(&ctx->sendLock);
+        ctx->idleStart = tv.tv_sec + (double)tv.tv_usec/1000000;
+        pthread_mutex_unlock(&ctx->sendLock);
+    }
+    
+    // the rest of a message must arrive within MESSAGE_TIMEOUT of the last bytes received once its header is complete
+    if (ctx->reactorParked || ctx->recvEnd - ctx->recvStart < HEADER_LENGTH) ctx->msgTimeout = DBL_MAX;
+    else if (n > 0) ctx->msgTimeout = time + MESSAGE_TIMEOUT;
+    return error;
+}
+
 static int _BRPeerOpenSocket(BRPeer *peer, double timeout, int *error)
 {
-    struct sockaddr addr;
+    struct sockaddr_storage addr;
     struct timeval tv;
     fd_set fds;
     socklen_t addrLen, optLen;
@@ -849,22 +1360,8 @@ static int _BRPeerOpenSocket(BRPeer *peer, double timeout, int *error)
     if (! r) err = errno;
 
     if (r) {
-        memset(&addr, 0, sizeof(addr));
-        
-        if (_BRPeerIsIPv4(peer)) {
-            ((struct sockaddr_in *)&addr)->sin_family = AF_INET;
-            ((struct sockaddr_in *)&addr)->sin_addr = *(struct in_addr *)&peer->address.u32[3];
-            ((struct sockaddr_in *)&addr)->sin_port = htons(peer->port);
-            addrLen = sizeof(struct sockaddr_in);
-        }
-        else {
-            ((struct sockaddr_in6 *)&addr)->sin6_family = AF_INET6;
-            ((struct sockaddr_in6 *)&addr)->sin6_addr = *(struct in6_addr *)&peer->address;
-            ((struct sockaddr_in6 *)&addr)->sin6_port = htons(peer->port);
-            addrLen = sizeof(struct sockaddr_in6);
-        }
-
-        if (connect(socket, &addr, addrLen) < 0) err = errno;
+        addrLen = _BRPeerSocketAddress(peer, &addr);
+        if (connect(socket, (struct sockaddr *)&addr, addrLen) < 0) err = errno;
 
         if (err == EINPROGRESS) {
             err = 0;
@@ -891,131 +1388,393 @@ static int _BRPeerOpenSocket(BRPeer *peer, double timeout, int *error)
     return r;
 }
 
+// closes the peer's socket if it's still open, fails any pending ping and mempool callbacks, and notifies the
+// disconnected callback - the peer must not be used by its thread, or the reactor thread, after this is called
+static void _BRPeerDidDisconnect(BRPeer *peer, int error)
+{
+    BRPeerContext *ctx = (BRPeerContext *)peer;
+    struct timeval tv;
+    int socket;
+    
+    // worker threads may still be using queued headers, so wait for them, and only relay them if there was no error
+    if (! _BRPeerRelayHeaders(peer, 1, error) && ! error) error = EPROTO;
+    
+    socket = ctx->socket;
+    ctx->socket = -1;
+    ctx->status = BRPeerStatusDisconnected;
+    if (socket >= 0) close(socket);
+    peer_log(peer, "disconnected");
+    free(ctx->recvBuf);
+    ctx->recvBuf = NULL;
+    ctx->recvStart = ctx->recvEnd = ctx->recvCapacity = 0;
+    ctx->msgTimeout = DBL_MAX;
+    pthread_mutex_lock(&ctx->sendLock); // anything still queued is dropped
+    ctx->idleStart = 0;
+    free(ctx->sendBuf);
+    ctx->sendBuf = NULL;
+    ctx->sendStart = ctx->sendEnd = ctx->sendCapacity = 0;
+    
+    if (ctx->sendBlockedStart > 0) {
+        gettimeofday(&tv, NULL);
+        ctx->stats.sendBlockedTime += tv.tv_sec + (double)tv.tv_usec/1000000 - ctx->sendBlockedStart;
+        ctx->sendBlockedStart = 0;
+    }
+    
+    pthread_mutex_unlock(&ctx->sendLock);
+    
+    while (array_count(ctx->pongCallback) > 0) {
+        void (*pongCallback)(void *, int) = ctx->pongCallback[0];
+        void *pongInfo = ctx->pongInfo[0];
+        
+        array_rm(ctx->pongCallback, 0);
+        array_rm(ctx->pongInfo, 0);
+        if (pongCallback) pongCallback(pongInfo, 0);
+    }
+
+    if (ctx->mempoolCallback) ctx->mempoolCallback(ctx->mempoolInfo, 0);
+    ctx->mempoolCallback = NULL;
+    if (ctx->disconnected) ctx->disconnected(ctx->info, error);
+}
+
 static void *_peerThreadRoutine(void *arg)
 {
     BRPeer *peer = arg;
     BRPeerContext *ctx = arg;
-    int socket, error = 0;
+    int error = 0;
 
     pthread_cleanup_push(ctx->threadCleanup, ctx->info);
     
     if (_BRPeerOpenSocket(peer, CONNECT_TIMEOUT, &error)) {
+        struct pollfd fds;
         struct timeval tv;
-        double time = 0, msgTimeout;
-        uint8_t header[HEADER_LENGTH], *payload = malloc(0x1000);
-        size_t len = 0, payloadLen = 0x1000;
-        ssize_t n = 0;
+        double time;
 
-        assert(payload != NULL);
         gettimeofday(&tv, NULL);
         ctx->startTime = tv.tv_sec + (double)tv.tv_usec/1000000;
+        pthread_mutex_lock(&ctx->sendLock);
+        ctx->idleStart = ctx->startTime;
+        pthread_mutex_unlock(&ctx->sendLock);
         BRPeerSendVersionMessage(peer);
         
         while (ctx->socket >= 0 && ! error) {
-            len = 0;
-            socket = ctx->socket;
+            pthread_mutex_lock(&ctx->sendLock);
+            fds.fd = ctx->socket;
+            fds.events = (ctx->sendEnd > 0) ? POLLIN | POLLOUT : POLLIN; // also wait to send what's still queued
+            fds.revents = 0;
+            pthread_mutex_unlock(&ctx->sendLock);
             
-            while (socket >= 0 && ! error && len < HEADER_LENGTH) {
-                n = read(socket, &header[len], sizeof(header) - len);
-                if (n > 0) len += n;
-                if (n == 0) error = ECONNRESET;
-                if (n < 0 && errno != EWOULDBLOCK) error = errno;
-                gettimeofday(&tv, NULL);
-                time = tv.tv_sec + (double)tv.tv_usec/1000000;
-                if (! error && time >= ctx->disconnectTime) error = ETIMEDOUT;
-
-                if (! error && time >= ctx->mempoolTime) {
-                    BRPeerSendPing(peer, ctx->mempoolInfo, ctx->mempoolCallback);
-                    ctx->mempoolCallback = NULL;
-                    ctx->mempoolTime = DBL_MAX;
-                }
-                
-                while (sizeof(uint32_t) <= len && UInt32GetLE(header) != MAGIC_NUMBER) {
-                    memmove(header, &header[1], --len); // consume one byte at a time until we find the magic number
-                }
-                
-                socket = ctx->socket;
+            // wait up to a second, so deadlines are checked, and anything queued meanwhile that the socket didn't
+            // take is sent, even if the peer isn't sending anything
+            if (poll(&fds, 1, 1000) < 0 && errno != EINTR) error = errno;
+            gettimeofday(&tv, NULL);
+            time = tv.tv_sec + (double)tv.tv_usec/1000000;
+            
+            if (! error && (fds.revents & POLLOUT)) {
+                pthread_mutex_lock(&ctx->sendLock);
+                _BRPeerFlush(peer); // send whatever the socket didn't take when it was queued
+                pthread_mutex_unlock(&ctx->sendLock);
             }
             
-            if (error) {
+            if (! error && (fds.revents & (POLLIN | POLLHUP | POLLERR))) {
+                error = _BRPeerReceive(peer, MSG_DONTWAIT, time);
+            }
+            
+            gettimeofday(&tv, NULL);
+            time = tv.tv_sec + (double)tv.tv_usec/1000000;
+            
+            if (! error && (time >= ctx->disconnectTime || time >= ctx->msgTimeout)) {
+                error = ETIMEDOUT;
                 peer_log(peer, "%s", strerror(error));
             }
-            else if (header[15] != 0) { // verify header type field is NULL terminated
-                peer_log(peer, "malformed message header: type not NULL terminated");
-                error = EPROTO;
+
+            if (! error && time >= ctx->mempoolTime) {
+                BRPeerSendPing(peer, ctx->mempoolInfo, ctx->mempoolCallback);
+                ctx->mempoolCallback = NULL;
+                ctx->mempoolTime = DBL_MAX;
+            }
+            
+            // relay any headers that finished hashing while waiting for the next message
+            if (! error && ctx->recvEnd == 0 && ! _BRPeerRelayHeaders(peer, 0, 0)) error = EPROTO;
+        }
+    }
+    
+    _BRPeerDidDisconnect(peer, error);
+    pthread_cleanup_pop(1);
+    return NULL; // detached threads don't need to return a value
+}
+
+#if PEER_REACTOR
+
+// wakes the reactor thread so it rechecks peer deadlines, disconnected peers, and finished headers
+static void _BRPeerReactorWake(void)
+{
+    if (_reactorWakeFd >= 0) eventfd_write(_reactorWakeFd, 1);
+}
+
+// handles a socket event for a peer serviced by the reactor thread, which is either the socket connection completing,
+// or the socket being readable or writable - returns an errno.h code if the peer should be disconnected, otherwise 0
+static int _BRPeerReactorEvent(BRPeer *peer, uint32_t events, double time)
+{
+    BRPeerContext *ctx = (BRPeerContext *)peer;
+    struct epoll_event event = { EPOLLIN, { ctx } };
+    socklen_t optLen = sizeof(int);
+    int socket = ctx->socket, arg, error = 0;
+    
+    if (socket >= 0 && ctx->reactorConnecting) {
+        if (getsockopt(socket, SOL_SOCKET, SO_ERROR, &error, &optLen) < 0) error = errno;
+        
+        if (! error) {
+            peer_log(peer, "socket connected");
+            ctx->reactorConnecting = 0;
+            arg = fcntl(socket, F_GETFL, NULL); // sends block as before, reads are done with MSG_DONTWAIT
+            if (arg >= 0) fcntl(socket, F_SETFL, arg & ~O_NONBLOCK);
+            if (epoll_ctl(_reactorFd, EPOLL_CTL_MOD, socket, &event) < 0) error = errno;
+            ctx->reactorEvents = EPOLLIN;
+        }
+        
+        if (error) peer_log(peer, "connect error: %s", strerror(error));
+        
+        if (! error) {
+            ctx->startTime = time;
+            pthread_mutex_lock(&ctx->sendLock);
+            ctx->idleStart = time;
+            pthread_mutex_unlock(&ctx->sendLock);
+            BRPeerSendVersionMessage(peer);
+        }
+    }
+    else if (socket >= 0) {
+        if (events & EPOLLOUT) {
+            pthread_mutex_lock(&ctx->sendLock);
+            _BRPeerFlush(peer);
+            pthread_mutex_unlock(&ctx->sendLock);
+        }
+        
+        // level triggered, so one read is enough
+        if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) error = _BRPeerReceive(peer, MSG_DONTWAIT, time);
+    }
+    
+    return error;
+}
+
+// checks the peer's disconnect, message and mempool deadlines, relays any headers that finished hashing, and accepts
+// a parked message once the headers it waited for are relayed
+// returns an errno.h code if the peer should be disconnected, otherwise 0
+static int _BRPeerReactorCheck(BRPeer *peer, double time)
+{
+    BRPeerContext *ctx = (BRPeerContext *)peer;
+    int error = ctx->reactorError;
+    
+    if (! error && ctx->reactorParked) {
+        error = _BRPeerAcceptFrames(peer);
+        
+        if (! ctx->reactorParked) { // the rest of a message must arrive within MESSAGE_TIMEOUT once it's read again
+            ctx->msgTimeout = (ctx->recvEnd - ctx->recvStart < HEADER_LENGTH) ? DBL_MAX : time + MESSAGE_TIMEOUT;
+        }
+    }
+    
+    if (! error && (time >= ctx->disconnectTime || time >= ctx->msgTimeout)) {
+        error = ETIMEDOUT;
+        peer_log(peer, "%s", strerror(error));
+    }
+    
+    if (! error && ! ctx->reactorConnecting && time >= ctx->mempoolTime) {
+        BRPeerSendPing(peer, ctx->mempoolInfo, ctx->mempoolCallback);
+        ctx->mempoolCallback = NULL;
+        ctx->mempoolTime = DBL_MAX;
+    }
+    
+    // relay any headers that finished hashing while waiting for the next message
+    if (! error && ctx->recvEnd == 0 && ! _BRPeerRelayHeaders(peer, 0, 0)) error = EPROTO;
+    return error;
+}
+
+// arms the reactor timer for the earliest deadline of the given peers, or disarms it if none of them have one
+static void _BRPeerReactorArm(BRPeerContext *peers[], size_t count)
+{
+    struct itimerspec its;
+    double time = DBL_MAX;
+    
+    for (size_t i = 0; i < count; i++) {
+        if (peers[i]->reactorDone) continue; // the deadlines of a peer being disconnected have already passed
+        if (peers[i]->disconnectTime < time) time = peers[i]->disconnectTime;
+        if (peers[i]->msgTimeout < time) time = peers[i]->msgTimeout;
+        if (! peers[i]->reactorConnecting && peers[i]->mempoolTime < time) time = peers[i]->mempoolTime;
+    }
+    
+    memset(&its, 0, sizeof(its));
+    
+    if (time < DBL_MAX) { // deadlines are unix times, so the timer uses the realtime clock
+        if (time < 1) time = 1; // a zero it_value would disarm the timer
+        its.it_value.tv_sec = (time_t)time;
+        its.it_value.tv_nsec = (long)((time - (time_t)time)*1000000000);
+    }
+    
+    timerfd_settime(_reactorTimerFd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+static void *_reactorThreadRoutine(void *arg)
+{
+    struct epoll_event events[REACTOR_EVENTS];
+    BRPeerContext **peers, *ctx;
+    void (*threadCleanup)(void *info);
+    void *info;
+    struct timeval tv;
+    uint64_t count;
+    double time;
+    int n, error, stopping = 0, stop = 0;
+    
+    (void)arg; // the reactor thread services all peers in _reactorPeers
+    array_new(peers, 10);
+    
+    while (! stop) {
+        n = epoll_wait(_reactorFd, events, REACTOR_EVENTS, -1);
+        gettimeofday(&tv, NULL);
+        time = tv.tv_sec + (double)tv.tv_usec/1000000;
+        
+        for (int i = 0; i < n; i++) { // peers are only freed after they're finished below, so their events are safe
+            if (events[i].data.ptr == &_reactorWakeFd) eventfd_read(_reactorWakeFd, &count);
+            else if (events[i].data.ptr == &_reactorTimerFd) {
+                if (read(_reactorTimerFd, &count, sizeof(count)) < 0) count = 0;
+            }
+            else {
+                ctx = events[i].data.ptr;
+                if (! ctx->reactorError) ctx->reactorError = _BRPeerReactorEvent(&ctx->peer, events[i].events, time);
             }
-            else if (len == HEADER_LENGTH) {
-                const char *type = (const char *)(&header[4]);
-                uint32_t msgLen = UInt32GetLE(&header[16]);
-                uint32_t checksum = UInt32GetLE(&header[20]);
-                UInt256 hash;
+        }
+        
+        pthread_mutex_lock(&_reactorLock);
+        array_clear(peers);
+        array_add_array(peers, _reactorPeers, array_count(_reactorPeers));
+        stopping = _reactorStopping;
+        pthread_mutex_unlock(&_reactorLock);
+        
+        for (size_t i = array_count(peers); i > 0; i--) {
+            ctx = peers[i - 1];
+            
+            if (! ctx->reactorDone) {
+                error = (ctx->socket >= 0) ? _BRPeerReactorCheck(&ctx->peer, time) : ctx->reactorError;
                 
-                if (msgLen > MAX_MSG_LENGTH) { // check message length
-                    peer_log(peer, "error reading %s, message length %"PRIu32" is too long", type, msgLen);
-                    error = EPROTO;
-                }
-                else {
-                    if (msgLen > payloadLen) payload = realloc(payload, (payloadLen = msgLen));
-                    assert(payload != NULL);
-                    len = 0;
-                    socket = ctx->socket;
-                    msgTimeout = time + MESSAGE_TIMEOUT;
-                    
-                    while (socket >= 0 && ! error && len < msgLen) {
-                        n = read(socket, &payload[len], msgLen - len);
-                        if (n > 0) len += n;
-                        if (n == 0) error = ECONNRESET;
-                        if (n < 0 && errno != EWOULDBLOCK) error = errno;
-                        gettimeofday(&tv, NULL);
-                        time = tv.tv_sec + (double)tv.tv_usec/1000000;
-                        if (n > 0) msgTimeout = time + MESSAGE_TIMEOUT;
-                        if (! error && time >= msgTimeout) error = ETIMEDOUT;
-                        socket = ctx->socket;
-                    }
-                    
-                    if (error) {
-                        peer_log(peer, "%s", strerror(error));
-                    }
-                    else if (len == msgLen) {
-                        BRSHA256_2(&hash, payload, msgLen);
-                        
-                        if (UInt32GetLE(&hash) != checksum) { // verify checksum
-                            peer_log(peer, "error reading %s, invalid checksum %x, expected %x, payload length:%"PRIu32
-                                     ", SHA256_2:%s", type, UInt32GetLE(&hash), checksum, msgLen,
-                                     u256_hex_encode(hash));
-                            error = EPROTO;
-                        }
-                        else if (! _BRPeerAcceptMessage(peer, payload, msgLen, type)) error = EPROTO;
-                    }
+                if (! error && ctx->socket >= 0 && stopping) { // see BRPeerStopThreads()
+                    error = ECONNABORTED;
+                    peer_log(&ctx->peer, "%s", strerror(error));
                 }
+                
+                if (ctx->socket >= 0 && ! error) continue;
+                if (ctx->socket >= 0) epoll_ctl(_reactorFd, EPOLL_CTL_DEL, ctx->socket, NULL);
+                ctx->reactorDone = 1;
+                ctx->reactorError = error;
+            }
+            
+            // worker threads may still be using queued headers, so relay the ones they're done with, and only finish
+            // the peer once the rest are done and the worker threads wake the reactor thread again
+            if (! _BRPeerRelayHeaders(&ctx->peer, 0, ctx->reactorError) && ! ctx->reactorError) {
+                ctx->reactorError = EPROTO;
             }
+            
+            if (array_count(ctx->headersJobs) > 0) continue;
+            pthread_mutex_lock(&_reactorLock); // the peer is done, so stop servicing it before calling its callbacks
+            
+            for (size_t j = array_count(_reactorPeers); j > 0; j--) {
+                if (_reactorPeers[j - 1] == ctx) array_rm(_reactorPeers, j - 1);
+            }
+            
+            pthread_mutex_unlock(&_reactorLock);
+            array_rm(peers, i - 1);
+            ctx->reactor = 0;
+            threadCleanup = ctx->threadCleanup; // the disconnected callback may free or reconnect the peer
+            info = ctx->info;
+            _BRPeerDidDisconnect(&ctx->peer, ctx->reactorError);
+            threadCleanup(info); // done with the peer, as if it had its own thread
         }
         
-        free(payload);
+        _BRPeerReactorArm(peers, array_count(peers));
+        pthread_mutex_lock(&_reactorLock);
+        stop = (_reactorStopping && array_count(_reactorPeers) == 0);
+        pthread_mutex_unlock(&_reactorLock);
     }
     
-    socket = ctx->socket;
-    ctx->socket = -1;
-    ctx->status = BRPeerStatusDisconnected;
-    if (socket >= 0) close(socket);
-    peer_log(peer, "disconnected");
+    array_free(peers);
+    return NULL; // joined by BRPeerStopThreads()
+}
+
+// closes the reactor's file descriptors - must be called with the reactor lock held, and the reactor thread not running
+static void _BRPeerReactorClose(void)
+{
+    if (_reactorFd >= 0) close(_reactorFd);
+    if (_reactorWakeFd >= 0) close(_reactorWakeFd);
+    if (_reactorTimerFd >= 0) close(_reactorTimerFd);
+    _reactorFd = _reactorWakeFd = _reactorTimerFd = -1;
+}
+
+// starts the reactor thread, if it isn't already running, and returns true if it's running and not being stopped
+static int _BRPeerReactorStart(void)
+{
+    struct epoll_event event = { EPOLLIN, { &_reactorWakeFd } };
+    int r = 1;
     
-    while (array_count(ctx->pongCallback) > 0) {
-        void (*pongCallback)(void *, int) = ctx->pongCallback[0];
-        void *pongInfo = ctx->pongInfo[0];
-        
-        array_rm(ctx->pongCallback, 0);
-        array_rm(ctx->pongInfo, 0);
-        if (pongCallback) pongCallback(pongInfo, 0);
+    pthread_mutex_lock(&_reactorLock);
+    
+    if (_reactorFd < 0) {
+        _reactorFd = epoll_create1(EPOLL_CLOEXEC);
+        _reactorWakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        _reactorTimerFd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (_reactorFd < 0 || _reactorWakeFd < 0 || _reactorTimerFd < 0) r = 0;
+        if (r && epoll_ctl(_reactorFd, EPOLL_CTL_ADD, _reactorWakeFd, &event) < 0) r = 0;
+        event.data.ptr = &_reactorTimerFd;
+        if (r && epoll_ctl(_reactorFd, EPOLL_CTL_ADD, _reactorTimerFd, &event) < 0) r = 0;
+        if (r && ! _reactorPeers) array_new(_reactorPeers, 10);
+        if (r && pthread_create(&_reactorThread, NULL, _reactorThreadRoutine, NULL) != 0) r = 0;
+        if (! r) _BRPeerReactorClose(); // the reactor isn't available, so peers will each have their own thread
     }
+    
+    // peers reconnected by their disconnected callback while the reactor is stopping get their own thread instead
+    r = (_reactorFd >= 0 && ! _reactorStopping);
+    pthread_mutex_unlock(&_reactorLock);
+    return r;
+}
 
-    if (ctx->mempoolCallback) ctx->mempoolCallback(ctx->mempoolInfo, 0);
-    ctx->mempoolCallback = NULL;
-    if (ctx->disconnected) ctx->disconnected(ctx->info, error);
-    pthread_cleanup_pop(1);
-    return NULL; // detached threads don't need to return a value
+// starts connecting the peer's socket without blocking, and hands the peer to the reactor thread, which completes the
+// connection, and calls the disconnected callback if it fails
+static void _BRPeerReactorAdd(BRPeer *peer)
+{
+    BRPeerContext *ctx = (BRPeerContext *)peer;
+    struct epoll_event event = { EPOLLOUT, { ctx } };
+    struct sockaddr_storage addr;
+    socklen_t addrLen = _BRPeerSocketAddress(peer, &addr);
+    int error = 0, arg = fcntl(ctx->socket, F_GETFL, NULL);
+    
+    if (arg < 0 || fcntl(ctx->socket, F_SETFL, arg | O_NONBLOCK) < 0) error = errno;
+    if (! error && connect(ctx->socket, (struct sockaddr *)&addr, addrLen) < 0 && errno != EINPROGRESS) error = errno;
+    if (error) peer_log(peer, "connect error: %s", strerror(error));
+    ctx->reactor = 1;
+    ctx->reactorConnecting = 1;
+    ctx->reactorError = error;
+    ctx->reactorParked = ctx->reactorDone = 0;
+    pthread_mutex_lock(&_reactorLock);
+    array_add(_reactorPeers, ctx);
+    if (! error && epoll_ctl(_reactorFd, EPOLL_CTL_ADD, ctx->socket, &event) < 0) ctx->reactorError = errno;
+    pthread_mutex_unlock(&_reactorLock);
+    _BRPeerReactorWake(); // arm the connect timeout, or disconnect right away if the connection already failed
 }
 
+#else
+
+static void _BRPeerReactorWake(void)
+{
+}
+
+static int _BRPeerReactorStart(void)
+{
+    return 0;
+}
+
+static void _BRPeerReactorAdd(BRPeer *peer)
+{
+    assert(0); // the reactor is never enabled without epoll
+}
+
+#endif // PEER_REACTOR
+
 static void _dummyThreadCleanup(void *info)
 {
 }
@@ -1033,8 +1792,11 @@ BRPeer *BRPeerNew(void)
     ctx->knownTxHashSet = BRSetNew(BRTransactionHash, BRTransactionEq, 10);
     array_new(ctx->pongInfo, 10);
     array_new(ctx->pongCallback, 10);
+    array_new(ctx->headersJobs, 10);
     ctx->pingTime = DBL_MAX;
+    ctx->msgTimeout = DBL_MAX;
     ctx->socket = -1;
+    pthread_mutex_init(&ctx->sendLock, NULL);
     ctx->threadCleanup = _dummyThreadCleanup;
     return &ctx->peer;
 }
@@ -1083,6 +1845,101 @@ void BRPeerSetCallbacks(BRPeer *peer, void *info,
     ctx->threadCleanup = (threadCleanup) ? threadCleanup : _dummyThreadCleanup;
 }
 
+// void relayedHeaders(void *, BRMerkleBlock *[], size_t) - called with the valid headers from a "headers" message, in
+// place of calling relayedBlock for each header, with the same info as the other callbacks (NULL to use relayedBlock)
+void BRPeerSetRelayedHeadersCallback(BRPeer *peer,
+                                     void (*relayedHeaders)(void *info, BRMerkleBlock *blocks[], size_t blocksCount))
+{
+    ((BRPeerContext *)peer)->relayedHeaders = relayedHeaders;
+}
+
+// sets whether peers connected after this call are serviced by a single shared reactor thread that waits on all their
+// sockets and deadlines with epoll, instead of each peer having its own thread that polls its socket
+// the threadCleanup callback of peers the reactor thread services is called on it after their disconnected callback
+// returns true if the reactor is enabled, which is never the case on systems without epoll
+int BRPeerSetReactorEnabled(int enabled)
+{
+    _reactorEnabled = (enabled && _BRPeerReactorStart());
+    return _reactorEnabled;
+}
+
+// stops the worker threads and the reactor thread shared by all peers, waiting for them to exit, so the library can be
+// unloaded cleanly - call this only once all peers are disconnected, any the reactor thread still services are
+// disconnected with ECONNABORTED, and the threads are started again as needed if more peers connect
+void BRPeerStopThreads(void)
+{
+    size_t i, count;
+    
+#if PEER_REACTOR
+    pthread_mutex_lock(&_reactorLock);
+    int reactor = (_reactorFd >= 0);
+    
+    _reactorStopping = reactor;
+    pthread_mutex_unlock(&_reactorLock);
+    _BRPeerReactorWake();
+    if (reactor) pthread_join(_reactorThread, NULL); // disconnected peers are finished once their headers are done
+#endif
+    
+    pthread_mutex_lock(&_headersLock);
+    _headersStopping = 1;
+    count = _headersThreadCount;
+    pthread_cond_broadcast(&_headersQueued);
+    pthread_mutex_unlock(&_headersLock);
+    for (i = 0; i < count; i++) pthread_join(_headersThreads[i], NULL);
+    pthread_mutex_lock(&_headersLock);
+    assert(array_count(_headersQueue) == 0);
+    _headersThreadCount = 0;
+    _headersStarted = _headersStopping = 0;
+    pthread_mutex_unlock(&_headersLock);
+    
+#if PEER_REACTOR
+    pthread_mutex_lock(&_reactorLock); // worker threads wake the reactor thread, so close it only after they've exited
+    if (reactor) _BRPeerReactorClose();
+    _reactorStopping = 0;
+    pthread_mutex_unlock(&_reactorLock);
+#endif
+}
+
+// sets the handler for a message type that peers don't otherwise handle, such as MSG_SENDHEADERS, MSG_CFILTER or
+// MSG_WTXIDRELAY, for all peers - a NULL handler drops messages of that type again
+// int handler(void *, BRPeer *, const uint8_t *, size_t) - called with each message of the given type received from a
+//   peer, on the thread servicing that peer, must return false if the message is malformed so the peer is disconnected
+// handlers can be set while peers are connected, but a replaced handler may still be called by a peer that looked it
+//   up just before it was replaced, so its info must stay valid until that handler returns
+// returns true on success, or false if type is handled by peers already, is longer than 11 characters, or if there's no
+// more room for message types
+int BRPeerSetMessageHandler(const char *type, void *info,
+                            int (*handler)(void *info, BRPeer *peer, const uint8_t *msg, size_t msgLen))
+{
+    char t[12];
+    size_t i;
+    int r = 0;
+    
+    assert(type != NULL);
+    pthread_once(&_msgOnce, _msgIndexBuild);
+    
+    if (strlen(type) < sizeof(t)) {
+        strncpy(t, type, sizeof(t));
+        pthread_rwlock_wrlock(&_msgLock);
+        i = _BRPeerMessageFind(t);
+        
+        if (_msgIndex[i] == msg_unknown && _msgTypesCount < MSG_TYPES_MAX) { // add the type to the end of the table
+            memcpy(_msgHandlers[_msgTypesCount].type, t, sizeof(t));
+            _msgIndex[i] = _msgTypesCount++;
+        }
+        
+        if (_msgIndex[i] != msg_unknown && ! _msgHandlers[_msgIndex[i]].accept) {
+            _msgHandlers[_msgIndex[i]].info = info;
+            _msgHandlers[_msgIndex[i]].handler = handler;
+            r = 1;
+        }
+        
+        pthread_rwlock_unlock(&_msgLock);
+    }
+    
+    return r;
+}
+
 // set earliestKeyTime to wallet creation time in order to speed up initial sync
 void BRPeerSetEarliestKeyTime(BRPeer *peer, uint32_t earliestKeyTime)
 {
@@ -1139,7 +1996,10 @@ void BRPeerConnect(BRPeer *peer)
                 setsockopt(ctx->socket, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
 #endif
 
-                if (pthread_attr_init(&attr) != 0) {
+                if (_reactorEnabled && _BRPeerReactorStart()) {
+                    _BRPeerReactorAdd(peer);
+                }
+                else if (pthread_attr_init(&attr) != 0) {
                     error = ENOMEM;
                     peer_log(peer, "error creating thread");
                     ctx->status = BRPeerStatusDisconnected;
@@ -1168,6 +2028,7 @@ void BRPeerDisconnect(BRPeer *peer)
         ctx->socket = -1;
         if (shutdown(socket, SHUT_RDWR) < 0) peer_log(peer, "%s", strerror(errno));
         close(socket);
+        if (ctx->reactor) _BRPeerReactorWake(); // closing the socket doesn't generate an event
     }
 }
 
@@ -1179,6 +2040,7 @@ void BRPeerScheduleDisconnect(BRPeer *peer, double seconds)
     
     gettimeofday(&tv, NULL);
     ctx->disconnectTime = (seconds < 0) ? DBL_MAX : tv.tv_sec + (double)tv.tv_usec/1000000 + seconds;
+    if (ctx->reactor) _BRPeerReactorWake(); // rearm the reactor timer
 }
 
 // call this when wallet addresses need to be added to bloom filter
@@ -1232,11 +2094,153 @@ uint64_t BRPeerFeePerKb(BRPeer *peer)
     return ((BRPeerContext *)peer)->feePerKb;
 }
 
+// writes the wire stats for peer since it was created to stats, it's safe to call from any thread
+void BRPeerGetStats(BRPeer *peer, BRPeerStats *stats)
+{
+    BRPeerContext *ctx = (BRPeerContext *)peer;
+    struct timeval tv;
+    double time;
+    
+    assert(stats != NULL);
+    gettimeofday(&tv, NULL);
+    time = tv.tv_sec + (double)tv.tv_usec/1000000;
+    pthread_once(&_msgOnce, _msgIndexBuild);
+    pthread_mutex_lock(&ctx->sendLock);
+    *stats = ctx->stats;
+    if (ctx->sendBlockedStart > 0) stats->sendBlockedTime += time - ctx->sendBlockedStart;
+    if (ctx->idleStart > 0 && time > ctx->idleStart) stats->idleTime += time - ctx->idleStart; // the wait so far
+    pthread_mutex_unlock(&ctx->sendLock);
+    pthread_rwlock_rdlock(&_msgLock);
+    
+    for (size_t i = msg_unknown + 1; i < _msgTypesCount; i++) memcpy(stats->types[i].type, _msgHandlers[i].type, 12);
+    pthread_rwlock_unlock(&_msgLock);
+    
+    for (size_t i = 0; i < PEER_STATS_TYPES; i++) {
+        stats->sent += stats->types[i].sent;
+        stats->received += stats->types[i].received;
+        stats->bytesSent += stats->types[i].bytesSent;
+        stats->bytesReceived += stats->types[i].bytesReceived;
+        stats->handlerTime += stats->types[i].handlerTime;
+    }
+}
+
 #ifndef MSG_NOSIGNAL   // linux based systems have a MSG_NOSIGNAL send flag, useful for supressing SIGPIPE signals
 #define MSG_NOSIGNAL 0 // set to 0 if undefined (BSD has the SO_NOSIGPIPE sockopt, and windows has no signals at all)
 #endif
 
-// sends a bitcoin protocol message to peer
+// writes the message header for a msgLen byte payload of the given type to header
+static void _BRPeerSetHeader(uint8_t *header, const uint8_t *msg, size_t msgLen, const char *type)
+{
+    uint8_t hash[32];
+    
+    UInt32SetLE(header, MAGIC_NUMBER);
+    strncpy((char *)&header[4], type, 12);
+    UInt32SetLE(&header[16], (uint32_t)msgLen);
+    BRSHA256_2(hash, msg, msgLen);
+    memcpy(&header[20], hash, sizeof(uint32_t));
+}
+
+// returns room for len more bytes at the end of the peer's send queue, to be added to it by advancing sendEnd
+// must be called with the send lock held
+static uint8_t *_BRPeerSendReserve(BRPeerContext *ctx, size_t len)
+{
+    if (ctx->sendEnd + len > ctx->sendCapacity && ctx->sendStart > 0) { // move what's queued to the start of the buffer
+        memmove(ctx->sendBuf, &ctx->sendBuf[ctx->sendStart], ctx->sendEnd - ctx->sendStart);
+        ctx->sendEnd -= ctx->sendStart;
+        ctx->sendStart = 0;
+    }
+    
+    if (ctx->sendEnd + len > ctx->sendCapacity) {
+        ctx->sendCapacity = (ctx->sendEnd + len > 2*ctx->sendCapacity) ? ctx->sendEnd + len : 2*ctx->sendCapacity;
+        if (ctx->sendCapacity < SEND_BUFFER_SIZE) ctx->sendCapacity = SEND_BUFFER_SIZE;
+        ctx->sendBuf = realloc(ctx->sendBuf, ctx->sendCapacity);
+        assert(ctx->sendBuf != NULL);
+    }
+    
+    return &ctx->sendBuf[ctx->sendEnd];
+}
+
+// sends as much of the peer's send queue as the socket will take without blocking, and for peers serviced by the
+// reactor, has the reactor thread send the rest once the socket is writable - must be called with the send lock held
+static void _BRPeerFlush(BRPeer *peer)
+{
+    BRPeerContext *ctx = (BRPeerContext *)peer;
+    int socket = ctx->socket, error = 0;
+    struct timeval tv;
+    double time;
+    ssize_t n = 1;
+    
+    while (socket >= 0 && ! ctx->reactorConnecting && ctx->sendStart < ctx->sendEnd && n > 0) {
+        n = send(socket, &ctx->sendBuf[ctx->sendStart], ctx->sendEnd - ctx->sendStart, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n > 0) ctx->sendStart += n;
+        if (n < 0 && errno == EINTR) n = 1;
+        else if (n < 0 && errno != EWOULDBLOCK && errno != EAGAIN) error = errno;
+    }
+    
+    if (ctx->sendStart == ctx->sendEnd) ctx->sendStart = ctx->sendEnd = 0;
+    if (! error && ctx->sendEnd - ctx->sendStart > MAX_SEND_QUEUE) error = ENOBUFS;
+    
+    if ((ctx->sendEnd > 0) != (ctx->sendBlockedStart > 0)) { // socket stopped, or resumed, taking all that's queued
+        gettimeofday(&tv, NULL);
+        time = tv.tv_sec + (double)tv.tv_usec/1000000;
+        if (ctx->sendBlockedStart > 0) ctx->stats.sendBlockedTime += time - ctx->sendBlockedStart;
+        ctx->sendBlockedStart = (ctx->sendEnd > 0) ? time : 0;
+    }
+    
+#if PEER_REACTOR
+    if (! error && socket >= 0 && ctx->reactor && ! ctx->reactorConnecting) {
+        struct epoll_event event = { (ctx->reactorParked) ? 0 : EPOLLIN, { ctx } };
+        
+        if (ctx->sendEnd > 0) event.events |= EPOLLOUT;
+        
+        if (event.events != ctx->reactorEvents && epoll_ctl(_reactorFd, EPOLL_CTL_MOD, socket, &event) == 0) {
+            ctx->reactorEvents = event.events;
+        }
+    }
+#endif
+    
+    if (error) {
+        peer_log(peer, "%s", strerror(error));
+        BRPeerDisconnect(peer);
+    }
+}
+
+// adds a msgLen byte message of the given type to the peer's sent stats - must be called with the send lock held
+static void _BRPeerCountSent(BRPeerContext *ctx, const char *type, size_t msgLen)
+{
+    BRPeerMessageStats *stats = &ctx->stats.types[_BRPeerMessageType(type)];
+    
+    stats->sent++;
+    stats->bytesSent += HEADER_LENGTH + msgLen;
+    stats->sentSizes[_BRPeerSizeBucket(msgLen)]++;
+}
+
+// takes the send lock, and returns where to write the payload of a msgLen byte message to be sent to peer, which must
+// then be passed to _BRPeerEndMessage() - messages are built directly in the send queue, so they're never copied
+static uint8_t *_BRPeerBeginMessage(BRPeer *peer, size_t msgLen)
+{
+    BRPeerContext *ctx = (BRPeerContext *)peer;
+    
+    pthread_mutex_lock(&ctx->sendLock);
+    return _BRPeerSendReserve(ctx, HEADER_LENGTH + msgLen) + HEADER_LENGTH;
+}
+
+// adds the message started with _BRPeerBeginMessage() to the send queue, sends as much of the queue as the socket will
+// take without blocking, and releases the send lock
+static void _BRPeerEndMessage(BRPeer *peer, size_t msgLen, const char *type)
+{
+    BRPeerContext *ctx = (BRPeerContext *)peer;
+    uint8_t *header = &ctx->sendBuf[ctx->sendEnd];
+    
+    _BRPeerSetHeader(header, &header[HEADER_LENGTH], msgLen, type);
+    peer_log(peer, "sending %s", type);
+    _BRPeerCountSent(ctx, type, msgLen);
+    ctx->sendEnd += HEADER_LENGTH + msgLen;
+    _BRPeerFlush(peer);
+    pthread_mutex_unlock(&ctx->sendLock);
+}
+
+// sends a bitcoin protocol message to peer without blocking, whatever the socket doesn't take right away is queued
 void BRPeerSendMessage(BRPeer *peer, const uint8_t *msg, size_t msgLen, const char *type)
 {
     if (msgLen > MAX_MSG_LENGTH) {
@@ -1244,40 +2248,37 @@ void BRPeerSendMessage(BRPeer *peer, const uint8_t *msg, size_t msgLen, const ch
     }
     else {
         BRPeerContext *ctx = (BRPeerContext *)peer;
-        uint8_t buf[HEADER_LENGTH + msgLen], hash[32];
-        size_t off = 0;
-        ssize_t n = 0;
-        struct timeval tv;
-        int socket, error = 0;
+        uint8_t header[HEADER_LENGTH], *buf;
+        struct iovec iov[2] = { { header, sizeof(header) }, { (void *)msg, msgLen } };
+        struct msghdr mh;
+        size_t off = 0, len, headerLen;
+        ssize_t n;
         
-        UInt32SetLE(&buf[off], MAGIC_NUMBER);
-        off += sizeof(uint32_t);
-        strncpy((char *)&buf[off], type, 12);
-        off += 12;
-        UInt32SetLE(&buf[off], (uint32_t)msgLen);
-        off += sizeof(uint32_t);
-        BRSHA256_2(hash, msg, msgLen);
-        memcpy(&buf[off], hash, sizeof(uint32_t));
-        off += sizeof(uint32_t);
-        memcpy(&buf[off], msg, msgLen);
+        _BRPeerSetHeader(header, msg, msgLen, type);
         peer_log(peer, "sending %s", type);
-        msgLen = 0;
-        socket = ctx->socket;
-        if (socket < 0) error = ENOTCONN;
+        pthread_mutex_lock(&ctx->sendLock);
+        _BRPeerCountSent(ctx, type, msgLen);
         
-        while (socket >= 0 && ! error && msgLen < sizeof(buf)) {
-            n = send(socket, &buf[msgLen], sizeof(buf) - msgLen, MSG_NOSIGNAL);
-            if (n >= 0) msgLen += n;
-            if (n < 0 && errno != EWOULDBLOCK) error = errno;
-            gettimeofday(&tv, NULL);
-            if (! error && tv.tv_sec + (double)tv.tv_usec/1000000 >= ctx->disconnectTime) error = ETIMEDOUT;
-            socket = ctx->socket;
+        // if nothing is queued, send header and payload together, without copying the payload, and only queue the rest
+        if (ctx->sendStart == ctx->sendEnd && ctx->socket >= 0 && ! ctx->reactorConnecting) {
+            memset(&mh, 0, sizeof(mh));
+            mh.msg_iov = iov;
+            mh.msg_iovlen = 2;
+            n = sendmsg(ctx->socket, &mh, MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (n > 0) off = (size_t)n; // any error is left for the flush below to find
         }
         
-        if (error) {
-            peer_log(peer, "%s", strerror(error));
-            BRPeerDisconnect(peer);
+        if (off < HEADER_LENGTH + msgLen) {
+            len = HEADER_LENGTH + msgLen - off;
+            headerLen = (off < HEADER_LENGTH) ? HEADER_LENGTH - off : 0;
+            buf = _BRPeerSendReserve(ctx, len);
+            if (headerLen > 0) memcpy(buf, &header[off], headerLen);
+            if (len > headerLen) memcpy(&buf[headerLen], &msg[off + headerLen - HEADER_LENGTH], len - headerLen);
+            ctx->sendEnd += len;
+            _BRPeerFlush(peer);
         }
+        
+        pthread_mutex_unlock(&ctx->sendLock);
     }
 }
 
@@ -1356,6 +2357,7 @@ void BRPeerSendMempool(BRPeer *peer, const UInt256 knownTxHashes[], size_t known
             ctx->mempoolTime = tv.tv_sec + (double)tv.tv_usec/1000000 + 5.0;
             ctx->mempoolInfo = info;
             ctx->mempoolCallback = completionCallback;
+            if (ctx->reactor) _BRPeerReactorWake(); // rearm the reactor timer
         }
         
         BRPeerSendMessage(peer, NULL, 0, MSG_MEMPOOL);
@@ -1367,25 +2369,25 @@ void BRPeerSendGetheaders(BRPeer *peer, const UInt256 locators[], size_t locator
 {
     size_t i, off = 0;
     size_t msgLen = sizeof(uint32_t) + BRVarIntSize(locatorsCount) + sizeof(*locators)*locatorsCount + sizeof(hashStop);
-    uint8_t msg[msgLen];
+    uint8_t *msg;
     
-    UInt32SetLE(&msg[off], PROTOCOL_VERSION);
-    off += sizeof(uint32_t);
-    off += BRVarIntSet(&msg[off], (off <= msgLen ? msgLen - off : 0), locatorsCount);
-
-    for (i = 0; i < locatorsCount; i++) {
-        UInt256Set(&msg[off], locators[i]);
-        off += sizeof(UInt256);
-    }
-
-    UInt256Set(&msg[off], hashStop);
-    off += sizeof(UInt256);
-
     if (locatorsCount > 0) {
         peer_log(peer, "calling getheaders with %zu locators: [%s,%s %s]", locatorsCount,
                  u256_hex_encode(locators[0]), (locatorsCount > 2 ? " ...," : ""),
                  (locatorsCount > 1 ? u256_hex_encode(locators[locatorsCount - 1]) : ""));
-        BRPeerSendMessage(peer, msg, off, MSG_GETHEADERS);
+        msg = _BRPeerBeginMessage(peer, msgLen);
+        UInt32SetLE(&msg[off], PROTOCOL_VERSION);
+        off += sizeof(uint32_t);
+        off += BRVarIntSet(&msg[off], (off <= msgLen ? msgLen - off : 0), locatorsCount);
+
+        for (i = 0; i < locatorsCount; i++) {
+            UInt256Set(&msg[off], locators[i]);
+            off += sizeof(UInt256);
+        }
+
+        UInt256Set(&msg[off], hashStop);
+        off += sizeof(UInt256);
+        _BRPeerEndMessage(peer, off, MSG_GETHEADERS);
     }
 }
 
@@ -1393,25 +2395,25 @@ void BRPeerSendGetblocks(BRPeer *peer, const UInt256 locators[], size_t locators
 {
     size_t i, off = 0;
     size_t msgLen = sizeof(uint32_t) + BRVarIntSize(locatorsCount) + sizeof(*locators)*locatorsCount + sizeof(hashStop);
-    uint8_t msg[msgLen];
-    
-    UInt32SetLE(&msg[off], PROTOCOL_VERSION);
-    off += sizeof(uint32_t);
-    off += BRVarIntSet(&msg[off], (off <= msgLen ? msgLen - off : 0), locatorsCount);
-    
-    for (i = 0; i < locatorsCount; i++) {
-        UInt256Set(&msg[off], locators[i]);
-        off += sizeof(UInt256);
-    }
-    
-    UInt256Set(&msg[off], hashStop);
-    off += sizeof(UInt256);
+    uint8_t *msg;
     
     if (locatorsCount > 0) {
         peer_log(peer, "calling getblocks with %zu locators: [%s,%s %s]", locatorsCount,
                  u256_hex_encode(locators[0]), (locatorsCount > 2 ? " ...," : ""),
                  (locatorsCount > 1 ? u256_hex_encode(locators[locatorsCount - 1]) : ""));
-        BRPeerSendMessage(peer, msg, off, MSG_GETBLOCKS);
+        msg = _BRPeerBeginMessage(peer, msgLen);
+        UInt32SetLE(&msg[off], PROTOCOL_VERSION);
+        off += sizeof(uint32_t);
+        off += BRVarIntSet(&msg[off], (off <= msgLen ? msgLen - off : 0), locatorsCount);
+        
+        for (i = 0; i < locatorsCount; i++) {
+            UInt256Set(&msg[off], locators[i]);
+            off += sizeof(UInt256);
+        }
+        
+        UInt256Set(&msg[off], hashStop);
+        off += sizeof(UInt256);
+        _BRPeerEndMessage(peer, off, MSG_GETBLOCKS);
     }
 }
 
@@ -1425,7 +2427,7 @@ void BRPeerSendInv(BRPeer *peer, const UInt256 txHashes[], size_t txCount)
 
     if (txCount > 0) {
         size_t i, off = 0, msgLen = BRVarIntSize(txCount) + (sizeof(uint32_t) + sizeof(*txHashes))*txCount;
-        uint8_t msg[msgLen];
+        uint8_t *msg = _BRPeerBeginMessage(peer, msgLen);
         
         off += BRVarIntSet(&msg[off], (off <= msgLen ? msgLen - off : 0), txCount);
         
@@ -1436,7 +2438,7 @@ void BRPeerSendInv(BRPeer *peer, const UInt256 txHashes[], size_t txCount)
             off += sizeof(UInt256);
         }
 
-        BRPeerSendMessage(peer, msg, off, MSG_INV);
+        _BRPeerEndMessage(peer, off, MSG_INV);
     }
 }
 
@@ -1450,8 +2452,10 @@ void BRPeerSendGetdata(BRPeer *peer, const UInt256 txHashes[], size_t txCount, c
     }
     else if (count > 0) {
         size_t msgLen = BRVarIntSize(count) + (sizeof(uint32_t) + sizeof(UInt256))*(count);
-        uint8_t msg[msgLen];
+        uint8_t *msg;
 
+        ((BRPeerContext *)peer)->sentGetdata = 1;
+        msg = _BRPeerBeginMessage(peer, msgLen);
         off += BRVarIntSet(&msg[off], (off <= msgLen ? msgLen - off : 0), count);
         
         for (i = 0; i < txCount; i++) {
@@ -1468,8 +2472,7 @@ void BRPeerSendGetdata(BRPeer *peer, const UInt256 txHashes[], size_t txCount, c
             off += sizeof(UInt256);
         }
         
-        ((BRPeerContext *)peer)->sentGetdata = 1;
-        BRPeerSendMessage(peer, msg, off, MSG_GETDATA);
+        _BRPeerEndMessage(peer, off, MSG_GETDATA);
     }
 }
 
@@ -1519,10 +2522,15 @@ void BRPeerFree(BRPeer *peer)
     if (ctx->knownTxHashSet) BRSetFree(ctx->knownTxHashSet);
     if (ctx->pongInfo) array_free(ctx->pongInfo);
     if (ctx->pongCallback) array_free(ctx->pongCallback);
+    if (ctx->headersJobs) array_free(ctx->headersJobs);
+    if (ctx->recvBuf) free(ctx->recvBuf);
+    if (ctx->sendBuf) free(ctx->sendBuf);
+    pthread_mutex_destroy(&ctx->sendLock);
     free(ctx);
 }
 
 void BRPeerAcceptMessageTest(BRPeer *peer, const uint8_t *msg, size_t msgLen, const char *type)
 {
-    _BRPeerAcceptMessage(peer, msg, msgLen, type);
+    _BRPeerAcceptMessage(peer, msg, msgLen, _BRPeerMessageType(type), type);
+    _BRPeerRelayHeaders(peer, 1, 0);
 }
@@ -87,6 +87,9 @@ extern "C" {
 #define MSG_ALERT       "alert"
 #define MSG_REJECT      "reject"   // described in BIP61: https://github.com/bitcoin/bips/blob/master/bip-0061.mediawiki
 #define MSG_FEEFILTER   "feefilter"// described in BIP133 https://github.com/bitcoin/bips/blob/master/bip-0133.mediawiki
+#define MSG_SENDHEADERS "sendheaders" // BIP130: https://github.com/bitcoin/bips/blob/master/bip-0130.mediawiki
+#define MSG_CFILTER     "cfilter"  // BIP157: https://github.com/bitcoin/bips/blob/master/bip-0157.mediawiki
+#define MSG_WTXIDRELAY  "wtxidrelay" // BIP339: https://github.com/bitcoin/bips/blob/master/bip-0339.mediawiki
 
 #define REJECT_INVALID     0x10 // transaction is invalid for some reason (invalid signature, output value > input, etc)
 #define REJECT_SPENT       0x12 // an input is already spent
@@ -110,6 +113,31 @@ typedef struct {
 
 #define BR_PEER_NONE ((BRPeer) { UINT128_ZERO, 0, 0, 0, 0 })
 
+#define PEER_STATS_TYPES   64 // message types stats are kept for, the first is for all messages of unknown type
+#define PEER_STATS_BUCKETS 8  // payload sizes are counted in buckets of < 16, 64, 256, 1k, 4k, 16k, 64k bytes, and more
+
+typedef struct {
+    char type[12]; // NULL padded message type, or all NULL for messages of unknown type and unused entries
+    uint64_t sent; // number of messages sent
+    uint64_t received; // number of messages received
+    uint64_t bytesSent; // bytes sent, including message headers
+    uint64_t bytesReceived; // bytes received, including message headers
+    uint64_t sentSizes[PEER_STATS_BUCKETS]; // number of messages sent, by payload size
+    uint64_t receivedSizes[PEER_STATS_BUCKETS]; // number of messages received, by payload size
+    double handlerTime; // seconds spent verifying and handling received messages
+} BRPeerMessageStats;
+
+typedef struct {
+    uint64_t sent; // number of messages sent, of all types
+    uint64_t received; // number of messages received, of all types
+    uint64_t bytesSent; // bytes sent, including message headers
+    uint64_t bytesReceived; // bytes received, including message headers
+    double handlerTime; // seconds spent verifying and handling received messages, time the peer costs in CPU
+    double sendBlockedTime; // seconds the socket had messages queued that it wouldn't take, waiting on the network
+    double idleTime; // seconds spent waiting for data from the peer while connected, waiting on the peer or network
+    BRPeerMessageStats types[PEER_STATS_TYPES];
+} BRPeerStats;
+
 // NOTE: BRPeer functions are not thread-safe
 
 // returns a newly allocated BRPeer struct that must be freed by calling BRPeerFree()
@@ -123,6 +151,9 @@ BRPeer *BRPeerNew(void);
 // void hasTx(void *, UInt256 txHash) - called when an "inv" message with an already-known tx hash is received from peer
 // void rejectedTx(void *, UInt256 txHash, uint8_t) - called when a "reject" message is received from peer
 // void relayedBlock(void *, BRMerkleBlock *) - called when a "merkleblock" or "headers" message is received from peer
+//   - a merkleblock with no matched transactions is given without its partial merkle tree, with totalTx as received but
+//     no hashes or flags, so it fails BRMerkleBlockIsValid() and serializes with an empty tree - its merkle root was
+//     checked before it was relayed, and receivers that need the tree for every block must not rely on it being there
 // void notfound(void *, const UInt256[], size_t, const UInt256[], size_t) - called when "notfound" message is received
 // BRTransaction *requestedTx(void *, UInt256) - called when "getdata" message with a tx hash is received from peer
 // int networkIsReachable(void *) - must return true when networking is available, false otherwise
@@ -142,6 +173,33 @@ void BRPeerSetCallbacks(BRPeer *peer, void *info,
                         int (*networkIsReachable)(void *info),
                         void (*threadCleanup)(void *info));
 
+// void relayedHeaders(void *, BRMerkleBlock *[], size_t) - called with the valid headers from a "headers" message, in
+// place of calling relayedBlock for each header, with the same info as the other callbacks (NULL to use relayedBlock)
+void BRPeerSetRelayedHeadersCallback(BRPeer *peer,
+                                     void (*relayedHeaders)(void *info, BRMerkleBlock *blocks[], size_t blocksCount));
+
+// sets whether peers connected after this call are serviced by a single shared reactor thread that waits on all their
+// sockets and deadlines with epoll, instead of each peer having its own thread that polls its socket
+// the threadCleanup callback of peers the reactor thread services is called on it after their disconnected callback
+// returns true if the reactor is enabled, which is never the case on systems without epoll
+int BRPeerSetReactorEnabled(int enabled);
+
+// stops the worker threads and the reactor thread shared by all peers, waiting for them to exit, so the library can be
+// unloaded cleanly - call this only once all peers are disconnected, any the reactor thread still services are
+// disconnected with ECONNABORTED, and the threads are started again as needed if more peers connect
+void BRPeerStopThreads(void);
+
+// sets the handler for a message type that peers don't otherwise handle, such as MSG_SENDHEADERS, MSG_CFILTER or
+// MSG_WTXIDRELAY, for all peers - a NULL handler drops messages of that type again
+// int handler(void *, BRPeer *, const uint8_t *, size_t) - called with each message of the given type received from a
+//   peer, on the thread servicing that peer, must return false if the message is malformed so the peer is disconnected
+// handlers can be set while peers are connected, but a replaced handler may still be called by a peer that looked it
+//   up just before it was replaced, so its info must stay valid until that handler returns
+// returns true on success, or false if type is handled by peers already, is longer than 11 characters, or if there's no
+// more room for message types
+int BRPeerSetMessageHandler(const char *type, void *info,
+                            int (*handler)(void *info, BRPeer *peer, const uint8_t *msg, size_t msgLen));
+
 // set earliestKeyTime to wallet creation time in order to speed up initial sync
 void BRPeerSetEarliestKeyTime(BRPeer *peer, uint32_t earliestKeyTime);
 
@@ -181,6 +239,9 @@ uint64_t BRPeerFeePerKb(BRPeer *peer);
 // average ping time for connected peer
 double BRPeerPingTime(BRPeer *peer);
 
+// writes the wire stats for peer since it was created to stats, it's safe to call from any thread
+void BRPeerGetStats(BRPeer *peer, BRPeerStats *stats);
+
 // sends a bitcoin protocol message to peer
 void BRPeerSendMessage(BRPeer *peer, const uint8_t *msg, size_t msgLen, const char *type);
 void BRPeerSendFilterload(BRPeer *peer, const uint8_t *filter, size_t filterLen);
@@ -24,6 +24,7 @@
 
 #include "BRPeerManager.h"
 #include "BRBloomFilter.h"
+#include "BRChainFile.h"
 #include "BRSet.h"
 #include "BRArray.h"
 #include "BRInt.h"
@@ -44,6 +45,9 @@
 #define CHECKPOINT_COUNT      (sizeof(checkpoint_array)/sizeof(*checkpoint_array))
 #define DNS_SEEDS_COUNT       (sizeof(dns_seeds)/sizeof(*dns_seeds))
 #define GENESIS_BLOCK_HASH    (UInt256Reverse(u256_hex_decode(checkpoint_array[0].hash)))
+#define CHAIN_PAGE_HEADERS    1024 // number of chain entries allocated together in one contiguous page
+#define CHAIN_RING_SIZE       4096 // number of recent main chain entries indexed by height, must be more than 2016
+#define CHAIN_FILE_MAX_COUNT  (4*BLOCK_DIFFICULTY_INTERVAL) // headers the chain file holds before it's compacted
 #define PEER_FLAG_SYNCED      0x01
 #define PEER_FLAG_NEEDSUPDATE 0x02
 
@@ -243,13 +247,13 @@ inline static int _BRPrevBlockEq(const void *block, const void *otherBlock)
 inline static size_t _BRBlockHeightHash(const void *block)
 {
     // (FNV_OFFSET xor height)*FNV_PRIME
-    return (size_t)((0x811C9dc5 ^ ((const BRMerkleBlock *)block)->height)*0x01000193);
+    return (size_t)((0x811C9dc5 ^ ((const BRBlockHeader *)block)->height)*0x01000193);
 }
 
 // true if block and otherBlock have equal height values
 inline static int _BRBlockHeightEq(const void *block, const void *otherBlock)
 {
-    return (((const BRMerkleBlock *)block)->height == ((const BRMerkleBlock *)otherBlock)->height);
+    return (((const BRBlockHeader *)block)->height == ((const BRBlockHeader *)otherBlock)->height);
 }
 
 struct BRPeerManagerStruct {
@@ -260,8 +264,12 @@ struct BRPeerManagerStruct {
     uint32_t earliestKeyTime, syncStartHeight, filterUpdateHeight, estimatedHeight;
     BRBloomFilter *bloomFilter;
     double fpRate, averageTxPerBlock;
-    BRSet *blocks, *orphans, *checkpoints;
-    BRMerkleBlock *lastBlock, *lastOrphan;
+    BRSet *blocks, *merkleBlocks, *orphans, *checkpoints;
+    BRBlockHeader *lastBlock, **headerPages, **freeHeaders;
+    BRBlockHeader *chain[CHAIN_RING_SIZE]; // recent main chain entries, chain[height % CHAIN_RING_SIZE]
+    size_t headerCount;
+    BRMerkleBlock *lastOrphan;
+    BRChainFile *chainFile;
     BRTxPeerList *txRelays, *txRequests;
     BRPublishedTx *publishedTx;
     UInt256 *publishedTxHashes;
@@ -324,20 +332,52 @@ static void _BRPeerManagerAddTxToPublishList(BRPeerManager *manager, BRTransacti
     }
 }
 
+// returns the main chain entry at height if it's one of the most recent CHAIN_RING_SIZE main chain blocks, and hasn't
+// been pruned, otherwise NULL
+static BRBlockHeader *_BRPeerManagerChainAt(BRPeerManager *manager, uint32_t height)
+{
+    BRBlockHeader *header = NULL;
+    
+    if (height <= manager->lastBlock->height && height + CHAIN_RING_SIZE > manager->lastBlock->height) {
+        header = manager->chain[height % CHAIN_RING_SIZE];
+    }
+    
+    return (header && header->height == height) ? header : NULL;
+}
+
+// returns the ancestor of header at height, or NULL if it's not in the chain index - once the walk back reaches the
+// main chain, the ancestor is found with a single lookup when it's one of the most recent main chain blocks
+static BRBlockHeader *_BRPeerManagerAncestor(BRPeerManager *manager, BRBlockHeader *header, uint32_t height)
+{
+    BRBlockHeader *b;
+    
+    while (header && header->height > height) {
+        b = (_BRPeerManagerChainAt(manager, header->height) == header) ? _BRPeerManagerChainAt(manager, height) : NULL;
+        header = (b) ? b : BRSetGet(manager->blocks, &header->prevBlock);
+    }
+    
+    return (header && header->height == height) ? header : NULL;
+}
+
+// sets the main chain tip to header, which must either extend the main chain or already be in it
+static void _BRPeerManagerSetLastBlock(BRPeerManager *manager, BRBlockHeader *header)
+{
+    manager->lastBlock = header;
+    manager->chain[header->height % CHAIN_RING_SIZE] = header;
+}
+
 static size_t _BRPeerManagerBlockLocators(BRPeerManager *manager, UInt256 locators[], size_t locatorsCount)
 {
     // append 10 most recent block hashes, decending, then continue appending, doubling the step back each time,
     // finishing with the genesis block (top, -1, -2, -3, -4, -5, -6, -7, -8, -9, -11, -15, -23, -39, -71, -135, ..., 0)
-    BRMerkleBlock *block = manager->lastBlock;
-    int32_t step = 1, i = 0, j;
+    BRBlockHeader *block = manager->lastBlock;
+    int32_t step = 1, i = 0;
     
     while (block && block->height > 0) {
         if (locators && i < locatorsCount) locators[i] = block->blockHash;
         if (++i >= 10) step *= 2;
         
-        for (j = 0; block && j < step; j++) {
-            block = BRSetGet(manager->blocks, &block->prevBlock);
-        }
+        block = (block->height >= (uint32_t)step) ? _BRPeerManagerAncestor(manager, block, block->height - step) : NULL;
     }
     
     if (locators && i < locatorsCount) locators[i] = GENESIS_BLOCK_HASH;
@@ -346,9 +386,135 @@ static size_t _BRPeerManagerBlockLocators(BRPeerManager *manager, UInt256 locato
 
 static void _setMapFreeBlock(void *info, void *block)
 {
+    (void)info;
     BRMerkleBlockFree(block);
 }
 
+// keeps block as the full merkle block for its chain entry if it has matched transactions, replacing any previously
+// kept merkle block for the same chain entry, otherwise block is freed and any previously kept merkle block is left
+static void _BRPeerManagerKeepMerkleBlock(BRPeerManager *manager, BRMerkleBlock *block, size_t txCount)
+{
+    BRMerkleBlock *b;
+    
+    if (txCount > 0) {
+        b = BRSetAdd(manager->merkleBlocks, block);
+        if (b && b != block) BRMerkleBlockFree(b);
+    }
+    else if (BRSetGet(manager->merkleBlocks, &block->blockHash) != block) BRMerkleBlockFree(block);
+}
+
+// returns a zeroed chain entry that isn't yet in the chain index, allocated from a page of contiguous entries, so that
+// walking prevBlock chains touches as little memory as possible
+static BRBlockHeader *_BRPeerManagerNewHeader(BRPeerManager *manager)
+{
+    BRBlockHeader *header;
+    
+    if (array_count(manager->freeHeaders) > 0) {
+        header = manager->freeHeaders[array_count(manager->freeHeaders) - 1];
+        array_rm_last(manager->freeHeaders);
+    }
+    else {
+        if ((manager->headerCount % CHAIN_PAGE_HEADERS) == 0) {
+            header = malloc(CHAIN_PAGE_HEADERS*sizeof(*header));
+            assert(header != NULL);
+            array_add(manager->headerPages, header);
+        }
+        
+        header = manager->headerPages[array_count(manager->headerPages) - 1];
+        header += manager->headerCount++ % CHAIN_PAGE_HEADERS;
+    }
+    
+    memset(header, 0, sizeof(*header));
+    return header;
+}
+
+// adds a copy of header to the chain index, or updates its existing chain entry, and returns the chain entry
+static BRBlockHeader *_BRPeerManagerAddHeader(BRPeerManager *manager, const BRBlockHeader *header)
+{
+    BRBlockHeader *h = BRSetGet(manager->blocks, &header->blockHash);
+    
+    if (! h) {
+        h = _BRPeerManagerNewHeader(manager);
+        *h = *header;
+        BRSetAdd(manager->blocks, h);
+    }
+    else *h = *header;
+    
+    return h;
+}
+
+// adds block to the chain index, or updates its existing chain entry, and returns the chain entry - the full merkle
+// block is only kept if it has matched transactions, otherwise block is freed
+static BRBlockHeader *_BRPeerManagerAddBlock(BRPeerManager *manager, BRMerkleBlock *block, size_t txCount)
+{
+    BRBlockHeader header;
+    
+    BRBlockHeaderSet(&header, block);
+    _BRPeerManagerKeepMerkleBlock(manager, block, txCount);
+    return _BRPeerManagerAddHeader(manager, &header);
+}
+
+// removes header from the chain index along with any full merkle block kept for it, and frees its chain entry
+static void _BRPeerManagerRemoveBlock(BRPeerManager *manager, BRBlockHeader *header)
+{
+    BRMerkleBlock *block = BRSetRemove(manager->merkleBlocks, &header->blockHash);
+    size_t i = header->height % CHAIN_RING_SIZE;
+    
+    if (block) BRMerkleBlockFree(block);
+    if (manager->chain[i] == header) manager->chain[i] = NULL;
+    BRSetRemove(manager->blocks, header);
+    array_add(manager->freeHeaders, header);
+}
+
+// returns the block to pass to the saveBlocks callback for the chain entry header, which is the full merkle block if
+// one was kept, otherwise a header only block is written to buf and returned
+static BRMerkleBlock *_BRPeerManagerSaveBlock(BRPeerManager *manager, const BRBlockHeader *header, BRMerkleBlock *buf)
+{
+    BRMerkleBlock *block = BRSetGet(manager->merkleBlocks, &header->blockHash);
+    
+    if (! block) *buf = BRBlockHeaderMerkleBlock(header), block = buf;
+    return block;
+}
+
+// brings the chain file up to date with the main chain ending at lastBlock, first truncating any headers that are no
+// longer in the main chain, and syncs it to persistent storage if sync is true
+static void _BRPeerManagerUpdateChainFile(BRPeerManager *manager, int sync)
+{
+    BRChainFile *file = manager->chainFile;
+    uint32_t first, start, end, height = manager->lastBlock->height;
+    const BRBlockHeader *h;
+    BRBlockHeader *b;
+    
+    if (! file) return;
+    first = BRChainFileFirstHeight(file);
+    end = first + (uint32_t)BRChainFileCount(file);
+    if (end > height + 1) end = height + 1;
+    
+    while (end > first) { // walk back to where the file joins the main chain
+        h = BRChainFileHeader(file, end - 1);
+        b = _BRPeerManagerChainAt(manager, end - 1);
+        if (b && UInt256Eq(h->blockHash, b->blockHash)) break;
+        end = (b) ? end - 1 : first; // start the file over if the join point is older than the main chain ring
+    }
+    
+    BRChainFileTruncate(file, end);
+    
+    if (BRChainFileCount(file) == 0) { // start with the transition block before the last one, same as saveBlocks
+        start = height % BLOCK_DIFFICULTY_INTERVAL + BLOCK_DIFFICULTY_INTERVAL;
+        start = (height > start) ? height - start : 0;
+        for (end = height; end > start && _BRPeerManagerChainAt(manager, end - 1); end--);
+    }
+    
+    while (end <= height && (b = _BRPeerManagerChainAt(manager, end)) && BRChainFileAppend(file, b)) end++;
+    
+    if (sync && BRChainFileCount(file) > CHAIN_FILE_MAX_COUNT) { // only keep the headers that are loaded at startup
+        start = height % BLOCK_DIFFICULTY_INTERVAL + BLOCK_DIFFICULTY_INTERVAL;
+        if (height > start) BRChainFileCompact(file, height - start);
+    }
+    
+    if (sync) BRChainFileSync(file);
+}
+
 static void _BRPeerManagerLoadBloomFilter(BRPeerManager *manager, BRPeer *peer)
 {
     // every time a new wallet address is added, the bloom filter has to be rebuilt, and each address is only used
@@ -364,41 +530,51 @@ static void _BRPeerManagerLoadBloomFilter(BRPeerManager *manager, BRPeer *peer)
     manager->fpRate = BLOOM_REDUCED_FALSEPOSITIVE_RATE;
     
     size_t addrsCount = BRWalletAllAddrs(manager->wallet, NULL, 0);
-    BRAddress *addrs = malloc(addrsCount*sizeof(*addrs));
+    BRAddress *addrs = (addrsCount > 0) ? malloc(addrsCount*sizeof(*addrs)) : NULL;
     size_t utxosCount = BRWalletUTXOs(manager->wallet, NULL, 0);
-    BRUTXO *utxos = malloc(utxosCount*sizeof(*utxos));
+    BRUTXO *utxos = (utxosCount > 0) ? malloc(utxosCount*sizeof(*utxos)) : NULL;
     uint32_t blockHeight = (manager->lastBlock->height > 100) ? manager->lastBlock->height - 100 : 0;
     size_t txCount = BRWalletTxUnconfirmedBefore(manager->wallet, NULL, 0, blockHeight);
-    BRTransaction **transactions = malloc(txCount*sizeof(*transactions));
+    BRTransaction **transactions = (txCount > 0) ? malloc(txCount*sizeof(*transactions)) : NULL;
     BRBloomFilter *filter;
+    size_t inCount = 0, elemCount = 0, outpointCount = 0, maxCount;
     
-    assert(addrs != NULL);
-    assert(utxos != NULL);
-    assert(transactions != NULL);
+    assert(addrs != NULL || addrsCount == 0);
+    assert(utxos != NULL || utxosCount == 0);
+    assert(transactions != NULL || txCount == 0);
     addrsCount = BRWalletAllAddrs(manager->wallet, addrs, addrsCount);
     utxosCount = BRWalletUTXOs(manager->wallet, utxos, utxosCount);
     txCount = BRWalletTxUnconfirmedBefore(manager->wallet, transactions, txCount, blockHeight);
     filter = BRBloomFilterNew(manager->fpRate, addrsCount + utxosCount + txCount + 100, (uint32_t)BRPeerHash(peer),
                               BLOOM_UPDATE_ALL); // BUG: XXX txCount not the same as number of spent wallet outputs
+    for (size_t i = 0; i < txCount; i++) inCount += transactions[i]->inCount;
+    
+    // the filter elements are collected first, and then hashed and added in one pass
+    maxCount = addrsCount + utxosCount + inCount;
+    UInt160 *hashes = (addrsCount > 0) ? malloc(addrsCount*sizeof(*hashes)) : NULL;
+    uint8_t (*outpoints)[sizeof(UInt256) + sizeof(uint32_t)] =
+        (utxosCount + inCount > 0) ? malloc((utxosCount + inCount)*sizeof(*outpoints)) : NULL;
+    const uint8_t **elems = (maxCount > 0) ? malloc(maxCount*sizeof(*elems)) : NULL;
+    size_t *elemLens = (maxCount > 0) ? malloc(maxCount*sizeof(*elemLens)) : NULL;
+    
+    assert(hashes != NULL || addrsCount == 0);
+    assert(outpoints != NULL || utxosCount + inCount == 0);
+    assert(elems != NULL || maxCount == 0);
+    assert(elemLens != NULL || maxCount == 0);
     
     for (size_t i = 0; i < addrsCount; i++) { // add addresses to watch for tx receiveing money to the wallet
-        UInt160 hash = UINT160_ZERO;
-        
-        BRAddressHash160(&hash, addrs[i].s);
-        
-        if (! UInt160IsZero(hash) && ! BRBloomFilterContainsData(filter, hash.u8, sizeof(hash))) {
-            BRBloomFilterInsertData(filter, hash.u8, sizeof(hash));
-        }
+        hashes[i] = UINT160_ZERO;
+        BRAddressHash160(&hashes[i], addrs[i].s);
+        if (UInt160IsZero(hashes[i])) continue;
+        elems[elemCount] = hashes[i].u8, elemLens[elemCount++] = sizeof(*hashes);
     }
 
     free(addrs);
         
     for (size_t i = 0; i < utxosCount; i++) { // add UTXOs to watch for tx sending money from the wallet
-        uint8_t o[sizeof(UInt256) + sizeof(uint32_t)];
-        
-        UInt256Set(o, utxos[i].hash);
-        UInt32SetLE(&o[sizeof(UInt256)], utxos[i].n);
-        if (! BRBloomFilterContainsData(filter, o, sizeof(o))) BRBloomFilterInsertData(filter, o, sizeof(o));
+        UInt256Set(outpoints[outpointCount], utxos[i].hash);
+        UInt32SetLE(&outpoints[outpointCount][sizeof(UInt256)], utxos[i].n);
+        elems[elemCount] = outpoints[outpointCount++], elemLens[elemCount++] = sizeof(*outpoints);
     }
     
     free(utxos);
@@ -407,17 +583,21 @@ static void _BRPeerManagerLoadBloomFilter(BRPeerManager *manager, BRPeer *peer)
         for (size_t j = 0; j < transactions[i]->inCount; j++) {
             BRTxInput *input = &transactions[i]->inputs[j];
             BRTransaction *tx = BRWalletTransactionForHash(manager->wallet, input->txHash);
-            uint8_t o[sizeof(UInt256) + sizeof(uint32_t)];
             
             if (tx && input->index < tx->outCount &&
                 BRWalletContainsAddress(manager->wallet, tx->outputs[input->index].address)) {
-                UInt256Set(o, input->txHash);
-                UInt32SetLE(&o[sizeof(UInt256)], input->index);
-                if (! BRBloomFilterContainsData(filter, o, sizeof(o))) BRBloomFilterInsertData(filter, o,sizeof(o));
+                UInt256Set(outpoints[outpointCount], input->txHash);
+                UInt32SetLE(&outpoints[outpointCount][sizeof(UInt256)], input->index);
+                elems[elemCount] = outpoints[outpointCount++], elemLens[elemCount++] = sizeof(*outpoints);
             }
         }
     }
     
+    BRBloomFilterInsertDataList(filter, elems, elemLens, elemCount);
+    free(elemLens);
+    free(elems);
+    free(outpoints);
+    free(hashes);
     free(transactions);
     if (manager->bloomFilter) BRBloomFilterFree(manager->bloomFilter);
     manager->bloomFilter = filter;
@@ -1169,18 +1349,24 @@ static void _peerRejectedTx(void *info, UInt256 txHash, uint8_t code)
     if (manager->txStatusUpdate) manager->txStatusUpdate(manager->info);
 }
 
-static int _BRPeerManagerVerifyBlock(BRPeerManager *manager, BRMerkleBlock *block, BRMerkleBlock *prev, BRPeer *peer)
+static int _BRPeerManagerVerifyBlock(BRPeerManager *manager, BRMerkleBlock *block, BRBlockHeader *prev, BRPeer *peer)
 {
     uint32_t transitionTime = 0;
     int r = 1;
     
+    // proof-of-work is only computed for blocks that are linked into the chain, and not for discarded blocks
+    if (! BRMerkleBlockVerifyPoW(block)) {
+        peer_log(peer, "relayed block with invalid proof-of-work, blockHash: %s", u256_hex_encode(block->blockHash));
+        r = 0;
+    }
+    
     // check if we hit a difficulty transition, and find previous transition time
-    if ((block->height % BLOCK_DIFFICULTY_INTERVAL) == 0) {
-        BRMerkleBlock *b = block;
+    if (r && (block->height % BLOCK_DIFFICULTY_INTERVAL) == 0) {
+        BRBlockHeader *b = NULL;
         UInt256 prevBlock;
 
-        for (uint32_t i = 0; b && i < BLOCK_DIFFICULTY_INTERVAL; i++) {
-            b = BRSetGet(manager->blocks, &b->prevBlock);
+        if (block->height >= BLOCK_DIFFICULTY_INTERVAL) {
+            b = _BRPeerManagerAncestor(manager, prev, block->height - BLOCK_DIFFICULTY_INTERVAL);
         }
 
         if (! b) {
@@ -1196,26 +1382,25 @@ static int _BRPeerManagerVerifyBlock(BRPeerManager *manager, BRMerkleBlock *bloc
         while (b) { // free up some memory
             b = BRSetGet(manager->blocks, &prevBlock);
             if (b) prevBlock = b->prevBlock;
-
-            if (b && (b->height % BLOCK_DIFFICULTY_INTERVAL) != 0) {
-                BRSetRemove(manager->blocks, b);
-                BRMerkleBlockFree(b);
-            }
+            if (b && (b->height % BLOCK_DIFFICULTY_INTERVAL) != 0) _BRPeerManagerRemoveBlock(manager, b);
         }
     }
 
     // verify block difficulty
-    if (r && ! BRMerkleBlockVerifyDifficulty(block, prev, transitionTime)) {
+    if (r && ! BRMerkleBlockVerifyDifficultyHeader(block, prev, transitionTime)) {
         peer_log(peer, "relayed block with invalid difficulty target %x, blockHash: %s", block->target,
                  u256_hex_encode(block->blockHash));
         r = 0;
     }
     
     if (r) {
-        BRMerkleBlock *checkpoint = BRSetGet(manager->checkpoints, block);
+        BRBlockHeader h, *checkpoint;
+
+        h.height = block->height;
+        checkpoint = BRSetGet(manager->checkpoints, &h);
 
         // verify blockchain checkpoints
-        if (checkpoint && ! BRMerkleBlockEq(block, checkpoint)) {
+        if (checkpoint && ! UInt256Eq(block->blockHash, checkpoint->blockHash)) {
             peer_log(peer, "relayed a block that differs from the checkpoint at height %"PRIu32", blockHash: %s, "
                      "expected: %s", block->height, u256_hex_encode(block->blockHash),
                      u256_hex_encode(checkpoint->blockHash));
@@ -1226,20 +1411,25 @@ static int _BRPeerManagerVerifyBlock(BRPeerManager *manager, BRMerkleBlock *bloc
     return r;
 }
 
-static void _peerRelayedBlock(void *info, BRMerkleBlock *block)
+// adds a block relayed by peer to the chain, must be called with manager->lock held
+// returns the block's chain entry if it was added to the chain, or NULL if it was freed or kept as an orphan, sets
+// saveCount to the number of blocks ending with the returned block that need to be saved, and sets next to the orphan
+// that follows the block, if any
+static BRBlockHeader *_BRPeerManagerAcceptBlock(BRPeerManager *manager, BRPeer *peer, BRMerkleBlock *block,
+                                               size_t *saveCount, BRMerkleBlock **next)
 {
-    BRPeer *peer = ((BRPeerCallbackInfo *)info)->peer;
-    BRPeerManager *manager = ((BRPeerCallbackInfo *)info)->manager;
-    size_t txCount = BRMerkleBlockTxHashes(block, NULL, 0);
+    size_t txCount = block->hashesCount; // upper bound on the number of matched tx hashes
     UInt256 _txHashes[(sizeof(UInt256)*txCount <= 0x1000) ? txCount : 0],
             *txHashes = (sizeof(UInt256)*txCount <= 0x1000) ? _txHashes : malloc(txCount*sizeof(*txHashes));
-    size_t i, fpCount = 0, saveCount = 0;
-    BRMerkleBlock orphan, *b, *b2, *prev, *next = NULL;
-    uint32_t txTime = 0;
+    size_t i, fpCount = 0;
+    BRMerkleBlock orphan;
+    BRBlockHeader *header = NULL, *b, *b2, *prev;
+    uint32_t txTime = 0, height = BLOCK_UNKNOWN_HEIGHT;
     
     assert(txHashes != NULL);
     txCount = BRMerkleBlockTxHashes(block, txHashes, txCount);
-    pthread_mutex_lock(&manager->lock);
+    *saveCount = 0;
+    *next = NULL;
     prev = BRSetGet(manager->blocks, &block->prevBlock);
 
     if (prev) {
@@ -1296,6 +1486,12 @@ static void _peerRelayedBlock(void *info, BRMerkleBlock *block)
             BRMerkleBlockFree(block);
             block = NULL;
         }
+        else if (! BRMerkleBlockVerifyPoW(block)) {
+            peer_log(peer, "relayed orphan with invalid proof-of-work");
+            BRMerkleBlockFree(block);
+            block = NULL;
+            _BRPeerManagerPeerMisbehavin(manager, peer);
+        }
         else {
             // call getblocks, unless we already did with the previous block, or we're still syncing
             if (manager->lastBlock->height >= BRPeerLastBlock(peer) &&
@@ -1323,43 +1519,37 @@ static void _peerRelayedBlock(void *info, BRMerkleBlock *block)
             peer_log(peer, "adding block #%"PRIu32", false positive rate: %f", block->height, manager->fpRate);
         }
         
-        BRSetAdd(manager->blocks, block);
-        manager->lastBlock = block;
-        _BRPeerManagerUpdateTx(manager, txHashes, txCount, block->height, txTime);
-        if (manager->downloadPeer) BRPeerSetCurrentBlockHeight(manager->downloadPeer, block->height);
+        header = _BRPeerManagerAddBlock(manager, block, txCount);
+        block = NULL;
+        _BRPeerManagerSetLastBlock(manager, header);
+        _BRPeerManagerUpdateTx(manager, txHashes, txCount, header->height, txTime);
+        if (manager->downloadPeer) BRPeerSetCurrentBlockHeight(manager->downloadPeer, header->height);
             
-        if (block->height < manager->estimatedHeight && peer == manager->downloadPeer) {
+        if (header->height < manager->estimatedHeight && peer == manager->downloadPeer) {
             BRPeerScheduleDisconnect(peer, PROTOCOL_TIMEOUT); // reschedule sync timeout
             manager->connectFailureCount = 0; // reset failure count once we know our initial request didn't timeout
         }
         
-        if ((block->height % BLOCK_DIFFICULTY_INTERVAL) == 0) saveCount = 1; // save transition block immediately
+        if ((header->height % BLOCK_DIFFICULTY_INTERVAL) == 0) *saveCount = 1; // save transition block immediately
         
-        if (block->height == manager->estimatedHeight) { // chain download is complete
-            saveCount = (block->height % BLOCK_DIFFICULTY_INTERVAL) + BLOCK_DIFFICULTY_INTERVAL + 1;
+        if (header->height == manager->estimatedHeight) { // chain download is complete
+            *saveCount = (header->height % BLOCK_DIFFICULTY_INTERVAL) + BLOCK_DIFFICULTY_INTERVAL + 1;
             _BRPeerManagerLoadMempools(manager);
         }
     }
-    else if (BRSetContains(manager->blocks, block)) { // we already have the block (or at least the header)
+    else if (BRSetContains(manager->blocks, &block->blockHash)) { // we already have the block (or at least the header)
         if ((block->height % 500) == 0 || txCount > 0 || block->height >= BRPeerLastBlock(peer)) {
             peer_log(peer, "relayed existing block #%"PRIu32, block->height);
         }
         
-        b = manager->lastBlock;
-        while (b && b->height > block->height) b = BRSetGet(manager->blocks, &b->prevBlock); // is block in main chain?
+        b = _BRPeerManagerAncestor(manager, manager->lastBlock, block->height); // is block in main chain?
         
-        if (BRMerkleBlockEq(b, block)) { // if it's not on a fork, set block heights for its transactions
+        if (b && UInt256Eq(b->blockHash, block->blockHash)) { // if it's not on a fork, set block heights for its tx
             _BRPeerManagerUpdateTx(manager, txHashes, txCount, block->height, txTime);
-            if (block->height == manager->lastBlock->height) manager->lastBlock = block;
         }
         
-        b = BRSetAdd(manager->blocks, block);
-
-        if (b != block) {
-            if (BRSetGet(manager->orphans, b) == b) BRSetRemove(manager->orphans, b);
-            if (manager->lastOrphan == b) manager->lastOrphan = NULL;
-            BRMerkleBlockFree(b);
-        }
+        header = _BRPeerManagerAddBlock(manager, block, txCount);
+        block = NULL;
     }
     else if (manager->lastBlock->height < BRPeerLastBlock(peer) &&
              block->height > manager->lastBlock->height + 1) { // special case, new block mined durring rescan
@@ -1375,27 +1565,33 @@ static void _peerRelayedBlock(void *info, BRMerkleBlock *block)
     }
     else { // new block is on a fork
         peer_log(peer, "chain fork reached height %"PRIu32, block->height);
-        BRSetAdd(manager->blocks, block);
+        header = _BRPeerManagerAddBlock(manager, block, txCount);
+        block = NULL;
 
-        if (block->height > manager->lastBlock->height) { // check if fork is now longer than main chain
-            b = block;
+        if (header->height > manager->lastBlock->height) { // check if fork is now longer than main chain
+            b = header;
             b2 = manager->lastBlock;
             
-            while (b && b2 && ! BRMerkleBlockEq(b, b2)) { // walk back to where the fork joins the main chain
+            while (b && b2 && b != b2) { // walk back to where the fork joins the main chain
                 b = BRSetGet(manager->blocks, &b->prevBlock);
-                if (b && b->height < b2->height) b2 = BRSetGet(manager->blocks, &b2->prevBlock);
+                if (b && b->height < b2->height) b2 = _BRPeerManagerAncestor(manager, b2, b->height);
             }
             
-            peer_log(peer, "reorganizing chain from height %"PRIu32", new height is %"PRIu32, b->height, block->height);
+            peer_log(peer, "reorganizing chain from height %"PRIu32", new height is %"PRIu32, b->height,
+                     header->height);
         
             BRWalletSetTxUnconfirmedAfter(manager->wallet, b->height); // mark tx after the join point as unconfirmed
 
-            b = block;
+            b = header;
         
             while (b && b2 && b->height > b2->height) { // set transaction heights for new main chain
-                size_t count = BRMerkleBlockTxHashes(b, NULL, 0);
+                BRMerkleBlock *mb = BRSetGet(manager->merkleBlocks, &b->blockHash); // only kept if it has matched tx
+                size_t count = (mb) ? mb->hashesCount : 0;
                 uint32_t height = b->height, timestamp = b->timestamp;
                 
+                // update the main chain ring, without overwriting newer heights if the fork is longer than the ring
+                if (height + CHAIN_RING_SIZE > header->height) manager->chain[height % CHAIN_RING_SIZE] = b;
+                
                 if (count > txCount) {
                     txHashes = (txHashes != _txHashes) ? realloc(txHashes, count*sizeof(*txHashes)) :
                                malloc(count*sizeof(*txHashes));
@@ -1403,49 +1599,133 @@ static void _peerRelayedBlock(void *info, BRMerkleBlock *block)
                     txCount = count;
                 }
                 
-                count = BRMerkleBlockTxHashes(b, txHashes, count);
+                count = (mb) ? BRMerkleBlockTxHashes(mb, txHashes, count) : 0;
                 b = BRSetGet(manager->blocks, &b->prevBlock);
                 if (b) timestamp = timestamp/2 + b->timestamp/2;
                 BRWalletUpdateTransactions(manager->wallet, txHashes, count, height, timestamp);
             }
         
-            manager->lastBlock = block;
+            manager->lastBlock = header; // main chain ring was already updated above
             
-            if (block->height == manager->estimatedHeight) { // chain download is complete
-                saveCount = (block->height % BLOCK_DIFFICULTY_INTERVAL) + BLOCK_DIFFICULTY_INTERVAL + 1;
+            if (header->height == manager->estimatedHeight) { // chain download is complete
+                *saveCount = (header->height % BLOCK_DIFFICULTY_INTERVAL) + BLOCK_DIFFICULTY_INTERVAL + 1;
                 _BRPeerManagerLoadMempools(manager);
             }
         }
     }
    
     if (txHashes != _txHashes) free(txHashes);
+    
+    // keep the chain file up to date whenever the main chain changes, syncing it once the chain download is complete
+    if (header && header == manager->lastBlock) _BRPeerManagerUpdateChainFile(manager, (*saveCount > 1));
+    if (header) height = header->height, orphan.prevBlock = header->blockHash;
+    else if (block) height = block->height, orphan.prevBlock = block->blockHash; // block was kept as an orphan
    
-    if (block && block->height != BLOCK_UNKNOWN_HEIGHT) {
-        if (block->height > manager->estimatedHeight) manager->estimatedHeight = block->height;
-        
-        // check if the next block was received as an orphan
-        orphan.prevBlock = block->blockHash;
-        next = BRSetRemove(manager->orphans, &orphan);
+    if (height != BLOCK_UNKNOWN_HEIGHT) {
+        if (height > manager->estimatedHeight) manager->estimatedHeight = height;
+        *next = BRSetRemove(manager->orphans, &orphan); // check if the next block was received as an orphan
     }
     
+    return header;
+}
+
+static void _peerRelayedBlock(void *info, BRMerkleBlock *block)
+{
+    BRPeer *peer = ((BRPeerCallbackInfo *)info)->peer;
+    BRPeerManager *manager = ((BRPeerCallbackInfo *)info)->manager;
+    size_t i, saveCount = 0;
+    BRBlockHeader *header, *h;
+    BRMerkleBlock *next = NULL, *buf;
+    uint32_t height = 0;
+    
+    pthread_mutex_lock(&manager->lock);
+    header = _BRPeerManagerAcceptBlock(manager, peer, block, &saveCount, &next);
+    if (header) height = header->height;
+    
     BRMerkleBlock *saveBlocks[saveCount];
     
-    for (i = 0, b = block; b && i < saveCount; i++) {
-        saveBlocks[i] = b;
-        b = BRSetGet(manager->blocks, &b->prevBlock);
+    buf = (saveCount > 0) ? malloc(saveCount*sizeof(*buf)) : NULL;
+    assert(buf != NULL || saveCount == 0);
+    
+    for (i = 0, h = header; h && i < saveCount; i++) {
+        saveBlocks[i] = _BRPeerManagerSaveBlock(manager, h, &buf[i]);
+        h = BRSetGet(manager->blocks, &h->prevBlock);
     }
     
     pthread_mutex_unlock(&manager->lock);
     if (i > 0 && manager->saveBlocks) manager->saveBlocks(manager->info, saveBlocks, i);
+    if (buf) free(buf);
     
-    if (block && block->height != BLOCK_UNKNOWN_HEIGHT && block->height >= BRPeerLastBlock(peer) &&
-        manager->txStatusUpdate) {
+    if (header && height >= BRPeerLastBlock(peer) && manager->txStatusUpdate) {
         manager->txStatusUpdate(manager->info); // notify that transaction confirmations may have changed
     }
     
     if (next) _peerRelayedBlock(info, next);
 }
 
+static void _peerRelayedHeaders(void *info, BRMerkleBlock *blocks[], size_t blocksCount)
+{
+    BRPeer *peer = ((BRPeerCallbackInfo *)info)->peer;
+    BRPeerManager *manager = ((BRPeerCallbackInfo *)info)->manager;
+    size_t i, j, k, saveCount = 0, *saveCounts;
+    BRBlockHeader *header, *h, *last = NULL;
+    BRMerkleBlock *next = NULL, **saveBlocks, *buf;
+    UInt256 *saveHashes, lastHash = UINT256_ZERO;
+    uint32_t lastHeight = 0;
+    
+    array_new(saveHashes, 0);
+    array_new(saveCounts, 0);
+    pthread_mutex_lock(&manager->lock); // add the whole batch of headers under a single lock
+    
+    for (i = 0; i < blocksCount; i++) {
+        next = blocks[i];
+        
+        while (next) { // also add any orphans that follow the block
+            header = _BRPeerManagerAcceptBlock(manager, peer, next, &saveCount, &next);
+            if (header) lastHash = header->blockHash;
+            
+            // blocks can be replaced later in the batch, so remember hashes and look up the blocks to save at the end
+            for (j = 0, h = header; h && j < saveCount; j++) {
+                array_add(saveHashes, h->blockHash);
+                h = BRSetGet(manager->blocks, &h->prevBlock);
+            }
+            
+            if (j > 0) array_add(saveCounts, j); // each group is saved separately, see saveBlocks in BRPeerManager.h
+        }
+    }
+    
+    array_new(saveBlocks, array_count(saveHashes));
+    buf = (array_count(saveHashes) > 0) ? malloc(array_count(saveHashes)*sizeof(*buf)) : NULL;
+    assert(buf != NULL || array_count(saveHashes) == 0);
+    
+    for (i = 0, k = 0; i < array_count(saveCounts); i++) {
+        for (j = k + saveCounts[i], saveCounts[i] = 0; k < j; k++) {
+            h = BRSetGet(manager->blocks, &saveHashes[k]);
+            if (! h) continue; // blocks replaced later in the batch are left out of their group
+            array_add(saveBlocks, _BRPeerManagerSaveBlock(manager, h, &buf[k]));
+            saveCounts[i]++;
+        }
+    }
+    
+    if (! UInt256IsZero(lastHash)) last = BRSetGet(manager->blocks, &lastHash);
+    if (last) lastHeight = last->height;
+    pthread_mutex_unlock(&manager->lock);
+    
+    // a count of 1 adds a block, and more than 1 replaces all saved blocks, so each group needs its own call
+    for (i = 0, k = 0; manager->saveBlocks && i < array_count(saveCounts); k += saveCounts[i], i++) {
+        if (saveCounts[i] > 0) manager->saveBlocks(manager->info, &saveBlocks[k], saveCounts[i]);
+    }
+    
+    if (last && lastHeight >= BRPeerLastBlock(peer) && manager->txStatusUpdate) {
+        manager->txStatusUpdate(manager->info); // notify that transaction confirmations may have changed
+    }
+    
+    if (buf) free(buf);
+    array_free(saveBlocks);
+    array_free(saveCounts);
+    array_free(saveHashes);
+}
+
 static void _peerDataNotfound(void *info, const UInt256 txHashes[], size_t txCount,
                              const UInt256 blockHashes[], size_t blockCount)
 {
@@ -1582,7 +1862,8 @@ BRPeerManager *BRPeerManagerNew(BRWallet *wallet, uint32_t earliestKeyTime, BRMe
                                 const BRPeer peers[], size_t peersCount)
 {
     BRPeerManager *manager = calloc(1, sizeof(*manager));
-    BRMerkleBlock orphan, *block = NULL;
+    BRMerkleBlock orphan, *block = NULL, *next;
+    BRBlockHeader *header;
     
     assert(manager != NULL);
     assert(wallet != NULL);
@@ -1595,22 +1876,25 @@ BRPeerManager *BRPeerManagerNew(BRWallet *wallet, uint32_t earliestKeyTime, BRMe
     if (peers) array_add_array(manager->peers, peers, peersCount);
     qsort(manager->peers, array_count(manager->peers), sizeof(*manager->peers), _peerTimestampCompare);
     array_new(manager->connectedPeers, PEER_MAX_CONNECTIONS);
-    manager->blocks = BRSetNew(BRMerkleBlockHash, BRMerkleBlockEq, blocksCount);
+    array_new(manager->headerPages, 10);
+    array_new(manager->freeHeaders, 10);
+    manager->blocks = BRSetNew(BRMerkleBlockHash, BRMerkleBlockEq, blocksCount); // chain entries are BRBlockHeader
+    manager->merkleBlocks = BRSetNew(BRMerkleBlockHash, BRMerkleBlockEq, 100);
     manager->orphans = BRSetNew(_BRPrevBlockHash, _BRPrevBlockEq, blocksCount); // orphans are indexed by prevBlock
     manager->checkpoints = BRSetNew(_BRBlockHeightHash, _BRBlockHeightEq, 100); // checkpoints are indexed by height
 
     for (size_t i = 0; i < CHECKPOINT_COUNT; i++) {
-        block = BRMerkleBlockNew();
-        block->height = checkpoint_array[i].height;
-        block->blockHash = UInt256Reverse(u256_hex_decode(checkpoint_array[i].hash));
-        block->timestamp = checkpoint_array[i].timestamp;
-        block->target = checkpoint_array[i].target;
-        BRSetAdd(manager->checkpoints, block);
-        BRSetAdd(manager->blocks, block);
-        if (i == 0 || block->timestamp + 7*24*60*60 < manager->earliestKeyTime) manager->lastBlock = block;
+        header = _BRPeerManagerNewHeader(manager);
+        header->height = checkpoint_array[i].height;
+        header->blockHash = UInt256Reverse(u256_hex_decode(checkpoint_array[i].hash));
+        header->timestamp = checkpoint_array[i].timestamp;
+        header->target = checkpoint_array[i].target;
+        BRSetAdd(manager->checkpoints, header);
+        BRSetAdd(manager->blocks, header);
+        if (i == 0 || header->timestamp + 7*24*60*60 < manager->earliestKeyTime) {
+            _BRPeerManagerSetLastBlock(manager, header);
+        }
     }
-
-    block = NULL;
     
     for (size_t i = 0; blocks && i < blocksCount; i++) {
         assert(blocks[i]->height != BLOCK_UNKNOWN_HEIGHT); // height must be saved/restored along with serialized block
@@ -1621,12 +1905,13 @@ BRPeerManager *BRPeerManagerNew(BRWallet *wallet, uint32_t earliestKeyTime, BRMe
     }
     
     while (block) {
-        BRSetAdd(manager->blocks, block);
-        manager->lastBlock = block;
         orphan.prevBlock = block->prevBlock;
         BRSetRemove(manager->orphans, &orphan);
         orphan.prevBlock = block->blockHash;
-        block = BRSetGet(manager->orphans, &orphan);
+        next = BRSetGet(manager->orphans, &orphan);
+        header = _BRPeerManagerAddBlock(manager, block, BRMerkleBlockTxHashes(block, NULL, 0));
+        _BRPeerManagerSetLastBlock(manager, header);
+        block = next;
     }
     
     array_new(manager->txRelays, 10);
@@ -1638,6 +1923,35 @@ BRPeerManager *BRPeerManagerNew(BRWallet *wallet, uint32_t earliestKeyTime, BRMe
     return manager;
 }
 
+// returns a newly allocated BRPeerManager struct that must be freed by calling BRPeerManagerFree()
+// the main chain is loaded from, and kept up to date in, the chain file at chainFilePath (see BRChainFile.h) instead of
+// being passed in as blocks - if the file can't be opened, the manager works the same as with no saved blocks
+BRPeerManager *BRPeerManagerNewWithChainFile(BRWallet *wallet, uint32_t earliestKeyTime, const char *chainFilePath,
+                                             const BRPeer peers[], size_t peersCount)
+{
+    BRPeerManager *manager = BRPeerManagerNew(wallet, earliestKeyTime, NULL, 0, peers, peersCount);
+    BRChainFile *file;
+    uint32_t height, first, start;
+    
+    assert(chainFilePath != NULL);
+    file = BRChainFileOpen(chainFilePath);
+    manager->chainFile = file;
+    
+    if (file && BRChainFileCount(file) > 0) {
+        // load from the transition block before the last one, the same blocks that are saved at sync completion
+        first = BRChainFileFirstHeight(file);
+        height = first + (uint32_t)BRChainFileCount(file) - 1;
+        start = height % BLOCK_DIFFICULTY_INTERVAL + BLOCK_DIFFICULTY_INTERVAL;
+        start = (height > first + start) ? height - start : first;
+        
+        for (uint32_t h = start; h <= height; h++) {
+            _BRPeerManagerSetLastBlock(manager, _BRPeerManagerAddHeader(manager, BRChainFileHeader(file, h)));
+        }
+    }
+    
+    return manager;
+}
+
 // not thread-safe, set callbacks once before calling BRPeerManagerConnect()
 // info is a void pointer that will be passed along with each callback call
 // void syncStarted(void *) - called when blockchain syncing starts
@@ -1647,6 +1961,10 @@ BRPeerManager *BRPeerManagerNew(BRWallet *wallet, uint32_t earliestKeyTime, BRMe
 // void saveBlocks(void *, BRMerkleBlock *[], size_t) - called when blocks should be saved to the persistent store
 //   - if count is 1, save the given block without removing any previously saved blocks
 //   - if count is 0 or more than 1, save the given blocks and delete any previously saved blocks not given
+//   - blocks without matched transactions are only kept as headers, and are given as header only blocks, with totalTx
+//     0 and no hashes or flags - these serialize to the 80 byte header, pass BRMerkleBlockIsValid(), and are loaded
+//     by BRPeerManagerNew() the same as full blocks, but apps that require tx hashes for every saved block must not
+//     rely on them
 // void savePeers(void *, const BRPeer[], size_t) - called when peers should be saved to the persistent store
 //   - if count is 1, save the given peer without removing any previously saved peers
 //   - if count is 0 or more than 1, save the given peers and delete any previously saved peers not given
@@ -1743,6 +2061,7 @@ void BRPeerManagerConnect(BRPeerManager *manager)
                 BRPeerSetCallbacks(info->peer, info, _peerConnected, _peerDisconnected, _peerRelayedPeers,
                                    _peerRelayedTx, _peerHasTx, _peerRejectedTx, _peerRelayedBlock, _peerDataNotfound,
                                    _peerSetFeePerKb, _peerRequestedTx, _peerNetworkIsReachable, _peerThreadCleanup);
+                BRPeerSetRelayedHeadersCallback(info->peer, _peerRelayedHeaders);
                 BRPeerSetEarliestKeyTime(info->peer, manager->earliestKeyTime);
                 BRPeerConnect(info->peer);
             }
@@ -1800,7 +2119,8 @@ void BRPeerManagerRescan(BRPeerManager *manager)
             if (i - 1 == 0 || checkpoint_array[i - 1].timestamp + 7*24*60*60 < manager->earliestKeyTime) {
                 UInt256 hash = UInt256Reverse(u256_hex_decode(checkpoint_array[i - 1].hash));
 
-                manager->lastBlock = BRSetGet(manager->blocks, &hash);
+                _BRPeerManagerSetLastBlock(manager, BRSetGet(manager->blocks, &hash));
+                _BRPeerManagerUpdateChainFile(manager, 0);
                 break;
             }
         }
@@ -1898,6 +2218,58 @@ size_t BRPeerManagerPeerCount(BRPeerManager *manager)
     return count;
 }
 
+// writes the combined wire stats of all currently connected peers to total, and if peers and stats aren't NULL, also
+// writes up to count connected peers and their individual stats to them, for finding slow peers
+// returns the number of connected peers
+size_t BRPeerManagerStats(BRPeerManager *manager, BRPeerStats *total, BRPeer peers[], BRPeerStats stats[],
+                          size_t count)
+{
+    BRPeerStats *peerStats = malloc(sizeof(*peerStats));
+    BRPeer *peer;
+    size_t i, j, k, n = 0;
+    
+    assert(manager != NULL);
+    assert(total != NULL);
+    assert(peerStats != NULL);
+    memset(total, 0, sizeof(*total));
+    pthread_mutex_lock(&manager->lock);
+    
+    for (i = 0; i < array_count(manager->connectedPeers); i++) {
+        peer = manager->connectedPeers[i];
+        if (BRPeerConnectStatus(peer) != BRPeerStatusConnected) continue;
+        BRPeerGetStats(peer, peerStats);
+        if (peers && n < count) peers[n] = *peer;
+        if (stats && n < count) stats[n] = *peerStats;
+        total->sent += peerStats->sent;
+        total->received += peerStats->received;
+        total->bytesSent += peerStats->bytesSent;
+        total->bytesReceived += peerStats->bytesReceived;
+        total->handlerTime += peerStats->handlerTime;
+        total->sendBlockedTime += peerStats->sendBlockedTime;
+        total->idleTime += peerStats->idleTime;
+        
+        for (j = 0; j < PEER_STATS_TYPES; j++) {
+            if (peerStats->types[j].type[0] != '\0') memcpy(total->types[j].type, peerStats->types[j].type, 12);
+            total->types[j].sent += peerStats->types[j].sent;
+            total->types[j].received += peerStats->types[j].received;
+            total->types[j].bytesSent += peerStats->types[j].bytesSent;
+            total->types[j].bytesReceived += peerStats->types[j].bytesReceived;
+            total->types[j].handlerTime += peerStats->types[j].handlerTime;
+            
+            for (k = 0; k < PEER_STATS_BUCKETS; k++) {
+                total->types[j].sentSizes[k] += peerStats->types[j].sentSizes[k];
+                total->types[j].receivedSizes[k] += peerStats->types[j].receivedSizes[k];
+            }
+        }
+        
+        n++;
+    }
+    
+    pthread_mutex_unlock(&manager->lock);
+    free(peerStats);
+    return n;
+}
+
 // description of the peer most recently used to sync blockchain data
 const char *BRPeerManagerDownloadPeerName(BRPeerManager *manager)
 {
@@ -2011,18 +2383,44 @@ void BRPeerManagerFree(BRPeerManager *manager)
     array_free(manager->peers);
     for (size_t i = array_count(manager->connectedPeers); i > 0; i--) BRPeerFree(manager->connectedPeers[i - 1]);
     array_free(manager->connectedPeers);
-    BRSetMap(manager->blocks, NULL, _setMapFreeBlock);
     BRSetFree(manager->blocks);
+    BRSetMap(manager->merkleBlocks, NULL, _setMapFreeBlock);
+    BRSetFree(manager->merkleBlocks);
     BRSetMap(manager->orphans, NULL, _setMapFreeBlock);
     BRSetFree(manager->orphans);
     BRSetFree(manager->checkpoints);
+    for (size_t i = array_count(manager->headerPages); i > 0; i--) free(manager->headerPages[i - 1]);
+    array_free(manager->headerPages);
+    array_free(manager->freeHeaders);
     for (size_t i = array_count(manager->txRelays); i > 0; i--) free(manager->txRelays[i - 1].peers);
     array_free(manager->txRelays);
     for (size_t i = array_count(manager->txRequests); i > 0; i--) free(manager->txRequests[i - 1].peers);
     array_free(manager->txRequests);
     array_free(manager->publishedTx);
     array_free(manager->publishedTxHashes);
+    if (manager->chainFile) BRChainFileClose(manager->chainFile);
     pthread_mutex_unlock(&manager->lock);
     pthread_mutex_destroy(&manager->lock);
     free(manager);
 }
+
+void BRPeerManagerAddHeadersTest(BRPeerManager *manager, const BRBlockHeader headers[], size_t count)
+{
+    pthread_mutex_lock(&manager->lock);
+    
+    for (size_t i = 0; i < count; i++) { // each header extends the main chain, same as a relayed block would
+        _BRPeerManagerSetLastBlock(manager, _BRPeerManagerAddHeader(manager, &headers[i]));
+    }
+    
+    pthread_mutex_unlock(&manager->lock);
+}
+
+size_t BRPeerManagerBlockLocatorsTest(BRPeerManager *manager, UInt256 locators[], size_t locatorsCount)
+{
+    size_t count;
+    
+    pthread_mutex_lock(&manager->lock);
+    count = _BRPeerManagerBlockLocators(manager, locators, locatorsCount);
+    pthread_mutex_unlock(&manager->lock);
+    return count;
+}
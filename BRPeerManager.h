@@ -44,6 +44,12 @@ typedef struct BRPeerManagerStruct BRPeerManager;
 BRPeerManager *BRPeerManagerNew(BRWallet *wallet, uint32_t earliestKeyTime, BRMerkleBlock *blocks[], size_t blocksCount,
                                 const BRPeer peers[], size_t peersCount);
 
+// returns a newly allocated BRPeerManager struct that must be freed by calling BRPeerManagerFree()
+// the main chain is loaded from, and kept up to date in, the chain file at chainFilePath (see BRChainFile.h) instead of
+// being passed in as blocks - if the file can't be opened, the manager works the same as with no saved blocks
+BRPeerManager *BRPeerManagerNewWithChainFile(BRWallet *wallet, uint32_t earliestKeyTime, const char *chainFilePath,
+                                             const BRPeer peers[], size_t peersCount);
+
 // not thread-safe, set callbacks once before calling BRPeerManagerConnect()
 // info is a void pointer that will be passed along with each callback call
 // void syncStarted(void *) - called when blockchain syncing starts
@@ -53,6 +59,10 @@ BRPeerManager *BRPeerManagerNew(BRWallet *wallet, uint32_t earliestKeyTime, BRMe
 // void saveBlocks(void *, BRMerkleBlock *[], size_t) - called when blocks should be saved to the persistent store
 //   - if count is 1, save the given block without removing any previously saved blocks
 //   - if count is 0 or more than 1, save the given blocks and delete any previously saved blocks not given
+//   - blocks without matched transactions are only kept as headers, and are given as header only blocks, with totalTx
+//     0 and no hashes or flags - these serialize to the 80 byte header, pass BRMerkleBlockIsValid(), and are loaded
+//     by BRPeerManagerNew() the same as full blocks, but apps that require tx hashes for every saved block must not
+//     rely on them
 // void savePeers(void *, const BRPeer[], size_t) - called when peers should be saved to the persistent store
 //   - if count is 1, save the given peer without removing any previously saved peers
 //   - if count is 0 or more than 1, save the given peers and delete any previously saved peers not given
@@ -97,6 +107,12 @@ double BRPeerManagerSyncProgress(BRPeerManager *manager, uint32_t startHeight);
 // returns the number of currently connected peers
 size_t BRPeerManagerPeerCount(BRPeerManager *manager);
 
+// writes the combined wire stats of all currently connected peers to total, and if peers and stats aren't NULL, also
+// writes up to count connected peers and their individual stats to them, for finding slow peers
+// returns the number of connected peers
+size_t BRPeerManagerStats(BRPeerManager *manager, BRPeerStats *total, BRPeer peers[], BRPeerStats stats[],
+                          size_t count);
+
 // description of the peer most recently used to sync blockchain data
 const char *BRPeerManagerDownloadPeerName(BRPeerManager *manager);
 
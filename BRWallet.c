@@ -334,16 +334,29 @@ void BRWalletUnusedAddrs(BRWallet *wallet, BRAddress addrs[], uint32_t gapLimit,
     while (i > 0 && ! BRSetContains(wallet->usedAddrs, &addrChain[i - 1])) i--;
     
     while (i + gapLimit > count) { // generate new addresses up to gapLimit
-        BRKey key;
-        BRAddress address = BR_ADDRESS_NONE;
-        uint8_t pubKey[BRBIP32PubKey(NULL, 0, wallet->masterPubKey, chain, count)];
-        size_t len = BRBIP32PubKey(pubKey, sizeof(pubKey), wallet->masterPubKey, chain, (uint32_t)count);
+        size_t n = i + gapLimit - count;
+        BRKey keys[n];
+        BRAddress addresses[n];
+        char *s[n];
+        uint32_t indexes[n];
         
-        BRKeySetPubKey(&key, pubKey, len);
-        if (! BRKeyAddress(&key, address.s, sizeof(address)) || BRAddressEq(&address, &BR_ADDRESS_NONE)) break;
-        array_add(addrChain, address);
-        count++;
-        if (BRSetContains(wallet->usedAddrs, &address)) i = count;
+        for (j = 0; j < n; j++) {
+            indexes[j] = (uint32_t)(count + j);
+            addresses[j] = BR_ADDRESS_NONE;
+            s[j] = addresses[j].s;
+        }
+        
+        BRBIP32PubKeyList(keys, n, wallet->masterPubKey, chain, indexes); // derive the whole batch of keys together
+        BRKeyAddressList(keys, n, s, sizeof(BRAddress)); // and hash them together
+        
+        for (j = 0; j < n; j++) {
+            if (BRAddressEq(&addresses[j], &BR_ADDRESS_NONE)) break;
+            array_add(addrChain, addresses[j]);
+            count++;
+            if (BRSetContains(wallet->usedAddrs, &addresses[j])) i = count;
+        }
+        
+        if (j < n) break;
     }
 
     if (addrs && i + gapLimit <= count) {
@@ -0,0 +1,452 @@
+//
+//  bench.c
+//
+//  Created by Aaron Voisine on 10/17/26.
+//  Copyright (c) 2026 breadwallet LLC
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+// benchmarks for the hash functions, build with optimizations turned on, e.g.:
+// cc -O2 -o bench bench.c BRCrypto.c
+// run with --json to time every primitive and print the results as json, for tracking regressions between builds
+
+#include "BRCrypto.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define TICKS_UNIT "cycles"
+#define _ticks() __rdtsc()
+#else
+#define TICKS_UNIT "ns" // no portable cycle counter, so time is used instead
+
+static uint64_t _ticks(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+#endif
+
+#ifdef __ANDROID__
+#include <android/log.h>
+#define printf(...) __android_log_print(ANDROID_LOG_INFO, "bread", __VA_ARGS__)
+#endif
+
+static const struct { uint32_t features; const char *name; } _paths[] = {
+    { 0, "portable" },
+    { BR_CRYPTO_AVX2, "avx2" },
+    { BR_CRYPTO_SHANI, "sha-ni" },
+    { BR_CRYPTO_ARMV8, "armv8" },
+    { BR_CRYPTO_AESNI, "aes-ni" }
+};
+
+// returns true if path i isn't supported by this cpu, or selects the same code as the portable path for a bench that
+// only has faster code for the given features
+static int _BRBenchSkipPath(size_t i, uint32_t features, uint32_t benchFeatures)
+{
+    if ((_paths[i].features & features) != _paths[i].features) return 1; // not supported by this cpu
+    return (_paths[i].features != 0 && (_paths[i].features & benchFeatures) == 0); // same code as portable
+}
+
+// returns ticks per byte for hashing len bytes of data count times
+static double _BRHashBench(void (*hash)(void *, const void *, size_t), const uint8_t *data, size_t len, size_t count)
+{
+    uint8_t md[64];
+    uint64_t start;
+
+    hash(md, data, len); // warm up
+    start = _ticks();
+    for (size_t i = 0; i < count; i++) hash(md, data, len);
+    return (double)(_ticks() - start)/((double)len*count);
+}
+
+void BRSHA256Bench()
+{
+    uint32_t features = BRCryptoFeatures();
+    size_t len = 1024*1024;
+    uint8_t *data = malloc(len);
+
+    for (size_t i = 0; i < len; i++) data[i] = (uint8_t)i;
+    printf("%-10s %14s %14s %14s %14s\n", TICKS_UNIT"/byte", "sha256 64B", "sha256 80B", "sha256 1MB",
+           "sha256_2 80B");
+
+    for (size_t i = 0; i < sizeof(_paths)/sizeof(*_paths); i++) {
+        if (_BRBenchSkipPath(i, features, BR_CRYPTO_SHANI | BR_CRYPTO_AVX2 | BR_CRYPTO_ARMV8)) continue;
+        BRCryptoSetFeatures(_paths[i].features);
+        printf("%-10s %14.2f %14.2f %14.2f %14.2f\n", _paths[i].name, _BRHashBench(BRSHA256, data, 64, 100000),
+               _BRHashBench(BRSHA256, data, 80, 100000), _BRHashBench(BRSHA256, data, len, 20),
+               _BRHashBench(BRSHA256_2, data, 80, 100000));
+    }
+
+    BRCryptoSetFeatures(features);
+    free(data);
+}
+
+// double-sha256 of 4096 merkle tree nodes, one at a time and in a batch, and of 4096 block headers in a batch
+void BRSHA256_2BatchBench()
+{
+    uint32_t features = BRCryptoFeatures();
+    size_t count = 4096, lens[4096];
+    uint8_t *data = malloc(count*81), *md = malloc(count*32);
+    void *mds[4096];
+    const void *headers[4096];
+    uint64_t start;
+
+    for (size_t i = 0; i < count*81; i++) data[i] = (uint8_t)i;
+    for (size_t i = 0; i < count; i++) mds[i] = &md[i*32], headers[i] = &data[i*81], lens[i] = 80;
+    printf("%-10s %14s %14s %14s\n", TICKS_UNIT"/byte", "nodes serial", "nodes batch", "headers batch");
+
+    for (size_t i = 0; i < sizeof(_paths)/sizeof(*_paths); i++) {
+        if (_BRBenchSkipPath(i, features, BR_CRYPTO_SHANI | BR_CRYPTO_AVX2 | BR_CRYPTO_ARMV8)) continue;
+        BRCryptoSetFeatures(_paths[i].features);
+        printf("%-10s", _paths[i].name);
+        start = _ticks();
+        for (size_t j = 0; j < count; j++) BRSHA256_2(&md[j*32], &data[j*64], 64);
+        printf(" %14.2f", (double)(_ticks() - start)/(count*64));
+        start = _ticks();
+        BRSHA256_2_64Batch(md, data, count);
+        printf(" %14.2f", (double)(_ticks() - start)/(count*64));
+        start = _ticks();
+        BRSHA256_2Batch(mds, headers, lens, count);
+        printf(" %14.2f\n", (double)(_ticks() - start)/(count*80));
+    }
+
+    BRCryptoSetFeatures(features);
+    free(md);
+    free(data);
+}
+
+// pbkdf2 with the bip39 seed derivation parameters, hmac-sha512 and 2048 rounds
+void BRPBKDF2Bench()
+{
+    uint32_t features = BRCryptoFeatures();
+    const char *phrase = "abandon abandon abandon abandon abandon abandon abandon abandon abandon abandon abandon "
+                         "about";
+    uint8_t key[64];
+    uint64_t start;
+
+    printf("%-10s %14s %14s\n", "k"TICKS_UNIT, "bip39 sha512", "2048 sha256");
+
+    for (size_t i = 0; i < sizeof(_paths)/sizeof(*_paths); i++) {
+        if (_BRBenchSkipPath(i, features, BR_CRYPTO_SHANI | BR_CRYPTO_AVX2 | BR_CRYPTO_ARMV8)) continue;
+        BRCryptoSetFeatures(_paths[i].features);
+        printf("%-10s", _paths[i].name);
+        start = _ticks();
+        for (size_t j = 0; j < 20; j++) BRPBKDF2(key, 64, BRSHA512, 64, phrase, strlen(phrase), "mnemonic", 8, 2048);
+        printf(" %14.1f", (double)(_ticks() - start)/(20*1000));
+        start = _ticks();
+        for (size_t j = 0; j < 20; j++) BRPBKDF2(key, 32, BRSHA256, 32, phrase, strlen(phrase), "mnemonic", 8, 2048);
+        printf(" %14.1f\n", (double)(_ticks() - start)/(20*1000));
+    }
+
+    BRCryptoSetFeatures(features);
+}
+
+// hmac-sha512 of 4096 bip32 child key derivation messages with the same chain code, one at a time and in a batch
+void BRHMACSHA512BatchBench()
+{
+    uint32_t features = BRCryptoFeatures();
+    size_t count = 4096;
+    uint8_t chain[32], *data = malloc(count*37), *mac = malloc(count*64);
+    void *macs[4096];
+    const void *msgs[4096];
+    uint64_t start;
+
+    for (size_t i = 0; i < sizeof(chain); i++) chain[i] = (uint8_t)i;
+    for (size_t i = 0; i < count*37; i++) data[i] = (uint8_t)(i*3);
+    for (size_t i = 0; i < count; i++) macs[i] = &mac[i*64], msgs[i] = &data[i*37];
+    printf("%-10s %14s %14s\n", TICKS_UNIT"/mac", "serial", "batch");
+
+    for (size_t i = 0; i < sizeof(_paths)/sizeof(*_paths); i++) {
+        if (_BRBenchSkipPath(i, features, BR_CRYPTO_AVX2)) continue;
+        BRCryptoSetFeatures(_paths[i].features);
+        printf("%-10s", _paths[i].name);
+        start = _ticks();
+        for (size_t j = 0; j < count; j++) BRHMAC(macs[j], BRSHA512, 64, chain, sizeof(chain), msgs[j], 37);
+        printf(" %14.1f", (double)(_ticks() - start)/count);
+        start = _ticks();
+        BRHMACSHA512Batch(macs, chain, sizeof(chain), msgs, 37, count);
+        printf(" %14.1f\n", (double)(_ticks() - start)/count);
+    }
+
+    BRCryptoSetFeatures(features);
+    free(mac);
+    free(data);
+}
+
+// hash-160 of 4096 compressed and 4096 uncompressed public keys, one at a time and in a batch
+void BRHash160BatchBench()
+{
+    uint32_t features = BRCryptoFeatures();
+    size_t count = 4096, lens[4096];
+    uint8_t *data = malloc(count*65), *md = malloc(count*20);
+    void *mds[4096];
+    const void *pubKeys[4096];
+    uint64_t start;
+
+    for (size_t i = 0; i < count*65; i++) data[i] = (uint8_t)(i*7);
+    for (size_t i = 0; i < count; i++) mds[i] = &md[i*20], pubKeys[i] = &data[i*65];
+    printf("%-10s %14s %14s %14s %14s\n", TICKS_UNIT"/key", "33B serial", "33B batch", "65B serial", "65B batch");
+
+    for (size_t i = 0; i < sizeof(_paths)/sizeof(*_paths); i++) {
+        if (_BRBenchSkipPath(i, features, BR_CRYPTO_SHANI | BR_CRYPTO_AVX2 | BR_CRYPTO_ARMV8)) continue;
+        BRCryptoSetFeatures(_paths[i].features);
+        printf("%-10s", _paths[i].name);
+
+        for (size_t len = 33; len <= 65; len += 32) {
+            for (size_t j = 0; j < count; j++) lens[j] = len;
+            start = _ticks();
+            for (size_t j = 0; j < count; j++) BRHash160(mds[j], pubKeys[j], len);
+            printf(" %14.1f", (double)(_ticks() - start)/count);
+            start = _ticks();
+            BRHash160Batch(mds, pubKeys, lens, count);
+            printf(" %14.1f", (double)(_ticks() - start)/count);
+        }
+
+        printf("\n");
+    }
+
+    BRCryptoSetFeatures(features);
+    free(md);
+    free(data);
+}
+
+// chacha20, poly1305 and chacha20-poly1305 aead encryption of a bip75 sized 1KB message, and chacha20 of 1MB
+void BRChacha20Poly1305Bench()
+{
+    uint32_t features = BRCryptoFeatures();
+    size_t len = 1024*1024;
+    uint8_t key[32], nonce[12], *data = malloc(len), *out = malloc(len + 16);
+    uint64_t start;
+
+    for (size_t i = 0; i < sizeof(key); i++) key[i] = (uint8_t)i;
+    for (size_t i = 0; i < sizeof(nonce); i++) nonce[i] = (uint8_t)(i*5);
+    for (size_t i = 0; i < len; i++) data[i] = (uint8_t)(i*3);
+    printf("%-10s %14s %14s %14s %14s\n", TICKS_UNIT"/byte", "chacha20 1KB", "chacha20 1MB", "poly1305 1KB",
+           "aead 1KB");
+
+    for (size_t i = 0; i < sizeof(_paths)/sizeof(*_paths); i++) {
+        if (_BRBenchSkipPath(i, features, BR_CRYPTO_AVX2)) continue;
+        BRCryptoSetFeatures(_paths[i].features);
+        printf("%-10s", _paths[i].name);
+        start = _ticks();
+        for (size_t j = 0; j < 10000; j++) BRChacha20(out, key, &nonce[4], data, 1024, j);
+        printf(" %14.2f", (double)(_ticks() - start)/(10000*1024));
+        start = _ticks();
+        for (size_t j = 0; j < 10; j++) BRChacha20(out, key, &nonce[4], data, len, j);
+        printf(" %14.2f", (double)(_ticks() - start)/(10*len));
+        start = _ticks();
+        for (size_t j = 0; j < 10000; j++) BRPoly1305(out, key, data, 1024);
+        printf(" %14.2f", (double)(_ticks() - start)/(10000*1024));
+        start = _ticks();
+        for (size_t j = 0; j < 10000; j++) {
+            BRChacha20Poly1305AEADEncrypt(out, 1024 + 16, key, nonce, data, 1024, key, 16);
+        }
+        printf(" %14.2f\n", (double)(_ticks() - start)/(10000*1024));
+    }
+
+    BRCryptoSetFeatures(features);
+    free(out);
+    free(data);
+}
+
+static const uint8_t _key[32] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23,
+                                  24, 25, 26, 27, 28, 29, 30, 31 };
+static BRAES256Ctx _aes;
+
+static void _BRMurmur3Op(void *out, const void *data, size_t len)
+{
+    *(uint32_t *)out = BRMurmur3_32(data, len, 0);
+}
+
+static void _BRHMACSHA256Op(void *out, const void *data, size_t len)
+{
+    BRHMAC(out, BRSHA256, 32, _key, sizeof(_key), data, len);
+}
+
+static void _BRHMACSHA512Op(void *out, const void *data, size_t len)
+{
+    BRHMAC(out, BRSHA512, 64, _key, sizeof(_key), data, len);
+}
+
+static void _BRPBKDF2BIP39Op(void *out, const void *data, size_t len)
+{
+    BRPBKDF2(out, 64, BRSHA512, 64, data, len, "mnemonic", 8, 2048);
+}
+
+static void _BRScryptHeaderOp(void *out, const void *data, size_t len)
+{
+    BRScrypt(out, 32, data, len, data, len, 1024, 1, 1);
+}
+
+static void _BRScryptBIP38Op(void *out, const void *data, size_t len)
+{
+    BRScrypt(out, 64, data, len, data, 4, 16384, 8, 8);
+}
+
+static void _BRChacha20Op(void *out, const void *data, size_t len)
+{
+    BRChacha20(out, _key, &_key[4], data, len, 0);
+}
+
+static void _BRPoly1305Op(void *out, const void *data, size_t len)
+{
+    BRPoly1305(out, _key, data, len);
+}
+
+static void _BRAEADEncryptOp(void *out, const void *data, size_t len)
+{
+    BRChacha20Poly1305AEADEncrypt(out, len + 16, _key, _key, data, len, NULL, 0);
+}
+
+static void _BRAES256ECBOp(void *out, const void *data, size_t len)
+{
+    memcpy(out, data, len);
+    BRAES256ECBEncrypt(&_aes, out, len);
+}
+
+// each primitive with the input sizes it's timed at, and the features that select different code for it
+static const struct {
+    const char *name;
+    void (*op)(void *out, const void *data, size_t len);
+    size_t lens[4];
+    uint32_t features;
+} _ops[] = {
+    { "sha1", BRSHA1, { 64, 1024, 65536 }, 0 },
+    { "sha224", BRSHA224, { 64, 1024, 65536 }, BR_CRYPTO_SHANI | BR_CRYPTO_AVX2 | BR_CRYPTO_ARMV8 },
+    { "sha256", BRSHA256, { 64, 1024, 65536 }, BR_CRYPTO_SHANI | BR_CRYPTO_AVX2 | BR_CRYPTO_ARMV8 },
+    { "sha256_2", BRSHA256_2, { 64, 80, 1024 }, BR_CRYPTO_SHANI | BR_CRYPTO_AVX2 | BR_CRYPTO_ARMV8 },
+    { "sha384", BRSHA384, { 64, 1024, 65536 }, 0 },
+    { "sha512", BRSHA512, { 64, 1024, 65536 }, 0 },
+    { "rmd160", BRRMD160, { 64, 1024, 65536 }, 0 },
+    { "hash160", BRHash160, { 33, 65, 1024 }, BR_CRYPTO_SHANI | BR_CRYPTO_AVX2 | BR_CRYPTO_ARMV8 },
+    { "md5", BRMD5, { 64, 1024, 65536 }, 0 },
+    { "murmur3_32", _BRMurmur3Op, { 20, 36, 1024 }, 0 },
+    { "hmac_sha256", _BRHMACSHA256Op, { 64, 1024, 65536 }, BR_CRYPTO_SHANI | BR_CRYPTO_AVX2 | BR_CRYPTO_ARMV8 },
+    { "hmac_sha512", _BRHMACSHA512Op, { 37, 1024, 65536 }, 0 },
+    { "pbkdf2_bip39", _BRPBKDF2BIP39Op, { 96 }, 0 },
+    { "scrypt_header", _BRScryptHeaderOp, { 80 }, BR_CRYPTO_SHANI | BR_CRYPTO_AVX2 | BR_CRYPTO_ARMV8 },
+    { "scrypt_bip38", _BRScryptBIP38Op, { 32 }, BR_CRYPTO_SHANI | BR_CRYPTO_AVX2 | BR_CRYPTO_ARMV8 },
+    { "chacha20", _BRChacha20Op, { 64, 1024, 65536 }, BR_CRYPTO_AVX2 },
+    { "poly1305", _BRPoly1305Op, { 64, 1024, 65536 }, 0 },
+    { "chacha20_poly1305", _BRAEADEncryptOp, { 64, 1024, 65536 }, BR_CRYPTO_AVX2 },
+    { "aes256_ecb", _BRAES256ECBOp, { 16, 1024, 65536 }, BR_CRYPTO_AESNI }
+};
+
+static uint64_t _nanoseconds(void)
+{
+    struct timespec ts;
+    
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+// times every primitive at each of its input sizes, for the portable code and each supported feature that selects
+// different code for it, and prints ns/op and ticks/byte, as a json array if json is true - ticks are cpu cycles where
+// there's a cycle counter, or ns where there isn't, given by the "unit" field so the keys are the same on every build
+void BRBenchmarkSuite(int json)
+{
+    uint32_t features = BRCryptoFeatures();
+    size_t maxLen = 65536, n;
+    int first = 1;
+    uint8_t *data = malloc(maxLen), *out = malloc(maxLen + 64);
+    uint64_t start, ticks, ns;
+    
+    for (size_t i = 0; i < maxLen; i++) data[i] = (uint8_t)(i*7);
+    BRAES256Init(&_aes, _key);
+    if (json) printf("[\n");
+    else printf("%-18s %-10s %8s %12s %14s\n", "op", "path", "len", "ns/op", TICKS_UNIT"/byte");
+    
+    for (size_t i = 0; i < sizeof(_ops)/sizeof(*_ops); i++) {
+        for (size_t j = 0; j < sizeof(_paths)/sizeof(*_paths); j++) {
+            if (_BRBenchSkipPath(j, features, _ops[i].features)) continue;
+            BRCryptoSetFeatures(_paths[j].features);
+            
+            for (size_t k = 0; k < sizeof(_ops[i].lens)/sizeof(*_ops[i].lens) && _ops[i].lens[k] > 0; k++) {
+                _ops[i].op(out, data, _ops[i].lens[k]); // warm up
+                start = _ticks(), ns = _nanoseconds();
+                
+                for (n = 0; n == 0 || _nanoseconds() - ns < 100000000; n++) { // run for at least 100ms
+                    _ops[i].op(out, data, _ops[i].lens[k]);
+                }
+                
+                ticks = _ticks() - start, ns = _nanoseconds() - ns;
+                
+                if (json) {
+                    printf("%s  { \"op\": \"%s\", \"path\": \"%s\", \"len\": %zu, \"iterations\": %zu, "
+                           "\"ns_per_op\": %.1f, \"ticks_per_byte\": %.3f, \"unit\": \"%s\" }", (first) ? "" : ",\n",
+                           _ops[i].name, _paths[j].name, _ops[i].lens[k], n, (double)ns/n,
+                           (double)ticks/((double)n*_ops[i].lens[k]), TICKS_UNIT);
+                }
+                else {
+                    printf("%-18s %-10s %8zu %12.1f %14.3f\n", _ops[i].name, _paths[j].name, _ops[i].lens[k],
+                           (double)ns/n, (double)ticks/((double)n*_ops[i].lens[k]));
+                }
+                
+                first = 0;
+            }
+        }
+    }
+    
+    if (json) printf("\n]\n");
+    BRCryptoSetFeatures(features);
+    memset(&_aes, 0, sizeof(_aes));
+    free(out);
+    free(data);
+}
+
+void BRRunBenchmarks()
+{
+    printf("BRSHA256Bench...\n");
+    BRSHA256Bench();
+    printf("\n");
+    printf("BRSHA256_2BatchBench...\n");
+    BRSHA256_2BatchBench();
+    printf("\n");
+    printf("BRPBKDF2Bench...\n");
+    BRPBKDF2Bench();
+    printf("\n");
+    printf("BRHMACSHA512BatchBench...\n");
+    BRHMACSHA512BatchBench();
+    printf("\n");
+    printf("BRHash160BatchBench...\n");
+    BRHash160BatchBench();
+    printf("\n");
+    printf("BRChacha20Poly1305Bench...\n");
+    BRChacha20Poly1305Bench();
+    printf("\n");
+    printf("BRBenchmarkSuite...\n");
+    BRBenchmarkSuite(0);
+    printf("\n");
+}
+
+#ifndef BITCOIN_BENCH_NO_MAIN
+int main(int argc, const char *argv[])
+{
+    if (argc > 1 && strcmp(argv[1], "--json") == 0) BRBenchmarkSuite(1);
+    else BRRunBenchmarks();
+    return 0;
+}
+#endif
@@ -25,6 +25,7 @@
 #include "BRCrypto.h"
 #include "BRBloomFilter.h"
 #include "BRMerkleBlock.h"
+#include "BRChainFile.h"
 #include "BRWallet.h"
 #include "BRKey.h"
 #include "BRBIP38Key.h"
@@ -45,6 +46,8 @@
 #include <errno.h>
 #include <time.h>
 #include <unistd.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
 #include <arpa/inet.h>
 
 #define SKIP_BIP38 1
@@ -391,6 +394,54 @@ int BRHashTests()
                     "\x14\x7c\x4e\x72\xb9\x80\x77\x85\xaf\xee\x48\xbb", *(UInt256 *)md))
         r = 0, fprintf(stderr, "***FAILED*** %s: BRSHA256() test 6\n", __func__);
 
+    // compare each hardware accelerated sha256 implementation supported by the cpu against the portable one
+    uint32_t features = BRCryptoFeatures();
+    uint8_t data[1000], md2[32];
+    
+    for (size_t i = 0; i < sizeof(data); i++) data[i] = (uint8_t)(i*7 + 3);
+    
+    for (uint32_t f = 1; f <= features; f <<= 1) {
+        if ((features & f) == 0) continue;
+        
+        for (size_t len = 0; len <= sizeof(data); len += 13) {
+            BRCryptoSetFeatures(0);
+            BRSHA256(md, data, len);
+            BRCryptoSetFeatures(f);
+            BRSHA256(md2, data, len);
+            if (memcmp(md, md2, sizeof(md2)) != 0)
+                r = 0, fprintf(stderr, "***FAILED*** %s: BRSHA256() features 0x%x test %zu\n", __func__, f, len);
+        }
+    }
+
+    // compare the batch double-sha256 functions against BRSHA256_2() for each feature, with enough messages of
+    // different lengths to fill the simd lanes and leave a partial batch
+    void *mds[11];
+    const void *msgs[11];
+    size_t lens[11];
+    uint8_t batch[11*64], nodes[11*64];
+
+    for (uint32_t f = 0; f <= features; f = (f << 1) | (f == 0)) {
+        if ((features & f) != f) continue;
+        BRCryptoSetFeatures(f);
+
+        for (size_t i = 0; i < 11; i++) mds[i] = &batch[i*32], msgs[i] = &data[i*61], lens[i] = i*29;
+        BRSHA256_2Batch(mds, msgs, lens, 11);
+        memcpy(nodes, data, sizeof(nodes));
+        BRSHA256_2_64Batch(nodes, nodes, 11);
+
+        for (size_t i = 0; i < 11; i++) {
+            BRSHA256_2(md, msgs[i], lens[i]);
+            if (memcmp(md, &batch[i*32], 32) != 0)
+                r = 0, fprintf(stderr, "***FAILED*** %s: BRSHA256_2Batch() features 0x%x test %zu\n", __func__, f, i);
+            BRSHA256_2(md, &data[i*64], 64);
+            if (memcmp(md, &nodes[i*32], 32) != 0)
+                r = 0, fprintf(stderr, "***FAILED*** %s: BRSHA256_2_64Batch() features 0x%x test %zu\n", __func__, f,
+                               i);
+        }
+    }
+
+    BRCryptoSetFeatures(features);
+
     // test sha512
     
     s = "Free online SHA512 Calculator, type text here...";
@@ -438,6 +489,62 @@ int BRHashTests()
                     "\x18\x33\x5d\xe0\x5a\xbc\x54\xd0\x56\x0e\x0f\x53\x02\x86\x0c\x65\x2b\xf0\x8d\x56\x02\x52"
                     "\xaa\x5e\x74\x21\x05\x46\xf3\x69\xfb\xbb\xce\x8c\x12\xcf\xc7\x95\x7b\x26\x52\xfe\x9a\x75",
                     *(UInt512 *)md)) r = 0, fprintf(stderr, "***FAILED*** %s: BRSHA512() test 6\n", __func__);
+
+    // compare the incremental sha family against the one-shot functions, feeding data in uneven pieces that straddle
+    // block boundaries, and resuming from an exported midstate
+    BRSHA256Ctx ctx256, mid256;
+    BRSHA512Ctx ctx512, mid512;
+    uint8_t md3[64], state[64];
+
+    for (size_t len = 0; len <= sizeof(data); len += 37) {
+        BRSHA256Init(&ctx256);
+        for (size_t i = 0; i < len; i += 1 + i % 71) BRSHA256Update(&ctx256, &data[i], (i + 1 + i % 71 <= len) ?
+                                                                     1 + i % 71 : len - i);
+        BRSHA256Final(&ctx256, md3);
+        BRSHA256(md, data, len);
+        if (memcmp(md, md3, 32) != 0)
+            r = 0, fprintf(stderr, "***FAILED*** %s: BRSHA256Update() test %zu\n", __func__, len);
+
+        BRSHA224Init(&ctx256);
+        BRSHA256Update(&ctx256, data, len);
+        BRSHA224Final(&ctx256, md3);
+        BRSHA224(md, data, len);
+        if (memcmp(md, md3, 28) != 0)
+            r = 0, fprintf(stderr, "***FAILED*** %s: BRSHA224Update() test %zu\n", __func__, len);
+
+        BRSHA512Init(&ctx512);
+        for (size_t i = 0; i < len; i += 1 + i % 143) BRSHA512Update(&ctx512, &data[i], (i + 1 + i % 143 <= len) ?
+                                                                      1 + i % 143 : len - i);
+        BRSHA512Final(&ctx512, md3);
+        BRSHA512(md, data, len);
+        if (memcmp(md, md3, 64) != 0)
+            r = 0, fprintf(stderr, "***FAILED*** %s: BRSHA512Update() test %zu\n", __func__, len);
+
+        BRSHA384Init(&ctx512);
+        BRSHA512Update(&ctx512, data, len);
+        BRSHA384Final(&ctx512, md3);
+        BRSHA384(md, data, len);
+        if (memcmp(md, md3, 48) != 0)
+            r = 0, fprintf(stderr, "***FAILED*** %s: BRSHA384Update() test %zu\n", __func__, len);
+    }
+
+    BRSHA256Init(&ctx256);
+    BRSHA256Update(&ctx256, data, 128);
+    BRSHA256Midstate(&ctx256, state);
+    BRSHA256InitMidstate(&mid256, state, 128);
+    BRSHA256Update(&mid256, &data[128], 100);
+    BRSHA256Final(&mid256, md3);
+    BRSHA256(md, data, 228);
+    if (memcmp(md, md3, 32) != 0) r = 0, fprintf(stderr, "***FAILED*** %s: BRSHA256Midstate() test\n", __func__);
+
+    BRSHA512Init(&ctx512);
+    BRSHA512Update(&ctx512, data, 256);
+    BRSHA512Midstate(&ctx512, state);
+    BRSHA512InitMidstate(&mid512, state, 256);
+    BRSHA512Update(&mid512, &data[256], 100);
+    BRSHA512Final(&mid512, md3);
+    BRSHA512(md, data, 356);
+    if (memcmp(md, md3, 64) != 0) r = 0, fprintf(stderr, "***FAILED*** %s: BRSHA512Midstate() test\n", __func__);
     
     // test ripemd160
     
@@ -473,6 +580,68 @@ int BRHashTests()
     if (! UInt160Eq(*(UInt160 *)"\x0b\xdc\x9d\x2d\x25\x6b\x3e\xe9\xda\xae\x34\x7b\xe6\xf4\xdc\x83\x5a\x46\x7f\xfe",
                     *(UInt160 *)md)) r = 0, fprintf(stderr, "***FAILED*** %s: BRRMD160() test 6\n", __func__);
 
+    // compare BRHash160Batch() against BRHash160() for each feature, with compressed and uncompressed pubkey sized
+    // messages, a multi-block message, and a partial batch
+    for (uint32_t f = 0; f <= features; f = (f << 1) | (f == 0)) {
+        if ((features & f) != f) continue;
+        BRCryptoSetFeatures(f);
+
+        for (size_t i = 0; i < 11; i++) mds[i] = &batch[i*20], msgs[i] = &data[i*65], lens[i] = (i % 2) ? 65 : 33;
+        lens[10] = 300;
+        BRHash160Batch(mds, msgs, lens, 11);
+
+        for (size_t i = 0; i < 11; i++) {
+            BRHash160(md, msgs[i], lens[i]);
+            if (memcmp(md, &batch[i*20], 20) != 0)
+                r = 0, fprintf(stderr, "***FAILED*** %s: BRHash160Batch() features 0x%x test %zu\n", __func__, f, i);
+        }
+    }
+
+    BRCryptoSetFeatures(features);
+
+    // compare BRMurmur3_32Seeds() against BRMurmur3_32() for each feature, with each length of partial final block
+    for (uint32_t f = 0; f <= features; f = (f << 1) | (f == 0)) {
+        if ((features & f) != f) continue;
+        BRCryptoSetFeatures(f);
+        
+        for (size_t len = 0; len < 40; len += 3) {
+            uint32_t seeds[11], hashes[11];
+            
+            for (size_t i = 0; i < 11; i++) seeds[i] = (uint32_t)(i*0xfba4c795 + len);
+            BRMurmur3_32Seeds(hashes, data, len, seeds, 11);
+            
+            for (size_t i = 0; i < 11; i++) {
+                if (hashes[i] != BRMurmur3_32(data, len, seeds[i]))
+                    r = 0, fprintf(stderr, "***FAILED*** %s: BRMurmur3_32Seeds() features 0x%x test %zu\n", __func__,
+                                   f, len);
+            }
+        }
+    }
+
+    BRCryptoSetFeatures(features);
+
+    // compare BRMurmur3_32Batch() against BRMurmur3_32() for each feature, with each length of partial final block
+    for (uint32_t f = 0; f <= features; f = (f << 1) | (f == 0)) {
+        if ((features & f) != f) continue;
+        BRCryptoSetFeatures(f);
+        
+        for (size_t len = 0; len < 40; len += 3) {
+            uint32_t hashes[11];
+            const void *elems[11];
+            
+            for (size_t i = 0; i < 11; i++) elems[i] = &data[i*44];
+            BRMurmur3_32Batch(hashes, elems, len, (uint32_t)len*0xfba4c795, 11);
+            
+            for (size_t i = 0; i < 11; i++) {
+                if (hashes[i] != BRMurmur3_32(elems[i], len, (uint32_t)len*0xfba4c795))
+                    r = 0, fprintf(stderr, "***FAILED*** %s: BRMurmur3_32Batch() features 0x%x test %zu\n", __func__,
+                                   f, len);
+            }
+        }
+    }
+
+    BRCryptoSetFeatures(features);
+
     // test md5
     
     s = "Free online MD5 Calculator, type text here...";
@@ -566,7 +735,53 @@ int BRMacTests()
                "\x27\x0c\xd7\xea\x25\x05\x54\x97\x58\xbf\x75\xc0\x5a\x99\x4a\x6d\x03\x4f\x65\xf8\xf0\xe6\xfd\xca\xea"
                "\xb1\xa3\x4d\x4a\x6b\x4b\x63\x6e\x07\x0a\x38\xbc\xe7\x37", mac, 64) != 0)
         r = 0, fprintf(stderr, "***FAILED*** %s: BRHMAC() sha512 test 2\n", __func__);
-    
+
+    BRHMACCtx ctx, ctx2;
+    uint8_t mac2[64];
+
+    BRHMACInit(&ctx, BRSHA512, 512/8, k2, sizeof(k2) - 1);
+    ctx2 = ctx; // reuse the hashed key for a second mac
+    BRHMACUpdate(&ctx, d2, 10);
+    BRHMACUpdate(&ctx, &d2[10], sizeof(d2) - 11);
+    BRHMACFinal(&ctx, mac2);
+    if (memcmp(mac, mac2, 64) != 0) r = 0, fprintf(stderr, "***FAILED*** %s: BRHMACUpdate() sha512 test 1\n", __func__);
+
+    BRHMACUpdate(&ctx2, d1, sizeof(d1) - 1);
+    BRHMACFinal(&ctx2, mac2);
+    BRHMAC(mac, BRSHA512, 512/8, k2, sizeof(k2) - 1, d1, sizeof(d1) - 1);
+    if (memcmp(mac, mac2, 64) != 0) r = 0, fprintf(stderr, "***FAILED*** %s: BRHMACUpdate() sha512 test 2\n", __func__);
+
+    BRHMAC(mac, BRSHA1, 160/8, k2, sizeof(k2) - 1, d2, sizeof(d2) - 1); // hash with no incremental interface
+    if (memcmp("\xef\xfc\xdf\x6a\xe5\xeb\x2f\xa2\xd2\x74\x16\xd5\xf1\x84\xdf\x9c\x25\x9a\x7c\x79", mac, 20) != 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRHMAC() sha1 test\n", __func__);
+
+    // compare BRHMACSHA512Batch() against BRHMAC() for each feature, with a partial batch and a multi-block message
+    uint32_t features = BRCryptoFeatures();
+    uint8_t macs[6*64], msgs[6*200];
+    void *macp[6];
+    const void *msgp[6];
+
+    for (size_t i = 0; i < sizeof(msgs); i++) msgs[i] = (uint8_t)(i*5 + 1);
+    for (size_t i = 0; i < 6; i++) macp[i] = &macs[i*64], msgp[i] = &msgs[i*200];
+
+    for (uint32_t f = 0; f <= features; f = (f << 1) | (f == 0)) {
+        if ((features & f) != f) continue;
+        BRCryptoSetFeatures(f);
+
+        for (size_t len = 37; len <= 200; len += 163) {
+            BRHMACSHA512Batch(macp, k2, sizeof(k2) - 1, msgp, len, 6);
+
+            for (size_t i = 0; i < 6; i++) {
+                BRHMAC(mac, BRSHA512, 512/8, k2, sizeof(k2) - 1, msgp[i], len);
+                if (memcmp(mac, macp[i], 64) != 0)
+                    r = 0, fprintf(stderr, "***FAILED*** %s: BRHMACSHA512Batch() features 0x%x test %zu\n", __func__,
+                                   f, i);
+            }
+        }
+    }
+
+    BRCryptoSetFeatures(features);
+
     // test poly1305
 
     const char key1[] = "\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0",
@@ -661,6 +876,31 @@ int BRMacTests()
     BRPoly1305(mac, key11, msg11, sizeof(msg11) - 1);
     if (memcmp("\x13\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0", mac, 16) != 0)
         r = 0, fprintf(stderr, "***FAILED*** %s: BRPoly1305() test 11\n", __func__);
+
+    // test pbkdf2 (vectors from https://tools.ietf.org/html/rfc7914#section-11)
+
+    uint8_t dk[64];
+
+    BRPBKDF2(dk, sizeof(dk), BRSHA256, 256/8, "passwd", 6, "salt", 4, 1);
+    if (memcmp("\x55\xac\x04\x6e\x56\xe3\x08\x9f\xec\x16\x91\xc2\x25\x44\xb6\x05\xf9\x41\x85\x21\x6d\xde\x04\x65"
+               "\xe6\x8b\x9d\x57\xc2\x0d\xac\xbc\x49\xca\x9c\xcc\xf1\x79\xb6\x45\x99\x16\x64\xb3\x9d\x77\xef\x31"
+               "\x7c\x71\xb8\x45\xb1\xe3\x0b\xd5\x09\x11\x20\x41\xd3\xa1\x97\x83", dk, 64) != 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPBKDF2() test 1\n", __func__);
+
+    BRPBKDF2(dk, sizeof(dk), BRSHA256, 256/8, "Password", 8, "NaCl", 4, 80000);
+    if (memcmp("\x4d\xdc\xd8\xf6\x0b\x98\xbe\x21\x83\x0c\xee\x5e\xf2\x27\x01\xf9\x64\x1a\x44\x18\xd0\x4c\x04\x14"
+               "\xae\xff\x08\x87\x6b\x34\xab\x56\xa1\xd4\x25\xa1\x22\x58\x33\x54\x9a\xdb\x84\x1b\x51\xc9\xb3\x17"
+               "\x6a\x27\x2b\xde\xbb\xa1\xd0\x78\x47\x8f\x62\xb3\x97\xf3\x3c\x8d", dk, 64) != 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPBKDF2() test 2\n", __func__);
+
+    // test scrypt, rfc 7914 test vector 2, mixing the 16 blocks on 1, 3 and 16 threads
+    for (unsigned i = 1; i <= 16; i += (i == 1) ? 2 : 13) {
+        BRScryptParallel(dk, sizeof(dk), "password", 8, "NaCl", 4, 1024, 8, 16, i, 16*128*8*1024);
+        if (memcmp("\xfd\xba\xbe\x1c\x9d\x34\x72\x00\x78\x56\xe7\x19\x0d\x01\xe9\xfe\x7c\x6a\xd7\xcb\xc8\x23\x78\x30"
+                   "\xe7\x73\x76\x63\x4b\x37\x31\x62\x2e\xaf\x30\xd9\x2e\x22\xa3\x88\x6f\xf1\x09\x27\x9d\x98\x30\xda"
+                   "\xc7\x27\xaf\xb9\x4a\x83\xee\x6d\x83\x60\xcb\xdf\xa2\xcc\x06\x40", dk, 64) != 0)
+            r = 0, fprintf(stderr, "***FAILED*** %s: BRScryptParallel() threads %u\n", __func__, i);
+    }
     
     return r;
 }
@@ -895,6 +1135,52 @@ int BRCypherTests()
     if (memcmp(msg3, out3, sizeof(out3)) != 0)
         r = 0, fprintf(stderr, "***FAILED*** %s: BRChacha20() de-cypher test 3\n", __func__);
 
+    // compare a multi-block message against one block at a time, across a block counter carry, for each feature
+    uint32_t features = BRCryptoFeatures();
+    uint8_t blocks[1000], out4[sizeof(blocks)], out5[sizeof(blocks)];
+    
+    for (size_t i = 0; i < sizeof(blocks); i++) blocks[i] = (uint8_t)(i*13);
+
+    for (uint32_t f = 0; f <= features; f = (f << 1) | (f == 0)) {
+        if ((features & f) != f) continue;
+        BRCryptoSetFeatures(f);
+        BRChacha20(out4, key3, iv3, blocks, sizeof(blocks), 0xfffffffaULL);
+        
+        for (size_t i = 0; i < sizeof(blocks); i += 64) {
+            BRChacha20(&out5[i], key3, iv3, &blocks[i], (i + 64 < sizeof(blocks)) ? 64 : sizeof(blocks) - i,
+                       0xfffffffaULL + i/64);
+        }
+        
+        if (memcmp(out4, out5, sizeof(out4)) != 0)
+            r = 0, fprintf(stderr, "***FAILED*** %s: BRChacha20() multi-block features 0x%x\n", __func__, f);
+    }
+    
+    BRCryptoSetFeatures(features);
+
+    // aes-256 test vector from fips-197 appendix c.3, in the first of several blocks, for each feature
+    const char aesMsg[] = "\x00\x11\x22\x33\x44\x55\x66\x77\x88\x99\xaa\xbb\xcc\xdd\xee\xff",
+    aesCypher[] = "\x8e\xa2\xb7\xca\x51\x67\x45\xbf\xea\xfc\x49\x90\x4b\x49\x60\x89";
+    BRAES256Ctx aes;
+    uint8_t buf[64];
+
+    BRAES256Init(&aes, key);
+
+    for (uint32_t f = 0; f <= features; f = (f << 1) | (f == 0)) {
+        if ((features & f) != f) continue;
+        BRCryptoSetFeatures(f);
+        memcpy(buf, aesMsg, 16);
+        for (size_t i = 16; i < sizeof(buf); i++) buf[i] = (uint8_t)(i*7);
+        BRAES256ECBEncrypt(&aes, buf, sizeof(buf));
+        if (memcmp(buf, aesCypher, 16) != 0)
+            r = 0, fprintf(stderr, "***FAILED*** %s: BRAES256ECBEncrypt() features 0x%x\n", __func__, f);
+
+        BRAES256ECBDecrypt(&aes, buf, sizeof(buf));
+        if (memcmp(buf, aesMsg, 16) != 0 || buf[63] != (uint8_t)(63*7))
+            r = 0, fprintf(stderr, "***FAILED*** %s: BRAES256ECBDecrypt() features 0x%x\n", __func__, f);
+    }
+
+    BRCryptoSetFeatures(features);
+    memset(&aes, 0, sizeof(aes));
     return r;
 }
 
@@ -1212,6 +1498,28 @@ int BRKeyTests()
     if (pkLen5 != pkLen || memcmp(pubKey, pubKey5, pkLen) != 0)
         r = 0, fprintf(stderr, "***FAILED*** %s: BRPubKeyRecover() test 3\n", __func__);
 
+    // batch addresses, with one key that has no pubkey, and more keys than are hashed together at a time
+    BRKey keys[70];
+    BRAddress addrs[70];
+    char *addrPtrs[70];
+    UInt256 secret = UINT256_ZERO;
+
+    for (size_t i = 0; i < 70; i++) {
+        secret.u8[31] = (uint8_t)(i + 1);
+        BRKeySetSecret(&keys[i], &secret, (i % 2 == 0));
+        addrPtrs[i] = addrs[i].s;
+    }
+
+    memset(&keys[5], 0, sizeof(keys[5]));
+    BRKeyAddressList(keys, 70, addrPtrs, sizeof(BRAddress));
+
+    for (size_t i = 0; i < 70; i++) {
+        addr = BR_ADDRESS_NONE;
+        BRKeyAddress(&keys[i], addr.s, sizeof(addr));
+        if (strncmp(addr.s, addrs[i].s, sizeof(addr)) != 0)
+            r = 0, fprintf(stderr, "***FAILED*** %s: BRKeyAddressList() test %zu\n", __func__, i);
+    }
+
     printf("                                    ");
     return r;
 }
@@ -1318,6 +1626,19 @@ int BRBIP38KeyTests()
     if (BRKeySetBIP38Key(&key, "6PRW5o9FLp4gJDDVqJQKJFTpMvdsSGJxMYHtHaQBF3ooa8mwD69bapcDQn", "foobar"))
         r = 0, fprintf(stderr, "***FAILED*** %s: BRKeySetBIP38Key() test 10\n", __func__);
 
+    // batch decrypt, with one incorrect password
+    BRKey keys[3];
+    int results[3];
+    const char *bip38Keys[] = { "6PRVWUbkzzsbcVac2qwfssoUJAN1Xhrg6bNk8J7Nzm5H7kxEbn2Nh2ZoGg",
+                                "6PRW5o9FLp4gJDDVqJQKJFTpMvdsSGJxMYHtHaQBF3ooa8mwD69bapcDQn",
+                                "6PRNFFkZc2NZ6dJqFfhRoFNMR9Lnyj7dYGrzdgXXVMXcxoKTePPX1dWByq" },
+               *passphrases[] = { "TestingOneTwoThree", "foobar", "Satoshi" };
+
+    if (BRKeySetBIP38KeyList(keys, results, 3, bip38Keys, passphrases) != 2 || ! results[0] || results[1] ||
+        ! results[2] || ! BRKeyPrivKey(&keys[2], privKey, sizeof(privKey)) ||
+        strncmp(privKey, "5HtasZ6ofTHP6HCwTqTkLDuLQisYPah7aUnSKfC7h4hMUVw2gi5", sizeof(privKey)) != 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRKeySetBIP38KeyList() test\n", __func__);
+
     printf("                                    ");
     return r;
 }
@@ -1533,6 +1854,19 @@ int BRBIP32SequenceTests()
                     u256_hex_decode("7b6a7dd645507d775215a9035be06700e1ed8c541da9351b4bd14bd50ab61428")))
         r = 0, fprintf(stderr, "***FAILED*** %s: BRBIP32PubKey() test\n", __func__);
 
+    uint32_t indexes[] = { 0, 1, 2, 19, 0x7fffffff };
+    BRKey keys[sizeof(indexes)/sizeof(*indexes)];
+    uint8_t pubKey2[33];
+
+    BRBIP32PubKeyList(keys, sizeof(keys)/sizeof(*keys), mpk, SEQUENCE_INTERNAL_CHAIN, indexes);
+
+    for (size_t i = 0; i < sizeof(keys)/sizeof(*keys); i++) {
+        BRBIP32PubKey(pubKey, sizeof(pubKey), mpk, SEQUENCE_INTERNAL_CHAIN, indexes[i]);
+        if (BRKeyPubKey(&keys[i], pubKey2, sizeof(pubKey2)) != sizeof(pubKey2) ||
+            memcmp(pubKey, pubKey2, sizeof(pubKey)) != 0)
+            r = 0, fprintf(stderr, "***FAILED*** %s: BRBIP32PubKeyList() test %zu\n", __func__, i);
+    }
+
     UInt512 dk;
     BRAddress addr;
 
@@ -1909,7 +2243,58 @@ int BRBloomFilterTests()
     if (len2 != sizeof(d2) - 1 || memcmp(buf2, d2, len2) != 0)
         r = 0, fprintf(stderr, "***FAILED*** %s: BRBloomFilterSerialize() test 2\n", __func__);
     
-    BRBloomFilterFree(f);    
+    BRBloomFilterFree(f);
+    
+    // a list insert with a duplicate should match inserting each element that isn't already contained
+    const uint8_t *elems[] = { (uint8_t *)data5, (uint8_t *)data7, (uint8_t *)data5, (uint8_t *)data8 },
+                  *elems2[] = { (uint8_t *)data5, (uint8_t *)data6, (uint8_t *)data7, (uint8_t *)data8 };
+    size_t elemLens[] = { sizeof(data5) - 1, sizeof(data7) - 1, sizeof(data5) - 1, sizeof(data8) - 1 };
+    int results[4];
+    BRBloomFilter *f2 = BRBloomFilterNew(0.000001, 3, 5, BLOOM_UPDATE_ALL);
+    
+    f = BRBloomFilterNew(0.000001, 3, 5, BLOOM_UPDATE_ALL);
+    
+    for (size_t i = 0; i < 4; i++) {
+        if (! BRBloomFilterContainsData(f, elems[i], elemLens[i])) BRBloomFilterInsertData(f, elems[i], elemLens[i]);
+    }
+    
+    if (BRBloomFilterInsertDataList(f2, elems, elemLens, 4) != 3 || f2->elemCount != f->elemCount ||
+        f2->length != f->length || memcmp(f2->filter, f->filter, f->length) != 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRBloomFilterInsertDataList() test\n", __func__);
+    
+    if (BRBloomFilterContainsDataList(f2, results, elems2, elemLens, 4) != 3 || ! results[0] || results[1] ||
+        ! results[2] || ! results[3])
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRBloomFilterContainsDataList() test 1\n", __func__);
+    
+    BRBloomFilterFree(f2);
+    BRBloomFilterFree(f);
+    
+    // a list contains with more elements than fit in one batch, runs of different lengths, and a NULL element, should
+    // match calling BRBloomFilterContainsData() for each element
+    uint8_t listData[200*36];
+    const uint8_t *list[200];
+    size_t listLens[200], matches = 0;
+    int listResults[200];
+    
+    for (size_t i = 0; i < sizeof(listData); i++) listData[i] = (uint8_t)(i*13 + i/7);
+    for (size_t i = 0; i < 200; i++) list[i] = &listData[i*36], listLens[i] = (i < 150) ? 20 : 36 - i % 3;
+    list[77] = NULL, listLens[77] = 0;
+    f = BRBloomFilterNew(0.01, 100, 11, BLOOM_UPDATE_ALL);
+    for (size_t i = 0; i < 200; i += 2) BRBloomFilterInsertData(f, list[i] ? list[i] : listData, listLens[i]);
+    
+    if (BRBloomFilterContainsDataList(f, listResults, list, listLens, 200) < 100)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRBloomFilterContainsDataList() test 2\n", __func__);
+    
+    for (size_t i = 0; i < 200; i++) {
+        if (listResults[i]) matches++;
+        if (listResults[i] != BRBloomFilterContainsData(f, list[i], listLens[i]))
+            r = 0, fprintf(stderr, "***FAILED*** %s: BRBloomFilterContainsDataList() test %zu\n", __func__, i + 3);
+    }
+    
+    if (matches != BRBloomFilterContainsDataList(f, listResults, list, listLens, 200))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRBloomFilterContainsDataList() match count test\n", __func__);
+    
+    BRBloomFilterFree(f);
     return r;
 }
 
@@ -1973,7 +2358,128 @@ int BRMerkleBlockTests()
                     u256_hex_decode("c9ab658448c10b6921b7a4ce3021eb22ed6bb6a7fde1e5bcc4b1db6615c6abc5")))
         r = 0, fprintf(stderr, "***FAILED*** %s: BRMerkleBlockTxHashes() test 4\n", __func__);
     
-    // TODO: test a block with an odd number of tree rows both at the tx level and merkle node level
+    if (! BRMerkleBlockIsValidExceptPoW(b, (uint32_t)time(NULL)))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRMerkleBlockIsValidExceptPoW() test\n", __func__);
+    
+    UInt256 matched[b->hashesCount];
+    size_t matchedCount = 0;
+    
+    if (! BRMerkleBlockValidateTxHashes(b, (uint32_t)time(NULL), matched, &matchedCount) || matchedCount != 4 ||
+        memcmp(matched, txHashes, sizeof(txHashes)) != 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRMerkleBlockValidateTxHashes() test\n", __func__);
+    
+    BRMerkleBlock view, *cpy;
+    
+    if (! BRMerkleBlockView(&view, (uint8_t *)block, sizeof(block) - 1) || ! UInt256Eq(view.blockHash, b->blockHash) ||
+        BRMerkleBlockTxHashes(&view, txHashes, 4) != 4 || ! BRMerkleBlockContainsTxHash(&view, txHashes[3]) ||
+        ! BRMerkleBlockIsValidExceptPoW(&view, (uint32_t)time(NULL)))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRMerkleBlockView() test 1\n", __func__);
+    
+    cpy = BRMerkleBlockCopy(&view);
+    
+    if (BRMerkleBlockSerialize(cpy, block2, sizeof(block2)) != sizeof(block2) ||
+        memcmp(block, block2, sizeof(block2)) != 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRMerkleBlockCopy() test\n", __func__);
+    
+    BRMerkleBlockFree(cpy);
+    
+    if (! BRMerkleBlockView(&view, (uint8_t *)block, sizeof(block) - 2) || view.flags != NULL || view.flagsLen != 0 ||
+        BRMerkleBlockIsValidExceptPoW(&view, (uint32_t)time(NULL))) // truncated merkle tree
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRMerkleBlockView() test 2\n", __func__);
+    
+    if (BRMerkleBlockView(&view, (uint8_t *)block, 79))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRMerkleBlockView() test 3\n", __func__);
+    
+    BRBlockHeader header;
+    BRMerkleBlock hb;
+    
+    BRBlockHeaderSet(&header, b);
+    hb = BRBlockHeaderMerkleBlock(&header);
+    
+    if (! UInt256Eq(hb.blockHash, b->blockHash) || hb.height != b->height || hb.hashesCount != 0 ||
+        BRMerkleBlockSerialize(&hb, block2, sizeof(block2)) != 80 || memcmp(block, block2, 80) != 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRBlockHeaderMerkleBlock() test\n", __func__);
+    
+    UInt256 tx[3], pair[2], m[2], root;
+    BRMerkleBlock *b3 = BRMerkleBlockNew();
+    
+    for (size_t i = 0; i < 3; i++) BRSHA256(&tx[i], &i, sizeof(i));
+    pair[0] = tx[0], pair[1] = tx[1];
+    BRSHA256_2(&m[0], pair, sizeof(pair));
+    pair[0] = pair[1] = tx[2]; // odd number of tx, so the last one is paired with itself
+    BRSHA256_2(&m[1], pair, sizeof(pair));
+    BRSHA256_2(&root, m, sizeof(m));
+    b3->totalTx = 3, b3->target = 0x1e0fffff, b3->merkleRoot = root;
+    BRMerkleBlockSetTxHashes(b3, (UInt256 []) { tx[0], tx[1], m[1] }, 3, (uint8_t []) { 0x0b }, 1); // match tx[1]
+    
+    if (! BRMerkleBlockIsValidExceptPoW(b3, (uint32_t)time(NULL)) || BRMerkleBlockTxHashes(b3, txHashes, 4) != 1 ||
+        ! UInt256Eq(txHashes[0], tx[1]))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRMerkleBlockTxHashes() test 5\n", __func__);
+    
+    BRMerkleBlockSetTxHashes(b3, (UInt256 []) { m[0], tx[2] }, 2, (uint8_t []) { 0x0d }, 1); // missing right branch
+    
+    if (! BRMerkleBlockIsValidExceptPoW(b3, (uint32_t)time(NULL)) || BRMerkleBlockTxHashes(b3, txHashes, 4) != 1 ||
+        ! UInt256Eq(txHashes[0], tx[2]))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRMerkleBlockTxHashes() test 6\n", __func__);
+    
+    BRMerkleBlockSetTxHashes(b3, (UInt256 []) { m[0], tx[2], tx[2] }, 3, (uint8_t []) { 0x1d }, 1);
+    
+    if (BRMerkleBlockIsValidExceptPoW(b3, (uint32_t)time(NULL))) // duplicate right branch (CVE-2012-2459)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRMerkleBlockIsValidExceptPoW() test 2\n", __func__);
+    
+    UInt256 tx100[100], level[100];
+    uint8_t flags100[26];
+    size_t n;
+    
+    for (size_t i = 0; i < 100; i++) BRSHA256(&tx100[i], &i, sizeof(i));
+    memcpy(level, tx100, sizeof(level));
+    
+    for (n = 100; n > 1; n = (n + 1)/2) { // odd rows at several levels, so each level has a node paired with itself
+        for (size_t i = 0; i < n; i += 2) {
+            pair[0] = level[i], pair[1] = (i + 1 < n) ? level[i + 1] : level[i];
+            BRSHA256_2(&level[i/2], pair, sizeof(pair));
+        }
+    }
+    
+    memset(flags100, 0xff, sizeof(flags100)); // every tx matched, so every node of the tree is walked
+    b3->totalTx = 100, b3->merkleRoot = level[0];
+    BRMerkleBlockSetTxHashes(b3, tx100, 100, flags100, sizeof(flags100));
+    
+    if (! BRMerkleBlockValidateTxHashes(b3, (uint32_t)time(NULL), level, &n) || n != 100 ||
+        memcmp(level, tx100, sizeof(tx100)) != 0) // more nodes than fit on the stack in the walk
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRMerkleBlockValidateTxHashes() test 2\n", __func__);
+    
+    BRMerkleBlockFree(b3);
+    
+    uint8_t headers[81*11];
+    BRMerkleBlock *blocks[11], *b2;
+
+    for (size_t i = 0; i < 11; i++) { // odd count so the last batch of headers doesn't fill all the simd lanes
+        memcpy(&headers[81*i], block, 80);
+        UInt32SetLE(&headers[81*i + 76], (uint32_t)i);
+        headers[81*i + 80] = 0;
+    }
+
+    BRMerkleBlockParseHeaders(blocks, headers, 11);
+    if (! UInt256IsZero(blocks[0]->powHash))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRMerkleBlockParseHeaders() powHash test\n", __func__);
+    BRMerkleBlockSetPowHashes(&blocks[3], 1); // the batch below should skip blocks that already have a powHash
+    BRMerkleBlockSetPowHashes(blocks, 11);
+
+    for (size_t i = 0; i < 11; i++) {
+        b2 = BRMerkleBlockParse(&headers[81*i], 81);
+        
+        if (BRMerkleBlockIsValid(b2, (uint32_t)time(NULL)) !=
+            (BRMerkleBlockIsValidExceptPoW(b2, (uint32_t)time(NULL)) && BRMerkleBlockVerifyPoW(b2)))
+            r = 0, fprintf(stderr, "***FAILED*** %s: BRMerkleBlockVerifyPoW() test %zu\n", __func__, i);
+
+        if (! UInt256Eq(blocks[i]->blockHash, b2->blockHash) || ! UInt256Eq(blocks[i]->powHash, b2->powHash) ||
+            UInt256IsZero(b2->powHash) || blocks[i]->nonce != i)
+            r = 0, fprintf(stderr, "***FAILED*** %s: BRMerkleBlockParseHeaders() test %zu\n", __func__, i);
+
+        BRMerkleBlockFree(b2);
+        BRMerkleBlockFree(blocks[i]);
+    }
 
     // TODO: XXX test BRMerkleBlockVerifyDifficulty()
     
@@ -1983,6 +2489,107 @@ int BRMerkleBlockTests()
     return r;
 }
 
+int BRChainFileTests()
+{
+    int r = 1, fd;
+    char path[] = "/tmp/BRChainFileTestXXXXXX";
+    BRChainFile *file, *file2;
+    struct stat st;
+    BRBlockHeader headers[3000], h;
+    const BRBlockHeader *p;
+    BRMerkleBlock b;
+    uint8_t buf[80];
+    
+    fd = mkstemp(path);
+    if (fd >= 0) close(fd);
+    memset(headers, 0, sizeof(headers));
+    
+    for (uint32_t i = 0; i < 3000; i++) { // more headers than the file is initially sized for
+        if (i > 0) headers[i].prevBlock = headers[i - 1].blockHash;
+        headers[i].nonce = i;
+        headers[i].height = 10000 + i;
+        b = BRBlockHeaderMerkleBlock(&headers[i]);
+        BRMerkleBlockSerialize(&b, buf, sizeof(buf));
+        BRSHA256_2(&headers[i].blockHash, buf, sizeof(buf));
+    }
+    
+    file = (fd >= 0) ? BRChainFileOpen(path) : NULL;
+    if (! file) return r = 0, fprintf(stderr, "***FAILED*** %s: BRChainFileOpen() test\n", __func__), r;
+    if (BRChainFileCount(file) != 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRChainFileCount() test 1\n", __func__);
+    
+    for (size_t i = 0; i < 3000; i++) {
+        if (! BRChainFileAppend(file, &headers[i]))
+            r = 0, fprintf(stderr, "***FAILED*** %s: BRChainFileAppend() test %zu\n", __func__, i);
+    }
+
+    if (BRChainFileAppend(file, &headers[0])) // wrong height
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRChainFileAppend() height test\n", __func__);
+    BRChainFileClose(file);
+    
+    file = BRChainFileOpen(path);
+    if (! file) return r = 0, fprintf(stderr, "***FAILED*** %s: BRChainFileOpen() reopen test\n", __func__), r;
+    if (BRChainFileCount(file) != 3000 || BRChainFileFirstHeight(file) != 10000)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRChainFileCount() test 2\n", __func__);
+    p = BRChainFileHeader(file, 12345);
+    if (! p || memcmp(p, &headers[2345], sizeof(*p)) != 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRChainFileHeader() test 1\n", __func__);
+    if (BRChainFileHeader(file, 9999) || BRChainFileHeader(file, 13000))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRChainFileHeader() test 2\n", __func__);
+    
+    BRChainFileTruncate(file, 12000); // reorg, replace the headers from 12000 with a fork
+    h = headers[2000];
+    h.nonce = UINT32_MAX;
+    b = BRBlockHeaderMerkleBlock(&h);
+    BRMerkleBlockSerialize(&b, buf, sizeof(buf));
+    BRSHA256_2(&h.blockHash, buf, sizeof(buf));
+    if (BRChainFileCount(file) != 2000 || ! BRChainFileAppend(file, &h) || BRChainFileHeader(file, 12001))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRChainFileTruncate() test\n", __func__);
+    
+    // a header that doesn't link to the one before it, as if it was left by a crash, is dropped on the next open
+    h = headers[2001];
+    if (! BRChainFileAppend(file, &h))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRChainFileAppend() test\n", __func__);
+    file2 = BRChainFileOpen(path); // opened before file is synced or closed, as if after a crash
+    if (! file2 || BRChainFileCount(file2) != 2001 || BRChainFileHeader(file2, 12001))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRChainFileOpen() tail test\n", __func__);
+    if (file2) BRChainFileClose(file2);
+    
+    // a record appended since the last sync that didn't make it to persistent storage before a crash is dropped on the
+    // next open, along with every record after it, even though the records after it link to each other
+    BRChainFileTruncate(file, 12000);
+    for (size_t i = 2000; i < 2100; i++) BRChainFileAppend(file, &headers[i]);
+    BRChainFileSync(file);
+    for (size_t i = 2100; i < 3000; i++) BRChainFileAppend(file, &headers[i]);
+    memset((void *)BRChainFileHeader(file, 12500), 0, sizeof(BRBlockHeader)); // as if its page was never written
+    file2 = BRChainFileOpen(path); // opened before file is synced or closed, as if after a crash
+    if (! file2 || BRChainFileCount(file2) != 2500 || BRChainFileHeader(file2, 12500))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRChainFileOpen() unsynced tail test\n", __func__);
+    if (file2) BRChainFileClose(file2);
+    
+    // so is a record that only partly made it to persistent storage, even though it links to the records around it
+    for (size_t i = 2500; i < 2600; i++) BRChainFileAppend(file, &headers[i]);
+    ((BRBlockHeader *)BRChainFileHeader(file, 12500))->timestamp++; // as if it straddled two pages and one was lost
+    file2 = BRChainFileOpen(path); // opened before file is synced or closed, as if after a crash
+    if (! file2 || BRChainFileCount(file2) != 2500 || BRChainFileHeader(file2, 12500))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRChainFileOpen() partly written record test\n", __func__);
+    if (file2) BRChainFileClose(file2);
+    
+    // compacting removes the headers from the front of the file, and the file shrinks
+    if (! BRChainFileCompact(file, 12400) || BRChainFileFirstHeight(file) != 12400 || BRChainFileCount(file) != 100 ||
+        ! (p = BRChainFileHeader(file, 12450)) || memcmp(p, &headers[2450], sizeof(*p)) != 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRChainFileCompact() test\n", __func__);
+    BRChainFileClose(file);
+    file = BRChainFileOpen(path);
+    if (! file || BRChainFileCount(file) != 100 || BRChainFileFirstHeight(file) != 12400 || stat(path, &st) != 0 ||
+        st.st_size >= 3000*(off_t)sizeof(BRBlockHeader))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRChainFileCompact() reopen test\n", __func__);
+    
+    if (file) BRChainFileClose(file);
+    unlink(path);
+    return r;
+}
+
 int BRPaymentProtocolTests()
 {
     int r = 1;
@@ -2423,13 +3030,427 @@ int BRPaymentProtocolEncryptionTests()
 
 void BRPeerAcceptMessageTest(BRPeer *peer, const uint8_t *msg, size_t len, const char *type);
 
+static int _peerTestHandler(void *info, BRPeer *peer, const uint8_t *msg, size_t msgLen)
+{
+    (void)peer, (void)msg;
+    *(size_t *)info = msgLen;
+    return 1;
+}
+
+static struct {
+    size_t count;
+    UInt256 lastHash;
+} _peerTestHeaders;
+
+static void _peerTestRelayedHeaders(void *info, BRMerkleBlock *blocks[], size_t blocksCount)
+{
+    (void)info;
+    for (size_t i = 0; i < blocksCount; i++) {
+        _peerTestHeaders.lastHash = blocks[i]->blockHash;
+        BRMerkleBlockFree(blocks[i]);
+    }
+    
+    _peerTestHeaders.count += blocksCount;
+}
+
+// writes the payload of a "headers" message with count chained headers to msg, which must have room for 9 + 81*count
+// bytes, the header at index invalid, if less than count, gets a timestamp too far in the future - sets last to the
+// hash of the last valid header, and returns the payload length
+static size_t _peerTestHeadersPayload(uint8_t *msg, size_t count, size_t invalid, UInt256 *last)
+{
+    size_t off = BRVarIntSet(msg, 9, count);
+    UInt256 hash = UINT256_ZERO;
+    uint8_t *h;
+    
+    *last = UINT256_ZERO;
+    
+    for (size_t i = 0; i < count; i++, off += 81) {
+        h = &msg[off];
+        memset(h, 0, 81);
+        UInt32SetLE(&h[0], 2); // version
+        UInt256Set(&h[4], hash); // prevBlock
+        UInt32SetLE(&h[36], (uint32_t)i); // merkleRoot
+        UInt32SetLE(&h[68], (i == invalid) ? (uint32_t)time(NULL) + 24*60*60 : 1400000000 + (uint32_t)i*150);
+        UInt32SetLE(&h[72], 0x1e0ffff0); // target
+        BRSHA256_2(&hash, h, 80);
+        if (i < invalid) *last = hash;
+    }
+    
+    return off;
+}
+
+// relays a "headers" message with count chained headers through the header worker threads, see
+// _peerTestHeadersPayload() - returns the hash of the last valid header
+static UInt256 _peerTestHeadersMessage(BRPeer *peer, size_t count, size_t invalid)
+{
+    uint8_t *msg = malloc(9 + 81*count);
+    UInt256 last;
+    size_t len = _peerTestHeadersPayload(msg, count, invalid, &last);
+    
+    BRPeerAcceptMessageTest(peer, msg, len, MSG_HEADERS);
+    free(msg);
+    return last;
+}
+
+// writes the payload of a "notfound" message with count tx hashes to msg, which must have room for 9 + 36*count bytes,
+// and returns the payload length
+static size_t _peerTestNotfoundPayload(uint8_t *msg, size_t count)
+{
+    size_t off = BRVarIntSet(msg, 9, count);
+    
+    for (size_t i = 0; i < count; i++, off += 36) {
+        memset(&msg[off], 0, 36);
+        UInt32SetLE(&msg[off], 1); // inv_tx
+        UInt32SetLE(&msg[off + 4], (uint32_t)i);
+    }
+    
+    return off;
+}
+
+static volatile struct {
+    int disconnected, error, cleanup, handled;
+    size_t headersCount; // number of headers relayed when the last message was handled
+    size_t hashes; // total number of tx hashes in the messages handled
+} _peerTestSocket;
+
+static void _peerTestDisconnected(void *info, int error)
+{
+    (void)info;
+    _peerTestSocket.error = error;
+    _peerTestSocket.disconnected++;
+}
+
+static void _peerTestThreadCleanup(void *info)
+{
+    (void)info;
+    _peerTestSocket.cleanup++;
+}
+
+static void _peerTestNotfound(void *info, const UInt256 txHashes[], size_t txCount, const UInt256 blockHashes[],
+                              size_t blockCount)
+{
+    (void)info, (void)txHashes, (void)blockHashes, (void)blockCount;
+    _peerTestSocket.headersCount = _peerTestHeaders.count;
+    _peerTestSocket.hashes += txCount;
+    _peerTestSocket.handled++;
+}
+
+// waits up to ten seconds for *count to reach n, returns false if it doesn't
+static int _peerTestWait(volatile int *count, int n)
+{
+    for (int i = 0; i < 1000 && *count < n; i++) usleep(10000);
+    return (*count >= n);
+}
+
+// returns a socket bound to an unused loopback port, that peer is set to connect to, and whose accept() times out
+static int _peerTestBind(BRPeer *peer)
+{
+    struct sockaddr_in addr;
+    socklen_t addrLen = sizeof(addr);
+    struct timeval tv = { 10, 0 };
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    getsockname(fd, (struct sockaddr *)&addr, &addrLen);
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    peer->address = ((UInt128) { .u8 = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff, 127, 0, 0, 1 } });
+    peer->port = ntohs(addr.sin_port);
+    return fd;
+}
+
+// connects peer to the local socket listening on fd, and returns the accepted socket, or -1 on failure, once the
+// peer's version message is read, and its header copied to header, so its magic number can be used to send messages
+static int _peerTestAccept(BRPeer *peer, int fd, uint8_t header[24])
+{
+    uint8_t payload[0x1000];
+    int s;
+    
+    BRPeerConnect(peer);
+    s = accept(fd, NULL, NULL);
+    
+    if (s >= 0 && (recv(s, header, 24, MSG_WAITALL) != 24 || UInt32GetLE(&header[16]) > sizeof(payload) ||
+                   recv(s, payload, UInt32GetLE(&header[16]), MSG_WAITALL) != UInt32GetLE(&header[16]))) {
+        close(s);
+        s = -1;
+    }
+    
+    return s;
+}
+
+// writes a message header with the magic number from header, the given type, and msgLen to buf, followed by the msgLen
+// byte message, which may already be at &buf[24] - returns the length of the framed message
+static size_t _peerTestFrame(uint8_t *buf, const uint8_t header[24], const char *type, const uint8_t *msg,
+                             size_t msgLen)
+{
+    UInt256 hash;
+    
+    BRSHA256_2(&hash, msg, msgLen);
+    memmove(&buf[24], msg, msgLen);
+    memcpy(buf, header, 4);
+    memset(&buf[4], 0, 12);
+    memcpy(&buf[4], type, strlen(type));
+    UInt32SetLE(&buf[16], (uint32_t)msgLen);
+    memcpy(&buf[20], &hash, 4);
+    return 24 + msgLen;
+}
+
 int BRPeerTests()
 {
     int r = 1;
     BRPeer *p = BRPeerNew();
     const char msg[] = "my message";
+    BRPeerStats stats;
+    UInt256 hash;
+    size_t i, len = 0;
     
     BRPeerAcceptMessageTest(p, (const uint8_t *)msg, sizeof(msg) - 1, "inv");
+    
+    if (BRPeerSetMessageHandler(MSG_PING, &len, _peerTestHandler))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerSetMessageHandler() test 1\n", __func__);
+
+    if (! BRPeerSetMessageHandler(MSG_SENDHEADERS, &len, _peerTestHandler))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerSetMessageHandler() test 2\n", __func__);
+
+    BRPeerAcceptMessageTest(p, (const uint8_t *)msg, sizeof(msg) - 1, MSG_SENDHEADERS);
+    
+    if (len != sizeof(msg) - 1)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerSetMessageHandler() test 3\n", __func__);
+
+    BRPeerSetMessageHandler(MSG_SENDHEADERS, NULL, NULL);
+    BRPeerSendMessage(p, (const uint8_t *)msg, sizeof(msg) - 1, MSG_SENDHEADERS); // queued, since p isn't connected
+    BRPeerGetStats(p, &stats);
+    
+    for (i = 0; i < PEER_STATS_TYPES && strncmp(stats.types[i].type, MSG_SENDHEADERS, 12) != 0; i++);
+    
+    if (i == PEER_STATS_TYPES || stats.types[i].sent != 1 || stats.types[i].sentSizes[0] != 1 ||
+        stats.bytesSent != 24 + sizeof(msg) - 1)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerGetStats() test\n", __func__);
+
+    // headers are hashed and validated on the worker threads, and relayed together once they're all done
+    BRPeerSetCallbacks(p, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL);
+    BRPeerSetRelayedHeadersCallback(p, _peerTestRelayedHeaders);
+    BRPeerSetEarliestKeyTime(p, 0); // headers newer than earliestKeyTime are only used to request blocks, so skip pow
+    hash = _peerTestHeadersMessage(p, 2000, 2000);
+    
+    if (_peerTestHeaders.count != 2000 || ! UInt256Eq(_peerTestHeaders.lastHash, hash))
+        r = 0, fprintf(stderr, "***FAILED*** %s: headers worker test 1\n", __func__);
+
+    _peerTestHeaders.count = 0; // nothing from the invalid header on is relayed
+    hash = _peerTestHeadersMessage(p, 2000, 1500);
+
+    if (_peerTestHeaders.count != 1500 || ! UInt256Eq(_peerTestHeaders.lastHash, hash))
+        r = 0, fprintf(stderr, "***FAILED*** %s: headers worker test 2\n", __func__);
+
+    BRPeerStopThreads();
+    _peerTestHeaders.count = 0; // the worker threads start again when they're needed
+    hash = _peerTestHeadersMessage(p, 2000, 2000);
+    
+    if (_peerTestHeaders.count != 2000 || ! UInt256Eq(_peerTestHeaders.lastHash, hash))
+        r = 0, fprintf(stderr, "***FAILED*** %s: headers worker test 3\n", __func__);
+
+    BRPeerStopThreads();
+    BRPeerFree(p);
+    
+    if (BRPeerSetReactorEnabled(1)) { // peers serviced by the reactor thread, only on systems with epoll
+        uint8_t header[24], *buf = malloc(24 + 9 + 81*2000 + 24 + 9);
+        int fd, s;
+        size_t len, n;
+        
+        assert(buf != NULL);
+        p = BRPeerNew();
+        BRPeerSetCallbacks(p, NULL, NULL, _peerTestDisconnected, NULL, NULL, NULL, NULL, NULL, _peerTestNotfound, NULL,
+                           NULL, NULL, _peerTestThreadCleanup);
+        BRPeerSetRelayedHeadersCallback(p, _peerTestRelayedHeaders);
+        fd = _peerTestBind(p); // a bound socket that isn't listening refuses connections
+        BRPeerConnect(p);
+        
+        if (! _peerTestWait(&_peerTestSocket.cleanup, 1) || _peerTestSocket.disconnected != 1 ||
+            _peerTestSocket.error != ECONNREFUSED)
+            r = 0, fprintf(stderr, "***FAILED*** %s: reactor connect test\n", __func__);
+        
+        listen(fd, 1);
+        s = _peerTestAccept(p, fd, header);
+        _peerTestHeaders.count = 0; // the reactor thread parks the message after the headers until they're relayed
+        len = _peerTestHeadersPayload(&buf[24], 2000, 2000, &hash);
+        len = _peerTestFrame(buf, header, MSG_HEADERS, &buf[24], len);
+        n = _peerTestNotfoundPayload(&buf[len + 24], 0);
+        len += _peerTestFrame(&buf[len], header, MSG_NOTFOUND, &buf[len + 24], n);
+        
+        if (s >= 0 && send(s, buf, len, 0) != (ssize_t)len) {
+            close(s);
+            s = -1;
+        }
+        
+        if (s < 0 || ! _peerTestWait(&_peerTestSocket.handled, 1) || _peerTestSocket.headersCount != 2000 ||
+            ! UInt256Eq(_peerTestHeaders.lastHash, hash))
+            r = 0, fprintf(stderr, "***FAILED*** %s: reactor headers test\n", __func__);
+        
+        BRPeerScheduleDisconnect(p, 0.1);
+        
+        if (! _peerTestWait(&_peerTestSocket.cleanup, 2) || _peerTestSocket.disconnected != 2 ||
+            _peerTestSocket.error != ETIMEDOUT)
+            r = 0, fprintf(stderr, "***FAILED*** %s: reactor timeout test\n", __func__);
+        
+        if (s >= 0) close(s);
+        s = _peerTestAccept(p, fd, header);
+        BRPeerDisconnect(p);
+        
+        if (s < 0 || ! _peerTestWait(&_peerTestSocket.cleanup, 3) || _peerTestSocket.error != 0)
+            r = 0, fprintf(stderr, "***FAILED*** %s: reactor disconnect test\n", __func__);
+        
+        if (s >= 0) close(s);
+        s = _peerTestAccept(p, fd, header);
+        BRPeerStopThreads(); // disconnects peers the reactor thread still services before it exits
+        
+        if (s < 0 || _peerTestSocket.cleanup != 4 || _peerTestSocket.error != ECONNABORTED)
+            r = 0, fprintf(stderr, "***FAILED*** %s: reactor stop test\n", __func__);
+        
+        if (s >= 0) close(s);
+        s = _peerTestAccept(p, fd, header); // the reactor thread starts again when it's needed
+        BRPeerDisconnect(p);
+        
+        if (s < 0 || ! _peerTestWait(&_peerTestSocket.cleanup, 5) || _peerTestSocket.disconnected != 5)
+            r = 0, fprintf(stderr, "***FAILED*** %s: reactor restart test\n", __func__);
+        
+        if (s >= 0) close(s);
+        close(fd);
+        BRPeerStopThreads();
+        BRPeerSetReactorEnabled(0);
+        BRPeerFree(p);
+        free(buf);
+    }
+    
+    // message framing and send queueing, by peers with their own thread, and then by the reactor thread if available
+    for (i = 0; i < 2 && BRPeerSetReactorEnabled((int)i) == (int)i; i++) {
+        uint8_t header[24], *buf = calloc(1, 0x20000), *msgs = malloc(0x20000);
+        int fd, s, handled = _peerTestSocket.handled, disconnected = _peerTestSocket.disconnected, rcvBuf = 0x1000;
+        int cleanup = _peerTestSocket.cleanup;
+        size_t j, n, off = 0;
+        
+        assert(buf != NULL);
+        assert(msgs != NULL);
+        p = BRPeerNew();
+        BRPeerSetCallbacks(p, NULL, NULL, _peerTestDisconnected, NULL, NULL, NULL, NULL, NULL, _peerTestNotfound, NULL,
+                           NULL, NULL, _peerTestThreadCleanup);
+        fd = _peerTestBind(p);
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvBuf, sizeof(rcvBuf)); // so the peer's socket soon stops taking sends
+        listen(fd, 1);
+        s = _peerTestAccept(p, fd, header);
+        _peerTestSocket.hashes = 0;
+        memcpy(msgs, "junk", 4); // garbage ending in a partial magic number
+        memcpy(&msgs[4], header, 2);
+        if (s >= 0) send(s, msgs, 6, 0);
+        usleep(100000);
+        memcpy(msgs, header, 3); // more garbage, starting with a partial magic number, before three buffered messages
+        off = 3 + _peerTestFrame(&msgs[3], header, MSG_NOTFOUND, buf, _peerTestNotfoundPayload(buf, 5));
+        off += _peerTestFrame(&msgs[off], header, MSG_NOTFOUND, buf, _peerTestNotfoundPayload(buf, 0));
+        off += _peerTestFrame(&msgs[off], header, MSG_NOTFOUND, buf, _peerTestNotfoundPayload(buf, 7));
+        if (s >= 0) send(s, msgs, off, 0);
+        n = _peerTestNotfoundPayload(buf, (0x20000 - 24 - 9)/36); // larger than the receive buffer
+        off = _peerTestFrame(msgs, header, MSG_NOTFOUND, buf, n);
+        
+        for (j = 0; s >= 0 && j < off; j += n) { // split across many reads, including inside its header
+            n = (j < 40) ? 10 : 0x8000;
+            if (n > off - j) n = off - j;
+            send(s, &msgs[j], n, 0);
+            usleep(10000);
+        }
+        
+        if (s < 0 || ! _peerTestWait(&_peerTestSocket.handled, handled + 4) ||
+            _peerTestSocket.hashes != 5 + 0 + 7 + (0x20000 - 24 - 9)/36 || _peerTestSocket.disconnected != disconnected)
+            r = 0, fprintf(stderr, "***FAILED*** %s: message framing test %zu\n", __func__, i + 1);
+        
+        // messages queued while the socket isn't taking any more are sent in order once it is
+        for (j = 0; j < 96; j++) {
+            memset(buf, (int)j, 0x8000);
+            BRPeerSendMessage(p, buf, 0x8000, MSG_NOTFOUND);
+        }
+        
+        for (j = 0; s >= 0 && j < 96;) { // skip anything else the peer sends, such as a ping
+            if (recv(s, msgs, 24, MSG_WAITALL) != 24 || UInt32GetLE(&msgs[16]) > 0x8000 ||
+                recv(s, &msgs[24], UInt32GetLE(&msgs[16]), MSG_WAITALL) != UInt32GetLE(&msgs[16])) break;
+            if (strncmp((char *)&msgs[4], MSG_NOTFOUND, 12) != 0) continue;
+            if (UInt32GetLE(&msgs[16]) != 0x8000 || msgs[24] != j || msgs[24 + 0x7fff] != j) break;
+            j++;
+        }
+        
+        BRPeerGetStats(p, &stats);
+        
+        if (j < 96 || stats.sendBlockedTime <= 0)
+            r = 0, fprintf(stderr, "***FAILED*** %s: send queue test %zu\n", __func__, i + 1);
+        
+        // peers that fall too far behind reading what's sent are disconnected
+        for (j = 0; j < 1000 && _peerTestSocket.disconnected == disconnected; j++) {
+            BRPeerSendMessage(p, buf, 0x8000, MSG_NOTFOUND);
+        }
+        
+        if (! _peerTestWait(&_peerTestSocket.disconnected, disconnected + 1))
+            r = 0, fprintf(stderr, "***FAILED*** %s: send queue limit test %zu\n", __func__, i + 1);
+        
+        BRPeerDisconnect(p);
+        _peerTestWait(&_peerTestSocket.cleanup, cleanup + 1); // the peer's thread is done with it after threadCleanup
+        if (s >= 0) close(s);
+        close(fd);
+        BRPeerStopThreads();
+        BRPeerFree(p);
+        free(msgs);
+        free(buf);
+    }
+    
+    BRPeerSetReactorEnabled(0);
+    return r;
+}
+
+void BRPeerManagerAddHeadersTest(BRPeerManager *manager, const BRBlockHeader headers[], size_t count);
+size_t BRPeerManagerBlockLocatorsTest(BRPeerManager *manager, UInt256 locators[], size_t locatorsCount);
+
+int BRPeerManagerTests()
+{
+    int r = 1;
+    BRMasterPubKey mpk = BRBIP32MasterPubKey("", 1);
+    BRWallet *w = BRWalletNew(NULL, 0, mpk);
+    BRPeerManager *manager = BRPeerManagerNew(w, 0, NULL, 0, NULL, 0);
+    uint32_t first = 2016*2000, count = 5000, height, step = 1; // more headers than fit in the main chain ring
+    BRBlockHeader *headers = calloc(count, sizeof(*headers));
+    UInt256 locators[64];
+    size_t i, n;
+    
+    assert(headers != NULL);
+    
+    for (i = 0; i < count; i++) { // made up block hashes, since the headers are added without any verification
+        headers[i].height = first + (uint32_t)i;
+        UInt32SetLE(headers[i].blockHash.u8, headers[i].height);
+        headers[i].blockHash.u8[31] = 0x5a;
+        if (i > 0) headers[i].prevBlock = headers[i - 1].blockHash;
+        headers[i].timestamp = 1500000000 + (uint32_t)i*150;
+        headers[i].target = 0x1e0ffff0;
+    }
+    
+    BRPeerManagerAddHeadersTest(manager, headers, count);
+    
+    if (BRPeerManagerLastBlockHeight(manager) != first + count - 1)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerManagerLastBlockHeight() test\n", __func__);
+    
+    // the chain ring wraps around within the added headers, and the oldest locators are below the ring, so they're
+    // found by walking prevBlock, until the walk runs past the first added header and the genesis block is appended
+    n = BRPeerManagerBlockLocatorsTest(manager, locators, sizeof(locators)/sizeof(*locators));
+    
+    for (i = 0, height = first + count - 1; height >= first; height -= step) {
+        if (i < n && ! UInt256Eq(locators[i], headers[height - first].blockHash))
+            r = 0, fprintf(stderr, "***FAILED*** %s: block locator %zu test\n", __func__, i);
+        if (++i >= 10) step *= 2;
+        if (height < first + step) break;
+    }
+    
+    if (n != i + 1 || height + 4096 > first + count - 1) // the last header locator must be below the ring
+        r = 0, fprintf(stderr, "***FAILED*** %s: block locators count test\n", __func__);
+    
+    free(headers);
+    BRPeerManagerFree(manager);
+    BRWalletFree(w);
     return r;
 }
 
@@ -2477,6 +3498,12 @@ int BRRunTests()
     printf("%s\n", (BRBloomFilterTests()) ? "success" : (fail++, "***FAIL***"));
     printf("BRMerkleBlockTests...               ");
     printf("%s\n", (BRMerkleBlockTests()) ? "success" : (fail++, "***FAIL***"));
+    printf("BRChainFileTests...                 ");
+    printf("%s\n", (BRChainFileTests()) ? "success" : (fail++, "***FAIL***"));
+    printf("BRPeerTests...                      ");
+    printf("%s\n", (BRPeerTests()) ? "success" : (fail++, "***FAIL***"));
+    printf("BRPeerManagerTests...               ");
+    printf("%s\n", (BRPeerManagerTests()) ? "success" : (fail++, "***FAIL***"));
     printf("BRPaymentProtocolTests...           ");
     printf("%s\n", (BRPaymentProtocolTests()) ? "success" : (fail++, "***FAIL***"));
     printf("BRPaymentProtocolEncryptionTests... ");